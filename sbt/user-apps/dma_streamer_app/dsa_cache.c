@@ -0,0 +1,299 @@
+/** \file      dsa_cache.c
+ *  \brief     implementation of the converted-waveform cache
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at: 
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+
+#include "dsa_cache.h"
+#include "dsa_channel.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("cache", LOG_LEVEL_INFO);
+
+
+// Each entry is one file, named for the key hash, holding a page-sized header and then
+// the channel's samples in native format, so a hit needs no conversion at all.
+#define CACHE_MAGIC    0x43415344  // "DSAC"
+#define CACHE_VERSION  1
+#define CACHE_HEAD     4096
+#define CACHE_BLOCK    16384       // samples per staging block when storing
+
+struct cache_head
+{
+	uint32_t              magic;
+	uint32_t              version;
+	uint64_t              len;     // samples in entry
+	struct dsa_cache_key  key;
+};
+
+
+// FNV-1a, 64-bit
+static uint64_t cache_fnv (uint64_t hash, const void *data, size_t size)
+{
+	const uint8_t *ptr = data;
+
+	while ( size-- )
+	{
+		hash ^= *ptr++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+// bytes per sample period in an entry
+static size_t cache_width (const struct dsa_cache_key *key)
+{
+	if ( (key->chan & (DC_CHAN_1|DC_CHAN_2)) == (DC_CHAN_1|DC_CHAN_2) )
+		return sizeof(struct dsa_sample_pair);
+
+	return sizeof(struct dsa_sample);
+}
+
+// returns 0 on success, <0 with errno ENAMETOOLONG if dir leaves no room for the name
+static int cache_name (char *dst, size_t max, const char *dir,
+                       const struct dsa_cache_key *key)
+{
+	if ( snprintf(dst, max, "%s/%016llx.dsc", dir, (unsigned long long)key->hash) >= max )
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int dsa_cache_key (struct dsa_cache_key *key, const char *path, const char *fmt,
+                   int chan, int lsh, size_t len, unsigned long rate_in,
+                   unsigned long rate_out)
+{
+	struct stat  sb;
+	char         real[PATH_MAX];
+
+	if ( stat(path, &sb) )
+		return -1;
+	if ( realpath(path, real) )
+		path = real;
+
+	// zero padding and the unused tail of fmt, since keys are compared with memcmp
+	memset(key, 0, sizeof(*key));
+	key->dev        = sb.st_dev;
+	key->ino        = sb.st_ino;
+	key->size       = sb.st_size;
+	key->mtime_sec  = sb.st_mtim.tv_sec;
+	key->mtime_nsec = sb.st_mtim.tv_nsec;
+	key->len        = len;
+	key->rate_in    = rate_in;
+	key->rate_out   = rate_out;
+	key->chan       = chan;
+	key->lsh        = !!lsh;
+	snprintf(key->fmt, sizeof(key->fmt), "%s", fmt);
+
+	key->hash = cache_fnv(0xcbf29ce484222325ULL, path, strlen(path));
+	key->hash = cache_fnv(key->hash, &key->dev, sizeof(*key) - sizeof(key->hash));
+
+	return 0;
+}
+
+
+int dsa_cache_find (const char *dir, const struct dsa_cache_key *key,
+                    struct dsa_cache_hit *hit)
+{
+	const struct cache_head *head;
+	struct stat              sb;
+	char                     name[PATH_MAX];
+	int                      flags = MAP_PRIVATE;
+	int                      fd;
+
+#ifdef MAP_POPULATE
+	flags |= MAP_POPULATE;
+#endif
+
+	if ( cache_name(name, sizeof(name), dir, key) < 0 )
+	{
+		LOG_DEBUG("%s: miss: %s\n", dir, strerror(errno));
+		return -1;
+	}
+	if ( (fd = open(name, O_RDONLY)) < 0 )
+	{
+		LOG_DEBUG("%s: miss: %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	if ( fstat(fd, &sb) || sb.st_size < CACHE_HEAD )
+	{
+		LOG_DEBUG("%s: miss: short file\n", name);
+		close(fd);
+		return -1;
+	}
+
+	hit->size = sb.st_size;
+	hit->map  = mmap(NULL, hit->size, PROT_READ, flags, fd, 0);
+	close(fd);
+	if ( hit->map == MAP_FAILED )
+	{
+		LOG_DEBUG("%s: miss: mmap: %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	head = hit->map;
+	if ( head->magic != CACHE_MAGIC || head->version != CACHE_VERSION ||
+	     memcmp(&head->key, key, sizeof(*key)) ||
+	     hit->size != CACHE_HEAD + head->len * cache_width(key) )
+	{
+		LOG_DEBUG("%s: miss: stale or damaged entry\n", name);
+		munmap(hit->map, hit->size);
+		return -1;
+	}
+
+	hit->data = (const uint8_t *)hit->map + CACHE_HEAD;
+	hit->len  = head->len;
+	LOG_DEBUG("%s: hit, %zu samples\n", name, hit->len);
+	return 0;
+}
+
+
+void dsa_cache_copy (struct dsa_cache_hit *hit, const struct dsa_cache_key *key,
+                     void *smp, size_t len, int pack)
+{
+	const struct dsa_sample *src = hit->data;
+	struct dsa_sample_pair  *dst = smp;
+	int                      c   = (key->chan == DC_CHAN_2) ? 1 : 0;
+	size_t                   i;
+
+	if ( len > hit->len )
+		len = hit->len;
+
+	// single-channel entries have the packed layout already
+	if ( pack || cache_width(key) == sizeof(struct dsa_sample_pair) )
+		memcpy(smp, hit->data, len * cache_width(key));
+	else
+		for ( i = 0; i < len; i++ )
+			dst[i].ch[c] = src[i];
+}
+
+void dsa_cache_release (struct dsa_cache_hit *hit)
+{
+	if ( hit->map )
+		munmap(hit->map, hit->size);
+	hit->map = NULL;
+}
+
+
+int dsa_cache_store (const char *dir, const struct dsa_cache_key *key,
+                     const void *buff, size_t len, int pack)
+{
+	const uint8_t     *smp = buff;
+	struct cache_head *head;
+	struct dsa_sample *blk;
+	void              *stage;
+	const void        *src;
+	size_t             want;
+	size_t             size;
+	size_t             i;
+	char               name[PATH_MAX];
+	char               temp[PATH_MAX + 8];  // name and mkstemp's suffix
+	int                c = (key->chan == DC_CHAN_2) ? 1 : 0;
+	int                fd;
+
+	if ( mkdir(dir, 0755) && errno != EEXIST )
+	{
+		LOG_WARN("%s: %s, not caching\n", dir, strerror(errno));
+		return -1;
+	}
+
+	// write to a temp file and rename into place, so readers never see partial entries
+	if ( cache_name(name, sizeof(name), dir, key) < 0 )
+	{
+		LOG_WARN("%s: %s, not caching\n", dir, strerror(errno));
+		return -1;
+	}
+	snprintf(temp, sizeof(temp), "%s.XXXXXX", name);
+	if ( (fd = mkstemp(temp)) < 0 )
+	{
+		LOG_WARN("%s: %s, not caching\n", temp, strerror(errno));
+		return -1;
+	}
+
+	// staging block doubles as the header buffer
+	if ( !(stage = calloc(CACHE_BLOCK, sizeof(struct dsa_sample))) )
+		goto fail;
+
+	blk  = stage;
+	head = stage;
+	head->magic   = CACHE_MAGIC;
+	head->version = CACHE_VERSION;
+	head->len     = len;
+	head->key     = *key;
+	if ( write(fd, stage, CACHE_HEAD) != CACHE_HEAD )
+		goto fail;
+
+	while ( len )
+	{
+		want = len;
+		if ( want > CACHE_BLOCK )
+			want = CACHE_BLOCK;
+
+		// whole-buffer and packed entries are written straight from the buffer
+		if ( pack || cache_width(key) == sizeof(struct dsa_sample_pair) )
+			src = smp;
+		else
+		{
+			for ( i = 0; i < want; i++ )
+				blk[i] = ((const struct dsa_sample_pair *)smp)[i].ch[c];
+			src = blk;
+		}
+
+		size = want * cache_width(key);
+		if ( write(fd, src, size) != (ssize_t)size )
+			goto fail;
+
+		smp += want * (pack ? sizeof(struct dsa_sample) : sizeof(struct dsa_sample_pair));
+		len -= want;
+	}
+
+	if ( close(fd) )
+	{
+		fd = -1;
+		goto fail;
+	}
+	if ( rename(temp, name) )
+	{
+		fd = -1;
+		goto fail;
+	}
+
+	free(stage);
+	LOG_DEBUG("%s: stored\n", name);
+	return 0;
+
+fail:
+	LOG_WARN("%s: %s, not caching\n", name, strerror(errno));
+	if ( fd > -1 )
+		close(fd);
+	unlink(temp);
+	free(stage);
+	return -1;
+}
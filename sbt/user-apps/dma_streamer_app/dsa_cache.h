@@ -0,0 +1,82 @@
+/** \file      dsa_cache.h
+ *  \brief     interfaces for the converted-waveform cache
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at: 
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_DSA_CACHE_H_
+#define _INCLUDE_DSA_CACHE_H_
+#include <stdint.h>
+#include <stddef.h>
+
+#include "dsa_sample.h"
+
+
+// identifies one channel's load of a source file: the file itself by device, inode, size
+// and modification time, and the options which change the converted data.  Compared
+// byte-wise, so always set up with dsa_cache_key().
+struct dsa_cache_key
+{
+	uint64_t  hash;        // of the path and the fields below, names the cache file
+	uint64_t  dev;
+	uint64_t  ino;
+	uint64_t  size;
+	int64_t   mtime_sec;
+	int64_t   mtime_nsec;
+	uint64_t  len;         // buffer length in samples, 0 if sized from the file
+	uint64_t  rate_in;     // resampled from the file's rate to the buffer's, 0 if not
+	uint64_t  rate_out;
+	uint32_t  chan;        // channels held: DC_CHAN_1, DC_CHAN_2, or both
+	uint32_t  lsh;
+	char      fmt[16];
+};
+
+// a cache entry mapped for reading
+struct dsa_cache_hit
+{
+	void           *map;
+	size_t          size;
+	const void     *data;  // one struct dsa_sample per channel per sample period
+	size_t          len;   // samples in data
+};
+
+
+// set up the key for loading channel(s) chan of a buffer of len samples from path in the
+// named format, resampled from rate_in to rate_out if not 0.  chan should be a single
+// channel for formats which load one channel at a time, both for formats which fill the
+// whole buffer.  Returns 0 on success, <0 if the file can't be stat'd.
+int  dsa_cache_key (struct dsa_cache_key *key, const char *path, const char *fmt,
+                    int chan, int lsh, size_t len, unsigned long rate_in,
+                    unsigned long rate_out);
+
+// look up an entry in the cache directory.  Returns 0 on a hit with the entry mapped into
+// hit, <0 on a miss.
+int  dsa_cache_find (const char *dir, const struct dsa_cache_key *key,
+                     struct dsa_cache_hit *hit);
+
+// copy up to len samples from a hit into the key's channel(s) of smp, leaving any other
+// channel intact.  If pack is set smp is a packed buffer holding only the key's channel.
+void dsa_cache_copy (struct dsa_cache_hit *hit, const struct dsa_cache_key *key,
+                     void *smp, size_t len, int pack);
+
+// release the mapping of a hit
+void dsa_cache_release (struct dsa_cache_hit *hit);
+
+// store the key's channel(s) of a freshly loaded buffer into the cache directory, packed
+// as for dsa_cache_copy().  Returns 0 on success, <0 on error; failures are not fatal to
+// the load.
+int  dsa_cache_store (const char *dir, const struct dsa_cache_key *key,
+                      const void *smp, size_t len, int pack);
+
+#endif // _INCLUDE_DSA_CACHE_H_
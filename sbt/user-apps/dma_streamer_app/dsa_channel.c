@@ -19,15 +19,24 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <unistd.h>
-#include <sys/mman.h>
 #include <ctype.h>
 #include <errno.h>
 #include <assert.h>
+#include <math.h>
 
 #include "dsa_main.h"
 #include "dsa_sample.h"
 #include "dsa_channel.h"
 #include "dsa_common.h"
+#include "dsa_worker.h"
+#include "dsa_cache.h"
+#include "dsa_pool.h"
+#include "dsa_shm.h"
+#include "dsa_fir.h"
+#include "dsa_iq.h"
+#include "dsa_resample.h"
+#include "dsa_ioctl.h"
+#include "dsa_report.h"
 
 #include "log.h"
 LOG_MODULE_STATIC("channel", LOG_LEVEL_INFO);
@@ -164,19 +173,43 @@ static struct dsa_channel_xfer **evt_to_xfer (struct dsa_channel_event *evt, int
 }
 
 
-static int realloc_buffer (struct dsa_channel_xfer *xfer, size_t len)
+// Packing is opt-in, only for buffers of a single channel, and needs the new ADI core's
+// R1 mode; the old FIFOs always move sample pairs.
+int dsa_channel_pack (int ident)
 {
-	size_t  size = len * sizeof(struct dsa_sample_pair);
+	int  chan = ident & (DC_CHAN_1|DC_CHAN_2);
+
+	if ( !dsa_opt_pack || !dsa_adi_new || chan == (DC_CHAN_1|DC_CHAN_2) )
+		return 0;
+
+	return chan;
+}
+
+
+// returns the sample buffer to where it came from
+static void put_buffer (struct dsa_channel_xfer *xfer)
+{
+	if ( dsa_shm_put(xfer->smp) )
+		dsa_pool_put(xfer->smp);
+}
+
+// (re)allocates the sample buffer from the pool.  If fresh is not NULL it's set nonzero
+// when the buffer is known to be zero-filled, so painting can be skipped.
+static int realloc_buffer (struct dsa_channel_xfer *xfer, size_t len, int *fresh)
+{
+	size_t  size;
 	void   *buff;
-	long    page;
 
+	if ( fresh )
+		*fresh = 0;
 
-	// need page size for posix_memalign()
-	if ( (page = sysconf(_SC_PAGESIZE)) < 0 )
+	// DMA moves whole bus words, so a packed buffer holds an even number of samples
+	if ( xfer->pack && (len & 1) )
 	{
-		LOG_ERROR("Failed to get system page size: %s\n", strerror(errno));
-		return -1;
+		LOG_DEBUG("Packed buffer rounded up to %zu samples\n", len + 1);
+		len++;
 	}
+	size = len * dsa_channel_width(xfer);
 
 	if ( !len || len == xfer->len )
 	{
@@ -185,27 +218,16 @@ static int realloc_buffer (struct dsa_channel_xfer *xfer, size_t len)
 		return 0;
 	}
 
-	// free old buffer
-	if ( (buff = xfer->smp) )
-	{
-		size = xfer->len * sizeof(struct dsa_sample_pair);
-		munlock(buff, size);
-		free(buff);
-	}
+	// return old buffer
+	put_buffer(xfer);
 	xfer->smp = NULL;
 	xfer->len = 0;
 
-	if ( posix_memalign(&buff, page, size) )
+	// RX buffers are published in shared memory if asked, falling back to the pool
+	buff = xfer->share ? dsa_shm_get(xfer->share - 1, size, fresh) : NULL;
+	if ( !buff && !(buff = dsa_pool_get(size, fresh)) )
 	{
-		LOG_ERROR("Failed to posix_memalign() %zu bytes aligned to %lu: %s\n",
-		          size, page, strerror(errno));
-		return -1;
-	}
-
-	if ( mlock(buff, size) )
-	{
-		LOG_ERROR("Failed to mlock() %zu bytes: %s\n", size, strerror(errno));
-		free(buff);
+		LOG_ERROR("Failed to allocate %zu bytes\n", size);
 		return -1;
 	}
 
@@ -220,7 +242,11 @@ static int realloc_buffer (struct dsa_channel_xfer *xfer, size_t len)
 // repaints as necessary.  Returns 0 on success, <0 on error.
 int dsa_channel_buffer (struct dsa_channel_event *evt, int ident, size_t len, int paint)
 {
+	struct dsa_report_mark    mark;
 	struct dsa_channel_xfer **xfer;
+	size_t                    want;
+	char                      name[8];
+	int                       fresh;
 	int                       dev;
 	int                       dir;
 
@@ -229,25 +255,56 @@ int dsa_channel_buffer (struct dsa_channel_event *evt, int ident, size_t len, in
 		for ( dir = DC_DIR_TX; dir <= DC_DIR_RX; dir <<= 1 )
 			if ( (xfer = evt_to_xfer(evt, ident & (dev|dir))) )
 			{
-				// allocate buffer management struct 
-				if ( ! *xfer )
-					*xfer = calloc(1, sizeof(struct dsa_channel_xfer));
+				dsa_report_start(&mark);
+				want = len;
+
+				// allocate buffer management struct, packed if it carries one channel
 				if ( ! *xfer )
-					return -1;
+				{
+					if ( !(*xfer = calloc(1, sizeof(struct dsa_channel_xfer))) )
+						return -1;
+					(*xfer)->pack = dsa_channel_pack(ident);
+					if ( dir == DC_DIR_RX )
+						(*xfer)->share = dev == DC_DEV_AD1 ? 1 : 2;
+				}
+
+				// a packed buffer only has room for its own channel: if the other is
+				// wanted too, return it and allocate a pair buffer instead
+				else if ( (*xfer)->pack && (ident & (DC_CHAN_1|DC_CHAN_2) & ~(*xfer)->pack) )
+				{
+					LOG_INFO("AD%c %cX uses both channels, not packing\n",
+					         dev == DC_DEV_AD1 ? '1' : '2', dir == DC_DIR_TX ? 'T' : 'R');
+					if ( !want )
+						want = (*xfer)->len ? (*xfer)->len : (*xfer)->want;
+					put_buffer(*xfer);
+					(*xfer)->smp  = NULL;
+					(*xfer)->len  = 0;
+					(*xfer)->pack = 0;
+				}
+
+				// a deferred setup only notes what dsa_channel_acquire() will allocate
+				if ( want )
+					(*xfer)->want = want;
+				(*xfer)->paint = paint;
+				if ( evt->defer )
+					continue;
 
 				// (re)allocate sample buffer
-				if ( realloc_buffer(*xfer, len) < 0 )
+				if ( realloc_buffer(*xfer, want, &fresh) < 0 )
 					return -1;
 
-				// paint buffer if requested and allocated
-				if ( paint && (*xfer)->smp && (ident & (DC_CHAN_1|DC_CHAN_2)) )
+				// paint buffer if requested and allocated, unless it's fresh from the
+				// pool and so already zero
+				if ( paint && !fresh && (*xfer)->smp && (ident & (DC_CHAN_1|DC_CHAN_2)) )
 				{
 					struct dsa_sample_pair *samp = (*xfer)->smp;
-					size_t                  left = len;
+					size_t                  left = want ? (*xfer)->len : 0;
 
-					// use memset to paint both channels at once
-					if ( (ident & (DC_CHAN_1|DC_CHAN_2)) == (DC_CHAN_1|DC_CHAN_2) )
-						memset(samp, 0x00, len * sizeof(struct dsa_sample_pair));
+					// use memset to paint both channels at once, or a packed buffer's
+					// only channel
+					if ( (*xfer)->pack ||
+					     (ident & (DC_CHAN_1|DC_CHAN_2)) == (DC_CHAN_1|DC_CHAN_2) )
+						memset(samp, 0x00, left * dsa_channel_width(*xfer));
 
 					// use for loop to paint only channel 1
 					else if ( ident & DC_CHAN_1 )
@@ -267,6 +324,60 @@ int dsa_channel_buffer (struct dsa_channel_event *evt, int ident, size_t len, in
 							samp++;
 						}
 				}
+
+				// a TX buffer sized by its file is allocated in the load instead
+				if ( (*xfer)->smp )
+				{
+					snprintf(name, sizeof(name), "AD%c%c", dev == DC_DEV_AD1 ? '1' : '2',
+					         dir == DC_DIR_TX ? 'T' : 'R');
+					dsa_report_phase(&mark, "alloc", name, dsa_channel_bytes(*xfer));
+				}
+			}
+
+	return 0;
+}
+
+
+void dsa_channel_release (struct dsa_channel_event *evt)
+{
+	struct dsa_channel_xfer **xfer;
+	int                       dev;
+	int                       dir;
+
+	for ( dev = DC_DEV_AD1; dev <= DC_DEV_AD2; dev <<= 1 )
+		for ( dir = DC_DIR_TX; dir <= DC_DIR_RX; dir <<= 1 )
+			if ( (xfer = evt_to_xfer(evt, dev|dir)) && *xfer )
+			{
+				put_buffer(*xfer);
+				(*xfer)->smp = NULL;
+				(*xfer)->len = 0;
+			}
+}
+
+int dsa_channel_acquire (struct dsa_channel_event *evt)
+{
+	struct dsa_report_mark    mark;
+	struct dsa_channel_xfer **xfer;
+	char                      name[8];
+	int                       fresh;
+	int                       dev;
+	int                       dir;
+
+	for ( dev = DC_DEV_AD1; dev <= DC_DEV_AD2; dev <<= 1 )
+		for ( dir = DC_DIR_TX; dir <= DC_DIR_RX; dir <<= 1 )
+			if ( (xfer = evt_to_xfer(evt, dev|dir)) && *xfer && (*xfer)->want &&
+			     !(*xfer)->smp )
+			{
+				dsa_report_start(&mark);
+				if ( realloc_buffer(*xfer, (*xfer)->want, &fresh) < 0 )
+					return -1;
+
+				if ( (*xfer)->paint && !fresh )
+					memset((*xfer)->smp, 0x00, dsa_channel_bytes(*xfer));
+
+				snprintf(name, sizeof(name), "AD%c%c", dev == DC_DEV_AD1 ? '1' : '2',
+				         dir == DC_DIR_TX ? 'T' : 'R');
+				dsa_report_phase(&mark, "alloc", name, dsa_channel_bytes(*xfer));
 			}
 
 	return 0;
@@ -299,8 +410,9 @@ static struct dsa_channel_sxx **xfer_to_sxx (struct dsa_channel_xfer *xfer, int
 // sizes, allocates, initializes, and returns a dsa_channel_sxx for the given user
 // bitmask, format, and location string.  TODO is location expansion with printf-style
 // format characters, which will complicate sizing the string and thus the buffer.
-static struct dsa_channel_sxx *sxx_int (struct format *fmt, const char *loc,
-                                        int dev, int dir, int sxx, int chan)
+static struct dsa_channel_sxx *sxx_int (struct format *fmt, const char *opts,
+                                        const char *loc, int dev, int dir, int sxx,
+                                        int chan)
 {
 	struct dsa_channel_sxx *ret;
 	const char             *s = loc;
@@ -312,6 +424,7 @@ static struct dsa_channel_sxx *sxx_int (struct format *fmt, const char *loc,
 		return NULL;
 
 	ret->fmt = fmt;
+	snprintf(ret->opts, sizeof(ret->opts), "%s", opts ? opts : "");
 
 	d = ret->loc;
 	e = ret->loc + PATH_MAX - 1;
@@ -394,7 +507,7 @@ static struct dsa_channel_sxx *sxx_int (struct format *fmt, const char *loc,
 // spec, but may be different to allow for unusual cases (see xfer_to_sxx above).  Returns
 // 0 on success, <0 on error.
 int dsa_channel_sxx (struct dsa_channel_event *evt, int ident, int mask,
-                     struct format *fmt, const char *loc)
+                     struct format *fmt, const char *opts, const char *loc)
 {
 	struct dsa_channel_xfer **xfer;
 	struct dsa_channel_sxx  **sxx;
@@ -409,18 +522,68 @@ int dsa_channel_sxx (struct dsa_channel_event *evt, int ident, int mask,
 	for ( dev = DC_DEV_AD1; dev <= DC_DEV_AD2; dev <<= 1 )
 		for ( dir1 = DC_DIR_TX; dir1 <= DC_DIR_RX; dir1 <<= 1 )
 			if ( (xfer = evt_to_xfer(evt, ident & (dev|dir1))) && *xfer )
+			{
+				if ( (*xfer)->pack && fmt && !(fmt->flags & FMT_F_PACK) )
+				{
+					LOG_ERROR("Format %s can't load or save packed buffers\n", fmt->name);
+					errno = EINVAL;
+					return -1;
+				}
+				if ( fmt && (fmt->flags & FMT_F_GEN) && (mask & DC_DIR_RX) )
+				{
+					LOG_ERROR("Format %s only synthesizes TX data\n", fmt->name);
+					errno = EINVAL;
+					return -1;
+				}
+
 				for ( chan = DC_CHAN_1; chan <= DC_CHAN_2; chan <<= 1 )
 					for ( dir2 = DC_DIR_TX; dir2 <= DC_DIR_RX; dir2 <<= 1 )
 						if ( (sxx = xfer_to_sxx(*xfer, mask & (chan|dir2))) )
 						{
 							free(*sxx);
-							if ( !(*sxx = sxx_int(fmt, loc, dev, dir1, dir2, chan)) )
+							if ( !(*sxx = sxx_int(fmt, opts, loc, dev, dir1, dir2, chan)) )
 								return -1;
 						}
+			}
 
 	return 0;
 }
 
+// copies sxx with num added to the filename: "cap.iqw" -> "cap.0001.iqw".  A network
+// stream is the same for every num, which is sent as a segment with its start time.
+struct dsa_channel_sxx *dsa_channel_sxx_number (const struct dsa_channel_sxx *sxx,
+                                                unsigned long num, unsigned long long time)
+{
+	struct dsa_channel_sxx *ret;
+	const char             *dot = strrchr(sxx->loc, '.');
+	const char             *sep = strrchr(sxx->loc, '/');
+	size_t                  len = strlen(sxx->loc) + 32;
+
+	if ( !(ret = malloc(offsetof(struct dsa_channel_sxx, loc) + len)) )
+		return NULL;
+
+	ret->fmt = sxx->fmt;
+	memcpy(ret->opts, sxx->opts, sizeof(ret->opts));
+	if ( sxx->fmt && (sxx->fmt->flags & FMT_F_NET) )
+	{
+		snprintf(ret->loc, len, "%s", sxx->loc);
+		if ( time && snprintf(ret->opts, sizeof(ret->opts), "time=%llu%s%s", time,
+		                      *sxx->opts ? "," : "", sxx->opts) >= sizeof(ret->opts) )
+		{
+			LOG_ERROR("%s: format options too long\n", sxx->loc);
+			free(ret);
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+	else if ( !dot || (sep && dot < sep) )
+		snprintf(ret->loc, len, "%s.%04lu", sxx->loc, num);
+	else
+		snprintf(ret->loc, len, "%.*s.%04lu%s", (int)(dot - sxx->loc), sxx->loc, num, dot);
+
+	return ret;
+}
+
 
 // cleans up evt, freeing all dynamically-allocated buffers and pointers.  evt itself is
 // not freed, just the objects within it allocated in these functions.
@@ -441,14 +604,7 @@ void dsa_channel_cleanup (struct dsa_channel_event *evt)
 
 			if ( *xfer )
 			{
-				size_t  size = (*xfer)->len * sizeof(struct dsa_sample_pair);
-				void   *buff = (*xfer)->smp;
-
-				if ( buff )
-				{
-					munlock(buff, size);
-					free(buff);
-				}
+				put_buffer(*xfer);
 
 				for ( chan = DC_CHAN_1; chan <= DC_CHAN_2; chan <<= 1 )
 					for ( dir2 = DC_DIR_TX; dir2 <= DC_DIR_RX; dir2 <<= 1 )
@@ -521,6 +677,7 @@ static void dump_xfer (struct dsa_channel_xfer *xfer)
 
 	LOG_DEBUG("\tsmp   : %p\n",  xfer->smp);
 	LOG_DEBUG("\tlen   : %zu\n", xfer->len);
+	LOG_DEBUG("\tpack  : %02x\n", xfer->pack);
 	if ( xfer->smp && xfer->len )
 		LOG_HEXDUMP(xfer->smp, MIN(xfer->len, 64));
 
@@ -539,158 +696,966 @@ void dsa_channel_event_dump (struct dsa_channel_event *evt)
 }
 
 
-int dsa_channel_load (struct dsa_channel_event *evt, int lsh)
+// A single load or save for one channel of one buffer.  Operations which must not run
+// concurrently - loads into the same buffer, since some formats fill both channels, and
+// saves to the same file - are chained through next and run in order by one worker.  A
+// save with pair set writes both channels of the buffer, sxx for channel 1 and pair for
+// channel 2, with the format's single-pass demux method.  opts has room for the address
+// and stream details put ahead of a network sink's own.
+struct chan_op
+{
+	struct chan_op           *next;
+	struct dsa_channel_xfer  *xfer;
+	struct dsa_channel_sxx   *sxx;
+	struct dsa_channel_sxx   *pair;
+	int                       ident;
+	int                       lsh;
+	char                      opts[FMT_OPTS_MAX * 2];
+};
+
+// 2 devices * 2 directions * 2 channels
+#define CHAN_OP_MAX  8
+
+
+static void chan_op_time (const char *verb, const char *loc, size_t bytes,
+                          unsigned long long usec)
+{
+	unsigned long long  rate = usec ? bytes / usec : 0;
+
+	LOG_INFO("\r\e[K%s %s: %zu bytes in %llu.%03llu sec, %llu MB/s\n", verb, loc, bytes,
+	         usec / 1000000, (usec / 1000) % 1000, rate);
+}
+
+// synthesized or network source: no file to open or cache, and the buffer may be sized
+// from the format's options.  A network source's address goes ahead of its options.
+static int chan_op_gen (struct chan_op *op, int mask)
+{
+	struct dsa_channel_xfer *xfer = op->xfer;
+	struct dsa_channel_sxx  *sxx  = op->sxx;
+	unsigned long long       beg  = mono_usec();
+	long                     len;
+
+	if ( !(sxx->fmt->flags & FMT_F_NET) )
+		snprintf(op->opts, sizeof(op->opts), "%s", sxx->opts);
+	else if ( snprintf(op->opts, sizeof(op->opts), "addr=%s%s%s", sxx->loc,
+	                   *sxx->opts ? "," : "", sxx->opts) >= sizeof(op->opts) )
+	{
+		LOG_ERROR("%s: format options too long\n", sxx->loc);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ( !xfer->smp )
+	{
+		if ( (len = format_size(sxx->fmt, NULL, mask, op->opts)) < 0 )
+			return -1;
+		if ( realloc_buffer(xfer, len / dsa_channel_width(xfer), NULL) < 0 )
+			return -1;
+	}
+
+	if ( format_read(sxx->fmt, NULL, xfer->smp, dsa_channel_bytes(xfer), mask, op->lsh,
+	                 op->opts) < 0 )
+	{
+		LOG_ERROR("format_read(%s,%s) failed: %s\n", sxx->fmt->name, op->opts,
+		          strerror(errno));
+		return -1;
+	}
+
+	if ( sxx->fmt->flags & FMT_F_NET )
+		chan_op_time("Received", sxx->loc, dsa_channel_bytes(xfer), mono_usec() - beg);
+	else
+		chan_op_time("Generated", sxx->fmt->name, dsa_channel_bytes(xfer),
+		             mono_usec() - beg);
+	return 0;
+}
+
+// rate=Hz in a source's options, with k or M allowed, is the file's sample rate for the
+// load to resample from; the others are copied to opts for the format.  Returns the rate,
+// 0 if not given, or <0 if invalid.
+static long chan_src_rate (const char *src, char *opts, size_t max)
+{
+	char    copy[FMT_OPTS_MAX];
+	char   *ptr = copy;
+	char   *key;
+	char   *val;
+	char   *end;
+	double  rate = 0.0;
+	size_t  len  = 0;
+
+	snprintf(copy, sizeof(copy), "%s", src);
+	*opts = '\0';
+	while ( format_opt_next(&ptr, &key, &val) )
+		if ( !strcmp(key, "rate") )
+		{
+			rate = val ? strtod(val, &end) : 0.0;
+			switch ( val ? tolower(*end) : 0 )
+			{
+				case 'm': rate *= 1000000.0; end++; break;
+				case 'k': rate *= 1000.0;    end++; break;
+			}
+			if ( !val || *end || rate < 1.0 || rate > 1e9 )
+			{
+				LOG_ERROR("Invalid source rate '%s'\n", val ? val : "");
+				errno = EINVAL;
+				return -1;
+			}
+		}
+		else
+			len += snprintf(opts + len, max - len, "%s%s%s%s", len ? "," : "", key,
+			                val ? "=" : "", val ? val : "");
+
+	return lround(rate);
+}
+
+// a source file at another rate is read at its own length into a scratch buffer, then
+// resampled into the channel's lanes
+static int chan_op_resample (struct chan_op *op, FILE *fp, int mask,
+                             const struct dsa_resample *rs, const char *opts)
+{
+	struct dsa_channel_xfer *xfer  = op->xfer;
+	struct dsa_channel_xfer  src   = *xfer;
+	int                      lanes = (op->ident & DC_CHAN_2) && !xfer->pack ? 0xC : 0x3;
+	long                     size;
+	int                      ret;
+
+	if ( (size = format_size(op->sxx->fmt, fp, mask, opts)) < 0 )
+	{
+		LOG_ERROR("Format %s can't size the file to resample: %s\n", op->sxx->fmt->name,
+		          strerror(errno));
+		return -1;
+	}
+	if ( !(src.len = size / dsa_channel_width(xfer)) )
+	{
+		LOG_ERROR("Nothing to resample in %s\n", op->sxx->loc);
+		errno = EINVAL;
+		return -1;
+	}
+	if ( !(src.smp = calloc(src.len, dsa_channel_width(xfer))) )
+		return -1;
+
+	if ( format_read(op->sxx->fmt, fp, src.smp, dsa_channel_bytes(&src), mask, 0, opts) < 0 )
+	{
+		LOG_ERROR("format_read(%s, %s) failed: %s\n", op->sxx->fmt->name, op->sxx->loc,
+		          strerror(errno));
+		free(src.smp);
+		return -1;
+	}
+
+	if ( !xfer->smp && realloc_buffer(xfer, dsa_resample_len(rs, src.len), NULL) < 0 )
+	{
+		free(src.smp);
+		return -1;
+	}
+
+	LOG_DEBUG("Resample %zu samples at %lu to %zu at %lu\n", src.len, rs->in, xfer->len,
+	          rs->out);
+	ret = dsa_resample_xfer(rs, xfer, &src, lanes, op->lsh);
+	free(src.smp);
+	return ret;
+}
+
+static int chan_op_load (struct chan_op *op)
+{
+	struct dsa_channel_xfer *xfer = op->xfer;
+	struct dsa_channel_sxx  *sxx  = op->sxx;
+	int                      chan = op->ident & (DC_CHAN_1|DC_CHAN_2);
+	int                      mask = xfer->pack ? chan | DC_PACKED : chan;
+	unsigned long long       beg  = mono_usec();
+	struct dsa_resample     *rs;
+	struct dsa_cache_key     key;
+	struct dsa_cache_hit     hit;
+	int                      cache = 0;
+	FILE                    *fp;
+	int                      ret;
+	long                     len;
+	long                     rate_in;
+	unsigned long            rate_out = 0;
+	char                     opts[FMT_OPTS_MAX];
+	char                     loc[PATH_MAX];
+
+	LOG_DEBUG("  load src for dev/dir/chan %s: %s:%s\n", dsa_channel_desc(op->ident),
+	          sxx->fmt ? sxx->fmt->name : "???", sxx->loc);
+
+	if ( !sxx->fmt )
+	{
+		LOG_ERROR("No format set, stop\n");
+		return -1;
+	}
+	if ( sxx->fmt->flags & (FMT_F_GEN|FMT_F_NET) )
+		return chan_op_gen(op, mask);
+
+	// a file at another rate than the transfer's is resampled as it loads
+	if ( (rate_in = chan_src_rate(sxx->opts, opts, sizeof(opts))) < 0 )
+		return -1;
+	if ( rate_in )
+	{
+		rate_out = dsa_active_rates[((op->ident & DC_DEV_AD2) ? 2 : 0) +
+		                            ((op->ident & DC_DIR_RX)  ? 1 : 0)];
+		if ( !rate_out )
+		{
+			LOG_ERROR("%s: transfer rate unknown, can't resample from %ld\n", sxx->loc,
+			          rate_in);
+			errno = EINVAL;
+			return -1;
+		}
+		if ( rate_out == rate_in )
+			rate_in = rate_out = 0;
+	}
+
+	// Loading data: search data path
+	snprintf(loc, sizeof(loc), "%s", sxx->loc);
+	if ( !(fp = fopen(sxx->loc, "r")) )
+	{
+		if ( !path_match(loc, sizeof(loc), env_data_path, sxx->loc) )
+		{
+			LOG_ERROR("%s: %s\n", sxx->loc, strerror(errno));
+			return -1;
+		}
+
+		LOG_DEBUG("%s: using %s\n", sxx->loc, loc);
+		if ( !(fp = fopen(loc, "r")) )
+		{
+			LOG_ERROR("%s: %s\n", loc, strerror(errno));
+			return -1;
+		}
+	}
+
+	// converted-waveform cache: on a hit the cached native samples are copied into the
+	// buffer, skipping the format conversion.  The key's length is 0 for a buffer sized
+	// from the file, in which case the cache entry gives the size.  A packed buffer
+	// holds just its channel whatever the format.
+	if ( dsa_opt_cache &&
+	     !dsa_cache_key(&key, loc, sxx->fmt->name,
+	                    (rate_in || xfer->pack || (sxx->fmt->flags & FMT_F_CHAN))
+	                        ? chan : DC_CHAN_1|DC_CHAN_2,
+	                    op->lsh, xfer->smp ? xfer->len : 0, rate_in, rate_out) )
+	{
+		cache = 1;
+		if ( !dsa_cache_find(dsa_opt_cache, &key, &hit) )
+		{
+			fclose(fp);
+			if ( !xfer->smp && realloc_buffer(xfer, hit.len, NULL) < 0 )
+			{
+				dsa_cache_release(&hit);
+				return -1;
+			}
+
+			dsa_cache_copy(&hit, &key, xfer->smp, xfer->len, xfer->pack);
+			dsa_cache_release(&hit);
+			chan_op_time("Loaded (cached)", loc, dsa_channel_bytes(xfer), mono_usec() - beg);
+			return 0;
+		}
+	}
+
+	if ( rate_in )
+	{
+		if ( !(rs = dsa_resample_init(rate_in, rate_out)) )
+		{
+			fclose(fp);
+			return -1;
+		}
+
+		if ( !dsa_worker_count() )
+			LOG_INFO("  Resampling buffer from %s...\r", loc);
+		ret = chan_op_resample(op, fp, mask, rs, opts);
+		dsa_resample_free(rs);
+		fclose(fp);
+		if ( ret < 0 )
+			return ret;
+
+		chan_op_time("Resampled", loc, dsa_channel_bytes(xfer), mono_usec() - beg);
+		if ( cache )
+			dsa_cache_store(dsa_opt_cache, &key, xfer->smp, xfer->len, xfer->pack);
+		return ret;
+	}
+
+	// late allocation of buffer size based on input file size
+	if ( ! xfer->smp )
+	{
+		LOG_DEBUG("Late buffer alloc attempt\n");
+		if ( !sxx->fmt->size )
+		{
+			LOG_ERROR("Format %s can't estimate size\n", sxx->fmt->name);
+			fclose(fp);
+			errno = ENOSYS;
+			return -1;
+		}
+		if ( (len = format_size(sxx->fmt, fp, mask, opts)) < 0 )
+		{
+			LOG_ERROR("Format size failed: %s\n", strerror(errno));
+			fclose(fp);
+			return -1;
+		}
+		len /= dsa_channel_width(xfer);
+		if ( realloc_buffer(xfer, len, NULL) < 0 )
+		{
+			fclose(fp);
+			return -1;
+		}
+
+		LOG_DEBUG("Late buffer alloc success: %ld samples\n", len);
+	}
+
+	// TODO: unwrap channel loop, pass dsa_channel_xfer, format size
+	// change to len, pass channel mask.  (dual-channel formats can
+	// then detect internally)
+	if ( !dsa_worker_count() )
+		LOG_INFO("  Loading buffer from %s...\r", loc);
+	ret = format_read(sxx->fmt, fp, xfer->smp, dsa_channel_bytes(xfer), mask, op->lsh,
+	                  opts);
+
+	if ( ret < 0 )
+	{
+		LOG_ERROR("format_read(%s, %s, %zu) failed: %s", sxx->fmt->name, loc,
+		          dsa_channel_bytes(xfer), strerror(errno));
+		fclose(fp);
+		return ret;
+	}
+
+	fclose(fp);
+	chan_op_time("Loaded", loc, dsa_channel_bytes(xfer), mono_usec() - beg);
+
+	if ( cache )
+		dsa_cache_store(dsa_opt_cache, &key, xfer->smp, xfer->len, xfer->pack);
+
+	return ret;
+}
+
+static int chan_op_save (struct chan_op *op)
+{
+	struct dsa_channel_xfer *xfer = op->xfer;
+	struct dsa_channel_sxx  *sxx  = op->sxx;
+	int                      chan = op->ident & (DC_CHAN_1|DC_CHAN_2);
+	int                      mask = xfer->pack ? chan | DC_PACKED : chan;
+	unsigned long long       beg  = mono_usec();
+	FILE                    *fp;
+	long                     pos;
+	int                      ret;
+
+	LOG_DEBUG("  save snk for dev/dir/chan %s: %s:%s\n", dsa_channel_desc(op->ident),
+	          sxx->fmt ? sxx->fmt->name : "???", sxx->loc);
+
+	if ( !sxx->fmt )
+	{
+		LOG_ERROR("No format set, stop\n");
+		return -1;
+	}
+	if ( sxx->fmt->flags & FMT_F_NET )
+		fp = NULL;
+	else if ( !(fp = fopen(sxx->loc, "w")) )
+	{
+		LOG_ERROR("%s: %s\n", sxx->loc, strerror(errno));
+		return -1;
+	}
+
+	// TODO: unwrap channel loop, pass dsa_channel_xfer, format size
+	// change to len, pass channel mask.  (dual-channel formats can
+	// then detect internally)
+	if ( !dsa_worker_count() )
+		LOG_INFO("  Saving buffer to %s...\r", sxx->loc);
+	ret = format_write(sxx->fmt, fp, xfer->smp, dsa_channel_bytes(xfer), mask, op->opts);
+
+	if ( ret < 0 )
+	{
+		LOG_ERROR("format_write(%s, %s, %zu) failed: %s\n", sxx->fmt->name, sxx->loc,
+		          dsa_channel_bytes(xfer), strerror(errno));
+		if ( fp )
+			fclose(fp);
+		return ret;
+	}
+
+	// streamed rather than written: count what went, one channel of a pair without the
+	// other
+	if ( !fp )
+	{
+		pos = xfer->pack || chan == (DC_CHAN_1|DC_CHAN_2) ? dsa_channel_bytes(xfer) :
+		      xfer->len * sizeof(struct dsa_sample);
+		chan_op_time("Sent", sxx->loc, pos, mono_usec() - beg);
+		return ret;
+	}
+
+	pos = ftell(fp);
+	if ( fclose(fp) )
+	{
+		LOG_ERROR("%s: %s\n", sxx->loc, strerror(errno));
+		return -1;
+	}
+	chan_op_time("Saved", sxx->loc, pos > 0 ? pos : 0, mono_usec() - beg);
+	return ret;
+}
+
+static int chan_op_save_demux (struct chan_op *op)
 {
+	struct dsa_channel_xfer *xfer = op->xfer;
+	struct dsa_channel_sxx  *sxx[2] = { op->sxx, op->pair };
+	unsigned long long       beg  = mono_usec();
+	unsigned long long       usec;
+	FILE                    *fp[2] = { NULL, NULL };
+	long                     pos[2];
+	int                      ret = -1;
+	int                      c;
+
+	LOG_DEBUG("  demux snk for dev/dir %s: %s:%s, %s\n", dsa_channel_desc(op->ident),
+	          sxx[0]->fmt->name, sxx[0]->loc, sxx[1]->loc);
+
+	for ( c = 0; c < 2; c++ )
+		if ( !(fp[c] = fopen(sxx[c]->loc, "w")) )
+		{
+			LOG_ERROR("%s: %s\n", sxx[c]->loc, strerror(errno));
+			goto close;
+		}
+
+	if ( !dsa_worker_count() )
+		LOG_INFO("  Saving buffer to %s, %s...\r", sxx[0]->loc, sxx[1]->loc);
+	ret = format_demux(sxx[0]->fmt, fp, xfer->smp, dsa_channel_bytes(xfer), op->opts);
+	if ( ret < 0 )
+		LOG_ERROR("format_demux(%s, %s, %s, %zu) failed: %s\n", sxx[0]->fmt->name,
+		          sxx[0]->loc, sxx[1]->loc, dsa_channel_bytes(xfer), strerror(errno));
+
+close:
+	for ( c = 0; c < 2; c++ )
+		if ( fp[c] )
+		{
+			pos[c] = ftell(fp[c]);
+			if ( fclose(fp[c]) && ret >= 0 )
+			{
+				LOG_ERROR("%s: %s\n", sxx[c]->loc, strerror(errno));
+				ret = -1;
+			}
+		}
+	if ( ret < 0 )
+		return ret;
+
+	usec = mono_usec() - beg;
+	for ( c = 0; c < 2; c++ )
+		chan_op_time("Saved", sxx[c]->loc, pos[c] > 0 ? pos[c] : 0, usec);
+	return ret;
+}
+
+// sample data an op moves: the whole buffer if packed or for both channels, else half
+static unsigned long long chan_op_bytes (const struct chan_op *op)
+{
+	unsigned long long  bytes = dsa_channel_bytes(op->xfer);
+
+	if ( !op->xfer->pack && (op->ident & (DC_CHAN_1|DC_CHAN_2)) != (DC_CHAN_1|DC_CHAN_2) )
+		bytes /= 2;
+
+	return bytes;
+}
+
+static int chan_op_load_chain (void *arg)
+{
+	struct dsa_report_mark  mark;
+	struct chan_op         *op;
+	int                     ret = 0;
+
+	for ( op = arg; op && ret >= 0; op = op->next )
+	{
+		dsa_report_start(&mark);
+		if ( (ret = chan_op_load(op)) >= 0 )
+			dsa_report_phase(&mark, "load", op->sxx->loc, chan_op_bytes(op));
+	}
+
+	return ret;
+}
+
+static int chan_op_save_chain (void *arg)
+{
+	struct dsa_report_mark  mark;
+	struct chan_op         *op;
+	int                     ret = 0;
+
+	for ( op = arg; op && ret >= 0; op = op->next )
+	{
+		dsa_report_start(&mark);
+		if ( (ret = op->pair ? chan_op_save_demux(op) : chan_op_save(op)) >= 0 )
+			dsa_report_phase(&mark, "save", op->sxx->loc, chan_op_bytes(op));
+	}
+
+	return ret;
+}
+
+// queue the jobs to the worker pool and wait for them to finish, but not for others'
+// jobs, like a playlist's saves running meanwhile; returns the first failure with its
+// errno, or the last success
+static int chan_op_run (struct dsa_worker_job *job, int num)
+{
+	struct dsa_worker_batch  batch = { 0 };
+	int                      ret = 0;
+	int                      err = 0;
+	int                      idx;
+
+	for ( idx = 0; idx < num; idx++ )
+		dsa_worker_queue_batch(&batch, &job[idx]);
+	dsa_worker_wait_batch(&batch);
+
+	for ( idx = 0; idx < num; idx++ )
+		if ( ret >= 0 )
+		{
+			ret = job[idx].ret;
+			err = job[idx].err;
+		}
+
+	errno = err;
+	return ret;
+}
+
+
+// whether two save ops write any file in common
+static int chan_op_same_file (struct chan_op *a, struct chan_op *b)
+{
+	struct dsa_channel_sxx *la[2] = { a->sxx, a->pair };
+	struct dsa_channel_sxx *lb[2] = { b->sxx, b->pair };
+	int                     i, j;
+
+	for ( i = 0; i < 2; i++ )
+		for ( j = 0; j < 2; j++ )
+			if ( la[i] && lb[j] && !strcmp(la[i]->loc, lb[j]->loc) )
+				return 1;
+
+	return 0;
+}
+
+
+// whether sxx is a network source
+static int chan_sxx_net (const struct dsa_channel_sxx *sxx)
+{
+	return sxx && sxx->fmt && (sxx->fmt->flags & FMT_F_NET);
+}
+
+// loads every TX source, or with net only the network ones
+static int chan_load (struct dsa_channel_event *evt, int lsh, int net)
+{
+	struct dsa_worker_job     job[CHAN_OP_MAX];
+	struct chan_op            ops[CHAN_OP_MAX];
+	struct chan_op           *tail;
 	struct dsa_channel_xfer **xfer;
-	struct dsa_channel_sxx  **sxx;
+	struct dsa_channel_sxx   *src[2];
 	int                       dev;
 	int                       dir;
 	int                       chan;
-	FILE                     *fp;
-	int                       ret = 0;
-	long                      len;
-	char                      loc[PATH_MAX];
+	int                       both;
+	int                       c;
+	int                       jobs = 0;
+	int                       num  = 0;
+	int                       ret;
 
 	LOG_DEBUG("Load data for evt %p:\n", evt);
 
+	// one job per buffer, loading its channels in order
 	for ( dev = DC_DEV_AD1; dev <= DC_DEV_AD2; dev <<= 1 )
 		for ( dir = DC_DIR_TX; dir <= DC_DIR_RX; dir <<= 1 )
 			if ( (xfer = evt_to_xfer(evt, dev|dir)) && *xfer )
-				for ( chan = DC_CHAN_1; chan <= DC_CHAN_2; chan <<= 1 )
-					if ( (sxx = xfer_to_sxx(*xfer, DC_DIR_TX|chan)) && *sxx )
-					{
-						LOG_DEBUG("  load src for dev/dir/chan %s: %s:%s\n",
-						        dsa_channel_desc(dev|dir|chan),
-						        (*sxx)->fmt ? (*sxx)->fmt->name : "???",
-						        (*sxx)->loc);
+			{
+				src[0] = (*xfer)->src[0];
+				src[1] = (*xfer)->src[1];
+
+				// both channels from the same network stream: take whole periods once
+				both = 0;
+				if ( chan_sxx_net(src[0]) && chan_sxx_net(src[1]) && !(*xfer)->pack &&
+				     src[0]->fmt == src[1]->fmt && !strcmp(src[0]->loc, src[1]->loc) &&
+				     !strcmp(src[0]->opts, src[1]->opts) )
+				{
+					src[1] = NULL;
+					both   = DC_CHAN_2;
+				}
 
-						if ( !(*sxx)->fmt )
+				tail = NULL;
+				for ( c = 0, chan = DC_CHAN_1; chan <= DC_CHAN_2; c++, chan <<= 1 )
+					if ( src[c] && (!net || chan_sxx_net(src[c])) )
+					{
+						ops[num].next  = NULL;
+						ops[num].xfer  = *xfer;
+						ops[num].sxx   = src[c];
+						ops[num].pair  = NULL;
+						ops[num].ident = dev|dir|chan|both;
+						ops[num].lsh   = lsh;
+
+						if ( tail )
+							tail->next = &ops[num];
+						else
 						{
-							LOG_ERROR("No format set, stop\n");
-							return -1;
+							job[jobs].func = chan_op_load_chain;
+							job[jobs].arg  = &ops[num];
+							jobs++;
 						}
+						tail = &ops[num++];
+					}
+			}
 
-						// Loading data: search data path
-						snprintf(loc, sizeof(loc), "%s", (*sxx)->loc);
-						if ( !(fp = fopen((*sxx)->loc, "r")) )
-						{
-							if ( !path_match(loc, sizeof(loc), env_data_path, (*sxx)->loc) )
-							{
-								LOG_ERROR("%s: %s\n", (*sxx)->loc, strerror(errno));
-								return -1;
-							}
-						
-							LOG_DEBUG("%s: using %s\n", (*sxx)->loc, loc);
-							fp = fopen(loc, "r");
-						}
+	ret = chan_op_run(job, jobs);
+	LOG_DEBUG("dsa_channel_load(): %d\n", ret);
+	return ret;
+}
 
-						// late allocation of buffer size based on input file size
-						if ( ! (*xfer)->smp )
-						{
-							LOG_DEBUG("Late buffer alloc attempt\n");
-							if ( !(*sxx)->fmt->size )
-							{
-								LOG_ERROR("Format %s can't estimate size\n",
-						                  (*sxx)->fmt ? (*sxx)->fmt->name : "???");
-								errno = ENOSYS;
-								return -1;
-							}
-							if ( (len = format_size((*sxx)->fmt, fp, chan)) < 0 )
-							{
-								LOG_ERROR("Format size failed: %s\n",
-						                  strerror(errno));
-								return -1;
-							}
-							len /= sizeof(struct dsa_sample_pair);
-							if ( realloc_buffer(*xfer, len) < 0 )
-								return -1;
+int dsa_channel_load (struct dsa_channel_event *evt, int lsh)
+{
+	return chan_load(evt, lsh, 0);
+}
 
-							LOG_DEBUG("Late buffer alloc success: %ld samples\n", len);
-						}
+int dsa_channel_reload (struct dsa_channel_event *evt, int lsh)
+{
+	return chan_load(evt, lsh, 1);
+}
 
-						// TODO: unwrap channel loop, pass dsa_channel_xfer, format size
-						// change to len, pass channel mask.  (dual-channel formats can
-						// then detect internally)
-						LOG_INFO("  Loading buffer from %s...\r", loc);
-						ret = format_read((*sxx)->fmt, fp, (*xfer)->smp,
-						                  (*xfer)->len * sizeof(struct dsa_sample_pair),
-						                  chan, lsh);
+int dsa_channel_streamed (struct dsa_channel_event *evt)
+{
+	struct dsa_channel_xfer **xfer;
+	int                       dev;
 
-						if ( ret < 0 )
-						{
-							LOG_ERROR("format_read(%s, %s, %zu) failed: %s",
-							          (*sxx)->fmt->name, loc,
-							          (*xfer)->len * sizeof(struct dsa_sample_pair),
-									  strerror(errno));
-							fclose(fp);
-							return ret;
-						}
+	for ( dev = DC_DEV_AD1; dev <= DC_DEV_AD2; dev <<= 1 )
+		if ( (xfer = evt_to_xfer(evt, dev|DC_DIR_TX)) && *xfer &&
+		     (chan_sxx_net((*xfer)->src[0]) || chan_sxx_net((*xfer)->src[1])) )
+			return 1;
 
-						fclose(fp);
-						LOG_INFO("\r\e[KLoaded %s\n", loc);
-					}
+	return 0;
+}
+
+
+// one channel of an RX buffer to decimate into a copy before saving
+struct chan_fir
+{
+	const struct dsa_fir          *fir;
+	struct dsa_channel_xfer       *dst;
+	const struct dsa_channel_xfer *src;
+	int                            lanes;
+};
+
+static int chan_fir_run (void *arg)
+{
+	struct chan_fir *cf = arg;
+
+	return dsa_fir_run(cf->fir, cf->dst, cf->src, cf->lanes);
+}
+
+// with -F, decimate the RX buffers of evt into dec, which the save then uses in place of
+// the buffers.  One job per channel with a sink, since the filter is the costly part.
+// Returns 0 on success, <0 on error with any dec buffers freed.
+static int chan_fir_decimate (struct dsa_channel_event *evt,
+                              struct dsa_channel_xfer dec[2])
+{
+	const struct dsa_fir    *fir;
+	struct dsa_worker_job    job[CHAN_OP_MAX];
+	struct chan_fir          cf[CHAN_OP_MAX];
+	struct dsa_channel_xfer *src;
+	int                      jobs = 0;
+	int                      ret  = 0;
+	int                      dev;
+	int                      c;
+
+	if ( !(fir = dsa_fir_get(dsa_opt_fir)) )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	for ( dev = 0; dev < 2; dev++ )
+	{
+		dec[dev].smp = NULL;
+		if ( !(src = evt->rx[dev]) || (!src->snk[0] && !src->snk[1]) )
+			continue;
+
+		if ( src->len < fir->factor )
+		{
+			LOG_ERROR("AD%d RX buffer is shorter than the decimation factor\n", dev + 1);
+			errno = EINVAL;
+			ret = -1;
+			break;
+		}
+
+		dec[dev] = *src;
+		if ( !(dec[dev].smp = calloc(src->len / fir->factor, dsa_channel_width(src))) )
+		{
+			ret = -1;
+			break;
+		}
+
+		for ( c = 0; c < 2; c++ )
+			if ( src->pack ? !c : !!src->snk[c] )
+			{
+				cf[jobs].fir   = fir;
+				cf[jobs].dst   = &dec[dev];
+				cf[jobs].src   = src;
+				cf[jobs].lanes = src->pack ? 0x3 : 0x3 << (c * 2);
+				job[jobs].func = chan_fir_run;
+				job[jobs].arg  = &cf[jobs];
+				jobs++;
+			}
+	}
+
+	if ( !ret )
+		ret = chan_op_run(job, jobs);
+
+	if ( ret < 0 )
+		for ( dev = 0; dev < 2; dev++ )
+			free(dec[dev].smp);
 
-	LOG_DEBUG("dsa_channel_load(): %d\n", ret);
 	return ret;
 }
 
+// -Q for a format which corrects while converting: "corr=" before the sink's own
+// options, which override it
+static int chan_op_opts (struct chan_op *op, const char *corr)
+{
+	const char *opts = op->sxx->opts;
+	size_t      need;
+
+	if ( !corr || !op->sxx->fmt || !(op->sxx->fmt->flags & FMT_F_CORR) )
+		need = snprintf(op->opts, sizeof(op->opts), "%s", opts);
+	else
+		need = snprintf(op->opts, sizeof(op->opts), "corr=%s%s%s", corr,
+		                *opts ? "," : "", opts);
+
+	if ( need >= sizeof(op->opts) )
+	{
+		LOG_ERROR("%s: format options too long\n", op->sxx->loc);
+		return -1;
+	}
+	return 0;
+}
+
+// network sinks: the address, a stream ID of 0xDC for AD9361 D and channels C, and the
+// first sample's time and the rate, ahead of the sink's options which may override them
+static int chan_op_net (struct chan_op *op, const struct dsm_xfer_stats *st,
+                        unsigned long rate)
+{
+	unsigned long long  time = 0;
+	char                opts[sizeof(op->opts)];
+	int                 id;
+
+	if ( st->start.tv_sec || st->start.tv_nsec )
+		time = st->start.tv_sec * 1000000000ULL + st->start.tv_nsec;
+	id  = (op->ident & DC_DEV_AD2 ? 2 : 1) << 4;
+	id |= (op->ident & (DC_CHAN_1|DC_CHAN_2)) / DC_CHAN_1;
+
+	memcpy(opts, op->opts, sizeof(opts));
+	if ( snprintf(op->opts, sizeof(op->opts), "addr=%s,id=%d,time=%llu,rate=%lu%s%s",
+	              op->sxx->loc, id, time, rate, *opts ? "," : "", opts) >= sizeof(op->opts) )
+	{
+		LOG_ERROR("%s: format options too long\n", op->sxx->loc);
+		return -1;
+	}
+	return 0;
+}
+
+// whether every RX sink for xfer corrects while converting
+static int chan_corr_fused (const struct dsa_channel_xfer *xfer)
+{
+	int  c;
+
+	for ( c = 0; c < 2; c++ )
+		if ( xfer->snk[c] && xfer->snk[c]->fmt && !(xfer->snk[c]->fmt->flags & FMT_F_CORR) )
+			return 0;
+
+	return 1;
+}
+
+// -Q for other formats: correct a copy of src into dst, measuring each channel first
+// for auto
+static int chan_corr_copy (struct dsa_channel_xfer *dst, const struct dsa_channel_xfer *src)
+{
+	struct dsa_iq_corr  corr;
+	struct dsa_iq_bal   bal;
+	struct dsa_iq_acc   acc;
+	const uint16_t     *smp;
+	size_t              stride = dsa_channel_width(src) / sizeof(uint16_t);
+	int                 meas;
+	int                 c;
+
+	if ( (meas = dsa_iq_corr_parse(&bal, dsa_opt_corr)) < 0 )
+		return -1;
+
+	*dst = *src;
+	if ( !(dst->smp = malloc(dsa_channel_bytes(src))) )
+	{
+		LOG_ERROR("Correction buffer: %s\n", strerror(errno));
+		return -1;
+	}
+
+	for ( c = 0; c < stride / 2; c++ )
+	{
+		smp = (const uint16_t *)src->smp + c * 2;
+		if ( meas )
+		{
+			memset(&acc, 0, sizeof(acc));
+			dsa_iq_sum(&acc, smp, stride, src->len);
+			dsa_iq_balance(&acc, &bal);
+			LOG_DEBUG("Chan %d: DC %+.4f/%+.4f, gain %+.3f dB, phase %+.3f deg\n",
+			          c + 1, bal.dc_i, bal.dc_q, bal.gain, bal.phase);
+		}
+
+		dsa_iq_corr_setup(&corr, &bal);
+		dsa_iq_corr_apply(&corr, (uint16_t *)dst->smp + c * 2, smp, stride, src->len);
+	}
+
+	return 0;
+}
 
 int dsa_channel_save (struct dsa_channel_event *evt)
 {
+	struct dsa_worker_job     job[CHAN_OP_MAX];
+	struct chan_op            ops[CHAN_OP_MAX];
+	struct chan_op           *tail;
 	struct dsa_channel_xfer **xfer;
-	struct dsa_channel_sxx  **sxx;
+	struct dsa_channel_xfer   dec[2];
+	struct dsa_channel_xfer   cor[2];
+	struct dsa_channel_event  sub;
+	const char               *corr;
+	struct dsa_channel_sxx   *snk[2];
+	struct dsm_user_stats     sb;
+	struct dsm_chan_stats    *chs;
+	unsigned long             rate;
+	int                       stats = 0;
 	int                       dev;
 	int                       dir;
 	int                       chan;
-	FILE                     *fp;
-	int                       ret = 0;
+	int                       jobs = 0;
+	int                       num  = 0;
+	int                       idx;
+	int                       ret;
+	int                       c;
 
 	LOG_DEBUG("Save data for evt %p:\n", evt);
+
+	// decimating or correcting: save from a copy of the event with filtered RX buffers
+	dec[0].smp = dec[1].smp = NULL;
+	cor[0].smp = cor[1].smp = NULL;
+	sub = *evt;
+	if ( dsa_opt_fir && (evt->rx[0] || evt->rx[1]) )
+	{
+		if ( chan_fir_decimate(evt, dec) < 0 )
+			return -1;
+
+		for ( dev = 0; dev < 2; dev++ )
+			if ( dec[dev].smp )
+				sub.rx[dev] = &dec[dev];
+	}
+
+	// formats which convert to float correct on the way, others save a corrected copy
+	if ( dsa_opt_corr )
+		for ( dev = 0; dev < 2; dev++ )
+			if ( sub.rx[dev] && !chan_corr_fused(sub.rx[dev]) )
+			{
+				if ( chan_corr_copy(&cor[dev], sub.rx[dev]) < 0 )
+				{
+					ret = -1;
+					goto done;
+				}
+				sub.rx[dev] = &cor[dev];
+			}
+	evt = &sub;
+
+	// one job per output file, normally one per channel
 	for ( dev = DC_DEV_AD1; dev <= DC_DEV_AD2; dev <<= 1 )
 		for ( dir = DC_DIR_TX; dir <= DC_DIR_RX; dir <<= 1 )
 			if ( (xfer = evt_to_xfer(evt, dev|dir)) && *xfer )
-				for ( chan = DC_CHAN_1; chan <= DC_CHAN_2; chan <<= 1 )
-					if ( (sxx = xfer_to_sxx(*xfer, DC_DIR_RX|chan)) && *sxx )
+			{
+				snk[0] = (*xfer)->snk[0];
+				snk[1] = (*xfer)->snk[1];
+				corr   = dir == DC_DIR_RX && !cor[dev == DC_DEV_AD2].smp ? dsa_opt_corr : NULL;
+
+				// both channels to the same network stream: send whole sample periods
+				if ( snk[0] && snk[1] && snk[0]->fmt && snk[0]->fmt == snk[1]->fmt &&
+				     (snk[0]->fmt->flags & FMT_F_NET) && !strcmp(snk[0]->loc, snk[1]->loc) &&
+				     !strcmp(snk[0]->opts, snk[1]->opts) )
+				{
+					ops[num].next  = NULL;
+					ops[num].xfer  = *xfer;
+					ops[num].sxx   = snk[0];
+					ops[num].pair  = NULL;
+					ops[num].ident = dev|dir|DC_CHAN_1|DC_CHAN_2;
+					ops[num].lsh   = 0;
+					if ( chan_op_opts(&ops[num], corr) < 0 )
+						goto fail;
+					snk[0] = snk[1] = NULL;
+					num++;
+				}
+
+				// both channels to separate files in the same format and options: if
+				// the format can demux, save both with one pass through the buffer
+				if ( snk[0] && snk[1] && snk[0]->fmt && snk[0]->fmt == snk[1]->fmt &&
+				     snk[0]->fmt->demux && strcmp(snk[0]->loc, snk[1]->loc) &&
+				     !strcmp(snk[0]->opts, snk[1]->opts) )
+				{
+					ops[num].next  = NULL;
+					ops[num].xfer  = *xfer;
+					ops[num].sxx   = snk[0];
+					ops[num].pair  = snk[1];
+					ops[num].ident = dev|dir|DC_CHAN_1|DC_CHAN_2;
+					ops[num].lsh   = 0;
+					if ( chan_op_opts(&ops[num], corr) < 0 )
+						goto fail;
+					snk[0] = snk[1] = NULL;
+					num++;
+				}
+
+				for ( c = 0, chan = DC_CHAN_1; c < 2; c++, chan <<= 1 )
+					if ( snk[c] )
 					{
-						LOG_DEBUG("  save snk for dev/dir/chan %s: %s:%s\n",
-						        dsa_channel_desc(dev|dir|chan),
-						        (*sxx)->fmt ? (*sxx)->fmt->name : "???",
-						        (*sxx)->loc);
+						ops[num].next  = NULL;
+						ops[num].xfer  = *xfer;
+						ops[num].sxx   = snk[c];
+						ops[num].pair  = NULL;
+						ops[num].ident = dev|dir|chan;
+						ops[num].lsh   = 0;
+						if ( chan_op_opts(&ops[num], corr) < 0 )
+							goto fail;
+						num++;
+					}
+			}
 
-						if ( !(*sxx)->fmt )
-						{
-							LOG_ERROR("No format set, stop\n");
-							return -1;
-						}
-						if ( !(fp = fopen((*sxx)->loc, "w")) )
-						{
-							LOG_ERROR("%s: %s\n", (*sxx)->loc, strerror(errno));
-							return -1;
-						}
+	// network sinks stamp their packets from the start of the transfer
+	for ( c = 0; c < num; c++ )
+		if ( ops[c].sxx->fmt && (ops[c].sxx->fmt->flags & FMT_F_NET) )
+		{
+			if ( !stats )
+			{
+				memset(&sb, 0, sizeof(sb));
+				dsa_ioctl_get_stats(&sb);
+				stats = 1;
+			}
 
-						// TODO: unwrap channel loop, pass dsa_channel_xfer, format size
-						// change to len, pass channel mask.  (dual-channel formats can
-						// then detect internally)
-						LOG_INFO("  Saving buffer to %s...\r", (*sxx)->loc);
-						ret = format_write((*sxx)->fmt, fp, (*xfer)->smp,
-						                   (*xfer)->len * sizeof(struct dsa_sample_pair),
-						                   chan);
+			idx  = ops[c].ident & DC_DEV_AD2 ? 1 : 0;
+			dir  = ops[c].ident & DC_DIR_RX;
+			rate = dsa_active_rates[idx * 2 + !!dir];
+			if ( dir && dec[idx].smp )
+				rate /= dsa_fir_get(dsa_opt_fir)->factor;
 
-						if ( ret < 0 )
-						{
-							LOG_ERROR("format_write(%s, %s, %zu) failed: %s\n",
-							          (*sxx)->fmt->name, (*sxx)->loc,
-							          (*xfer)->len * sizeof(struct dsa_sample_pair),
-									  strerror(errno));
-							fclose(fp);
-							return ret;
-						}
+			chs = idx ? &sb.adi2 : &sb.adi1;
+			if ( chan_op_net(&ops[c], dir ? &chs->rx : &chs->tx, rate) < 0 )
+				goto fail;
+		}
 
-						fclose(fp);
-						LOG_INFO("\r\e[KSaved %s\n", (*sxx)->loc);
-					}
+	// chain ops which write to the same file, otherwise one job per op
+	for ( c = 0; c < num; c++ )
+	{
+		for ( idx = 0; idx < jobs; idx++ )
+			for ( tail = job[idx].arg; tail; tail = tail->next )
+				if ( chan_op_same_file(tail, &ops[c]) )
+					goto chain;
+
+		job[jobs].func = chan_op_save_chain;
+		job[jobs].arg  = &ops[c];
+		jobs++;
+		continue;
+
+chain:
+		for ( tail = job[idx].arg; tail->next; tail = tail->next ) ;
+		tail->next = &ops[c];
+	}
+
+	ret = chan_op_run(job, jobs);
 
+done:
+	free(dec[0].smp);
+	free(dec[1].smp);
+	free(cor[0].smp);
+	free(cor[1].smp);
 	return ret;
+
+fail:
+	ret = -1;
+	goto done;
 }
 
 
@@ -706,8 +1671,7 @@ void dsa_channel_calc_exp (struct dsa_channel_event *evt, int reps)
 		if ( (xfer = evt_to_xfer(evt, dev|DC_DIR_TX)) && *xfer )
 			if ( (*xfer)->smp && (*xfer)->len )
 			{
-				exp = dsnk_sum((*xfer)->smp,
-				               (*xfer)->len * sizeof(struct dsa_sample_pair));
+				exp = dsnk_sum((*xfer)->smp, dsa_channel_bytes(*xfer));
 				(*xfer)->exp = 0;
 				for ( rep = 0; rep < reps; rep++ )
 					(*xfer)->exp += exp;
@@ -921,7 +1885,7 @@ int main (int argc, char **argv)
 
 		if ( argv[num] )
 		{
-			if ( dsa_channel_sxx(&evt, ident, ident, &fmt, argv[num]) < 0 )
+			if ( dsa_channel_sxx(&evt, ident, ident, &fmt, NULL, argv[num]) < 0 )
 			{
 				perror("dsa_channel_sxx");
 				return 1;
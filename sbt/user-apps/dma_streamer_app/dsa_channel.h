@@ -18,6 +18,7 @@
 #ifndef _INCLUDE_DSA_CHANNEL_H_
 #define _INCLUDE_DSA_CHANNEL_H_
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <limits.h>
 
@@ -32,6 +33,10 @@
 #define DC_CHAN_1   0x10
 #define DC_CHAN_2   0x20
 
+// not part of a user ident: set in the channel mask passed to formats for a packed
+// buffer, which holds the channel given at 4 bytes per sample (see dsa_sample.h)
+#define DC_PACKED   0x40
+
 #define DC_DEV_IDX_TO_MASK(i)  (DC_DEV_AD1 << (i))
 #define DC_CHAN_IDX_TO_MASK(i) (DC_CHAN_1  << (i))
 
@@ -40,6 +45,7 @@
 struct dsa_channel_sxx
 {
 	struct format *fmt;
+	char           opts[FMT_OPTS_MAX];  // passed to the format, empty for none
 	char           loc[0];
 };
 
@@ -49,6 +55,10 @@ struct dsa_channel_xfer
 	struct dsa_sample_pair *smp;
 	size_t                  len;
 	uint64_t                exp;
+	int                     pack;  // DC_CHAN_1 or DC_CHAN_2 if packed 1T1R, else 0
+	int                     share; // 1 + device for RX, which dsa_shm may publish, else 0
+	size_t                  want;  // samples asked for at setup, 0 if sized by the source
+	int                     paint; // zero the buffer when it's allocated
 	struct dsa_channel_sxx *src[2];
 	struct dsa_channel_sxx *snk[2];
 };
@@ -59,20 +69,56 @@ struct dsa_channel_event
 {
 	struct dsa_channel_xfer *tx[2];
 	struct dsa_channel_xfer *rx[2];
+
+	// set before setup to only record the buffer sizes, for dsa_channel_acquire()
+	int                      defer;
 };
 
 
+// bytes per sample period and total buffer size in bytes
+static inline size_t dsa_channel_width (const struct dsa_channel_xfer *xfer)
+{
+	return xfer->pack ? sizeof(struct dsa_sample) : sizeof(struct dsa_sample_pair);
+}
+
+static inline size_t dsa_channel_bytes (const struct dsa_channel_xfer *xfer)
+{
+	return xfer->len * dsa_channel_width(xfer);
+}
+
+
 int  dsa_channel_ident   (const char *argv0);
+// returns the channel bit a new buffer for ident would be packed for, or 0 if it would
+// hold both channels
+int  dsa_channel_pack    (int ident);
 int  dsa_channel_buffer  (struct dsa_channel_event *evt, int ident, size_t len, int paint);
 int  dsa_channel_sxx     (struct dsa_channel_event *evt, int ident, int sxx,
-                          struct format *fmt, const char *loc);
+                          struct format *fmt, const char *opts, const char *loc);
 void dsa_channel_cleanup (struct dsa_channel_event *evt);
 
+// Return the sample buffers to the pool, keeping the sizes and sources and sinks, and
+// allocate them again at the sizes given at setup; a TX buffer sized by its source is
+// allocated by dsa_channel_load() as usual.  Returns 0 on success, <0 on error.
+void dsa_channel_release (struct dsa_channel_event *evt);
+int  dsa_channel_acquire (struct dsa_channel_event *evt);
+
+// Returns a copy of sxx for one of a numbered series of saves, with num added to the
+// filename: "cap.iqw" becomes "cap.0001.iqw".  A network sink keeps its address, with
+// time, if nonzero, as the segment's start time.  Returns NULL on error; free() it.
+struct dsa_channel_sxx *dsa_channel_sxx_number (const struct dsa_channel_sxx *sxx,
+                                                unsigned long num, unsigned long long time);
+
 const char *dsa_channel_desc (int ident);
 void dsa_channel_event_dump (struct dsa_channel_event *evt);
 
 // Load all setup channels with data - if lsh is nonzero, shift sample data left by 4 bits
 int dsa_channel_load (struct dsa_channel_event *evt, int lsh);
+
+// Load only the network TX sources, with the next samples of their streams, between
+// triggers of a streamed transfer; dsa_channel_streamed says whether there are any
+int dsa_channel_reload (struct dsa_channel_event *evt, int lsh);
+int dsa_channel_streamed (struct dsa_channel_event *evt);
+
 int dsa_channel_save (struct dsa_channel_event *evt);
 
 void dsa_channel_calc_exp (struct dsa_channel_event *evt, int reps);
@@ -17,8 +17,12 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <signal.h>
 
 #include <dma_streamer_mod.h>
 
@@ -28,7 +32,12 @@
 #include "dsa_ioctl_adi_new.h"
 #include "dsa_sample.h"
 #include "dsa_channel.h"
+#include "dsa_command.h"
 #include "dsa_common.h"
+#include "dsa_fir.h"
+#include "dsa_iq.h"
+#include "dsa_shm.h"
+#include "dsa_report.h"
 
 #include "log.h"
 LOG_MODULE_STATIC("command", LOG_LEVEL_INFO);
@@ -37,7 +46,9 @@ LOG_MODULE_STATIC("command", LOG_LEVEL_INFO);
 void dsa_command_options_usage (void)
 {
 	printf("\nGlobal options: [-qv] [-D mod:lvl] [-s bytes[K|M]] [-S samples[K|M]]\n"
-	       "                [-f format] [-t timeout] [-n node]\n"
+	       "                [-f format] [-t timeout] [-n node] [-j jobs] [-C dir] [-H1]\n"
+	       "                [-P playlist] [-F factor[:taps|file]] [-Q auto|corr]\n"
+	       "                [-M name] [-R [json:|csv:]file] [-L socket | -c socket]\n"
 	       "Where:\n"
 	       "-q          Quiet messages: warnings and errors only\n"
 	       "-v          Verbose messages: enable debugging\n"
@@ -46,24 +57,44 @@ void dsa_command_options_usage (void)
 	       "-S samples  Set buffer size in samples, add K/M for kilo-samples/mega-samples\n"
 	       "-f format   Set data format for sample data\n"
 	       "-t timeout  Set timeout in jiffies\n"
-	       "-n node     Device node for kernelspace module\n\n");
+	       "-n node     Device node for kernelspace module\n"
+	       "-j jobs     Load/save up to jobs channel files in parallel (default: one per CPU)\n"
+	       "-C dir      Cache converted TX waveforms in dir (default: $DSA_CACHE_DIR)\n"
+	       "-H          Use huge pages for sample buffers if available\n"
+	       "-1          Pack single-channel buffers 1T1R, 4 bytes per sample (new ADI only)\n"
+	       "-P file     Run the transfers in a playlist file instead of buffer options\n"
+	       "-F factor   Decimate RX data by factor before saving, through a lowpass FIR of\n"
+	       "            16 * factor + 1 taps; :taps sets the length, or :file gives the\n"
+	       "            coefficients\n"
+	       "-Q corr     Correct RX DC offset and IQ imbalance before saving: \"auto\" to\n"
+	       "            measure each channel, or dci/dcq/gain/phase as the stats format\n"
+	       "            reports them (DC as fraction of full scale, gain dB, phase degrees)\n"
+	       "-M name     Publish RX buffers in shared memory as /name.ad1r and /name.ad2r, for\n"
+	       "            analysis processes to map while the next capture is set up\n"
+	       "-R file     Append wall and CPU time, bytes, and throughput of each phase of the\n"
+	       "            run to file, \"-\" for stdout: JSON or CSV by prefix or extension\n"
+	       "-L socket   Run as a daemon, taking commands on the Unix-domain socket\n"
+	       "-c socket   Pass this command to the daemon on socket (default: $DSA_SOCKET)\n\n");
 }
 
 int dsa_command_options (int argc, char **argv)
 {
-	char *ptr;
-	int   opt;
-	while ( (opt = posix_getopt(argc, argv, "?hqvs:S:f:t:n:D:")) > -1 )
+	struct dsa_iq_bal  bal;
+	char              *ptr;
+	int                opt;
+	while ( (opt = posix_getopt(argc, argv, "?hqvs:S:f:t:n:j:C:H1P:F:Q:M:R:L:c:D:")) > -1 )
 	{
 		LOG_DEBUG("dsa_getopt: global opt '%c' with arg '%s'\n", opt, optarg);
 		switch ( opt )
 		{
 			case 'q':
-				log_set_global_level(LOG_LEVEL_WARN);
+				dsa_opt_level = LOG_LEVEL_WARN;
+				log_set_global_level(dsa_opt_level);
 				break;
 
 			case 'v':
-				log_set_global_level(LOG_LEVEL_DEBUG);
+				dsa_opt_level = LOG_LEVEL_DEBUG;
+				log_set_global_level(dsa_opt_level);
 				break;
 
 			case 's':
@@ -97,6 +128,26 @@ int dsa_command_options (int argc, char **argv)
 				break;
 
 			case 'n': dsa_opt_device  = optarg; break;
+			case 'C': dsa_opt_cache   = *optarg ? optarg : NULL; break;
+			case 'H': dsa_opt_huge    = 1; break;
+			case '1': dsa_opt_pack    = 1; break;
+			case 'P': dsa_opt_playlist = optarg; break;
+			case 'F': dsa_opt_fir     = *optarg ? optarg : NULL; break;
+			case 'Q': dsa_opt_corr    = *optarg ? optarg : NULL; break;
+			case 'M': dsa_opt_shm     = *optarg ? optarg : NULL; break;
+			case 'R': dsa_opt_report  = *optarg ? optarg : NULL; break;
+			case 'L': dsa_opt_daemon  = optarg; break;
+			case 'c': dsa_opt_client  = *optarg ? optarg : NULL; break;
+
+			case 'j':
+				errno = 0;
+				dsa_opt_jobs = strtoul(optarg, NULL, 0);
+				if ( errno || dsa_opt_jobs < 1 )
+				{
+					LOG_ERROR("Invalid job count '%s'\n", optarg);
+					return -1;
+				}
+				break;
 
 			case 'f':
 				if ( !(dsa_opt_format = format_find(optarg)) )
@@ -125,6 +176,15 @@ int dsa_command_options (int argc, char **argv)
 		}
 	}
 
+	// set up the filter now, rather than find a bad spec after a capture
+	if ( dsa_opt_fir && !dsa_fir_get(dsa_opt_fir) )
+		return -1;
+	if ( dsa_opt_corr && dsa_iq_corr_parse(&bal, dsa_opt_corr) < 0 )
+	{
+		LOG_ERROR("Invalid IQ correction '%s'\n", dsa_opt_corr);
+		return -1;
+	}
+
 	if ( !dsa_opt_format )
 		dsa_opt_format = format_find(DEF_FORMAT);
 	if ( !dsa_opt_format )
@@ -140,7 +200,7 @@ int dsa_command_options (int argc, char **argv)
 void dsa_command_setup_usage (void)
 {
 	printf("\nBuffer options: transfer [-zZ] [-s bytes[K|M]] [-S samples[K|M]] [-f format]\n"
-	       "                [format:]filename\n"
+	       "                [format[,opts]:]filename\n"
 	       "Where:\n"
 	       "-z          Paint buffer before transfer (default)\n"
 	       "-Z          Suppress buffer painting\n"
@@ -166,8 +226,9 @@ void dsa_command_setup_usage (void)
 	       "The \"filename\" specifier describes the source of sample data for TX transfers,\n"
 	       "or the destination of sample data for RX transfers.  The format may be given\n"
 	       "as a prefix, specified with the -f option, or guessed from the filename\n"
-	       "extension.  The following printf-style sequences may be used, which are useful\n"
-	       "when using multiple ADIs or channels:\n"
+	       "extension.  Options for the format follow its name in a prefix, separated by\n"
+	       "commas, like \"stats,block=1M,csv:ad1r.csv\".  The following printf-style\n"
+	       "sequences may be used, which are useful with multiple ADIs or channels:\n"
 	       "- \"%%a\" - expands to the ADI device (1/2)\n"
 	       "- \"%%c\" - expands to the channel (1/2)\n"
 	       "- \"%%d\" - expands to the direction (t/r, use \"%%D\" for T/R)\n\n"
@@ -177,13 +238,56 @@ void dsa_command_setup_usage (void)
 	       "  \"ad1r2.iqw\" - I/Q data from AD1 RX channel 2\n"
 	       "  \"ad2r1.iqw\" - I/Q data from AD2 RX channel 1\n"
 	       "  \"ad2r2.iqw\" - I/Q data from AD2 RX channel 2\n"
-	       "- \"AD1T waveform.iqw\" - load waveform into both TX channels of AD1\n\n");
+	       "- \"AD1T waveform.iqw\" - load waveform into both TX channels of AD1\n"
+	       "- \"AD1T1 gen,tone=0.01,amp=0.5:\" - synthesize a tone for AD1 TX1\n\n"
+	       "The gen format synthesizes TX data instead of loading a file, so no filename\n"
+	       "follows the prefix.  Frequencies are in cycles per sample, -0.5 to 0.5, and\n"
+	       "amplitudes a fraction of full scale.  Its options are one of:\n"
+	       "- \"tone=f[/f...]\"  - a tone, or up to 16 tones sharing the amplitude\n"
+	       "- \"chirp=f0/f1\"    - a linear sweep from f0 to f1, repeating every \"period=N\"\n"
+	       "                     samples, by default the buffer length\n"
+	       "- \"qpsk=sps\"       - QPSK from a PRBS, \"prbs=7|15|23|31\" (default 15), each\n"
+	       "                     symbol held for sps samples\n"
+	       "- \"noise=bw\"       - noise within bw of DC: random-phase tones on each bin of\n"
+	       "                     an \"fft=N\" (default 1024) block, RMS a quarter of amp,\n"
+	       "                     with \"seed=N\" to change the sequence\n"
+	       "- \"bits=7|15|23|31\" - the PRBS itself, 12 bits per word, for the prbs format\n"
+	       "plus \"amp=a\" for the peak amplitude (default 0.5), and \"len=N\" for the length\n"
+	       "if no buffer size is given.\n\n"
+	       "The prbs format checks RX data instead of saving it: each I and Q word\n"
+	       "carries 12 bits of its own PRBS as gen,bits= makes, and the checker locks on\n"
+	       "to each from the data.  It reports bits, bit and sample errors, BER, and sync\n"
+	       "losses per channel, with \"order=N\" (default 15), \"block=N\" samples per\n"
+	       "report, and each burst of errors up to \"gap=N\" samples apart (default 16);\n"
+	       "\"csv\" gives the counts only.  For example \"AD1R prbs,order=23:-\".\n\n"
+	       "A TX file recorded at another sample rate is resampled as it loads to the rate\n"
+	       "the AD9361 is set to, with \"rate=Hz\" (K/M allowed) in any format's options,\n"
+	       "like \"AD1T iqw,rate=7.68M:lte.iqw\".  The file is taken as looping, as the TX\n"
+	       "buffer does, and the buffer is sized from the resampled length if not given.\n\n"
+	       "The udp and tcp formats stream RX data to \"host:port\" instead of saving it,\n"
+	       "like \"AD1R udp:192.168.1.10:5500\".  Each capture goes as a segment of packets\n"
+	       "sent straight from the buffer, each with a stream ID, sequence number, sample\n"
+	       "index, and timestamp; the stream stays open between captures, so the index\n"
+	       "runs on.  \"id=N\" sets the stream ID, by default 0xDC for AD9361 D and\n"
+	       "channels C, and \"pkt=bytes\" the payload per packet (UDP 1408, TCP 32768).\n"
+	       "A TCP sink connects to a listener; dsa_format receives either, as in\n"
+	       "\"dsa_format udp,len=1M:5500 iqw:cap.iqw\".\n\n"
+	       "Given for TX, like \"AD1T udp,len=64K:5500\", they listen on the port for a\n"
+	       "stream in the same framing, as dsa_format sends.  Packets go into a jitter\n"
+	       "buffer of \"ring=N\" samples (default 256K) by sample index, and each rep of\n"
+	       "a trigger sends one buffer of \"len=N\" samples, refilled from the stream\n"
+	       "between reps until reps are done or interrupted, with RX saved each rep.\n"
+	       "\"jitter=N\" samples are gathered before the first is sent, and again after an\n"
+	       "underflow; samples lost, or not come within \"idle=ms\" (default 1000), are\n"
+	       "sent as \"fill=zero\" (default) or \"fill=last\", repeating the last sample,\n"
+	       "and counted.  \"wait=ms\" bounds the wait for the stream to start.\n\n");
 }
 
-int dsa_command_setup (int sxx, int argc, char **argv)
+int dsa_command_setup (struct dsa_channel_event *evt, int sxx, int argc, char **argv)
 {
 	struct format *fmt   = NULL;
 	size_t         len   = 0;
+	size_t         width = DSM_BUS_WIDTH;
 	int            paint = 1;
 	int            ret;
 	int            ident;
@@ -213,6 +317,10 @@ int dsa_command_setup (int sxx, int argc, char **argv)
 	if ( sxx < 0 )
 		sxx = ident;
 
+	// a packed buffer holds twice the samples in the same bytes
+	if ( dsa_channel_pack(ident) )
+		width = sizeof(struct dsa_sample);
+
 	optind = 1;
 	while ( (ret = posix_getopt(argc, argv, "zZs:S:f:")) > -1 )
 	{
@@ -229,14 +337,14 @@ int dsa_command_setup (int sxx, int argc, char **argv)
 					          optarg, DSM_BUS_WIDTH, DSM_MAX_SIZE, DSM_BUS_WIDTH);
 					return -1;
 				}
-				len /= DSM_BUS_WIDTH;
+				len /= width;
 				break;
 
 			case 'S':
 				if ( (len = size_dec(optarg)) < 1 )
 				{
-					LOG_ERROR("Invalid buffer size '%s' - minimum %u, maximum %u\n",
-					          optarg, 1, DSM_MAX_SIZE / DSM_BUS_WIDTH);
+					LOG_ERROR("Invalid buffer size '%s' - minimum %u, maximum %zu\n",
+					          optarg, 1, DSM_MAX_SIZE / width);
 					return -1;
 				}
 				break;
@@ -270,15 +378,15 @@ LOG_DEBUG("len %zu, paint %d, fmt %s, loc %s\n",
 	}
 
 	// for either direction check against the max size
-	if ( len > DSM_MAX_SIZE / DSM_BUS_WIDTH )
+	if ( len > DSM_MAX_SIZE / width )
 	{
-		LOG_ERROR("Invalid buffer size, maximum %u samples\n", DSM_MAX_SIZE / DSM_BUS_WIDTH);
+		LOG_ERROR("Invalid buffer size, maximum %zu samples\n", DSM_MAX_SIZE / width);
 		return -1;
 	}
 
 	// for source buffers, len may be passed as 0 here, and we'll try to get buffer size
 	// from the source data file when we _load
-	if ( (ret = dsa_channel_buffer(&dsa_evt, ident, len, paint)) < 0 )
+	if ( (ret = dsa_channel_buffer(evt, ident, len, paint)) < 0 )
 	{
 		LOG_ERROR("Early buffer alloc (%zu samples) failed: %s\n", len, strerror(errno));
 		return ret;
@@ -290,12 +398,21 @@ LOG_DEBUG("len %zu, paint %d, fmt %s, loc %s\n",
 
 	if ( sxx && optind < argc && argv[optind] )
 	{
+		char *opts = NULL;
 		char *p;
 
-		// specifying a format with a prefix, imagemagick-style, equivalent to -f 
+		// specifying a format with a prefix, imagemagick-style, equivalent to -f.  The
+		// format may be followed by options for it, as "format,opts:filename"
 		if ( (p = strchr(argv[optind], ':')) )
 		{
 			*p++ = '\0';
+			if ( (opts = strchr(argv[optind], ',')) )
+				*opts++ = '\0';
+			if ( opts && strlen(opts) >= FMT_OPTS_MAX )
+			{
+				LOG_ERROR("Format options '%s' too long\n", opts);
+				return -1;
+			}
 			if ( !(fmt = format_find(argv[optind])) )
 			{
 				LOG_ERROR("Format '%s' not known\n", argv[optind]);
@@ -324,7 +441,7 @@ LOG_DEBUG("len %zu, paint %d, fmt %s, loc %s\n",
 
 		// expand filename escapes and load data files if appropriate. this may also
 		// allocate the buffers if no 
-		if ( (ret = dsa_channel_sxx(&dsa_evt, ident, sxx, fmt, p)) < 0 )
+		if ( (ret = dsa_channel_sxx(evt, ident, sxx, fmt, opts, p)) < 0 )
 		{
 			LOG_ERROR("%s: %s\n", p, strerror(errno));
 			return ret;
@@ -345,7 +462,9 @@ LOG_DEBUG("dsa_parse_channel(): return %d\n", optind);
 
 void dsa_command_trigger_usage (void)
 {
-	printf("\nTrigger options: [-sSefuc] [reps|once]\n"
+	printf("\nTrigger options: [-sSefuc] [-t xfer:time] [-o xfer:ref:samples]\n"
+	       "                  [-d dbfs:pre:post[:holdoff[:events]]] [-l corr[:bin]]\n"
+	       "                  [-n count] [-i interval] [reps|once]\n"
 	       "Where:\n"
 	       "-s  Show statistics for DMA transfers after completion (default)\n"
 	       "-S  Suppress statistics display\n"
@@ -353,49 +472,264 @@ void dsa_command_trigger_usage (void)
 	       "-f  Debugging: show FIFO counters before and after transfer\n"
 	       "-u  Debugging: un-transpose RX data after transfer in software\n"
 	       "-c  Debugging: debug FIFO control registers before and after transfer\n"
+	       "-t  Start xfer at a CLOCK_MONOTONIC time in seconds, or +seconds after trigger\n"
+	       "-o  Start xfer a number of samples at ref's sample rate after ref starts\n"
+	       "-d  Re-trigger RX and save pre/post samples around blocks over dbfs power\n"
+	       "-l  Re-trigger TX and RX and measure the latency of the TX buffer in the RX\n"
+	       "-n  Capture count times, or until interrupted if 0, saving each capture while\n"
+	       "    the next is taken\n"
+	       "-i  Start repeated captures interval seconds apart (default: back to back)\n"
 	       "The \"reps\" may be a number of repetitions to run before returning, or\n"
-	       "the word \"once\" for a single run, which is the default if omitted\n\n");
+	       "the word \"once\" for a single run, which is the default if omitted.\n"
+	       "The xfer and ref for timed starts are given as AD1T, AD1R, AD2T, or AD2R, and\n"
+	       "the achieved start error is reported after the transfer.  Starts may be at\n"
+	       "most 60 seconds ahead.\n"
+	       "With -d the RX buffer is captured repeatedly until the events count or reps\n"
+	       "segments are done, or until interrupted; each event is saved to the RX sinks\n"
+	       "with a number added, cap.iqw becoming cap.0000.iqw and so on.\n"
+	       "With -l the TX buffer is a marker, found in each RX capture by cross-correlation;\n"
+	       "captures whose normalized correlation peak is under corr (0-1) are counted as\n"
+	       "misses.  After reps captures, or when interrupted, the latency from the start\n"
+	       "of the RX capture is reported in samples and microseconds, with a histogram of\n"
+	       "bin samples per bar (default 1).  Use one TX and one RX buffer, RX longer than\n"
+	       "TX, with a marker with a sharp autocorrelation like \"gen,qpsk=2\"; the last\n"
+	       "capture is saved to the RX sinks.\n"
+	       "With -n the RX buffers are doubled, and each capture is saved on a thread while\n"
+	       "the next is captured into the other buffer, with a number added to the RX sink\n"
+	       "names as for -d.  A summary gives the capture and save times.\n\n");
+}
+
+// parse a transfer name for a timed start: exactly one device and direction, returns
+// the index as for dsa_active_channels, or -1 if invalid
+static int start_index (const char *str)
+{
+	int  ident = dsa_channel_ident(str);
+
+	switch ( ident & (DC_DEV_AD1|DC_DEV_AD2|DC_DIR_TX|DC_DIR_RX) )
+	{
+		case DC_DEV_AD1|DC_DIR_TX: return 0;
+		case DC_DEV_AD1|DC_DIR_RX: return 1;
+		case DC_DEV_AD2|DC_DIR_TX: return 2;
+		case DC_DEV_AD2|DC_DIR_RX: return 3;
+	}
+
+	LOG_ERROR("Timed start needs one device and direction, not '%s'\n", str);
+	return -1;
+}
+
+static struct dsm_start_at *start_slot (struct dsm_user_start *us, int idx)
+{
+	struct dsm_chan_start *chan = idx & 2 ? &us->adi2 : &us->adi1;
+
+	return idx & 1 ? &chan->rx : &chan->tx;
+}
+
+static const char *start_desc (int idx)
+{
+	static const char *desc[4] = { "AD1 TX", "AD1 RX", "AD2 TX", "AD2 RX" };
+
+	return desc[idx & 3];
+}
+
+// -t xfer:time - absolute CLOCK_MONOTONIC seconds, or +seconds after the trigger
+static int parse_start_time (struct dsa_trigger_opts *opts, char *arg)
+{
+	struct dsm_start_at *at;
+	struct timespec      now;
+	double               sec;
+	double               ofs;
+	char                *ptr;
+	char                *end;
+	int                  idx;
+
+	if ( !(ptr = strchr(arg, ':')) )
+		return -1;
+	*ptr++ = '\0';
+
+	if ( (idx = start_index(arg)) < 0 )
+		return -1;
+
+	if ( *ptr == '+' )
+		opts->start_rel |= 1 << idx;
+	errno = 0;
+	if ( (sec = strtod(ptr, &end)) < 0 || errno || *end )
+	{
+		LOG_ERROR("Invalid start time '%s'\n", ptr);
+		return -1;
+	}
+
+	// the kernel refuses times well past or too far ahead; say which here
+	ofs = sec;
+	if ( !(opts->start_rel & (1 << idx)) )
+	{
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ofs -= now.tv_sec + now.tv_nsec / 1000000000.0;
+	}
+	if ( ofs * 1000000000.0 < -(double)DSM_START_LATE_NS ||
+	     ofs * 1000000000.0 > DSM_START_MAX_NS )
+	{
+		LOG_ERROR("Start time '%s' is %.3f sec from now, must be 0 to %.0f\n", ptr, ofs,
+		          DSM_START_MAX_NS / 1000000000.0);
+		return -1;
+	}
+
+	at = start_slot(&opts->start, idx);
+	at->mode         = DSM_START_TIME;
+	at->time.tv_sec  = sec;
+	at->time.tv_nsec = (sec - at->time.tv_sec) * 1000000000.0;
+	opts->timed |= 1 << idx;
+
+	return 0;
 }
 
-int dsa_command_trigger (int argc, char **argv)
+// -o xfer:ref:samples - start samples after ref starts, at ref's sample rate
+static int parse_start_after (struct dsa_trigger_opts *opts, char *arg)
 {
-	unsigned long long  u64;
-	unsigned long       sum[2];
-	unsigned long       last[2];
-	unsigned long       reps     = 1;
-	unsigned long       timeout;
-	int                 fifo     = 0;
-	int                 stats    = 1;
-	int                 exp      = 0;
-	int                 utp      = 0;
-	int                 ctrl     = 0;
-	int                 ret;
-	int                 dev;
-
-LOG_DEBUG("dsa_command_trigger(argc %d, argv):\n", argc);
+	struct dsm_start_at *at;
+	unsigned long long   nsec;
+	unsigned long        smp;
+	char                *ptr;
+	char                *end;
+	int                  idx;
+	int                  ref;
+
+	if ( !(ptr = strchr(arg, ':')) )
+		return -1;
+	*ptr++ = '\0';
+	if ( (idx = start_index(arg)) < 0 )
+		return -1;
+
+	arg = ptr;
+	if ( !(ptr = strchr(arg, ':')) )
+		return -1;
+	*ptr++ = '\0';
+	if ( (ref = start_index(arg)) < 0 )
+		return -1;
+
+	if ( ref == idx )
+	{
+		LOG_ERROR("%s can't start relative to itself\n", start_desc(idx));
+		return -1;
+	}
+
+	errno = 0;
+	smp = strtoul(ptr, &end, 0);
+	if ( errno || *end )
+	{
+		LOG_ERROR("Invalid sample count '%s'\n", ptr);
+		return -1;
+	}
+
+	// samples are converted to time at the reference transfer's rate
+	if ( !dsa_active_rates[ref] )
+	{
+		LOG_ERROR("Sample rate of %s unknown, can't time a start from it\n",
+		          start_desc(ref));
+		return -1;
+	}
+	nsec  = smp;
+	nsec *= 1000000000ULL;
+	nsec /= dsa_active_rates[ref];
+	if ( nsec > ULONG_MAX || nsec > DSM_START_MAX_NS )
+	{
+		LOG_ERROR("%lu samples is too long a delay\n", smp);
+		return -1;
+	}
+
+	at = start_slot(&opts->start, idx);
+	at->mode   = DSM_START_AFTER;
+	at->ref    = ref & 2 ? DSM_TARGT_ADI2 : DSM_TARGT_ADI1;
+	at->ref_rx = ref & 1;
+	at->delay  = nsec;
+	opts->timed |= 1 << idx;
+
+	return 0;
+}
+
+int dsa_command_trigger_parse (struct dsa_trigger_opts *opts, int argc, char **argv)
+{
+	char *end;
+	int   ret;
+
+LOG_DEBUG("dsa_command_trigger_parse(argc %d, argv):\n", argc);
 for ( ret = 0; ret <= argc; ret++ )
 	LOG_DEBUG("  argv[%d]: '%s'\n", ret, argv[ret]);
 
+	memset(opts, 0, sizeof(*opts));
+	opts->stats = 1;
+
 	//
 	optind = 1;
-	while ( (ret = posix_getopt(argc, argv, "fsSeuc")) > -1 )
+	while ( (ret = posix_getopt(argc, argv, "fsSeuct:o:d:l:n:i:")) > -1 )
 		switch ( ret )
 		{
-			case 'f': fifo  = 1; break;
-			case 's': stats = 1; break;
-			case 'S': stats = 0; break;
-			case 'e': exp = 1;   break;
-			case 'u': utp = 1;   break;
-			case 'c': ctrl = 1;  break;
+			case 'f': opts->fifo  = 1; break;
+			case 's': opts->stats = 1; break;
+			case 'S': opts->stats = 0; break;
+			case 'e': opts->exp   = 1; break;
+			case 'u': opts->utp   = 1; break;
+			case 'c': opts->ctrl  = 1; break;
+
+			case 't':
+				if ( parse_start_time(opts, optarg) < 0 )
+					return -1;
+				break;
+
+			case 'o':
+				if ( parse_start_after(opts, optarg) < 0 )
+					return -1;
+				break;
+
+			case 'd':
+				if ( dsa_detect_parse(&opts->det, optarg) < 0 )
+					return -1;
+				opts->detect = 1;
+				break;
+
+			case 'l':
+				if ( dsa_latency_parse(&opts->lat, optarg) < 0 )
+					return -1;
+				opts->latency = 1;
+				break;
+
+			case 'n':
+				errno = 0;
+				opts->rep.count = strtoul(optarg, &end, 0);
+				if ( errno || *end )
+				{
+					LOG_ERROR("Invalid capture count '%s'\n", optarg);
+					return -1;
+				}
+				opts->repeat = 1;
+				break;
+
+			case 'i':
+				errno = 0;
+				opts->rep.interval = strtod(optarg, &end);
+				if ( errno || *end || opts->rep.interval < 0.0 )
+				{
+					LOG_ERROR("Invalid capture interval '%s'\n", optarg);
+					return -1;
+				}
+				break;
 
 			default:
 				return -1;
 		}
 
+	if ( opts->detect + opts->latency + opts->repeat > 1 )
+	{
+		LOG_ERROR("Detection, latency measurement, and repeated captures can't be "
+		          "combined\n");
+		return -1;
+	}
+	if ( opts->rep.interval > 0.0 && !opts->repeat )
+		LOG_WARN("Capture interval only applies to repeated captures with -n\n");
+
 	// figure number of reps from argument
 	if ( !argv[optind] || !strcasecmp(argv[optind], "once") )
 	{
-		reps = 1;
+		opts->reps = 1;
 		LOG_INFO("Set for single trigger...\n");
 	}
 //	else if ( !strcasecmp(argv[optind], "cont") )
@@ -408,41 +742,168 @@ for ( ret = 0; ret <= argc; ret++ )
 //		reps  = 0;
 //		LOG_INFO("Set paused triggers...\n");
 //	}
-	else if ( (reps = size_dec(argv[optind])) < 1 )
+	else if ( (opts->reps = size_dec(argv[optind])) < 1 )
 	{
 		LOG_ERROR("Invalid repetition count '%s'\n", argv[optind]);
 		return -1;
 	}
 	else
-		LOG_INFO("Set for %lu repetitions...\n", reps);
+		LOG_INFO("Set for %lu repetitions...\n", opts->reps);
+
+	return 0;
+}
+
+static volatile sig_atomic_t stream_stop;
+
+static void stream_sigint (int signum)
+{
+	stream_stop = 1;
+}
+
+// A network TX source is fed from its stream a buffer at a time: each rep triggers the
+// buffer once, then the next buffer's worth is taken from the jitter buffer while it's
+// still mapped, and any RX is saved as it goes.  Stats and a timed start apply to the
+// first rep only.
+int dsa_command_stream (struct dsa_channel_event *evt,
+                        const struct dsa_trigger_opts *opts, int fresh)
+{
+	struct dsa_trigger_opts  rep_opts = *opts;
+	struct sigaction         sa, old;
+	unsigned long            num;
+	int                      ret = 0;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stream_sigint;
+	stream_stop   = 0;
+	sigaction(SIGINT, &sa, &old);
+
+	rep_opts.reps = 1;
+	for ( num = 0; !stream_stop && num < opts->reps; num++ )
+	{
+		if ( (num || !fresh) && dsa_channel_reload(evt, dsa_adi_new) < 0 )
+		{
+			LOG_ERROR("Failed to reload streamed IQ data: %s\n", strerror(errno));
+			ret = -1;
+			break;
+		}
+
+		if ( (ret = dsa_command_trigger_run(evt, &rep_opts)) < 0 )
+			break;
+		rep_opts.stats = 0;
+		rep_opts.exp   = 0;
+		rep_opts.timed = 0;
+
+		if ( (evt->rx[0] || evt->rx[1]) && dsa_channel_save(evt) < 0 )
+			LOG_ERROR("Failed to save IQ data: %s\n", strerror(errno));
+	}
+
+	sigaction(SIGINT, &old, NULL);
+	LOG_INFO("Streamed %lu of %lu buffers\n", num, opts->reps);
+	return ret;
+}
+
+int dsa_command_trigger (struct dsa_channel_event *evt, int argc, char **argv)
+{
+	struct dsa_trigger_opts  opts;
+	int                      streamed;
+	int                      ret;
+
+	if ( dsa_command_trigger_parse(&opts, argc, argv) < 0 )
+		return -1;
 
 	// load source buffers before map - allows buffer sized to input data size
 	// pass dsa_adi_new as lsh: new ADI PL enforces a 4-bit right-shift on TX data
-	if ( dsa_channel_load(&dsa_evt, dsa_adi_new) < 0 )
+	if ( dsa_channel_load(evt, dsa_adi_new) < 0 )
 	{
 		LOG_ERROR("Failed to load IQ data: %s\n", strerror(errno));
 		return -1;
 	}
 
-	if ( exp )
-		dsa_channel_calc_exp(&dsa_evt, reps);
+	// repeated captures map each of their pair of buffers in turn, and save as they go
+	if ( opts.repeat )
+		return dsa_repeat_run(evt, &opts) < 0 ? -2 : 0;
 
-	// try mapping once, first time through
-	if ( dsa_main_map(reps) )
+	// try mapping once, first time through; detection re-triggers one rep per segment,
+	// latency one per capture, and a streamed TX one per buffer
+	streamed = !opts.detect && !opts.latency && dsa_channel_streamed(evt);
+	if ( dsa_main_map(evt, opts.detect || opts.latency || streamed ? 1 : opts.reps) )
 	{
 		LOG_ERROR("DMA mapping failed: %s\n", strerror(errno));
 		return -1;
 	}
 
+	// streaming saves RX as it goes
+	if ( streamed )
+	{
+		ret = dsa_command_stream(evt, &opts, 1);
+		if ( dsa_main_unmap() )
+			LOG_ERROR("DMA unmapping failed: %s\n", strerror(errno));
+		return ret < 0 ? -2 : 0;
+	}
+
+	// detection saves its events as they're found, not the whole buffer
+	if ( opts.detect )
+	{
+		ret = dsa_detect_run(evt, &opts);
+		if ( dsa_main_unmap() )
+			LOG_ERROR("DMA unmapping failed: %s\n", strerror(errno));
+		return ret < 0 ? -2 : 0;
+	}
+
+	if ( opts.latency )
+		ret = dsa_latency_run(evt, &opts);
+	else
+		ret = dsa_command_trigger_run(evt, &opts);
+
+	if ( dsa_main_unmap() )
+		LOG_ERROR("DMA unmapping failed: %s\n", strerror(errno));
+
+	// save sink buffers 
+	if ( dsa_channel_save(evt) < 0 )
+	{
+		LOG_ERROR("Failed to save IQ data: %s\n", strerror(errno));
+		ret = -1;
+	}
+
+	return ret < 0 ? -2 : 0;
+}
+
+int dsa_command_trigger_run (struct dsa_channel_event *evt,
+                             const struct dsa_trigger_opts *opts)
+{
+	struct dsa_report_mark  mark;
+	unsigned long long      bytes;
+	unsigned long long      u64;
+	unsigned long           sum[2];
+	unsigned long           last[2];
+	unsigned long           reps  = opts->reps;
+	unsigned long           timeout;
+	int                     fifo  = opts->fifo;
+	int                     stats = opts->stats;
+	int                     exp   = opts->exp;
+	int                     utp   = opts->utp;
+	int                     ctrl  = opts->ctrl;
+	int                     trig;
+	int                     ret;
+	int                     dev;
+
+	if ( exp )
+		dsa_channel_calc_exp(evt, reps);
+
 	// set timeout: if user's specified a value use that even if it's wrong. 
 	// otherwise calculate from data sizes + margin, minimum 1 sec.
-	if ( !(timeout = dsa_opt_timeout) )
-		timeout = dsa_channel_timeout(&dsa_evt, 4);
-	if ( timeout < 100 )
-		timeout = 100;
-	dsa_ioctl_set_timeout(timeout);
+	if ( opts->timeout_ms )
+		dsa_ioctl_set_timeout_ms(opts->timeout_ms);
+	else
+	{
+		if ( !(timeout = dsa_opt_timeout) )
+			timeout = dsa_channel_timeout(evt, 4);
+		if ( timeout < 100 )
+			timeout = 100;
+		dsa_ioctl_set_timeout(timeout);
+	}
 
-	if ( reps > 1 && (dsa_evt.rx[0] || dsa_evt.rx[1]) )
+	if ( reps > 1 && (evt->rx[0] || evt->rx[1]) )
 		LOG_WARN("Specified %lu reps applies to TX only; RX will run once\n", reps);
 
 	if ( reps )
@@ -475,33 +936,44 @@ for ( ret = 0; ret <= argc; ret++ )
 			for ( dev = 0; dev < 2; dev++ ) 
 			{ 
 				unsigned long  reg;
+				int            r1;
+
+				// packed RX buffers use R1 mode: the core packs two samples of the one
+				// channel per DMA word, from the first I/Q channel pair only
+				r1 = evt->rx[dev] && evt->rx[dev]->pack;
 
 				// RX channel 1 parameters - minimal setup for now
 				reg = ADI_NEW_RX_FORMAT_ENABLE | ADI_NEW_RX_ENABLE;
 				dsa_ioctl_adi_new_write(dev, ADI_NEW_RX, ADI_NEW_RX_REG_CHAN_CNTRL(0), reg);
 				dsa_ioctl_adi_new_write(dev, ADI_NEW_RX, ADI_NEW_RX_REG_CHAN_CNTRL(1), reg);
 
-				// RX channel 2 parameters - minimal setup for now
-				reg = ADI_NEW_RX_FORMAT_ENABLE | ADI_NEW_RX_ENABLE;
+				// RX channel 2 parameters - minimal setup for now, disabled in R1 mode
+				reg = r1 ? 0 : ADI_NEW_RX_FORMAT_ENABLE | ADI_NEW_RX_ENABLE;
 				dsa_ioctl_adi_new_write(dev, ADI_NEW_RX, ADI_NEW_RX_REG_CHAN_CNTRL(2), reg);
 				dsa_ioctl_adi_new_write(dev, ADI_NEW_RX, ADI_NEW_RX_REG_CHAN_CNTRL(3), reg);
 
-				// Always using T2R2 for now - discard the extra samples
+				// T2R2 unless packed - discard the extra samples
 				dsa_ioctl_adi_new_read(dev, ADI_NEW_RX, ADI_NEW_RX_REG_CNTRL, &reg);
-				reg &= ~ADI_NEW_RX_R1_MODE;
+				if ( r1 )
+					reg |= ADI_NEW_RX_R1_MODE;
+				else
+					reg &= ~ADI_NEW_RX_R1_MODE;
 				dsa_ioctl_adi_new_write(dev, ADI_NEW_RX, ADI_NEW_RX_REG_CNTRL, reg);
 
-				// TX channel parameters - Always using T2R2
-				if ( dsa_evt.tx[dev] )
+				// TX channel parameters - T2R2 unless packed
+				if ( evt->tx[dev] )
 				{
-					// Select DMA source, enable format, disable T1R1 mode
+					r1 = evt->tx[dev]->pack;
+
+					// Select DMA source, enable format, set T1R1 mode if packed
 					reg  = ADI_NEW_TX_DATA_SEL(ADI_NEW_TX_DATA_SEL_DMA);
 					reg |= ADI_NEW_TX_DATA_FORMAT;
-					reg &= ~ADI_NEW_TX_R1_MODE;
+					if ( r1 )
+						reg |= ADI_NEW_TX_R1_MODE;
 					dsa_ioctl_adi_new_write(dev, ADI_NEW_TX, ADI_NEW_TX_REG_CNTRL_2, reg);
 
-					// Rate 3 for T2R2 mode
-					reg = ADI_NEW_TX_TO_RATE(3);
+					// Rate 3 for T2R2 mode, 1 for T1R1
+					reg = ADI_NEW_TX_RATE(r1 ? 1 : 3);
 					dsa_ioctl_adi_new_write(dev, ADI_NEW_TX, ADI_NEW_TX_REG_RATECNTRL, reg);
 				}
 			} 
@@ -510,11 +982,11 @@ for ( ret = 0; ret <= argc; ret++ )
 		else
 			for ( dev = 0; dev < 2; dev++ )
 			{
-				if ( dsa_evt.tx[dev] )
-					dsa_ioctl_adi_old_set_tx_cnt(dev, dsa_evt.tx[dev]->len, reps);
+				if ( evt->tx[dev] )
+					dsa_ioctl_adi_old_set_tx_cnt(dev, evt->tx[dev]->len, reps);
 			
-				if ( dsa_evt.rx[dev] )
-					dsa_ioctl_adi_old_set_rx_cnt(dev, dsa_evt.rx[dev]->len, reps);
+				if ( evt->rx[dev] )
+					dsa_ioctl_adi_old_set_rx_cnt(dev, evt->rx[dev]->len, reps);
 			}
 	}
 
@@ -550,11 +1022,68 @@ for ( ret = 0; ret <= argc; ret++ )
 		dsa_main_show_fifos(&fb);
 	}
 
+	// Timed starts: resolve times relative to now, then arm the kernel for them
+	if ( opts->timed )
+	{
+		struct dsm_user_start  start = opts->start;
+		struct dsm_start_at   *at;
+		struct timespec        now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for ( dev = 0; dev < 4; dev++ )
+			if ( opts->start_rel & (1 << dev) )
+			{
+				at = start_slot(&start, dev);
+				at->time.tv_sec  += now.tv_sec;
+				at->time.tv_nsec += now.tv_nsec;
+				if ( at->time.tv_nsec >= 1000000000 )
+				{
+					at->time.tv_nsec -= 1000000000;
+					at->time.tv_sec++;
+				}
+			}
+
+		if ( dsa_ioctl_start_at(&start) )
+		{
+			LOG_ERROR("Failed to arm timed start: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+
 	// Trigger DMA and block until complete
 	LOG_INFO("Triggering DMA...\n");
+	dsa_shm_begin(evt);
+	dsa_report_start(&mark);
 	errno = 0;
-	if ( !dsa_ioctl_trigger() && !stats )
+	if ( !(trig = dsa_ioctl_trigger()) && !stats )
 		LOG_INFO("DMA triggered\n");
+	if ( !trig )
+	{
+		// TX buffers go out reps times, RX buffers fill once
+		for ( dev = 0, bytes = 0; dev < 2; dev++ )
+		{
+			if ( evt->tx[dev] )
+				bytes += (unsigned long long)dsa_channel_bytes(evt->tx[dev]) * reps;
+			if ( evt->rx[dev] )
+				bytes += dsa_channel_bytes(evt->rx[dev]);
+		}
+		dsa_report_phase(&mark, "trigger", NULL, bytes);
+	}
+
+	// Timed starts: report the achieved start time and error
+	if ( opts->timed )
+	{
+		struct dsm_user_stats   sb;
+		struct dsm_xfer_stats  *st[4] = { &sb.adi1.tx, &sb.adi1.rx, &sb.adi2.tx, &sb.adi2.rx };
+
+		memset(&sb, 0, sizeof(sb));
+		dsa_ioctl_get_stats(&sb);
+		for ( dev = 0; dev < 4; dev++ )
+			if ( opts->timed & (1 << dev) )
+				LOG_INFO("%s started at %lu.%09lu, error %+.3f us\n", start_desc(dev),
+				         st[dev]->start.tv_sec, st[dev]->start.tv_nsec,
+				         st[dev]->start_err / 1000.0);
+	}
 
 
 	// Show FIFO numbers before transfer
@@ -570,7 +1099,7 @@ for ( ret = 0; ret <= argc; ret++ )
 	if ( exp && !dsa_adi_new ) 
 		for ( dev = 0; dev < 2; dev++ )
 		{
-			if ( !dsa_evt.tx[dev] )
+			if ( !evt->tx[dev] )
 				continue;
 
 			dsa_ioctl_adi_old_get_sum(dev, sum);
@@ -583,12 +1112,12 @@ for ( ret = 0; ret <= argc; ret++ )
 			u64  |= sum[1];
 
 			printf("Sink sum: %016llx (%08lx.%08lx)\n", u64, sum[0],  sum[1]);
-			printf("Expected: %016llx\n", dsa_evt.tx[dev]->exp);
+			printf("Expected: %016llx\n", evt->tx[dev]->exp);
 
-			if ( u64 > dsa_evt.tx[dev]->exp )
-				printf("Larger  : %016llx\n", u64 - dsa_evt.tx[dev]->exp);
-			else if ( u64 < dsa_evt.tx[dev]->exp )
-				printf("Smaller : %016llx\n", dsa_evt.tx[dev]->exp - u64);
+			if ( u64 > evt->tx[dev]->exp )
+				printf("Larger  : %016llx\n", u64 - evt->tx[dev]->exp);
+			else if ( u64 < evt->tx[dev]->exp )
+				printf("Smaller : %016llx\n", evt->tx[dev]->exp - u64);
 		}
 
 	if ( ctrl && !dsa_adi_new ) 
@@ -615,10 +1144,10 @@ for ( ret = 0; ret <= argc; ret++ )
 
 		dsa_ioctl_get_stats(&sb);
 
-		if ( dsa_evt.tx[0] )  dsa_main_show_stats(&sb.adi1.tx, "AD1 TX");
-		if ( dsa_evt.rx[0] )  dsa_main_show_stats(&sb.adi1.rx, "AD1 RX");
-		if ( dsa_evt.tx[1] )  dsa_main_show_stats(&sb.adi2.tx, "AD2 TX");
-		if ( dsa_evt.rx[1] )  dsa_main_show_stats(&sb.adi2.rx, "AD2 RX");
+		if ( evt->tx[0] )  dsa_main_show_stats(&sb.adi1.tx, "AD1 TX");
+		if ( evt->rx[0] )  dsa_main_show_stats(&sb.adi1.rx, "AD1 RX");
+		if ( evt->tx[1] )  dsa_main_show_stats(&sb.adi2.tx, "AD2 TX");
+		if ( evt->rx[1] )  dsa_main_show_stats(&sb.adi2.rx, "AD2 RX");
 	}
 
 
@@ -631,10 +1160,12 @@ for ( ret = 0; ret <= argc; ret++ )
 		int      Index;
 
 		for ( dev = 0; dev < 2; dev++ )
-			if ( dsa_evt.rx[dev] )
+			if ( evt->rx[dev] && evt->rx[dev]->pack )
+				LOG_WARN("AD%d RX is packed, not un-transposing\n", dev + 1);
+			else if ( evt->rx[dev] )
 			{
-				RxPacket     = (uint8_t *)dsa_evt.rx[dev]->smp;
-				BYTES_TO_RX  = dsa_evt.rx[dev]->len * sizeof(struct dsa_sample_pair);
+				RxPacket     = (uint8_t *)evt->rx[dev]->smp;
+				BYTES_TO_RX  = evt->rx[dev]->len * sizeof(struct dsa_sample_pair);
 				BYTES_TO_RX -= 16;
 
 				for (Index = 0; Index< BYTES_TO_RX; Index = Index+8){
@@ -646,13 +1177,7 @@ for ( ret = 0; ret <= argc; ret++ )
 			}
 	}
 
-	if ( dsa_main_unmap() )
-		LOG_ERROR("DMA unmapping failed: %s\n", strerror(errno));
-
-	// save sink buffers 
-	if ( dsa_channel_save(&dsa_evt) < 0 )
-		LOG_ERROR("Failed to save IQ data: %s\n", strerror(errno));
-
-	return 0;
+	// published RX buffers are complete once any fixups are done
+	dsa_shm_end(evt, !trig);
+	return trig;
 }
-
@@ -18,9 +18,65 @@
 #ifndef _INCLUDE_DSA_COMMAND_H_
 #define _INCLUDE_DSA_COMMAND_H_
 
+#include <dma_streamer_mod.h>
+
+#include "dsa_channel.h"
+#include "dsa_detect.h"
+#include "dsa_latency.h"
+#include "dsa_repeat.h"
+
+// trigger options, parsed separately so a playlist can check them before running
+struct dsa_trigger_opts
+{
+	unsigned long          reps;
+	int                    fifo;
+	int                    stats;
+	int                    exp;
+	int                    utp;
+	int                    ctrl;
+
+	// DMA timeout in ms, for callers working in real time; 0 for dsa_opt_timeout
+	unsigned long          timeout_ms;
+
+	// timed starts: timed has a bit per transfer as in dsa_active_channels, and start_rel
+	// marks the DSM_START_TIME ones relative to the trigger rather than absolute
+	int                    timed;
+	int                    start_rel;
+	struct dsm_user_start  start;
+
+	// event detection with the RX buffer as a segment, reps limits the segments
+	int                    detect;
+	struct dsa_detect_opts det;
+
+	// latency measurement, reps captures with the TX buffer as the marker
+	int                     latency;
+	struct dsa_latency_opts lat;
+
+	// repeated captures, each saved while the next is captured
+	int                     repeat;
+	struct dsa_repeat_opts  rep;
+};
+
 int dsa_command_options (int argc, char **argv);
-int dsa_command_setup   (int sxx, int argc, char **argv);
-int dsa_command_trigger (int argc, char **argv);
+int dsa_command_setup   (struct dsa_channel_event *evt, int sxx, int argc, char **argv);
+
+// load, trigger, and save evt with the trigger options in argv; returns 0 on success, -1
+// on invalid options or a failure to load or map, -2 if the run or its save failed
+int dsa_command_trigger (struct dsa_channel_event *evt, int argc, char **argv);
+
+// parse trigger options and reps into opts; returns 0 on success, <0 on error
+int dsa_command_trigger_parse (struct dsa_trigger_opts *opts, int argc, char **argv);
+
+// program the FIFOs and trigger evt, which must be loaded and mapped already.  Returns
+// 0 on success, <0 if the trigger failed.
+int dsa_command_trigger_run (struct dsa_channel_event *evt,
+                             const struct dsa_trigger_opts *opts);
+
+// trigger evt, mapped for one rep, once per rep of opts, refilling its network TX sources
+// from their streams before each but the first if fresh, and saving RX after each; stops
+// early on SIGINT.  Returns 0 on success, <0 on error.
+int dsa_command_stream (struct dsa_channel_event *evt,
+                        const struct dsa_trigger_opts *opts, int fresh);
 
 void dsa_command_options_usage (void);
 void dsa_command_setup_usage   (void);
@@ -21,6 +21,7 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <ctype.h>
 #include <limits.h>
 #include <errno.h>
@@ -122,6 +123,19 @@ int posix_getopt (int argc, char **argv, const char *optstring)
 	return ret;
 }
 
+unsigned long long mono_usec (void)
+{
+	struct timespec     ts;
+	unsigned long long  ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ret  = ts.tv_sec;
+	ret *= 1000000;
+	ret += ts.tv_nsec / 1000;
+
+	return ret;
+}
+
 
 /** Find a leaf filename in a colon-separated path list and return a full path
  *
@@ -18,6 +18,8 @@
 #ifndef _INCLUDE_DSA_COMMON_H_
 #define _INCLUDE_DSA_COMMON_H_
 #include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
 
 
 void stop (const char *fmt, ...);
@@ -26,6 +28,7 @@ size_t size_bin (const char *str);
 size_t size_dec (const char *str);
 uint64_t dsnk_sum (void *buff, size_t size);
 int posix_getopt (int argc, char **argv, const char *optstring);
+unsigned long long mono_usec (void);
 
 
 /** Find a leaf filename in a colon-separated path list and return a full path
@@ -0,0 +1,303 @@
+/** \file      dsa_core.c
+ *  \brief     device, buffer mapping, and global state shared by the app and libdsa
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at: 
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "dsa_main.h"
+#include "dsa_ioctl.h"
+#include "dsa_common.h"
+#include "dsa_report.h"
+
+#include <ad9361_channels.h>
+
+#include "log.h"
+LOG_MODULE_STATIC("core", LOG_LEVEL_INFO);
+
+
+int         dsa_dev = -1;
+int         dsa_adi_new = 0;
+
+size_t      dsa_opt_len      = 1000000; // 1MS default
+unsigned    dsa_opt_timeout  = 0; // auto-calculated now
+int         dsa_opt_jobs     = 0; // one per CPU
+const char *dsa_opt_cache    = NULL; // no caching
+int         dsa_opt_huge     = 0;
+int         dsa_opt_pack     = 0; // 1T1R buffers for single-channel transfers
+int         dsa_opt_level    = LOG_LEVEL_INFO;
+const char *dsa_opt_daemon   = NULL; // socket path to listen on
+const char *dsa_opt_client   = NULL; // socket path to pass the command line to
+const char *dsa_opt_device   = DEF_DEVICE;
+const char *dsa_opt_playlist = NULL; // run the steps in this file instead
+const char *dsa_opt_fir      = NULL; // decimate RX before saving, see dsa_fir.h
+const char *dsa_opt_corr     = NULL; // correct RX DC/IQ balance before saving, see dsa_iq.h
+const char *dsa_opt_shm      = NULL; // publish RX buffers in shared memory, see dsa_shm.h
+const char *dsa_opt_report   = NULL; // per-phase timing report, see dsa_report.h
+
+char *opt_lib_dir   = NULL;
+char  env_data_path[PATH_MAX];
+
+unsigned char  dsa_active_channels[4];
+unsigned long  dsa_active_rates[4];
+
+struct format *dsa_opt_format = NULL;
+struct dsa_channel_event dsa_evt;
+
+
+void dsa_main_show_stats (const struct dsm_xfer_stats *st, const char *dir)
+{
+	printf("%s stats:\n", dir);
+	if ( !st->bytes )
+	{
+		printf ("  not run\n");
+		return;
+	}
+
+	unsigned long long usec = st->total.tv_sec;
+	usec *= 1000000000;
+	usec += st->total.tv_nsec;
+	usec /= 1000;
+
+	unsigned long long rate = 0;
+	if ( usec > 0 )
+		rate = st->bytes / usec;
+
+	printf("  bytes    : %llu\n",      st->bytes);
+	printf("  total    : %lu.%09lu\n", st->total.tv_sec, st->total.tv_nsec);
+	printf("  rate     : %llu MB/s\n", rate);
+
+	printf("  completes: %lu\n",       st->completes);
+	printf("  errors   : %lu\n",       st->errors);
+	printf("  timeouts : %lu\n",       st->timeouts);
+	printf("  started  : %lu.%09lu\n", st->start.tv_sec, st->start.tv_nsec);
+}
+
+void dsa_main_show_fifos (const struct dsm_fifo_counts *buff)
+{
+	printf("  RX 1: %08lx/%08lx\n", buff->rx_1_ins, buff->rx_1_ext);
+	printf("  RX 2: %08lx/%08lx\n", buff->rx_2_ins, buff->rx_2_ext);
+	printf("  TX 1: %08lx/%08lx\n", buff->tx_1_ins, buff->tx_1_ext);
+	printf("  TX 2: %08lx/%08lx\n", buff->tx_2_ins, buff->tx_2_ext);
+}
+
+
+static char *target_desc (int mask)
+{
+	static char buff[64];
+
+	snprintf(buff, sizeof(buff), "{ %s%s%s%s%s}",
+		     mask & DSM_TARGT_ADI1 ? "adi1 " : "",
+		     mask & DSM_TARGT_ADI2 ? "adi2 " : "",
+		     mask & DSM_TARGT_NEW  ? "new: " : "",
+		     mask & DSM_TARGT_DSXX ? "dsrc " : "",
+		     mask & DSM_TARGT_DSXX ? "dsnk " : "");
+
+	return buff;
+}
+
+
+// bytes mapped by the last dsa_main_map, for the unmap's report
+static unsigned long long dsa_main_mapped = 0;
+
+int dsa_main_map (struct dsa_channel_event *evt, int reps)
+{
+	// pass to kernelspace and prepare DMA
+	struct dsm_user_buffs   buffs;
+	struct dsa_report_mark  mark;
+	int                     ret;
+
+	if ( dsa_dev < 0 )
+		return -1;
+
+	dsa_report_start(&mark);
+	memset (&buffs, 0, sizeof(struct dsm_user_buffs));
+
+	if ( evt->tx[0] )
+	{
+		buffs.adi1.tx.addr = (unsigned long)evt->tx[0]->smp;
+		buffs.adi1.tx.size = dsa_channel_bytes(evt->tx[0]);
+		buffs.adi1.tx.words = buffs.adi1.tx.size / DSM_BUS_WIDTH * reps;
+	}
+
+	if ( evt->tx[1] )
+	{
+		buffs.adi2.tx.addr = (unsigned long)evt->tx[1]->smp;
+		buffs.adi2.tx.size = dsa_channel_bytes(evt->tx[1]);
+		buffs.adi2.tx.words = buffs.adi2.tx.size / DSM_BUS_WIDTH * reps;
+	}
+
+	if ( evt->rx[0] )
+	{
+		buffs.adi1.rx.addr = (unsigned long)evt->rx[0]->smp;
+		buffs.adi1.rx.size = dsa_channel_bytes(evt->rx[0]);
+		buffs.adi1.rx.words = buffs.adi1.rx.size / DSM_BUS_WIDTH;
+	}
+
+	if ( evt->rx[1] )
+	{
+		buffs.adi2.rx.addr = (unsigned long)evt->rx[1]->smp;
+		buffs.adi2.rx.size = dsa_channel_bytes(evt->rx[1]);
+		buffs.adi2.rx.words = buffs.adi2.rx.size / DSM_BUS_WIDTH;
+	}
+
+	// old: calculate FIFO control register ctrl value based on channel config
+	// new: calculate channel/TX/RX enable ctrl value based on channel config
+	if ( evt->tx[0] || evt->rx[0] )
+		buffs.adi1.ctrl = dsa_channel_ctrl(evt, DC_DEV_AD1, !dsa_adi_new);
+	if ( evt->tx[1] || evt->rx[1] )
+		buffs.adi2.ctrl = dsa_channel_ctrl(evt, DC_DEV_AD2, !dsa_adi_new);
+
+	if ( (ret = dsa_ioctl_map(&buffs)) )
+		return ret;
+
+	dsa_main_mapped = (unsigned long long)buffs.adi1.tx.size + buffs.adi2.tx.size +
+	                  buffs.adi1.rx.size + buffs.adi2.rx.size;
+	dsa_report_phase(&mark, "map", NULL, dsa_main_mapped);
+	return 0;
+}
+
+
+int dsa_main_unmap (void)
+{
+	struct dsa_report_mark  mark;
+	int                     ret;
+
+	if ( dsa_dev < 0 )
+		return -1;
+
+	dsa_report_start(&mark);
+	if ( (ret = dsa_ioctl_unmap()) )
+		return ret;
+
+	dsa_report_phase(&mark, "unmap", NULL, dsa_main_mapped);
+	return 0;
+}
+
+
+void dsa_main_dev_close (void)
+{
+	if ( dsa_dev < 0 )
+		return;
+
+	close(dsa_dev);
+	dsa_dev = -1;
+}
+
+
+int dsa_main_dev_reopen (unsigned long *mask)
+{
+	dsa_main_dev_close();
+
+	if ( (dsa_dev = open(dsa_opt_device, O_RDWR)) < 0 )
+	{
+		LOG_DEBUG("open(%s): %s\n", dsa_opt_device, strerror(errno));
+		return -1;
+	}
+
+	if ( dsa_ioctl_target_list(mask) )
+	{
+		LOG_ERROR("DSM_IOCG_TARGET_LIST: %s\n", strerror(errno));
+		dsa_main_dev_close();
+		return -1;
+	}
+
+	LOG_DEBUG("Supported targets: %s\n", target_desc(*mask));
+	if ( !*mask )
+	{
+		LOG_ERROR("No supported targets in this build; reconfigure your PetaLinux with the path to\n"
+		       "your hardware project's BSP include directory, containing xparameters.h.  The\n"
+		       "petalinux-config-apps path is:\n"
+		       "  User Modules ->\n"
+		       "    dma_streamer_mod -> \n"
+		       "      Path to Xilinx-generated BSP containing xparameters.h\n"
+		       "or search for USER_MODULES_DMA_STREAMER_MOD_BSP\n");
+
+		dsa_main_dev_close();
+		return -1;
+	}
+
+	return 0;
+}
+
+// Channel enables and rates are published by the ad9361 tool in a shared-memory segment,
+// indexed like dsa_active_channels: AD1 TX, AD1 RX, AD2 TX, AD2 RX
+void dsa_main_import_channels (void)
+{
+	struct ad9361_channels_dev  chs[AD9361_CHANNELS_DEVS];
+	struct ad9361_channels     *shm;
+	int                         probe = 0;
+	int                         dev;
+	int                         dir;
+
+	memset(dsa_active_channels, 0, sizeof(dsa_active_channels));
+	memset(dsa_active_rates,    0, sizeof(dsa_active_rates));
+	memset(chs,                 0, sizeof(chs));
+
+	// if ad9361 hasn't run since boot, or hasn't looked at both devices, run it once to
+	// probe: it starts looking at ad1, then switches to ad2, publishing each
+	while ( 1 )
+	{
+		if ( (shm = ad9361_channels_map(0)) )
+		{
+			if ( ad9361_channels_read(shm, chs) )
+				LOG_WARN("Channel state unreadable: %s\n", strerror(errno));
+			ad9361_channels_unmap(shm);
+		}
+		else if ( errno != ENOENT )
+			LOG_WARN("Channel state unavailable: %s\n", strerror(errno));
+
+		if ( probe || (chs[0].valid && chs[1].valid) )
+			break;
+
+		LOG_DEBUG("Channel state incomplete, probing with ad9361\n");
+		system("/usr/bin/ad9361 device ad2 2>/dev/null");
+		probe = 1;
+	}
+
+	for ( dev = 0; dev < AD9361_CHANNELS_DEVS; dev++ )
+		if ( chs[dev].valid )
+		{
+			dsa_active_channels[dev * 2]     = chs[dev].tx;
+			dsa_active_channels[dev * 2 + 1] = chs[dev].rx;
+			dsa_active_rates[dev * 2]        = chs[dev].tx_rate;
+			dsa_active_rates[dev * 2 + 1]    = chs[dev].rx_rate;
+		}
+
+	LOG_DEBUG("Active channels from %02x %02x %02x %02x:\n", 
+	          dsa_active_channels[0], dsa_active_channels[1], 
+	          dsa_active_channels[2], dsa_active_channels[3]);
+
+	for ( dev = 0; dev < 4; dev += 2 )
+		for ( dir = 0; dir < 2; dir++ )
+		{
+			unsigned char ch = dsa_active_channels[dev + dir];
+			LOG_DEBUG("  %s %s:%s%s%s, %lu Hz\n",
+			          dev ? "AD2" : "AD1",
+			          dir ? "RX"  : "TX",
+			          ch & 0x80 ? " CH2" : "",
+			          ch & 0x40 ? " CH1" : "",
+			          ch & 0xC0 ? "" : " none",
+			          dsa_active_rates[dev + dir]);
+		}
+}
@@ -0,0 +1,532 @@
+/** \file      dsa_daemon.c
+ *  \brief     implementation of the resident daemon and its client
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at: 
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+
+#include "dsa_daemon.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("daemon", LOG_LEVEL_INFO);
+
+
+// A request is a header, carrying the client's stdin, stdout, and stderr as SCM_RIGHTS,
+// followed by size bytes of NUL-terminated strings: the working directory and then argc
+// arguments.  The reply is the exit status as an int32_t.  While the request runs, a
+// byte from the client cancels it, as SIGINT would in-process, and so does the client
+// going away.
+#define DAEMON_MAGIC    0x44534144  // "DASD"
+#define DAEMON_VERSION  1
+#define DAEMON_FDS      3
+#define DAEMON_CANCEL   'C'
+
+struct daemon_head
+{
+	uint32_t  magic;
+	uint32_t  version;
+	uint32_t  argc;
+	uint32_t  size;
+};
+
+
+// watches the client's socket while a request runs
+struct daemon_watch
+{
+	int        sock;
+	int        pipe[2];
+	pthread_t  main;
+	pthread_t  thread;
+};
+
+static volatile sig_atomic_t daemon_quit   = 0;
+static volatile sig_atomic_t daemon_cancel = 0;
+
+// the SIGINT that cancels a request is for the request's own handler, if it set one;
+// without, it must not shut the daemon down
+static void daemon_signal (int signum)
+{
+	if ( signum != SIGINT || !daemon_cancel )
+		daemon_quit = 1;
+}
+
+static int client_sock = -1;
+
+// send() is async-signal-safe, so the cancel goes out from the handler itself
+static void client_signal (int signum)
+{
+	int   err    = errno;
+	char  cancel = DAEMON_CANCEL;
+
+	send(client_sock, &cancel, 1, MSG_NOSIGNAL|MSG_DONTWAIT);
+	errno = err;
+}
+
+
+static int daemon_recv_all (int sock, void *buff, size_t size)
+{
+	uint8_t *ptr = buff;
+	ssize_t  ret;
+
+	while ( size )
+	{
+		if ( (ret = recv(sock, ptr, size, 0)) < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			return -1;
+		}
+		if ( !ret )
+		{
+			errno = ECONNRESET;
+			return -1;
+		}
+		ptr  += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+static int daemon_send_all (int sock, const void *buff, size_t size)
+{
+	const uint8_t *ptr = buff;
+	ssize_t        ret;
+
+	while ( size )
+	{
+		if ( (ret = send(sock, ptr, size, MSG_NOSIGNAL)) < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			return -1;
+		}
+		ptr  += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+// on a cancel byte or hangup from the client, stop the request the way Ctrl-C stops it
+// in-process: with SIGINT to the thread running it, which sets the stop flag of the
+// run mode's handler and breaks it out of any wait
+static void *daemon_watch_main (void *arg)
+{
+	struct daemon_watch *dw = arg;
+	struct pollfd        pfd[2];
+	char                 byte;
+
+	pfd[0].fd     = dw->sock;
+	pfd[0].events = POLLIN;
+	pfd[1].fd     = dw->pipe[0];
+	pfd[1].events = POLLIN;
+	for ( ;; )
+	{
+		if ( poll(pfd, 2, -1) < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			LOG_ERROR("poll(): %s\n", strerror(errno));
+			break;
+		}
+		if ( pfd[1].revents )
+			break;
+		if ( !pfd[0].revents )
+			continue;
+
+		if ( (pfd[0].revents & POLLIN) && recv(dw->sock, &byte, 1, MSG_DONTWAIT) == 1 )
+			LOG_INFO("Request cancelled by the client\n");
+		else
+			LOG_WARN("Client went away, stopping its request\n");
+		daemon_cancel = 1;
+		pthread_kill(dw->main, SIGINT);
+		break;
+	}
+
+	return NULL;
+}
+
+static int daemon_watch_start (struct daemon_watch *dw, int sock)
+{
+	sigset_t  set, old;
+
+	daemon_cancel = 0;
+	dw->sock      = sock;
+	dw->main      = pthread_self();
+	if ( pipe(dw->pipe) )
+		return -1;
+
+	// signals for the daemon stay with the thread running the request
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+	errno = pthread_create(&dw->thread, NULL, daemon_watch_main, dw);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if ( errno )
+	{
+		close(dw->pipe[0]);
+		close(dw->pipe[1]);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void daemon_watch_stop (struct daemon_watch *dw)
+{
+	char  byte = 0;
+
+	if ( write(dw->pipe[1], &byte, 1) != 1 )
+		LOG_WARN("Failed to stop the client watch: %s\n", strerror(errno));
+	pthread_join(dw->thread, NULL);
+	close(dw->pipe[0]);
+	close(dw->pipe[1]);
+}
+
+
+static int daemon_addr (struct sockaddr_un *addr, const char *path)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if ( strlen(path) >= sizeof(addr->sun_path) )
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+
+// run one request with the client's stdio and working directory swapped in for ours
+static int daemon_request (int sock, dsa_daemon_fn func)
+{
+	struct daemon_watch  dw;
+	struct daemon_head   head;
+	struct msghdr        msg;
+	struct cmsghdr      *cmsg;
+	struct iovec         iov;
+	char                 ctrl[CMSG_SPACE(sizeof(int) * DAEMON_FDS)];
+	char                *buff = NULL;
+	char               **argv = NULL;
+	char                *ptr;
+	int                  fds[DAEMON_FDS] = { -1, -1, -1 };
+	int                  own[DAEMON_FDS] = { -1, -1, -1 };
+	int                 *got;
+	int                  cwd = -1;
+	int32_t              ret = 1;
+	unsigned             idx;
+	unsigned             num;
+	ssize_t              len;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base       = &head;
+	iov.iov_len        = sizeof(head);
+	msg.msg_iov        = &iov;
+	msg.msg_iovlen     = 1;
+	msg.msg_control    = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+
+	do
+		len = recvmsg(sock, &msg, MSG_WAITALL);
+	while ( len < 0 && errno == EINTR );
+	if ( len < 0 )
+	{
+		LOG_ERROR("recvmsg(): %s\n", strerror(errno));
+		return -1;
+	}
+
+	// every fd passed is ours to close, but only a single set of three is used
+	for ( cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg) )
+	{
+		if ( cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS )
+			continue;
+
+		got = (int *)CMSG_DATA(cmsg);
+		num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		if ( num == DAEMON_FDS && fds[0] < 0 )
+			memcpy(fds, got, sizeof(fds));
+		else
+			for ( idx = 0; idx < num; idx++ )
+				close(got[idx]);
+	}
+
+	// a truncated control message may have lost fds, so don't trust what came through
+	if ( msg.msg_flags & MSG_CTRUNC )
+	{
+		LOG_ERROR("Bad request header: control data truncated\n");
+		goto close;
+	}
+
+	if ( len != sizeof(head) || head.magic != DAEMON_MAGIC || head.version != DAEMON_VERSION ||
+	     head.size < 1 || head.size > DSA_DAEMON_MAX_REQ || head.argc < 1 ||
+	     head.argc > head.size || fds[0] < 0 || fds[1] < 0 || fds[2] < 0 )
+	{
+		LOG_ERROR("Bad request header\n");
+		goto close;
+	}
+
+	// unpack the strings, which must fill the payload exactly
+	if ( !(buff = malloc(head.size)) || !(argv = calloc(head.argc + 1, sizeof(char *))) ||
+	     daemon_recv_all(sock, buff, head.size) )
+		goto close;
+	if ( buff[head.size - 1] )
+	{
+		LOG_ERROR("Bad request payload\n");
+		goto close;
+	}
+	ptr = buff + strlen(buff) + 1;
+	for ( idx = 0; idx < head.argc; idx++ )
+	{
+		if ( ptr >= buff + head.size )
+		{
+			LOG_ERROR("Bad request payload\n");
+			goto close;
+		}
+		argv[idx] = ptr;
+		ptr += strlen(ptr) + 1;
+	}
+
+	LOG_DEBUG("Request in %s: %s, %u args\n", buff, argv[0], head.argc);
+
+	// swap in the client's environment
+	fflush(stdout);
+	fflush(stderr);
+	if ( (cwd = open(".", O_RDONLY|O_DIRECTORY)) < 0 )
+		goto close;
+	for ( idx = 0; idx < DAEMON_FDS; idx++ )
+		if ( (own[idx] = dup(idx)) < 0 || dup2(fds[idx], idx) < 0 )
+			goto restore;
+
+	if ( chdir(buff) )
+		fprintf(stderr, "%s: %s\n", buff, strerror(errno));
+	else if ( daemon_watch_start(&dw, sock) )
+	{
+		LOG_WARN("Failed to watch the client, request can't be cancelled: %s\n",
+		         strerror(errno));
+		ret = func(head.argc, argv);
+	}
+	else
+	{
+		ret = func(head.argc, argv);
+		daemon_watch_stop(&dw);
+	}
+
+restore:
+	fflush(stdout);
+	fflush(stderr);
+	clearerr(stdin);
+	for ( idx = 0; idx < DAEMON_FDS; idx++ )
+		if ( own[idx] > -1 )
+		{
+			dup2(own[idx], idx);
+			close(own[idx]);
+		}
+	if ( fchdir(cwd) )
+		LOG_WARN("Failed to restore working directory: %s\n", strerror(errno));
+	close(cwd);
+
+	LOG_DEBUG("Request done: %d\n", ret);
+	daemon_send_all(sock, &ret, sizeof(ret));
+
+close:
+	for ( idx = 0; idx < DAEMON_FDS; idx++ )
+		if ( fds[idx] > -1 )
+			close(fds[idx]);
+	free(argv);
+	free(buff);
+	return 0;
+}
+
+
+int dsa_daemon_serve (const char *path, dsa_daemon_fn func)
+{
+	struct sockaddr_un  addr;
+	struct sigaction    sa;
+	int                 sock;
+	int                 conn;
+
+	if ( daemon_addr(&addr, path) )
+	{
+		LOG_ERROR("%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	// no SA_RESTART, so accept() returns on a signal and the loop can exit
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = daemon_signal;
+	sigaction(SIGINT,  &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if ( (sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 )
+	{
+		LOG_ERROR("socket(): %s\n", strerror(errno));
+		return -1;
+	}
+
+	unlink(path);
+	if ( bind(sock, (struct sockaddr *)&addr, sizeof(addr)) || listen(sock, 4) )
+	{
+		LOG_ERROR("%s: %s\n", path, strerror(errno));
+		close(sock);
+		return -1;
+	}
+	chmod(path, 0660);
+
+	LOG_INFO("Listening on %s\n", path);
+	while ( !daemon_quit )
+	{
+		if ( (conn = accept(sock, NULL, NULL)) < 0 )
+		{
+			if ( errno == EINTR || errno == ECONNABORTED )
+				continue;
+			LOG_ERROR("accept(): %s\n", strerror(errno));
+			break;
+		}
+
+		daemon_request(conn, func);
+		close(conn);
+	}
+
+	LOG_INFO("Shutting down\n");
+	close(sock);
+	unlink(path);
+	return daemon_quit ? 0 : -1;
+}
+
+
+int dsa_daemon_client (const char *path, int argc, char **argv)
+{
+	struct sockaddr_un  addr;
+	struct daemon_head  head;
+	struct sigaction    sa, old;
+	struct msghdr       msg;
+	struct cmsghdr     *cmsg;
+	struct iovec        iov;
+	char                ctrl[CMSG_SPACE(sizeof(int) * DAEMON_FDS)];
+	int                 fds[DAEMON_FDS] = { 0, 1, 2 };
+	char               *buff;
+	char               *ptr;
+	int32_t             ret;
+	size_t              size;
+	int                 sock;
+	int                 idx;
+
+	if ( !(buff = malloc(DSA_DAEMON_MAX_REQ)) )
+		return -1;
+
+	// pack working directory and arguments
+	if ( !getcwd(buff, PATH_MAX) )
+	{
+		LOG_ERROR("getcwd(): %s\n", strerror(errno));
+		free(buff);
+		return -1;
+	}
+	ptr  = buff + strlen(buff) + 1;
+	size = ptr - buff;
+	for ( idx = 0; idx < argc; idx++ )
+	{
+		if ( size + strlen(argv[idx]) + 1 > DSA_DAEMON_MAX_REQ )
+		{
+			LOG_ERROR("Command line too long for daemon\n");
+			free(buff);
+			return -1;
+		}
+		strcpy(buff + size, argv[idx]);
+		size += strlen(argv[idx]) + 1;
+	}
+
+	if ( daemon_addr(&addr, path) || (sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 )
+	{
+		LOG_ERROR("%s: %s\n", path, strerror(errno));
+		free(buff);
+		return -1;
+	}
+	if ( connect(sock, (struct sockaddr *)&addr, sizeof(addr)) )
+	{
+		LOG_ERROR("%s: %s\n", path, strerror(errno));
+		close(sock);
+		free(buff);
+		return -1;
+	}
+
+	head.magic   = DAEMON_MAGIC;
+	head.version = DAEMON_VERSION;
+	head.argc    = argc;
+	head.size    = size;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(ctrl, 0, sizeof(ctrl));
+	iov.iov_base       = &head;
+	iov.iov_len        = sizeof(head);
+	msg.msg_iov        = &iov;
+	msg.msg_iovlen     = 1;
+	msg.msg_control    = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type  = SCM_RIGHTS;
+	cmsg->cmsg_len   = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	fflush(stdout);
+	fflush(stderr);
+	if ( sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(head) ||
+	     daemon_send_all(sock, buff, size) )
+	{
+		LOG_ERROR("%s: %s\n", path, strerror(errno));
+		close(sock);
+		free(buff);
+		return -1;
+	}
+	free(buff);
+
+	// Ctrl-C while waiting is passed on to stop the request; a second one kills the
+	// client as usual, and the daemon stops the request on seeing it go
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = client_signal;
+	sa.sa_flags   = SA_RESETHAND|SA_RESTART;
+	client_sock   = sock;
+	sigaction(SIGINT, &sa, &old);
+
+	if ( daemon_recv_all(sock, &ret, sizeof(ret)) )
+	{
+		LOG_ERROR("%s: %s\n", path, strerror(errno));
+		sigaction(SIGINT, &old, NULL);
+		close(sock);
+		return -1;
+	}
+
+	sigaction(SIGINT, &old, NULL);
+	close(sock);
+	return ret;
+}
@@ -0,0 +1,40 @@
+/** \file      dsa_daemon.h
+ *  \brief     interfaces for the resident daemon and its client
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at: 
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_DSA_DAEMON_H_
+#define _INCLUDE_DSA_DAEMON_H_
+
+// largest request accepted: working directory and argument strings
+#define DSA_DAEMON_MAX_REQ  65536
+
+
+// runs one request: argc/argv as given to the client, with the client's working
+// directory and stdin/stdout/stderr in effect.  Returns the client's exit status.
+typedef int (* dsa_daemon_fn) (int argc, char **argv);
+
+
+// listen on the Unix-domain socket at path and run requests one at a time with func,
+// until SIGINT or SIGTERM.  A request whose client cancels it or goes away gets a SIGINT
+// as it would in-process.  Returns 0 on clean shutdown, <0 on error.
+int dsa_daemon_serve (const char *path, dsa_daemon_fn func);
+
+// pass argc/argv, the working directory and stdio to the daemon at path, wait for it to
+// finish, and return its exit status; SIGINT meanwhile cancels the request.  Returns <0
+// if the daemon can't be reached.
+int dsa_daemon_client (const char *path, int argc, char **argv);
+
+#endif // _INCLUDE_DSA_DAEMON_H_
@@ -0,0 +1,406 @@
+/** \file      dsa_detect.c
+ *  \brief     implementation of RX capture with a pre-trigger window and event detection
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <math.h>
+#include <errno.h>
+
+#include <dma_streamer_mod.h>
+
+#include "dsa_main.h"
+#include "dsa_ioctl.h"
+#include "dsa_channel.h"
+#include "dsa_command.h"
+#include "dsa_common.h"
+#include "dsa_detect.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("detect", LOG_LEVEL_INFO);
+
+
+// 0dBFS is a full-scale complex tone: I^2 + Q^2 = 2048^2
+#define FULL_SCALE  (2048.0 * 2048.0)
+
+// The RX buffer is captured as a segment per trigger, with the mapping kept between
+// triggers.  The last pre samples are kept in hist, so an event near the start of a
+// segment still gets its pre-trigger window; note the window may then span the gap
+// between two triggers.
+struct detect_state
+{
+	const struct dsa_detect_opts *opts;
+	struct dsa_channel_xfer      *xfer;
+	int                           dev;
+	size_t                        width;   // bytes per sample period
+	size_t                        stride;  // uint16_t words per sample period
+	int                           chans;   // channel offsets to detect on, bitmask
+	double                        thresh;  // per-sample power threshold
+
+	uint8_t                      *hist;
+	size_t                        hist_fill;
+
+	struct dsa_channel_xfer       ev;      // event being collected, buffer pre + post
+	unsigned long long            ev_time; // ns of its first sample, 0 if not known
+	size_t                        post_left;
+	size_t                        holdoff_left;
+	int                           collecting;
+	unsigned long                 events;
+	unsigned long                 errs;    // events which failed to save
+};
+
+
+static volatile sig_atomic_t detect_stop;
+
+static void detect_sigint (int signum)
+{
+	detect_stop = 1;
+}
+
+
+int dsa_detect_parse (struct dsa_detect_opts *opts, char *arg)
+{
+	char *tok[5] = { NULL, NULL, NULL, NULL, NULL };
+	char *end;
+	int   num = 0;
+
+	memset(opts, 0, sizeof(*opts));
+	while ( num < 5 && (tok[num] = arg) )
+	{
+		if ( (arg = strchr(arg, ':')) )
+			*arg++ = '\0';
+		num++;
+	}
+	if ( num < 3 || arg )
+	{
+		LOG_ERROR("Detect needs dbfs:pre:post[:holdoff[:events]]\n");
+		return -1;
+	}
+
+	errno = 0;
+	opts->thresh = strtod(tok[0], &end);
+	if ( errno || *end || opts->thresh > 0 )
+	{
+		LOG_ERROR("Invalid threshold '%s', must be 0dBFS or less\n", tok[0]);
+		return -1;
+	}
+
+	opts->pre = size_dec(tok[1]);
+	if ( !(opts->post = size_dec(tok[2])) )
+	{
+		LOG_ERROR("Invalid post-trigger length '%s', minimum 1 sample\n", tok[2]);
+		return -1;
+	}
+
+	if ( tok[3] )
+		opts->holdoff = size_dec(tok[3]);
+
+	if ( tok[4] )
+	{
+		errno = 0;
+		opts->events = strtoul(tok[4], &end, 0);
+		if ( errno || *end )
+		{
+			LOG_ERROR("Invalid event count '%s'\n", tok[4]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+// mean power of num samples of one channel, from d with stride words per sample.  kept
+// to a simple integer loop the compiler can vectorize; 64 samples of 12-bit I and Q sum
+// to under 2^30.
+static uint32_t block_power (const uint16_t *d, size_t stride, size_t num)
+{
+	uint32_t  acc = 0;
+	int32_t   i, q;
+
+	for ( ; num; num--, d += stride )
+	{
+		i    = dsa_sample_value(d[0]);
+		q    = dsa_sample_value(d[1]);
+		acc += i * i + q * q;
+	}
+
+	return acc;
+}
+
+// returns the sample index of the first block from pos over the threshold, or len if
+// none; *dbfs is set to that block's power
+static size_t detect_scan (struct detect_state *st, const uint16_t *seg, size_t pos,
+                           size_t len, double *dbfs)
+{
+	uint32_t  pwr;
+	size_t    num;
+	int       c;
+
+	for ( ; pos < len; pos += num )
+	{
+		num = len - pos < DSA_DETECT_BLOCK ? len - pos : DSA_DETECT_BLOCK;
+		for ( c = 0; c < 2; c++ )
+			if ( st->chans & (1 << c) )
+			{
+				pwr = block_power(seg + pos * st->stride + c * 2, st->stride, num);
+				if ( pwr > st->thresh * num )
+				{
+					*dbfs = 10.0 * log10(pwr / (num * FULL_SCALE));
+					return pos;
+				}
+			}
+	}
+
+	return len;
+}
+
+static void event_append (struct detect_state *st, const void *src, size_t num)
+{
+	memcpy((uint8_t *)st->ev.smp + st->ev.len * st->width, src, num * st->width);
+	st->ev.len += num;
+}
+
+static int event_save (struct detect_state *st)
+{
+	struct dsa_channel_event  evt;
+	int                       ret = 0;
+	int                       c;
+
+	memset(&evt, 0, sizeof(evt));
+	evt.rx[st->dev] = &st->ev;
+	for ( c = 0; c < 2; c++ )
+		if ( st->xfer->snk[c] &&
+		     !(st->ev.snk[c] = dsa_channel_sxx_number(st->xfer->snk[c], st->events,
+		                                              st->ev_time)) )
+			ret = -1;
+
+	if ( !ret && (ret = dsa_channel_save(&evt)) < 0 )
+		LOG_ERROR("Failed to save event %lu: %s\n", st->events, strerror(errno));
+
+	for ( c = 0; c < 2; c++ )
+	{
+		free(st->ev.snk[c]);
+		st->ev.snk[c] = NULL;
+	}
+
+	return ret;
+}
+
+// process one captured segment; returns 1 when the event limit is reached
+static int detect_segment (struct detect_state *st, unsigned long seg_num,
+                           const struct dsm_xfer_stats *stats)
+{
+	const uint8_t *seg = (const uint8_t *)st->xfer->smp;
+	size_t         len = st->xfer->len;
+	size_t         pre = st->opts->pre;
+	size_t         pos = 0;
+	size_t         num;
+	size_t         trg;
+	double         dbfs;
+	double         ofs;
+	unsigned long  rate = dsa_active_rates[st->dev * 2 + 1];
+
+	while ( pos < len )
+	{
+		// collect post-trigger samples, then save
+		if ( st->collecting )
+		{
+			num = len - pos < st->post_left ? len - pos : st->post_left;
+			event_append(st, seg + pos * st->width, num);
+			st->post_left -= num;
+			pos           += num;
+			if ( st->post_left )
+				continue;
+
+			if ( event_save(st) )
+				st->errs++;
+			st->collecting   = 0;
+			st->holdoff_left = st->opts->holdoff;
+			if ( ++st->events == st->opts->events )
+				return 1;
+			continue;
+		}
+
+		// skip the holdoff after an event
+		if ( st->holdoff_left )
+		{
+			num = len - pos < st->holdoff_left ? len - pos : st->holdoff_left;
+			st->holdoff_left -= num;
+			pos              += num;
+			continue;
+		}
+
+		if ( (trg = detect_scan(st, (const uint16_t *)seg, pos, len, &dbfs)) >= len )
+			break;
+
+		// pre-trigger window: from this segment first, the rest from the history
+		st->ev.len = 0;
+		num = trg < pre ? trg : pre;
+		if ( pre > num )
+		{
+			size_t from = pre - num < st->hist_fill ? pre - num : st->hist_fill;
+			event_append(st, st->hist + (st->hist_fill - from) * st->width, from);
+		}
+		event_append(st, seg + (trg - num) * st->width, num);
+
+		// timestamp from the segment's start time, if the sample rate is known
+		ofs = rate ? (double)trg / rate : 0.0;
+		LOG_INFO("Event %lu: segment %lu sample %zu, %.9f, %.1f dBFS, %zu pre\n",
+		         st->events, seg_num, trg,
+		         stats->start.tv_sec + stats->start.tv_nsec / 1e9 + ofs, dbfs, st->ev.len);
+
+		st->ev_time = 0;
+		if ( rate && (stats->start.tv_sec || stats->start.tv_nsec) )
+			st->ev_time = stats->start.tv_sec * 1000000000ULL + stats->start.tv_nsec +
+			              ((long long)trg - (long long)st->ev.len) * 1000000000LL / rate;
+
+		st->collecting = 1;
+		st->post_left  = st->opts->post;
+		pos            = trg;
+	}
+
+	// keep the last pre samples for the next segment
+	if ( len >= pre )
+	{
+		memcpy(st->hist, seg + (len - pre) * st->width, pre * st->width);
+		st->hist_fill = pre;
+	}
+	else
+	{
+		num = st->hist_fill + len > pre ? pre - len : st->hist_fill;
+		memmove(st->hist, st->hist + (st->hist_fill - num) * st->width, num * st->width);
+		memcpy(st->hist + num * st->width, seg, len * st->width);
+		st->hist_fill = num + len;
+	}
+
+	return 0;
+}
+
+
+int dsa_detect_run (struct dsa_channel_event *evt, const struct dsa_trigger_opts *opts)
+{
+	struct dsa_trigger_opts  seg_opts = *opts;
+	struct dsm_user_stats    sb;
+	struct detect_state      st;
+	struct sigaction         sa, old;
+	unsigned long            segs = opts->reps > 1 ? opts->reps : 0;
+	unsigned long            num;
+	int                      ret = 0;
+
+	memset(&st, 0, sizeof(st));
+	st.opts = &opts->det;
+
+	if ( evt->tx[0] || evt->tx[1] || (evt->rx[0] && evt->rx[1]) || (!evt->rx[0] && !evt->rx[1]) )
+	{
+		LOG_ERROR("Detection needs RX buffers on one device, and no TX\n");
+		errno = EINVAL;
+		return -1;
+	}
+	st.dev  = evt->rx[1] ? 1 : 0;
+	st.xfer = evt->rx[st.dev];
+
+	if ( st.xfer->pack )
+	{
+		st.chans  = 1;
+		st.stride = 2;
+	}
+	else
+	{
+		st.chans  = (st.xfer->snk[0] ? 1 : 0) | (st.xfer->snk[1] ? 2 : 0);
+		st.stride = 4;
+	}
+	if ( !st.xfer->snk[0] && !st.xfer->snk[1] )
+	{
+		LOG_ERROR("Detection needs a file to save events to\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	st.width  = dsa_channel_width(st.xfer);
+	st.thresh = FULL_SCALE * pow(10.0, opts->det.thresh / 10.0);
+	st.ev     = *st.xfer;
+	st.ev.snk[0] = st.ev.snk[1] = NULL;
+	st.ev.src[0] = st.ev.src[1] = NULL;
+
+	st.hist  = malloc(opts->det.pre * st.width + 1);
+	st.ev.smp = malloc((opts->det.pre + opts->det.post) * st.width);
+	if ( !st.hist || !st.ev.smp )
+	{
+		free(st.hist);
+		free(st.ev.smp);
+		return -1;
+	}
+
+	LOG_INFO("Detecting at %.1f dBFS on AD%d RX, %zu pre, %zu post, %zu holdoff\n",
+	         opts->det.thresh, st.dev + 1, opts->det.pre, opts->det.post,
+	         opts->det.holdoff);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = detect_sigint;
+	detect_stop   = 0;
+	sigaction(SIGINT, &sa, &old);
+
+	// stats per segment would drown the event reports; a timed start applies to the
+	// first segment only
+	seg_opts.stats = 0;
+	seg_opts.reps  = 1;
+	for ( num = 0; !detect_stop && (!segs || num < segs); num++ )
+	{
+		if ( dsa_command_trigger_run(evt, &seg_opts) < 0 )
+		{
+			ret = -1;
+			break;
+		}
+		seg_opts.timed = 0;
+
+		memset(&sb, 0, sizeof(sb));
+		dsa_ioctl_get_stats(&sb);
+		if ( detect_segment(&st, num, st.dev ? &sb.adi2.rx : &sb.adi1.rx) )
+		{
+			num++;
+			break;
+		}
+	}
+
+	sigaction(SIGINT, &old, NULL);
+
+	// an event cut short by the end of the run is saved with what it has
+	if ( st.collecting )
+	{
+		if ( event_save(&st) )
+			st.errs++;
+		st.events++;
+	}
+
+	printf("Detect: %lu segments, %lu events, %lu failed to save\n", num, st.events,
+	       st.errs);
+
+	free(st.hist);
+	free(st.ev.smp);
+
+	// the failed saves are logged as they happen; the run fails if any did
+	if ( ret >= 0 && st.errs )
+	{
+		LOG_ERROR("Failed to save %lu of %lu events\n", st.errs, st.events);
+		errno = EIO;
+		return -1;
+	}
+
+	return ret < 0 ? ret : (int)st.events;
+}
@@ -0,0 +1,50 @@
+/** \file      dsa_detect.h
+ *  \brief     interfaces for RX capture with a pre-trigger window and event detection
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at: 
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_DSA_DETECT_H_
+#define _INCLUDE_DSA_DETECT_H_
+#include <stddef.h>
+
+// samples per detector block: the trigger is the start of the first block whose mean
+// power is over the threshold
+#define DSA_DETECT_BLOCK  64
+
+
+struct dsa_detect_opts
+{
+	double         thresh;   // dBFS, mean power of a block vs a full-scale tone
+	size_t         pre;      // samples saved from before the trigger
+	size_t         post;     // samples saved from the trigger on
+	size_t         holdoff;  // samples after an event's end before the next may trigger
+	unsigned long  events;   // stop after this many events, 0 for no limit
+};
+
+struct dsa_channel_event;
+struct dsa_trigger_opts;
+
+
+// parse "dbfs:pre:post[:holdoff[:events]]" into opts, returns 0 on success, <0 on error
+int dsa_detect_parse (struct dsa_detect_opts *opts, char *arg);
+
+// capture RX segments into evt repeatedly until the event count, reps segments, or
+// SIGINT, saving pre/post-trigger windows around each detected event to the sinks of evt
+// with an event number added to the filenames.  evt must be loaded and mapped, with RX
+// buffers on a single device and no TX.  Returns the number of events, or <0 on error,
+// including any event that failed to save.
+int dsa_detect_run (struct dsa_channel_event *evt, const struct dsa_trigger_opts *opts);
+
+#endif // _INCLUDE_DSA_DETECT_H_
@@ -0,0 +1,330 @@
+/** \file      dsa_fft.c
+ *  \brief     implementation of the complex FFT used by spectrum outputs
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FFT_NEON 1
+#endif
+
+#include "dsa_fft.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("fft", LOG_LEVEL_INFO);
+
+
+// Iterative decimation-in-time after a bit-reversal permutation.  Each radix-4 stage does
+// the work of two radix-2 stages, taking sub-transforms of size h to 4h: with V the 4h-th
+// root of unity for butterfly k, and W = V^2,
+//   b0 = a0 + W a1   b1 = a0 - W a1   b2 = a2 + W a3   b3 = a2 - W a3
+//   y0 = b0 + V b2   y2 = b0 - V b2   y1 = b1 - jV b3  y3 = b1 + jV b3
+// An odd log2 size starts with one radix-2 stage.
+
+struct dsa_fft *dsa_fft_init (size_t size)
+{
+	struct dsa_fft *fft;
+	unsigned        log2;
+	size_t          h, k, i;
+	uint32_t        r;
+	float          *tw;
+	double          a;
+
+	for ( log2 = 0; ((size_t)1 << log2) < size; log2++ ) ;
+	if ( size < DSA_FFT_MIN || size > DSA_FFT_MAX || ((size_t)1 << log2) != size )
+	{
+		LOG_ERROR("Invalid FFT size %zu: a power of 2 from %d to %d\n", size,
+		          DSA_FFT_MIN, DSA_FFT_MAX);
+		return NULL;
+	}
+
+	if ( !(fft = calloc(1, sizeof(*fft))) )
+		return NULL;
+	fft->size = size;
+	fft->log2 = log2;
+
+	// the radix-4 stages' twiddles total less than size * 4 / 3 complex pairs
+	if ( !(fft->rev = malloc(size * sizeof(uint32_t))) ||
+	     !(fft->tw  = malloc(size * 4 * sizeof(float))) )
+	{
+		dsa_fft_free(fft);
+		return NULL;
+	}
+
+	for ( i = 0; i < size; i++ )
+	{
+		for ( r = 0, k = 0; k < log2; k++ )
+			r |= ((i >> k) & 1) << (log2 - 1 - k);
+		fft->rev[i] = r;
+	}
+
+	tw = fft->tw;
+	for ( h = log2 & 1 ? 2 : 1; h < size; h *= 4 )
+	{
+		for ( k = 0; k < h; k++ )
+		{
+			a = -2.0 * M_PI * k / (4 * h);
+			tw[k]         = cos(a);
+			tw[k + h]     = sin(a);
+			tw[k + 2 * h] = cos(2 * a);
+			tw[k + 3 * h] = sin(2 * a);
+		}
+		tw += 4 * h;
+	}
+
+	return fft;
+}
+
+void dsa_fft_free (struct dsa_fft *fft)
+{
+	if ( !fft )
+		return;
+
+	free(fft->rev);
+	free(fft->tw);
+	free(fft);
+}
+
+
+static void fft_reverse (const struct dsa_fft *fft, float *x)
+{
+	size_t  i, j;
+	float   t;
+
+	for ( i = 0; i < fft->size; i++ )
+		if ( (j = fft->rev[i]) > i )
+		{
+			t = x[2 * i];     x[2 * i]     = x[2 * j];     x[2 * j]     = t;
+			t = x[2 * i + 1]; x[2 * i + 1] = x[2 * j + 1]; x[2 * j + 1] = t;
+		}
+}
+
+static void fft_stage2 (float *x, size_t n)
+{
+	size_t  i;
+	float   r, m;
+
+	for ( i = 0; i < n * 2; i += 4 )
+	{
+		r = x[i];     x[i]     = r + x[i + 2]; x[i + 2] = r - x[i + 2];
+		m = x[i + 1]; x[i + 1] = m + x[i + 3]; x[i + 3] = m - x[i + 3];
+	}
+}
+
+static void fft_stage4_ref (float *x, size_t n, size_t h, const float *tw)
+{
+	const float *vr = tw, *vi = tw + h, *wr = tw + 2 * h, *wi = tw + 3 * h;
+	size_t       base, k;
+	float       *p0, *p1, *p2, *p3;
+	float        t1r, t1i, t3r, t3i;
+	float        b0r, b0i, b1r, b1i, b2r, b2i, b3r, b3i;
+	float        u2r, u2i, u3r, u3i;
+
+	for ( base = 0; base < n; base += 4 * h )
+		for ( k = 0; k < h; k++ )
+		{
+			p0 = x + 2 * (base + k);
+			p1 = p0 + 2 * h;
+			p2 = p1 + 2 * h;
+			p3 = p2 + 2 * h;
+
+			t1r = wr[k] * p1[0] - wi[k] * p1[1];
+			t1i = wr[k] * p1[1] + wi[k] * p1[0];
+			t3r = wr[k] * p3[0] - wi[k] * p3[1];
+			t3i = wr[k] * p3[1] + wi[k] * p3[0];
+
+			b0r = p0[0] + t1r;  b0i = p0[1] + t1i;
+			b1r = p0[0] - t1r;  b1i = p0[1] - t1i;
+			b2r = p2[0] + t3r;  b2i = p2[1] + t3i;
+			b3r = p2[0] - t3r;  b3i = p2[1] - t3i;
+
+			u2r = vr[k] * b2r - vi[k] * b2i;
+			u2i = vr[k] * b2i + vi[k] * b2r;
+			u3r = vr[k] * b3r - vi[k] * b3i;
+			u3i = vr[k] * b3i + vi[k] * b3r;
+
+			p0[0] = b0r + u2r;  p0[1] = b0i + u2i;
+			p2[0] = b0r - u2r;  p2[1] = b0i - u2i;
+			p1[0] = b1r + u3i;  p1[1] = b1i - u3r;
+			p3[0] = b1r - u3i;  p3[1] = b1i + u3r;
+		}
+}
+
+#ifdef FFT_NEON
+static inline float32x4x2_t fft_cmul (float32x4x2_t a, float32x4_t br, float32x4_t bi)
+{
+	float32x4x2_t  r;
+
+	r.val[0] = vmlsq_f32(vmulq_f32(a.val[0], br), a.val[1], bi);
+	r.val[1] = vmlaq_f32(vmulq_f32(a.val[1], br), a.val[0], bi);
+	return r;
+}
+
+// four butterflies at a time, for stages with h a multiple of 4
+static void fft_stage4_neon (float *x, size_t n, size_t h, const float *tw)
+{
+	float32x4x2_t  a0, a1, a2, a3, t1, t3, b0, b1, b2, b3, u2, u3;
+	float32x4_t    vr, vi, wr, wi;
+	size_t         base, k;
+	float         *p0;
+
+	for ( base = 0; base < n; base += 4 * h )
+		for ( k = 0; k < h; k += 4 )
+		{
+			p0 = x + 2 * (base + k);
+			vr = vld1q_f32(tw + k);
+			vi = vld1q_f32(tw + h + k);
+			wr = vld1q_f32(tw + 2 * h + k);
+			wi = vld1q_f32(tw + 3 * h + k);
+
+			a0 = vld2q_f32(p0);
+			a1 = vld2q_f32(p0 + 2 * h);
+			a2 = vld2q_f32(p0 + 4 * h);
+			a3 = vld2q_f32(p0 + 6 * h);
+
+			t1 = fft_cmul(a1, wr, wi);
+			t3 = fft_cmul(a3, wr, wi);
+			b0.val[0] = vaddq_f32(a0.val[0], t1.val[0]);
+			b0.val[1] = vaddq_f32(a0.val[1], t1.val[1]);
+			b1.val[0] = vsubq_f32(a0.val[0], t1.val[0]);
+			b1.val[1] = vsubq_f32(a0.val[1], t1.val[1]);
+			b2.val[0] = vaddq_f32(a2.val[0], t3.val[0]);
+			b2.val[1] = vaddq_f32(a2.val[1], t3.val[1]);
+			b3.val[0] = vsubq_f32(a2.val[0], t3.val[0]);
+			b3.val[1] = vsubq_f32(a2.val[1], t3.val[1]);
+
+			u2 = fft_cmul(b2, vr, vi);
+			u3 = fft_cmul(b3, vr, vi);
+			a0.val[0] = vaddq_f32(b0.val[0], u2.val[0]);
+			a0.val[1] = vaddq_f32(b0.val[1], u2.val[1]);
+			a2.val[0] = vsubq_f32(b0.val[0], u2.val[0]);
+			a2.val[1] = vsubq_f32(b0.val[1], u2.val[1]);
+			a1.val[0] = vaddq_f32(b1.val[0], u3.val[1]);
+			a1.val[1] = vsubq_f32(b1.val[1], u3.val[0]);
+			a3.val[0] = vsubq_f32(b1.val[0], u3.val[1]);
+			a3.val[1] = vaddq_f32(b1.val[1], u3.val[0]);
+
+			vst2q_f32(p0,         a0);
+			vst2q_f32(p0 + 2 * h, a1);
+			vst2q_f32(p0 + 4 * h, a2);
+			vst2q_f32(p0 + 6 * h, a3);
+		}
+}
+#endif
+
+static void fft_run (const struct dsa_fft *fft, float *data, int neon)
+{
+	const float *tw = fft->tw;
+	size_t       h;
+
+	fft_reverse(fft, data);
+
+	h = 1;
+	if ( fft->log2 & 1 )
+	{
+		fft_stage2(data, fft->size);
+		h = 2;
+	}
+
+	for ( ; h < fft->size; tw += 4 * h, h *= 4 )
+	{
+#ifdef FFT_NEON
+		if ( neon && !(h & 3) )
+		{
+			fft_stage4_neon(data, fft->size, h, tw);
+			continue;
+		}
+#endif
+		fft_stage4_ref(data, fft->size, h, tw);
+	}
+}
+
+void dsa_fft_run (const struct dsa_fft *fft, float *data)
+{
+	fft_run(fft, data, 1);
+}
+
+
+#ifdef FFT_TEST
+// Check of each size against a direct DFT, and of the NEON stages against the reference
+// ones, which is only a real check when built for NEON: a ramp through the transform,
+// with errors allowed for float rounding relative to the largest output.
+int main (int argc, char **argv)
+{
+	struct dsa_fft *fft;
+	double          re, im, a;
+	float          *x;
+	float           peak, err;
+	size_t          size, n, k;
+
+	log_dupe(stdout);
+	setbuf(stdout, NULL);
+
+	for ( size = DSA_FFT_MIN; size <= DSA_FFT_MAX; size *= 2 )
+	{
+		if ( !(fft = dsa_fft_init(size)) || !(x = malloc(size * 4 * sizeof(float))) )
+		{
+			printf("FAIL: no plan for %zu\n", size);
+			return 1;
+		}
+
+		for ( n = 0; n < size * 2; n++ )
+			x[n] = x[size * 2 + n] = (float)((int)((n * 37) % 4096) - 2048) / 2048.0;
+
+		// the direct DFT is slow, so only the smaller sizes get one
+		if ( size <= 1024 )
+			for ( k = 0; k < size; k++ )
+			{
+				for ( re = im = 0.0, n = 0; n < size; n++ )
+				{
+					a   = -2.0 * M_PI * ((n * k) % size) / size;
+					re += x[n * 2] * cos(a) - x[n * 2 + 1] * sin(a);
+					im += x[n * 2] * sin(a) + x[n * 2 + 1] * cos(a);
+				}
+				x[size * 2 + k * 2]     = re;
+				x[size * 2 + k * 2 + 1] = im;
+			}
+		else
+			fft_run(fft, x + size * 2, 0);
+
+		fft_run(fft, x, 1);
+		for ( peak = err = 0.0, n = 0; n < size * 2; n++ )
+		{
+			if ( fabsf(x[size * 2 + n]) > peak )
+				peak = fabsf(x[size * 2 + n]);
+			if ( fabsf(x[n] - x[size * 2 + n]) > err )
+				err = fabsf(x[n] - x[size * 2 + n]);
+		}
+		printf("%5zu: error %g of peak %g against the %s\n", size, err, peak,
+		       size <= 1024 ? "DFT" : "reference stages");
+
+		free(x);
+		dsa_fft_free(fft);
+		if ( err > peak * 1e-5 )
+		{
+			printf("FAIL\n");
+			return 1;
+		}
+	}
+
+	printf("PASS\n");
+	return 0;
+}
+#endif
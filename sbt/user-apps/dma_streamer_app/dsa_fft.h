@@ -0,0 +1,49 @@
+/** \file      dsa_fft.h
+ *  \brief     interfaces for the complex FFT used by spectrum outputs
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_DSA_FFT_H_
+#define _INCLUDE_DSA_FFT_H_
+#include <stdint.h>
+#include <stddef.h>
+
+
+#define DSA_FFT_MIN  4
+#define DSA_FFT_MAX  65536
+
+
+// a plan for one FFT size: the bit-reversal permutation, and the twiddles for each
+// radix-4 stage laid out as four arrays of the stage's quarter size - V real, V imag,
+// V^2 real, V^2 imag - so a vector of consecutive butterflies loads them directly
+struct dsa_fft
+{
+	size_t     size;
+	unsigned   log2;
+	uint32_t  *rev;
+	float     *tw;
+};
+
+
+// set up a plan for a power-of-two size between DSA_FFT_MIN and DSA_FFT_MAX; returns
+// NULL on error
+struct dsa_fft *dsa_fft_init (size_t size);
+
+// forward transform in place: data is size complex values as interleaved re, im floats
+void dsa_fft_run (const struct dsa_fft *fft, float *data);
+
+void dsa_fft_free (struct dsa_fft *fft);
+
+#endif // _INCLUDE_DSA_FFT_H_
@@ -0,0 +1,371 @@
+/** \file      dsa_fir.c
+ *  \brief     implementation of the decimating FIR applied to RX data before saving
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <errno.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FIR_NEON 1
+#endif
+
+#include "dsa_sample.h"
+#include "dsa_channel.h"
+#include "dsa_fir.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("fir", LOG_LEVEL_INFO);
+
+
+#define FIR_ONE  32768.0
+
+
+// the last filter set up, reused while the spec is unchanged
+static struct dsa_fir *fir_last = NULL;
+
+
+int32_t dsa_fir_dot_ref (const int16_t *x, const int16_t *h, size_t num)
+{
+	int32_t  acc = 0;
+
+	while ( num-- )
+		acc += *x++ * *h++;
+
+	return acc;
+}
+
+#ifdef FIR_NEON
+// num is a multiple of DSA_FIR_ALIGN
+static int32_t fir_dot_neon (const int16_t *x, const int16_t *h, size_t num)
+{
+	int32x4_t  acc = vdupq_n_s32(0);
+	int64x2_t  sum;
+	int16x8_t  vx, vh;
+
+	for ( ; num; num -= 8, x += 8, h += 8 )
+	{
+		vx  = vld1q_s16(x);
+		vh  = vld1q_s16(h);
+		acc = vmlal_s16(acc, vget_low_s16(vx),  vget_low_s16(vh));
+		acc = vmlal_s16(acc, vget_high_s16(vx), vget_high_s16(vh));
+	}
+
+	sum = vpaddlq_s32(acc);
+	return (int32_t)(vgetq_lane_s64(sum, 0) + vgetq_lane_s64(sum, 1));
+}
+#define fir_dot fir_dot_neon
+#else
+#define fir_dot dsa_fir_dot_ref
+#endif
+
+int32_t dsa_fir_dot (const int16_t *x, const int16_t *h, size_t num)
+{
+	return fir_dot(x, h, num);
+}
+
+
+// windowed-sinc lowpass with the cutoff just inside the decimated Nyquist, Blackman
+// window, unity gain at DC
+static void fir_design (double *h, size_t taps, unsigned factor)
+{
+	double  fc  = 0.45 / factor;
+	double  mid = (taps - 1) / 2.0;
+	double  sum = 0.0;
+	double  t, w;
+	size_t  n;
+
+	for ( n = 0; n < taps; n++ )
+	{
+		t = n - mid;
+		w = taps > 1 ? 0.42 - 0.5  * cos(2 * M_PI * n / (taps - 1))
+		                    + 0.08 * cos(4 * M_PI * n / (taps - 1)) : 1.0;
+		h[n] = (t == 0.0 ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t)) * w;
+		sum += h[n];
+	}
+
+	for ( n = 0; n < taps; n++ )
+		h[n] /= sum;
+}
+
+// whitespace- or comma-separated coefficients, '#' to end of line is a comment;
+// returns the number read, or <0 on error
+static long fir_read (double *h, const char *path)
+{
+	FILE   *fp;
+	char    buff[1024];
+	char   *ptr, *end;
+	long    num = 0;
+
+	if ( !(fp = fopen(path, "r")) )
+	{
+		LOG_ERROR("%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while ( fgets(buff, sizeof(buff), fp) )
+	{
+		if ( (ptr = strchr(buff, '#')) )
+			*ptr = '\0';
+
+		for ( ptr = buff; *ptr; ptr = end )
+		{
+			while ( isspace(*ptr) || *ptr == ',' )
+				ptr++;
+			if ( !*ptr )
+				break;
+
+			if ( num >= DSA_FIR_MAX )
+			{
+				LOG_ERROR("%s: more than %d taps\n", path, DSA_FIR_MAX);
+				goto fail;
+			}
+
+			h[num] = strtod(ptr, &end);
+			if ( end == ptr )
+			{
+				LOG_ERROR("%s: invalid coefficient '%s'\n", path, ptr);
+				goto fail;
+			}
+			num++;
+		}
+	}
+
+	fclose(fp);
+	return num;
+
+fail:
+	fclose(fp);
+	return -1;
+}
+
+static void fir_free (struct dsa_fir *fir)
+{
+	if ( !fir )
+		return;
+
+	free(fir->spec);
+	free(fir->coef);
+	free(fir);
+}
+
+const struct dsa_fir *dsa_fir_get (const char *spec)
+{
+	struct dsa_fir *fir;
+	double         *h;
+	const char     *arg;
+	char           *end;
+	unsigned long   factor;
+	long            taps;
+	long            q;
+	size_t          n;
+
+	if ( fir_last && !strcmp(fir_last->spec, spec) )
+		return fir_last;
+
+	errno  = 0;
+	factor = strtoul(spec, &end, 0);
+	if ( errno || factor < 1 || factor > DSA_FIR_MAX || (*end && *end != ':') )
+	{
+		LOG_ERROR("Invalid decimation factor in '%s'\n", spec);
+		return NULL;
+	}
+
+	if ( !(fir = calloc(1, sizeof(*fir))) || !(fir->spec = strdup(spec)) ||
+	     !(h = malloc(DSA_FIR_MAX * sizeof(double))) )
+	{
+		fir_free(fir);
+		return NULL;
+	}
+	fir->factor = factor;
+
+	// taps may be given as a count for the default design or a coefficient file
+	arg  = *end ? end + 1 : "";
+	taps = factor * 16 + 1;
+	if ( *arg && isdigit(*arg) )
+	{
+		taps = strtol(arg, &end, 0);
+		if ( *end )
+			taps = fir_read(h, arg);
+		else if ( taps < 1 || taps > DSA_FIR_MAX )
+		{
+			LOG_ERROR("Invalid tap count '%s', 1 to %d allowed\n", arg, DSA_FIR_MAX);
+			taps = -1;
+		}
+		else
+			fir_design(h, taps, factor);
+	}
+	else if ( *arg )
+		taps = fir_read(h, arg);
+	else
+		fir_design(h, taps, factor);
+
+	if ( taps < 1 )
+	{
+		if ( !taps )
+			LOG_ERROR("%s: no coefficients\n", arg);
+		goto fail;
+	}
+	if ( taps > DSA_FIR_MAX )
+		taps = DSA_FIR_MAX;
+
+	fir->taps = taps;
+	fir->pad  = (taps + DSA_FIR_ALIGN - 1) & ~(DSA_FIR_ALIGN - 1);
+	if ( !(fir->coef = calloc(fir->pad, sizeof(int16_t))) )
+		goto fail;
+
+	// Q15, time-reversed so outputs are a dot product with the input in order
+	for ( n = 0; n < fir->taps; n++ )
+	{
+		q = lround(h[n] * FIR_ONE);
+		if ( q < INT16_MIN || q > INT16_MAX )
+		{
+			LOG_ERROR("Coefficient %zu (%f) out of range, must be within +/-1.0\n", n, h[n]);
+			goto fail;
+		}
+		fir->coef[fir->taps - 1 - n] = q;
+	}
+	free(h);
+
+	LOG_INFO("Decimating RX by %u with %zu taps\n", fir->factor, fir->taps);
+	fir_free(fir_last);
+	fir_last = fir;
+	return fir;
+
+fail:
+	free(h);
+	fir_free(fir);
+	return NULL;
+}
+
+
+int dsa_fir_run (const struct dsa_fir *fir, struct dsa_channel_xfer *dst,
+                 const struct dsa_channel_xfer *src, int lanes)
+{
+	const uint16_t *in     = (const uint16_t *)src->smp;
+	uint16_t       *out    = (uint16_t *)dst->smp;
+	size_t          stride = dsa_channel_width(src) / sizeof(uint16_t);
+	size_t          hist   = fir->taps - 1;
+	size_t          size   = hist + DSA_FIR_BLOCK * fir->factor + DSA_FIR_ALIGN;
+	size_t          outs   = src->len / fir->factor;
+	size_t          beg, num, i;
+	int16_t        *work;
+	int16_t        *w;
+	int32_t         acc;
+	int             lane;
+	int             idx;
+
+	dst->len = outs;
+	if ( !(work = calloc(size * stride, sizeof(int16_t))) )
+		return -1;
+
+	// each lane has a work buffer holding the last taps - 1 inputs, zero at the start,
+	// followed by the block's inputs.  Only the kept outputs are computed, each from the
+	// inputs up to the last of its factor inputs.
+	for ( beg = 0; beg < outs; beg += num )
+	{
+		num = outs - beg < DSA_FIR_BLOCK ? outs - beg : DSA_FIR_BLOCK;
+		for ( lane = 0, w = work; lane < stride; lane++, w += size )
+			if ( lanes & (1 << lane) )
+			{
+				idx = beg * fir->factor * stride + lane;
+				for ( i = 0; i < num * fir->factor; i++, idx += stride )
+					w[hist + i] = dsa_sample_value(in[idx]);
+
+				idx = beg * stride + lane;
+				for ( i = 0; i < num; i++, idx += stride )
+				{
+					acc = fir_dot(w + i * fir->factor + fir->factor - 1, fir->coef, fir->pad);
+					acc = (acc + (1 << 14)) >> 15;
+					if ( acc > 2047 )
+						acc = 2047;
+					else if ( acc < -2048 )
+						acc = -2048;
+					out[idx] = (uint16_t)acc;
+				}
+
+				memmove(w, w + num * fir->factor, hist * sizeof(int16_t));
+			}
+	}
+
+	free(work);
+	return 0;
+}
+
+
+#ifdef FIR_TEST
+// Check of the inner product against the scalar reference, which is only a real check
+// when built for NEON, and of the designs' unity gain at DC, on short and long filters
+// with a ramp, full-scale alternating, and random inputs.
+int main (int argc, char **argv)
+{
+	static const char    *specs[] = { "2", "4:31", "16:4096" };
+	const struct dsa_fir *fir;
+	int16_t               x[DSA_FIR_MAX + DSA_FIR_ALIGN];
+	int32_t               got;
+	int32_t               ref;
+	size_t                n;
+	int                   s, k;
+
+	log_dupe(stdout);
+	setbuf(stdout, NULL);
+
+	for ( s = 0; s < sizeof(specs) / sizeof(specs[0]); s++ )
+	{
+		if ( !(fir = dsa_fir_get(specs[s])) )
+		{
+			printf("FAIL: filter '%s' not set up\n", specs[s]);
+			return 1;
+		}
+
+		for ( k = 0; k < 3; k++ )
+		{
+			for ( n = 0; n < fir->pad; n++ )
+				switch ( k )
+				{
+					case 0:  x[n] = (int16_t)((n * 37) % 4096) - 2048; break;
+					case 1:  x[n] = n & 1 ? 2047 : -2048;              break;
+					default: x[n] = (rand() % 4096) - 2048;            break;
+				}
+
+			got = dsa_fir_dot(x, fir->coef, fir->pad);
+			ref = dsa_fir_dot_ref(x, fir->coef, fir->pad);
+			printf("'%s' input %d: %ld, reference %ld\n", specs[s], k, (long)got, (long)ref);
+			if ( got != ref )
+			{
+				printf("FAIL: inner product disagrees with the reference\n");
+				return 1;
+			}
+		}
+
+		for ( n = 0; n < fir->pad; n++ )
+			x[n] = 1000;
+		got = (dsa_fir_dot(x, fir->coef, fir->pad) + (1 << 14)) >> 15;
+		if ( got < 999 || got > 1001 )
+		{
+			printf("FAIL: '%s' DC gain %ld/1000\n", specs[s], (long)got);
+			return 1;
+		}
+	}
+
+	printf("PASS\n");
+	return 0;
+}
+#endif
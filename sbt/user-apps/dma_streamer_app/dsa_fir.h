@@ -0,0 +1,65 @@
+/** \file      dsa_fir.h
+ *  \brief     interfaces for the decimating FIR applied to RX data before saving
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_DSA_FIR_H_
+#define _INCLUDE_DSA_FIR_H_
+#include <stdint.h>
+#include <stddef.h>
+
+#include "dsa_channel.h"
+
+
+#define DSA_FIR_MAX    4096  // taps
+#define DSA_FIR_ALIGN  8     // taps are zero-padded to a multiple of this
+#define DSA_FIR_BLOCK  4096  // output samples filtered per block
+
+
+// a filter set up from a "factor[:taps|file]" spec.  coef is Q15, time-reversed and
+// zero-padded to a multiple of DSA_FIR_ALIGN taps, so each output is a dot product of
+// coef with consecutive inputs.
+struct dsa_fir
+{
+	char      *spec;
+	unsigned   factor;
+	size_t     taps;   // before padding
+	size_t     pad;    // after padding
+	int16_t   *coef;
+};
+
+
+// return the filter for spec, designing or loading it if spec differs from the last
+// call.  spec is a decimation factor, optionally followed by a number of taps for a
+// windowed-sinc lowpass at the new rate, or a file of coefficients, one or more per line.
+// Returns NULL on error.
+const struct dsa_fir *dsa_fir_get (const char *spec);
+
+// decimate the sample words set in lanes of src into dst, which must have room for
+// src->len / factor samples of the same width and packing; lanes has a bit per 16-bit
+// word of a sample period, 0x3 for channel 1 I/Q, 0xC for channel 2.  Sets dst->len and
+// returns 0 on success, <0 on error.
+int dsa_fir_run (const struct dsa_fir *fir, struct dsa_channel_xfer *dst,
+                 const struct dsa_channel_xfer *src, int lanes);
+
+// inner product of num Q15 taps h with inputs x, num a multiple of DSA_FIR_ALIGN; NEON
+// where available
+int32_t dsa_fir_dot (const int16_t *x, const int16_t *h, size_t num);
+
+// scalar reference for the inner product, used where NEON is not available and by the
+// check test of the NEON version
+int32_t dsa_fir_dot_ref (const int16_t *x, const int16_t *h, size_t num);
+
+#endif // _INCLUDE_DSA_FIR_H_
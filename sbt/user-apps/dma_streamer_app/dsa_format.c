@@ -17,12 +17,15 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <sys/stat.h>
 #include <ctype.h>
 #include <math.h>
 #include <errno.h>
+#include <endian.h>
+#include <sys/socket.h>
 
 #ifdef UNIT_TEST
 #define DSM_BUS_WIDTH 8
@@ -33,6 +36,12 @@
 
 #include "dsa_format.h"
 #include "dsa_channel.h"
+#include "dsa_common.h"
+#include "dsa_fft.h"
+#include "dsa_iq.h"
+#include "dsa_gen.h"
+#include "dsa_prbs.h"
+#include "dsa_net.h"
 
 #include "log.h"
 LOG_MODULE_STATIC("format", LOG_LEVEL_INFO);
@@ -47,7 +56,7 @@ static void spin (void)
 }
 
 
-static long fmt_bin_size (FILE *fp, int chan)
+static long fmt_bin_size (FILE *fp, int chan, const char *opts)
 {
 	if ( fp == stdin )
 	{
@@ -64,7 +73,8 @@ static long fmt_bin_size (FILE *fp, int chan)
 	return sb.st_size;
 }
 
-static int fmt_bin_read (FILE *fp, void *buff, size_t size, int chan, int lsh)
+static int fmt_bin_read (FILE *fp, void *buff, size_t size, int chan, int lsh,
+                         const char *opts)
 {
 	long    page = sysconf(_SC_PAGESIZE);
 	int     file = 0;
@@ -141,7 +151,8 @@ static int fmt_bin_read (FILE *fp, void *buff, size_t size, int chan, int lsh)
 	return 0;
 }
 
-static int fmt_bin_write (FILE *fp, void *buff, size_t size, int chan)
+static int fmt_bin_write (FILE *fp, void *buff, size_t size, int chan,
+                          const char *opts)
 {
 	char  *dst  = buff;
 	long   page = sysconf(_SC_PAGESIZE);
@@ -195,7 +206,8 @@ void hexdump_buff (FILE *fp, const void *buf, int len)
 		hexdump_line(fp, ptr, len);
 }
 
-static int fmt_hex_write (FILE *fp, void *buff, size_t size, int chan)
+static int fmt_hex_write (FILE *fp, void *buff, size_t size, int chan,
+                          const char *opts)
 {
 	hexdump_buff(fp, buff, size);
 	return 0;
@@ -237,14 +249,15 @@ void smpdump (FILE *fp, void *buff, size_t size)
 	fprintf(fp, "\n");
 }
 
-static int fmt_bit_write (FILE *fp, void *buff, size_t size, int chan)
+static int fmt_bit_write (FILE *fp, void *buff, size_t size, int chan,
+                          const char *opts)
 {
 	smpdump(fp, buff, size);
 	return 0;
 }
 
 
-static long fmt_bist_size (FILE *fp, int chan)
+static long fmt_bist_size (FILE *fp, int chan, const char *opts)
 {
 	char  buf[256];
 	long  val;
@@ -265,7 +278,8 @@ static long fmt_bist_size (FILE *fp, int chan)
 	return cnt * sizeof(uint16_t);
 }
 
-static int fmt_bist_read (FILE *fp, void *buff, size_t size, int chan, int lsh)
+static int fmt_bist_read (FILE *fp, void *buff, size_t size, int chan, int lsh,
+                          const char *opts)
 {
 	char      buf[256];
 	long      val;
@@ -301,7 +315,8 @@ static int fmt_bist_read (FILE *fp, void *buff, size_t size, int chan, int lsh)
 }
 
 
-static int fmt_bist_write (FILE *fp, void *buff, size_t size, int chan)
+static int fmt_bist_write (FILE *fp, void *buff, size_t size, int chan,
+                           const char *opts)
 {
 	uint8_t *ptr = buff;
 	size_t   idx = 0;
@@ -319,13 +334,14 @@ static int fmt_bist_write (FILE *fp, void *buff, size_t size, int chan)
 }
 
 
-static int fmt_null_write (FILE *fp, void *buff, size_t size, int chan)
+static int fmt_null_write (FILE *fp, void *buff, size_t size, int chan,
+                           const char *opts)
 {
 	return 0;
 }
 
 
-static long fmt_dec_size (FILE *fp, int chan)
+static long fmt_dec_size (FILE *fp, int chan, const char *opts)
 {
 	char  buf[256];
 	long  cnt = 0;
@@ -339,7 +355,8 @@ static long fmt_dec_size (FILE *fp, int chan)
 	return cnt * sizeof(uint16_t);
 }
 
-static int fmt_dec_read (FILE *fp, void *buff, size_t size, int chan, int lsh)
+static int fmt_dec_read (FILE *fp, void *buff, size_t size, int chan, int lsh,
+                         const char *opts)
 {
 	char      l[256];
 	char     *p;
@@ -378,7 +395,8 @@ static int fmt_dec_read (FILE *fp, void *buff, size_t size, int chan, int lsh)
 	return 0;
 }
 
-static int fmt_dec_write (FILE *fp, void *buff, size_t size, int chan)
+static int fmt_dec_write (FILE *fp, void *buff, size_t size, int chan,
+                          const char *opts)
 {
 	uint16_t *s = buff;
 	long      v;
@@ -401,15 +419,22 @@ static int fmt_dec_write (FILE *fp, void *buff, size_t size, int chan)
 }
 
 
-static long fmt_iqw_data_size (uint32_t head)
+// bytes per sample period in the buffer: a packed buffer holds just the one channel
+static inline size_t fmt_width (int chan)
+{
+	return (chan & DC_PACKED) ? sizeof(struct dsa_sample) : DSM_BUS_WIDTH;
+}
+
+
+static long fmt_iqw_data_size (uint32_t head, int chan)
 {
 	long data = head;
 	data /= 2;
-	data *= DSM_BUS_WIDTH;
+	data *= fmt_width(chan);
 	return data;
 }
 
-static long fmt_iqw_size (FILE *fp, int chan)
+static long fmt_iqw_size (FILE *fp, int chan, const char *opts)
 {
 	struct stat  sb;
 	uint32_t     head;
@@ -431,21 +456,28 @@ static long fmt_iqw_size (FILE *fp, int chan)
 	if ( fstat(fileno(fp), &sb) || sb.st_size != file )
 		return -2;
 	
-	ret = fmt_iqw_data_size(head);
+	ret = fmt_iqw_data_size(head, chan);
 	LOG_DEBUG("head %08x -> %lu bytes\n", head, ret);
 	return ret;
 }
 
-static int fmt_iqw_read (FILE *fp, void *buff, size_t size, int chan, int lsh)
+static int fmt_iqw_read (FILE *fp, void *buff, size_t size, int chan, int lsh,
+                         const char *opts)
 {
 	int       i;
 	float     f;
 	int16_t   s;
 	uint16_t *d = buff;
+	size_t    w = fmt_width(chan);
 	size_t    p;
+	int       pack = chan & DC_PACKED;
 	int       c = 0;
 	uint32_t  every = 0;
 
+	// a packed buffer holds the one channel in the channel 1 position
+	if ( pack )
+		chan = DC_CHAN_1;
+
 	if ( fp != stdin )
 		fseek(fp, sizeof(uint32_t), SEEK_SET);
 	else
@@ -454,10 +486,10 @@ static int fmt_iqw_read (FILE *fp, void *buff, size_t size, int chan, int lsh)
 		if ( fread(&head, 1, sizeof(head), fp) < sizeof(head) )
 			return -1;
 		// TODO: endian swap head if necessary
-		if ( size != fmt_iqw_data_size(head) )
+		if ( size != fmt_iqw_data_size(head, pack) )
 		{
 			fprintf(stderr, "iqw: file has data size %ld, buffer size %zu, stop\n",
-			        size, fmt_iqw_data_size(head));
+			        fmt_iqw_data_size(head, pack), size);
 			errno = EINVAL;
 			return -1;
 		}
@@ -468,7 +500,7 @@ static int fmt_iqw_read (FILE *fp, void *buff, size_t size, int chan, int lsh)
 	{
 		LOG_DEBUG("start pass %d\n", i);
 		d = buff;
-		p = size / DSM_BUS_WIDTH;
+		p = size / w;
 		while ( p-- )
 		{
 			if ( fread(&f, 1, sizeof(f), fp) < sizeof(f) )
@@ -498,7 +530,7 @@ static int fmt_iqw_read (FILE *fp, void *buff, size_t size, int chan, int lsh)
 			}
 
 			// store in channel 2
-			if ( chan & DC_CHAN_1 )
+			if ( chan & DC_CHAN_2 )
 			{
 				d[i + 2] = (unsigned long)s & 0x7FF;
 				if ( s < 0 )
@@ -507,7 +539,7 @@ static int fmt_iqw_read (FILE *fp, void *buff, size_t size, int chan, int lsh)
 					d[i + 2] <<= 4;
 			}
 			
-			d += DSM_BUS_WIDTH / sizeof(uint16_t);
+			d += w / sizeof(uint16_t);
 
 			if ( (every++ & 0x1ffff) == 0x1ffff )
 				spin();
@@ -523,17 +555,27 @@ static int fmt_iqw_read (FILE *fp, void *buff, size_t size, int chan, int lsh)
 	return 0;
 }
 
-static int fmt_iqw_write (FILE *fp, void *buff, size_t size, int chan)
+// 12-bit two's complement in the low bits of a 16-bit word to float in [-1.0, 1.0)
+static inline float iqw_float (uint16_t d)
+{
+	return (int16_t)(d << 4) / 32768.0f;
+}
+
+// Streaming writer for outputs which can't seek, like stdout: two passes through the data,
+// first writing the I values, then the Q values.  corr may be NULL for no correction.
+static int iqw_write_stream (FILE *fp, void *buff, size_t size, int chan,
+                             const struct dsa_iq_corr *corr)
 {
 	uint32_t  head = size;
 	int       i;
 	float     f;
 	int16_t   s;
 	uint16_t *d = buff;
+	size_t    w = fmt_width(chan);
 	size_t    p;
 	uint32_t  every = 0;
 
-	head /= DSM_BUS_WIDTH;
+	head /= w;
 	head *= 2;
 	if ( fwrite(&head, 1, sizeof(head), fp) < sizeof(head) )
 		return -1;
@@ -543,8 +585,8 @@ static int fmt_iqw_write (FILE *fp, void *buff, size_t size, int chan)
 	{
 		LOG_DEBUG("start pass %d\n", i);
 		d = buff;
-		p = size / DSM_BUS_WIDTH;
-		if ( chan & DC_CHAN_2 )
+		p = size / w;
+		if ( (chan & DC_CHAN_2) && !(chan & DC_PACKED) )
 			d += 2;
 		while ( p-- )
 		{
@@ -554,12 +596,16 @@ static int fmt_iqw_write (FILE *fp, void *buff, size_t size, int chan)
 
 			f  = s;
 			f /= 2048.0;
+			if ( corr && i )
+				f = corr->a * (f - corr->dc_q) + corr->b * (iqw_float(d[0]) - corr->dc_i);
+			else if ( corr )
+				f -= corr->dc_i;
 			// TODO: endian swap f if necessary
 
 			if ( fwrite(&f, 1, sizeof(f), fp) < sizeof(f) )
 				return -1;
 
-			d += DSM_BUS_WIDTH / sizeof(uint16_t);
+			d += w / sizeof(uint16_t);
 			if ( (every++ & 0x1ffff) == 0x1ffff )
 				spin();
 		}
@@ -570,16 +616,1302 @@ static int fmt_iqw_write (FILE *fp, void *buff, size_t size, int chan)
 	return 0;
 }
 
+// Single-pass writer: the I and Q sections of each file are at known offsets, so a block of
+// sample pairs is split into I and Q blocks for both channels in one walk of the buffer,
+// and each block is written to its place with pwrite().  This reads the buffer once rather
+// than twice per file, and replaces per-sample fwrite() calls with large writes.
+#define IQW_BLOCK  16384  // sample periods per staging block
+
+static int iqw_pwrite (int fd, const void *buff, size_t size, off_t offs)
+{
+	const uint8_t *ptr = buff;
+	ssize_t        ret;
+
+	while ( size )
+	{
+		if ( (ret = pwrite(fd, ptr, size, offs)) < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			return -1;
+		}
+		ptr  += ret;
+		offs += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+// offsets are absolute, so the file must be a regular file with nothing written yet
+static int iqw_seekable (FILE *fp)
+{
+	struct stat sb;
+
+	if ( fstat(fileno(fp), &sb) || !S_ISREG(sb.st_mode) || ftell(fp) != 0 )
+		return 0;
+
+	return 1;
+}
+
+// the corrected version of iqw_write_split()'s conversion of a block
+static void iqw_split_corr (float **ptr, void *buff, size_t base, size_t want, int pack,
+                            const struct dsa_iq_corr *corr)
+{
+	struct dsa_sample_pair *smp = buff;
+	struct dsa_sample      *one = buff;
+	const struct dsa_sample *s;
+	size_t                  i;
+	int                     c;
+
+	for ( c = 0; c < (pack ? 1 : 2); c++ )
+		for ( i = 0; i < want; i++ )
+		{
+			s = pack ? &one[base + i] : &smp[base + i].ch[c];
+			ptr[c * 2][i]     = iqw_float(s->i) - corr[c].dc_i;
+			ptr[c * 2 + 1][i] = corr[c].a * (iqw_float(s->q) - corr[c].dc_q) +
+			                    corr[c].b * ptr[c * 2][i];
+		}
+}
+
+// corr=auto|dci/dcq/gain/phase: DC and I/Q balance correction applied while converting
+// to float, so corrected output costs no extra pass over the buffer; auto measures each
+// channel to be written first.  Returns 1 with corr[] set for channels 1 and 2 as for
+// iqw_write_split(), 0 for no correction, or <0 on error.
+static int iqw_opts (const char *opts, FILE **fp, void *buff, size_t size, int pack,
+                     struct dsa_iq_corr *corr)
+{
+	struct dsa_iq_bal  bal;
+	struct dsa_iq_acc  acc;
+	const char        *spec = NULL;
+	char               copy[FMT_OPTS_MAX];
+	char              *ptr = copy;
+	char              *key;
+	char              *val;
+	int                ret;
+	int                c;
+
+	snprintf(copy, sizeof(copy), "%s", opts ? opts : "");
+	while ( format_opt_next(&ptr, &key, &val) )
+		if ( !strcmp(key, "corr") && val )
+			spec = val;
+		else
+		{
+			LOG_ERROR("iqw: invalid option '%s', use corr=auto|dci/dcq/gain/phase\n", key);
+			errno = EINVAL;
+			return -1;
+		}
+
+	if ( !spec )
+		return 0;
+	if ( (ret = dsa_iq_corr_parse(&bal, spec)) < 0 )
+		return ret;
+
+	for ( c = 0; c < 2; c++ )
+	{
+		if ( ret && fp[c] )
+		{
+			memset(&acc, 0, sizeof(acc));
+			dsa_iq_sum(&acc, (uint16_t *)buff + (pack ? 0 : c * 2),
+			           fmt_width(pack) / sizeof(uint16_t), size / fmt_width(pack));
+			dsa_iq_balance(&acc, &bal);
+			LOG_DEBUG("iqw: channel %d DC %+.5f/%+.5f, gain %+.3f dB, phase %+.3f deg\n",
+			          c + 1, bal.dc_i, bal.dc_q, bal.gain, bal.phase);
+		}
+		dsa_iq_corr_setup(&corr[c], &bal);
+	}
+
+	return 1;
+}
+
+// fp[0] and fp[1] receive channels 1 and 2 of a pair buffer; a packed buffer has only
+// the one channel, which goes to fp[0].  corr is NULL, or the corrections for fp[0] and
+// fp[1].
+static int iqw_write_split (FILE **fp, void *buff, size_t size, int pack,
+                            const struct dsa_iq_corr *corr)
+{
+	struct dsa_sample_pair *smp = buff;
+	struct dsa_sample      *one = buff;
+	size_t                  num = size / fmt_width(pack);
+	size_t                  base;
+	size_t                  want;
+	size_t                  i;
+	uint32_t                head = num * 2;
+	off_t                   offs[2];
+	float                  *blk;
+	float                  *ptr[4];
+	uint32_t                every = 0;
+	int                     fd[2] = { -1, -1 };
+	int                     c;
+
+	// fall back to the streaming writer if any output can't seek
+	for ( c = 0; c < 2; c++ )
+		if ( fp[c] && !iqw_seekable(fp[c]) )
+		{
+			for ( c = 0; c < 2; c++ )
+				if ( fp[c] && iqw_write_stream(fp[c], buff, size,
+				                               pack | (c ? DC_CHAN_2 : DC_CHAN_1),
+				                               corr ? &corr[c] : NULL) )
+					return -1;
+			return 0;
+		}
+
+	if ( !(blk = malloc(IQW_BLOCK * sizeof(float) * 4)) )
+		return -1;
+	for ( c = 0; c < 4; c++ )
+		ptr[c] = blk + IQW_BLOCK * c;
+
+	// header written through the FILE, then data with pwrite() at absolute offsets
+	for ( c = 0; c < 2; c++ )
+		if ( fp[c] )
+		{
+			if ( fwrite(&head, 1, sizeof(head), fp[c]) < sizeof(head) || fflush(fp[c]) )
+				goto fail;
+			fd[c] = fileno(fp[c]);
+		}
+	offs[0] = sizeof(head);
+	offs[1] = sizeof(head) + num * sizeof(float);
+
+	for ( base = 0; base < num; base += want )
+	{
+		want = num - base;
+		if ( want > IQW_BLOCK )
+			want = IQW_BLOCK;
+
+		// ptr[0..3]: channel 1 I, channel 1 Q, channel 2 I, channel 2 Q
+		if ( corr )
+			iqw_split_corr(ptr, buff, base, want, pack, corr);
+		else if ( pack )
+			for ( i = 0; i < want; i++ )
+			{
+				ptr[0][i] = iqw_float(one[base + i].i);
+				ptr[1][i] = iqw_float(one[base + i].q);
+			}
+		else
+			for ( i = 0; i < want; i++ )
+			{
+				ptr[0][i] = iqw_float(smp[base + i].ch[0].i);
+				ptr[1][i] = iqw_float(smp[base + i].ch[0].q);
+				ptr[2][i] = iqw_float(smp[base + i].ch[1].i);
+				ptr[3][i] = iqw_float(smp[base + i].ch[1].q);
+			}
+		// TODO: endian swap if necessary
+
+		for ( c = 0; c < 2; c++ )
+			if ( fd[c] > -1 )
+				if ( iqw_pwrite(fd[c], ptr[c * 2], want * sizeof(float),
+				                offs[0] + base * sizeof(float)) ||
+				     iqw_pwrite(fd[c], ptr[c * 2 + 1], want * sizeof(float),
+				                offs[1] + base * sizeof(float)) )
+					goto fail;
+
+		if ( (every++ & 0x1f) == 0x1f )
+			spin();
+	}
+
+	// leave the FILE positioned at the end, so the caller's ftell() is the file size
+	for ( c = 0; c < 2; c++ )
+		if ( fp[c] )
+			fseek(fp[c], 0, SEEK_END);
+
+	free(blk);
+	fputc('\r', stderr);
+	return 0;
+
+fail:
+	free(blk);
+	return -1;
+}
+
+static int fmt_iqw_demux (FILE **fp, void *buff, size_t size, const char *opts)
+{
+	struct dsa_iq_corr  corr[2];
+	int                 ret;
+
+	if ( (ret = iqw_opts(opts, fp, buff, size, 0, corr)) < 0 )
+		return ret;
+
+	return iqw_write_split(fp, buff, size, 0, ret ? corr : NULL);
+}
+
+static int fmt_iqw_write (FILE *fp, void *buff, size_t size, int chan,
+                          const char *opts)
+{
+	struct dsa_iq_corr  corr[2];
+	FILE               *fps[2] = { NULL, NULL };
+	int                 ret;
+
+	fps[(chan & DC_CHAN_2) && !(chan & DC_PACKED) ? 1 : 0] = fp;
+	if ( (ret = iqw_opts(opts, fps, buff, size, chan & DC_PACKED, corr)) < 0 )
+		return ret;
+
+	return iqw_write_split(fps, buff, size, chan & DC_PACKED, ret ? corr : NULL);
+}
+
+
+// p12: packed 12-bit samples.  The AD9361 delivers 12-bit I/Q values which are stored in
+// 16-bit words in the DMA buffers; p12 stores each value in 1.5 bytes, so a single-channel
+// sample takes 3 bytes and a sample pair 6 bytes, little-endian.  A short header gives the
+// channel layout, so a file saved from one channel can be loaded into either or both.
+#define P12_MAGIC    0x32315044  // "DP12"
+#define P12_VERSION  1
+#define P12_CHAN_1   0x01
+#define P12_CHAN_2   0x02
+#define P12_BLOCK    4096        // sample periods per staging block
+
+struct fmt_p12_head
+{
+	uint32_t  magic;
+	uint16_t  version;
+	uint16_t  chans;    // P12_CHAN_* bits for the channels stored
+	uint32_t  samples;  // sample periods in file
+} __attribute__((packed));
+
+// Pack four 12-bit values in the 16-bit lanes of w into the low 48 bits of the result,
+// and the inverse.  Working a whole word at a time keeps the inner loops free of
+// per-value branches and shifts, so they vectorize on targets which support it.  A pair
+// of single-channel samples (I, Q, I, Q) has the same layout as a sample pair.
+static inline uint64_t p12_pack (uint64_t w)
+{
+	return ( w        & 0x000000000FFFULL) |
+	       ((w >>  4) & 0x000000FFF000ULL) |
+	       ((w >>  8) & 0x000FFF000000ULL) |
+	       ((w >> 12) & 0xFFF000000000ULL);
+}
+
+static inline uint64_t p12_unpack (uint64_t p)
+{
+	return ( p        & 0x0000000000000FFFULL) |
+	       ((p <<  4) & 0x000000000FFF0000ULL) |
+	       ((p <<  8) & 0x00000FFF00000000ULL) |
+	       ((p << 12) & 0x0FFF000000000000ULL);
+}
+
+static int p12_head_read (FILE *fp, struct fmt_p12_head *head)
+{
+	if ( fp != stdin )
+		fseek(fp, 0, SEEK_SET);
+
+	if ( fread(head, 1, sizeof(*head), fp) < sizeof(*head) )
+		return -1;
+
+	// TODO: endian swap head if necessary
+	if ( head->magic != P12_MAGIC || head->version != P12_VERSION ||
+	     !(head->chans & (P12_CHAN_1|P12_CHAN_2)) || (head->chans & ~(P12_CHAN_1|P12_CHAN_2)) )
+	{
+		LOG_ERROR("p12: bad header: magic %08x, version %u, chans %x\n",
+		          head->magic, head->version, head->chans);
+		errno = EINVAL;
+		return -1;
+	}
+
+	LOG_DEBUG("p12: version %u, chans %x, %u samples\n",
+	          head->version, head->chans, head->samples);
+	return 0;
+}
+
+static long fmt_p12_size (FILE *fp, int chan, const char *opts)
+{
+	struct fmt_p12_head  head;
+
+	if ( p12_head_read(fp, &head) )
+		return -1;
+
+	return (long)head.samples * fmt_width(chan);
+}
+
+static int fmt_p12_read (FILE *fp, void *buff, size_t size, int chan, int lsh,
+                         const char *opts)
+{
+	struct dsa_sample_pair *smp  = buff;
+	struct dsa_sample      *one  = buff;
+	size_t                  left = size / fmt_width(chan);
+	size_t                  file;
+	size_t                  want;
+	size_t                  bytes;
+	size_t                  i;
+	struct fmt_p12_head     head;
+	uint8_t                 blk[P12_BLOCK * 6 + sizeof(uint64_t)];
+	uint8_t                *s;
+	uint64_t                p;
+	uint64_t                w;
+	uint32_t                every = 0;
+	int                     pack  = chan & DC_PACKED;
+	int                     both;
+
+	if ( p12_head_read(fp, &head) )
+		return -1;
+	if ( !head.samples )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ( !(chan & (DC_CHAN_1|DC_CHAN_2)) )
+		chan |= DC_CHAN_1|DC_CHAN_2;
+	both = head.chans == (P12_CHAN_1|P12_CHAN_2);
+
+	file = head.samples;
+	while ( left )
+	{
+		// more buffer to fill from file: rewind to first sample and repeat
+		if ( !file )
+		{
+			if ( fp == stdin )
+				break;
+
+			LOG_DEBUG("p12: file < buffer, rewind and reload\n");
+			fseek(fp, sizeof(head), SEEK_SET);
+			file = head.samples;
+		}
+
+		want = left;
+		if ( want > P12_BLOCK )
+			want = P12_BLOCK;
+		if ( want > file )
+			want = file;
+
+		bytes = want * (both ? 6 : 3);
+		if ( fread(blk, 1, bytes, fp) < bytes )
+			return -1;
+		memset(blk + bytes, 0, sizeof(uint64_t));
+
+		s = blk;
+		if ( both )
+			for ( i = 0; i < want; i++, s += 6 )
+			{
+				memcpy(&p, s, sizeof(p));
+				w = p12_unpack(p);
+				if ( lsh )
+					w <<= 4;
+
+				// a packed buffer takes the wanted channel only
+				if ( pack )
+					memcpy(&one[i], (uint8_t *)&w + ((chan & DC_CHAN_2) ? sizeof(uint32_t) : 0),
+					       sizeof(uint32_t));
+
+				// loading one channel must leave the other intact
+				else if ( (chan & (DC_CHAN_1|DC_CHAN_2)) == (DC_CHAN_1|DC_CHAN_2) )
+					memcpy(&smp[i], &w, sizeof(w));
+				else if ( chan & DC_CHAN_1 )
+					memcpy(&smp[i].ch[0], &w, sizeof(uint32_t));
+				else
+					memcpy(&smp[i].ch[1], (uint8_t *)&w + sizeof(uint32_t),
+					       sizeof(uint32_t));
+			}
+		else
+			for ( i = 0; i < want; i += 2, s += 6 )
+			{
+				memcpy(&p, s, sizeof(p));
+				w = p12_unpack(p);
+				if ( lsh )
+					w <<= 4;
+
+				// a packed buffer has the file's layout, two samples to a word
+				if ( pack )
+				{
+					memcpy(&one[i], &w, (i + 1 < want ? 2 : 1) * sizeof(uint32_t));
+					continue;
+				}
+
+				if ( chan & DC_CHAN_1 )
+					memcpy(&smp[i].ch[0], &w, sizeof(uint32_t));
+				if ( chan & DC_CHAN_2 )
+					memcpy(&smp[i].ch[1], &w, sizeof(uint32_t));
+
+				// odd sample count: the upper half of the last group is padding
+				if ( i + 1 >= want )
+					break;
+
+				if ( chan & DC_CHAN_1 )
+					memcpy(&smp[i + 1].ch[0], (uint8_t *)&w + sizeof(uint32_t),
+					       sizeof(uint32_t));
+				if ( chan & DC_CHAN_2 )
+					memcpy(&smp[i + 1].ch[1], (uint8_t *)&w + sizeof(uint32_t),
+					       sizeof(uint32_t));
+			}
+
+		smp  += want;
+		one  += want;
+		left -= want;
+		file -= want;
+
+		if ( (every++ & 0x3f) == 0x3f )
+			spin();
+	}
+
+	fputc('\r', stderr);
+	return 0;
+}
+
+static int fmt_p12_write (FILE *fp, void *buff, size_t size, int chan,
+                          const char *opts)
+{
+	struct dsa_sample_pair *smp  = buff;
+	struct dsa_sample      *one  = buff;
+	size_t                  left = size / fmt_width(chan);
+	size_t                  want;
+	size_t                  bytes;
+	size_t                  i;
+	struct fmt_p12_head     head;
+	uint8_t                 blk[P12_BLOCK * 6 + sizeof(uint64_t)];
+	uint8_t                *d;
+	uint32_t                lo;
+	uint32_t                hi;
+	uint64_t                p;
+	uint64_t                w;
+	uint32_t                every = 0;
+	int                     c;
+
+	head.magic   = P12_MAGIC;
+	head.version = P12_VERSION;
+	head.chans   = 0;
+	head.samples = left;
+	if ( chan & DC_CHAN_1 )  head.chans |= P12_CHAN_1;
+	if ( chan & DC_CHAN_2 )  head.chans |= P12_CHAN_2;
+	if ( !head.chans )
+		head.chans = P12_CHAN_1|P12_CHAN_2;
+
+	if ( fwrite(&head, 1, sizeof(head), fp) < sizeof(head) )
+		return -1;
+
+	c = (head.chans == P12_CHAN_2) ? 1 : 0;
+	while ( left )
+	{
+		want = left;
+		if ( want > P12_BLOCK )
+			want = P12_BLOCK;
+
+		d = blk;
+		if ( head.chans == (P12_CHAN_1|P12_CHAN_2) )
+		{
+			for ( i = 0; i < want; i++, d += 6 )
+			{
+				memcpy(&w, &smp[i], sizeof(w));
+				p = p12_pack(w);
+				memcpy(d, &p, sizeof(p));
+			}
+			bytes = want * 6;
+		}
+		else
+		{
+			for ( i = 0; i < want; i += 2, d += 6 )
+			{
+				// a packed buffer's channel is at each sample, not each pair
+				memcpy(&lo, (chan & DC_PACKED) ? &one[i] : &smp[i].ch[c], sizeof(lo));
+				hi = 0;
+				if ( i + 1 < want )
+					memcpy(&hi, (chan & DC_PACKED) ? &one[i + 1] : &smp[i + 1].ch[c],
+					       sizeof(hi));
+
+				w = ((uint64_t)hi << 32) | lo;
+				p = p12_pack(w);
+				memcpy(d, &p, sizeof(p));
+			}
+			bytes = want * 3;
+		}
+
+		if ( fwrite(blk, 1, bytes, fp) < bytes )
+			return -1;
+
+		smp  += want;
+		one  += want;
+		left -= want;
+
+		if ( (every++ & 0x3f) == 0x3f )
+			spin();
+	}
+
+	fputc('\r', stderr);
+	return 0;
+}
+
+// Split a dual-channel buffer into two single-channel files in one pass
+static int fmt_p12_demux (FILE **fp, void *buff, size_t size, const char *opts)
+{
+	struct dsa_sample_pair *smp  = buff;
+	size_t                  left = size / DSM_BUS_WIDTH;
+	size_t                  want;
+	size_t                  i;
+	struct fmt_p12_head     head;
+	uint8_t                *blk;
+	uint8_t                *d[2];
+	uint64_t                w[2];
+	uint64_t                p;
+	uint32_t                every = 0;
+	int                     c;
+
+	if ( !fp[0] || !fp[1] )
+		return fp[0] ? fmt_p12_write(fp[0], buff, size, DC_CHAN_1, opts)
+		             : fmt_p12_write(fp[1], buff, size, DC_CHAN_2, opts);
+
+	if ( !(blk = malloc((P12_BLOCK * 3 + sizeof(uint64_t)) * 2)) )
+		return -1;
+
+	head.magic   = P12_MAGIC;
+	head.version = P12_VERSION;
+	head.samples = left;
+	for ( c = 0; c < 2; c++ )
+	{
+		head.chans = c ? P12_CHAN_2 : P12_CHAN_1;
+		if ( fwrite(&head, 1, sizeof(head), fp[c]) < sizeof(head) )
+			goto fail;
+	}
+
+	while ( left )
+	{
+		want = left;
+		if ( want > P12_BLOCK )
+			want = P12_BLOCK;
+
+		d[0] = blk;
+		d[1] = blk + P12_BLOCK * 3 + sizeof(uint64_t);
+		for ( i = 0; i < want; i += 2, d[0] += 6, d[1] += 6 )
+		{
+			// w[c] holds channel c of sample i in the low half and of sample i+1 in
+			// the high half, the same layout as a dual-channel sample
+			memcpy(&w[0], &smp[i], sizeof(w[0]));
+			w[1] = w[0] >> 32;
+			w[0] &= 0xFFFFFFFFULL;
+			if ( i + 1 < want )
+			{
+				memcpy(&p, &smp[i + 1], sizeof(p));
+				w[0] |= p << 32;
+				w[1] |= p & 0xFFFFFFFF00000000ULL;
+			}
+
+			for ( c = 0; c < 2; c++ )
+			{
+				p = p12_pack(w[c]);
+				memcpy(d[c], &p, sizeof(p));
+			}
+		}
+
+		if ( fwrite(blk, 1, want * 3, fp[0]) < want * 3 ||
+		     fwrite(blk + P12_BLOCK * 3 + sizeof(uint64_t), 1, want * 3, fp[1]) < want * 3 )
+			goto fail;
+
+		smp  += want;
+		left -= want;
+
+		if ( (every++ & 0x3f) == 0x3f )
+			spin();
+	}
+
+	free(blk);
+	fputc('\r', stderr);
+	return 0;
+
+fail:
+	free(blk);
+	return -1;
+}
+
+
+// stats: a summary of each channel in place of the samples - mean power, peak, DC offset,
+// clipped samples and I/Q balance - over the whole buffer or per block of samples.
+// Options: "block=samples" to summarize per block, "csv" or "bin" for the output instead
+// of text.  Both channels of a pair buffer are summed a chunk at a time in the one walk.
+#define STATS_FS2  (2048.0 * 2048.0)
+
+// binary output: one record per channel per block, in the board's byte order
+struct fmt_stats_rec
+{
+	uint32_t  chan;
+	uint32_t  clip;
+	uint64_t  start;
+	uint64_t  num;
+	float     power;  // dBFS, mean I^2 + Q^2 vs a full-scale tone
+	float     peak;   // dBFS
+	float     dc_i;   // fraction of full scale
+	float     dc_q;
+	float     gain;   // dB, I vs Q
+	float     phase;  // degrees from quadrature
+};
+
+enum stats_out
+{
+	STATS_TEXT,
+	STATS_CSV,
+	STATS_BIN,
+};
+
+static void stats_result (const struct dsa_iq_acc *acc, struct fmt_stats_rec *rec)
+{
+	struct dsa_iq_bal  bal;
+
+	dsa_iq_balance(acc, &bal);
+	rec->num   = acc->num;
+	rec->clip  = acc->clip;
+	rec->power = 10.0 * log10((double)(acc->sii + acc->sqq) / acc->num / STATS_FS2);
+	rec->peak  = 10.0 * log10(acc->peak / STATS_FS2);
+	rec->dc_i  = bal.dc_i;
+	rec->dc_q  = bal.dc_q;
+	rec->gain  = bal.gain;
+	rec->phase = bal.phase;
+}
+
+static int stats_emit (FILE *fp, enum stats_out out, const struct fmt_stats_rec *rec)
+{
+	switch ( out )
+	{
+		case STATS_BIN:
+			return fwrite(rec, 1, sizeof(*rec), fp) < sizeof(*rec) ? -1 : 0;
+
+		case STATS_CSV:
+			return fprintf(fp, "%u,%llu,%llu,%.2f,%.2f,%.5f,%.5f,%u,%.3f,%.3f\n",
+			               rec->chan, (unsigned long long)rec->start,
+			               (unsigned long long)rec->num, rec->power, rec->peak,
+			               rec->dc_i, rec->dc_q, rec->clip, rec->gain, rec->phase) < 0;
+
+		default:
+			return fprintf(fp, "Channel %u, samples %llu-%llu: power %.2f dBFS, peak %.2f "
+			               "dBFS, DC I %+.5f Q %+.5f, clipped %u, IQ gain %+.3f dB phase "
+			               "%+.3f deg\n", rec->chan, (unsigned long long)rec->start,
+			               (unsigned long long)(rec->start + rec->num - 1), rec->power,
+			               rec->peak, rec->dc_i, rec->dc_q, rec->clip, rec->gain,
+			               rec->phase) < 0;
+	}
+}
+
+static int fmt_stats_write (FILE *fp, void *buff, size_t size, int chan,
+                            const char *opts)
+{
+	struct fmt_stats_rec  rec;
+	struct dsa_iq_acc     acc[2];
+	enum stats_out        out    = STATS_TEXT;
+	const uint16_t       *d      = buff;
+	size_t                stride = fmt_width(chan) / sizeof(uint16_t);
+	size_t                num    = size / fmt_width(chan);
+	size_t                block  = 0;
+	size_t                start, end, ofs, want;
+	char                  copy[FMT_OPTS_MAX];
+	char                 *ptr = copy;
+	char                 *key;
+	char                 *val;
+	const uint16_t       *base[2];
+	int                   chans[2];
+	int                   cnt = 0;
+	int                   c;
+
+	snprintf(copy, sizeof(copy), "%s", opts ? opts : "");
+	while ( format_opt_next(&ptr, &key, &val) )
+		if ( !strcmp(key, "block") && val && (block = size_dec(val)) > 0 )
+			continue;
+		else if ( !strcmp(key, "csv") )
+			out = STATS_CSV;
+		else if ( !strcmp(key, "bin") )
+			out = STATS_BIN;
+		else if ( !strcmp(key, "text") )
+			out = STATS_TEXT;
+		else
+		{
+			LOG_ERROR("stats: invalid option '%s', use block=N, csv, bin, text\n", key);
+			errno = EINVAL;
+			return -1;
+		}
+
+	if ( !num )
+		return 0;
+	if ( !block || block > num )
+		block = num;
+
+	// channel numbers and word offsets: a packed buffer holds just the given channel,
+	// a pair buffer either or both
+	if ( chan & DC_PACKED )
+	{
+		base[cnt]    = d;
+		chans[cnt++] = chan & DC_CHAN_2 ? 1 : 0;
+	}
+	else
+		for ( c = 0; c < 2; c++ )
+			if ( (chan & DC_CHAN_IDX_TO_MASK(c)) || !(chan & (DC_CHAN_1|DC_CHAN_2)) )
+			{
+				base[cnt]    = d + c * 2;
+				chans[cnt++] = c;
+			}
+
+	if ( out == STATS_CSV &&
+	     fprintf(fp, "channel,start,samples,power_dbfs,peak_dbfs,dc_i,dc_q,clipped,"
+	                 "gain_db,phase_deg\n") < 0 )
+		return -1;
+
+	for ( start = 0; start < num; start += block )
+	{
+		memset(acc, 0, sizeof(acc));
+		end = start + block < num ? start + block : num;
+		for ( ofs = start; ofs < end; ofs += want )
+		{
+			want = end - ofs < DSA_IQ_CHUNK ? end - ofs : DSA_IQ_CHUNK;
+			for ( c = 0; c < cnt; c++ )
+				dsa_iq_sum(&acc[c], base[c] + ofs * stride, stride, want);
+		}
+
+		for ( c = 0; c < cnt; c++ )
+		{
+			stats_result(&acc[c], &rec);
+			rec.chan  = chans[c] + 1;
+			rec.start = start;
+			if ( stats_emit(fp, out, &rec) )
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+// psd: a Welch power spectrum of each channel in place of the samples.  The buffer is cut
+// into segments of the FFT size overlapping by a percentage, each windowed, transformed
+// and its bin powers summed.  Bins are written lowest frequency first, in dBFS where a
+// full-scale tone on a bin centre reads 0dB.  Options: "fft=N" (default 1024),
+// "overlap=percent" (default 50), "window=hann|hamming|blackman|rect", and "bin" for
+// float32 dBFS values instead of text lines of frequency, as a fraction of the sample
+// rate, and dBFS.
+#define PSD_FFT_DEF  1024
+
+static int psd_window (float *win, size_t n, const char *name)
+{
+	double  a;
+	size_t  i;
+
+	for ( i = 0; i < n; i++ )
+	{
+		a = 2.0 * M_PI * i / n;
+		if ( !strcmp(name, "hann") )
+			win[i] = 0.5 - 0.5 * cos(a);
+		else if ( !strcmp(name, "hamming") )
+			win[i] = 0.54 - 0.46 * cos(a);
+		else if ( !strcmp(name, "blackman") )
+			win[i] = 0.42 - 0.5 * cos(a) + 0.08 * cos(2.0 * a);
+		else if ( !strcmp(name, "rect") )
+			win[i] = 1.0;
+		else
+			return -1;
+	}
+
+	return 0;
+}
+
+static int fmt_psd_write (FILE *fp, void *buff, size_t size, int chan,
+                          const char *opts)
+{
+	struct dsa_fft *fft    = NULL;
+	const uint16_t *d      = buff;
+	const uint16_t *base;
+	size_t          stride = fmt_width(chan) / sizeof(uint16_t);
+	size_t          num    = size / fmt_width(chan);
+	size_t          n      = PSD_FFT_DEF;
+	size_t          over   = 50;
+	size_t          step, start, segs, i, j;
+	const char     *window = "hann";
+	float          *win    = NULL;
+	float          *data   = NULL;
+	float          *acc    = NULL;
+	float           f;
+	double          scale;
+	char            copy[FMT_OPTS_MAX];
+	char           *ptr = copy;
+	char           *key;
+	char           *val;
+	int             bin = 0;
+	int             ret = -1;
+	int             c;
+
+	snprintf(copy, sizeof(copy), "%s", opts ? opts : "");
+	while ( format_opt_next(&ptr, &key, &val) )
+		if ( !strcmp(key, "fft") && val )
+			n = size_dec(val);
+		else if ( !strcmp(key, "overlap") && val && (over = strtoul(val, NULL, 0)) < 100 )
+			continue;
+		else if ( !strcmp(key, "window") && val )
+			window = val;
+		else if ( !strcmp(key, "bin") )
+			bin = 1;
+		else if ( !strcmp(key, "text") )
+			bin = 0;
+		else
+		{
+			LOG_ERROR("psd: invalid option '%s', use fft=N, overlap=percent, window=name, "
+			          "bin, text\n", key);
+			errno = EINVAL;
+			return -1;
+		}
+
+	if ( !(fft = dsa_fft_init(n)) )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if ( !(win = malloc(n * sizeof(float))) || !(data = malloc(n * 2 * sizeof(float))) ||
+	     !(acc = malloc(n * sizeof(float))) )
+		goto done;
+	if ( psd_window(win, n, window) )
+	{
+		LOG_ERROR("psd: unknown window '%s'\n", window);
+		errno = EINVAL;
+		goto done;
+	}
+
+	for ( scale = 0.0, i = 0; i < n; i++ )
+		scale += win[i];
+	scale *= 2048.0;
+	if ( (step = n - n * over / 100) < 1 )
+		step = 1;
+
+	for ( c = 0; c < 2; c++ )
+	{
+		// a packed buffer holds just the given channel, a pair buffer either or both
+		if ( chan & DC_PACKED )
+		{
+			if ( c != (chan & DC_CHAN_2 ? 1 : 0) )
+				continue;
+			base = d;
+		}
+		else if ( (chan & DC_CHAN_IDX_TO_MASK(c)) || !(chan & (DC_CHAN_1|DC_CHAN_2)) )
+			base = d + c * 2;
+		else
+			continue;
+
+		// a buffer shorter than the FFT is one zero-padded segment
+		memset(acc, 0, n * sizeof(float));
+		for ( segs = 0, start = 0; !segs || start + n <= num; start += step, segs++ )
+		{
+			for ( i = 0; i < n; i++ )
+				if ( start + i < num )
+				{
+					data[i * 2]     = dsa_sample_value(base[(start + i) * stride])     * win[i];
+					data[i * 2 + 1] = dsa_sample_value(base[(start + i) * stride + 1]) * win[i];
+				}
+				else
+					data[i * 2] = data[i * 2 + 1] = 0.0;
+
+			dsa_fft_run(fft, data);
+			for ( i = 0; i < n; i++ )
+				acc[i] += data[i * 2] * data[i * 2] + data[i * 2 + 1] * data[i * 2 + 1];
+		}
+
+		if ( !bin && fprintf(fp, "# channel %d: %zu segments of %zu, %s window\n",
+		                     c + 1, segs, n, window) < 0 )
+			goto done;
+
+		for ( j = 0; j < n; j++ )
+		{
+			i = (j + n / 2) % n;
+			f = 10.0 * log10(acc[i] / segs / (scale * scale) + 1e-20);  // -200dB floor
+			if ( bin ? fwrite(&f, 1, sizeof(f), fp) < sizeof(f)
+			         : fprintf(fp, "%+.6f %.2f\n", ((double)j - n / 2) / n, f) < 0 )
+				goto done;
+		}
+	}
+	ret = 0;
+
+done:
+	free(acc);
+	free(data);
+	free(win);
+	dsa_fft_free(fft);
+	return ret;
+}
+
+
+// prbs: checks each channel against a PRBS, 12 bits per word and each I and Q its own
+// sequence as "gen,bits=" makes, in place of the samples.  Reports bit and sample errors
+// and BER over the whole buffer or per block, and in text each burst of errors as it
+// ends.  Options: "order=7|15|23|31" (default 15), "block=samples", "gap=samples" between
+// errors that ends a burst (default 16), and "csv" for the counts without bursts.
+struct prbs_out
+{
+	FILE  *fp;
+	int    chan[2];
+	int    csv;
+	int    err;
+};
+
+static void prbs_burst (void *arg, int c, const struct dsa_prbs_burst *b)
+{
+	struct prbs_out *out = arg;
+
+	if ( !out->csv &&
+	     fprintf(out->fp, "Channel %d burst at samples %llu-%llu: %llu samples, %llu bits "
+	             "in error\n", out->chan[c], b->start, b->last, b->smp_errs, b->bit_errs) < 0 )
+		out->err = 1;
+}
+
+static int prbs_emit (struct prbs_out *out, int c, const struct dsa_prbs *chk,
+                      size_t start, size_t num)
+{
+	const struct dsa_prbs_count *cnt = &chk->count[c];
+	double                       ber = cnt->bits ? (double)cnt->bit_errs / cnt->bits : 0.0;
+
+	if ( out->csv )
+		return fprintf(out->fp, "%d,%zu,%zu,%llu,%llu,%llu,%.3e,%llu,%lu,%lu\n", out->chan[c],
+		               start, num, cnt->samples, cnt->bits, cnt->bit_errs, ber,
+		               cnt->smp_errs, cnt->bursts, cnt->losses) < 0;
+
+	if ( !cnt->samples )
+		return fprintf(out->fp, "Channel %d, samples %zu-%zu: no PRBS%u sync\n",
+		               out->chan[c], start, start + num - 1, chk->order) < 0;
+
+	return fprintf(out->fp, "Channel %d, samples %zu-%zu: %llu bits, %llu errors, BER "
+	               "%.3e, %llu sample errors, %lu bursts, %lu sync losses\n", out->chan[c],
+	               start, start + num - 1, cnt->bits, cnt->bit_errs, ber, cnt->smp_errs,
+	               cnt->bursts, cnt->losses) < 0;
+}
+
+static int fmt_prbs_write (FILE *fp, void *buff, size_t size, int chan,
+                           const char *opts)
+{
+	struct dsa_prbs  chk;
+	struct prbs_out  out;
+	const uint16_t  *d      = buff;
+	size_t           stride = fmt_width(chan) / sizeof(uint16_t);
+	size_t           num    = size / fmt_width(chan);
+	size_t           block  = 0;
+	size_t           gap    = DSA_PRBS_GAP;
+	size_t           start, want;
+	unsigned long    order  = 15;
+	char             copy[FMT_OPTS_MAX];
+	char            *ptr = copy;
+	char            *key;
+	char            *val;
+	char            *end;
+	int              chans = 0;
+	int              c;
+
+	memset(&out, 0, sizeof(out));
+	out.fp = fp;
+
+	snprintf(copy, sizeof(copy), "%s", opts ? opts : "");
+	while ( format_opt_next(&ptr, &key, &val) )
+		if ( !strcmp(key, "order") && val && (order = strtoul(val, &end, 0)) && !*end )
+			continue;
+		else if ( !strcmp(key, "block") && val && (block = size_dec(val)) > 0 )
+			continue;
+		else if ( !strcmp(key, "gap") && val )
+			gap = size_dec(val);
+		else if ( !strcmp(key, "csv") )
+			out.csv = 1;
+		else if ( !strcmp(key, "text") )
+			out.csv = 0;
+		else
+		{
+			LOG_ERROR("prbs: invalid option '%s', use order=N, block=N, gap=N, csv, text\n",
+			          key);
+			errno = EINVAL;
+			return -1;
+		}
+
+	if ( dsa_prbs_init(&chk, order, gap) < 0 )
+		return -1;
+	chk.report = prbs_burst;
+	chk.arg    = &out;
+
+	if ( !num )
+		return 0;
+	if ( !block || block > num )
+		block = num;
+
+	// a packed buffer holds just the given channel, in the channel 1 words
+	if ( chan & DC_PACKED )
+	{
+		chans       = 1;
+		out.chan[0] = chan & DC_CHAN_2 ? 2 : 1;
+	}
+	else
+		for ( c = 0; c < 2; c++ )
+		{
+			out.chan[c] = c + 1;
+			if ( (chan & DC_CHAN_IDX_TO_MASK(c)) || !(chan & (DC_CHAN_1|DC_CHAN_2)) )
+				chans |= 1 << c;
+		}
+
+	if ( out.csv &&
+	     fprintf(fp, "channel,start,samples,checked,bits,bit_errors,ber,sample_errors,"
+	                 "bursts,sync_losses\n") < 0 )
+		return -1;
+
+	// the lock carries across blocks; a burst is reported, and counted, as it ends
+	for ( start = 0; start < num; start += want )
+	{
+		want = num - start < block ? num - start : block;
+		dsa_prbs_check(&chk, d + start * stride, stride, want, chans);
+		if ( start + want == num )
+			dsa_prbs_flush(&chk);
+
+		for ( c = 0; c < 2; c++ )
+			if ( (chans & (1 << c)) && prbs_emit(&out, c, &chk, start, want) )
+				return -1;
+		memset(chk.count, 0, sizeof(chk.count));
+	}
+
+	return out.err ? -1 : 0;
+}
+
+
+// Synthesized TX data, no file: the waveform and its length come from the options
+static long fmt_gen_size (FILE *fp, int chan, const char *opts)
+{
+	struct dsa_gen  gen;
+
+	if ( dsa_gen_init(&gen, opts) < 0 )
+		return -1;
+	dsa_gen_free(&gen);
+
+	if ( !gen.len )
+	{
+		LOG_ERROR("gen: give len=samples or a buffer size\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return gen.len * fmt_width(chan);
+}
+
+static int fmt_gen_read (FILE *fp, void *buff, size_t size, int chan, int lsh,
+                         const char *opts)
+{
+	struct dsa_gen  gen;
+	int             lanes = 0;
+	int             ret;
+
+	if ( dsa_gen_init(&gen, opts) < 0 )
+		return -1;
+
+	// a packed buffer holds the one channel in the channel 1 position
+	if ( chan & (DC_CHAN_1|DC_PACKED) )
+		lanes |= 0x3;
+	if ( (chan & (DC_CHAN_2|DC_PACKED)) == DC_CHAN_2 )
+		lanes |= 0xC;
+
+	ret = dsa_gen_run(&gen, buff, fmt_width(chan) / sizeof(uint16_t), size / fmt_width(chan),
+	                  lanes, lsh);
+	if ( gen.clip )
+		LOG_WARN("gen: %lu words clipped, lower amp=\n", gen.clip);
+
+	dsa_gen_free(&gen);
+	return ret;
+}
+
+
+// Network streams, no file: the address comes as addr= ahead of the other options
+struct fmt_net
+{
+	char                 addr[FMT_OPTS_MAX];
+	long                 stream;
+	size_t               pkt;
+	size_t               len;
+	uint64_t             time;
+	unsigned long        rate;
+	size_t               ring;
+	struct dsa_net_take  take;
+};
+
+static int fmt_net_opts (struct fmt_net *net, int type, const char *opts)
+{
+	const char *name = type == SOCK_STREAM ? "tcp" : "udp";
+	char        copy[FMT_OPTS_MAX * 2];
+	char       *ptr = copy;
+	char       *key;
+	char       *val;
+	char       *end;
+
+	memset(net, 0, sizeof(*net));
+	net->stream = -1;
+	net->pkt    = type == SOCK_STREAM ? DSA_NET_TCP_PKT : DSA_NET_UDP_PKT;
+	net->take.wait = -1;
+	net->take.idle = 1000;
+	net->take.fill = DSA_NET_FILL_ZERO;
+
+	snprintf(copy, sizeof(copy), "%s", opts ? opts : "");
+	while ( format_opt_next(&ptr, &key, &val) )
+		if ( !strcmp(key, "addr") && val )
+			snprintf(net->addr, sizeof(net->addr), "%s", val);
+		else if ( !strcmp(key, "id") && val &&
+		          (net->stream = strtol(val, &end, 0)) >= 0 && net->stream <= UINT16_MAX &&
+		          !*end )
+			continue;
+		else if ( !strcmp(key, "pkt") && val && (net->pkt = size_dec(val)) >= 4 &&
+		          net->pkt <= DSA_NET_PKT_MAX )
+			continue;
+		else if ( !strcmp(key, "len") && val && (net->len = size_dec(val)) > 0 )
+			continue;
+		else if ( !strcmp(key, "time") && val )
+			net->time = strtoull(val, NULL, 0);
+		else if ( !strcmp(key, "rate") && val )
+			net->rate = strtoul(val, NULL, 0);
+		else if ( !strcmp(key, "wait") && val )
+			net->take.wait = strtol(val, NULL, 0);
+		else if ( !strcmp(key, "idle") && val )
+			net->take.idle = strtol(val, NULL, 0);
+		else if ( !strcmp(key, "jitter") && val )
+			net->take.jitter = size_dec(val);
+		else if ( !strcmp(key, "ring") && val && (net->ring = size_dec(val)) > 0 )
+			continue;
+		else if ( !strcmp(key, "fill") && val && !strcmp(val, "zero") )
+			net->take.fill = DSA_NET_FILL_ZERO;
+		else if ( !strcmp(key, "fill") && val && !strcmp(val, "last") )
+			net->take.fill = DSA_NET_FILL_LAST;
+		else
+		{
+			LOG_ERROR("%s: invalid option '%s', use id=N, pkt=bytes, len=N, wait=ms, "
+			          "idle=ms, jitter=N, ring=N, fill=zero|last\n", name, key);
+			errno = EINVAL;
+			return -1;
+		}
+
+	if ( !net->addr[0] )
+	{
+		LOG_ERROR("%s: no address given\n", name);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static long fmt_net_size (int type, int chan, const char *opts)
+{
+	struct fmt_net  net;
+
+	if ( fmt_net_opts(&net, type, opts) < 0 )
+		return -1;
+
+	if ( !net.len )
+	{
+		LOG_ERROR("%s: give len=samples or a buffer size\n", net.addr);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return net.len * fmt_width(chan);
+}
+
+// Fill the buffer from the stream's jitter buffer, which the source's thread keeps in
+// sample index order between reads, so a stream carries on over many.  A single channel
+// received feeds each channel read; two map across, a packed buffer taking its own.
+// Waits wait= ms for the stream to start (default forever) and gathers jitter= samples
+// before taking any; samples lost, or not come after idle= ms (default 1000), are filled
+// as fill= says, zero or repeating the last.
+static int fmt_net_read (int type, void *buff, size_t size, int chan, int lsh,
+                         const char *opts)
+{
+	struct fmt_net   net;
+	struct dsa_net  *src;
+	int              slot[2] = { -1, -1 };
+	int              c;
+
+	if ( fmt_net_opts(&net, type, opts) < 0 )
+		return -1;
+	if ( !(src = dsa_net_source(net.addr, type, net.stream, net.ring)) )
+		return -1;
+
+	if ( chan & DC_PACKED )
+		slot[0] = chan & DC_CHAN_2 ? 1 : 0;
+	else
+		for ( c = 0; c < 2; c++ )
+			if ( (chan & DC_CHAN_IDX_TO_MASK(c)) || !(chan & (DC_CHAN_1|DC_CHAN_2)) )
+				slot[c] = c;
+
+	if ( dsa_net_take(src, buff, fmt_width(chan) / sizeof(uint16_t), slot, lsh,
+	                  size / fmt_width(chan), &net.take) < 0 )
+	{
+		if ( errno == ETIMEDOUT )
+			LOG_ERROR("%s: no data\n", net.addr);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Send the buffer as one segment, straight from it: a whole period at a time for both
+// channels or a packed buffer, else gathering the one channel's words
+static int fmt_net_write (int type, void *buff, size_t size, int chan, const char *opts)
+{
+	struct fmt_net      net;
+	struct dsa_net     *snk;
+	const uint8_t      *smp   = buff;
+	size_t              width = fmt_width(chan);
+	unsigned long long  lost;
+	int                 chans;
+
+	if ( fmt_net_opts(&net, type, opts) < 0 )
+		return -1;
+
+	if ( chan & DC_PACKED )
+		chans = chan & DC_CHAN_2 ? 2 : 1;
+	else if ( (chans = (chan & (DC_CHAN_1|DC_CHAN_2)) / DC_CHAN_1) == 1 )
+		width = sizeof(struct dsa_sample);
+	else if ( chans == 2 )
+	{
+		smp  += sizeof(struct dsa_sample);
+		width = sizeof(struct dsa_sample);
+	}
+	else
+		chans = 3;
+
+	if ( !(snk = dsa_net_sink(net.addr, type, net.stream < 0 ? 0 : net.stream)) )
+		return -1;
+
+	lost = snk->stats.lost;
+	if ( dsa_net_send(snk, smp, fmt_width(chan), width, size / fmt_width(chan), chans,
+	                  net.pkt, net.time, net.rate) < 0 )
+		return -1;
+	if ( snk->stats.lost > lost )
+		LOG_WARN("%s: %llu packets dropped\n", net.addr, snk->stats.lost - lost);
+
+	return 0;
+}
+
+static long fmt_udp_size (FILE *fp, int chan, const char *opts)
+{
+	return fmt_net_size(SOCK_DGRAM, chan, opts);
+}
+
+static int fmt_udp_read (FILE *fp, void *buff, size_t size, int chan, int lsh,
+                         const char *opts)
+{
+	return fmt_net_read(SOCK_DGRAM, buff, size, chan, lsh, opts);
+}
+
+static int fmt_udp_write (FILE *fp, void *buff, size_t size, int chan, const char *opts)
+{
+	return fmt_net_write(SOCK_DGRAM, buff, size, chan, opts);
+}
+
+static long fmt_tcp_size (FILE *fp, int chan, const char *opts)
+{
+	return fmt_net_size(SOCK_STREAM, chan, opts);
+}
+
+static int fmt_tcp_read (FILE *fp, void *buff, size_t size, int chan, int lsh,
+                         const char *opts)
+{
+	return fmt_net_read(SOCK_STREAM, buff, size, chan, lsh, opts);
+}
+
+static int fmt_tcp_write (FILE *fp, void *buff, size_t size, int chan, const char *opts)
+{
+	return fmt_net_write(SOCK_STREAM, buff, size, chan, opts);
+}
+
 
 static struct format format_list[] =
 {
-	{ "bin",   "",  fmt_bin_size,   fmt_bin_read,   fmt_bin_write   },
-	{ "hex",   "",  NULL,           NULL,           fmt_hex_write   },
-	{ "bist",  "",  fmt_bist_size,  fmt_bist_read,  fmt_bist_write  },
-	{ "null",  "",  NULL,           NULL,           fmt_null_write  },
-	{ "dec",   "",  fmt_dec_size,   fmt_dec_read,   fmt_dec_write   },
-	{ "iqw",   "",  fmt_iqw_size,   fmt_iqw_read,   fmt_iqw_write   },
-	{ "bit",   "",  NULL,           NULL,           fmt_bit_write  },
+	{ "bin",   "",  fmt_bin_size,   fmt_bin_read,   fmt_bin_write,   NULL,          FMT_F_PACK                       },
+	{ "hex",   "",  NULL,           NULL,           fmt_hex_write,   NULL,          FMT_F_PACK                       },
+	{ "bist",  "",  fmt_bist_size,  fmt_bist_read,  fmt_bist_write,  NULL,          0                                },
+	{ "null",  "",  NULL,           NULL,           fmt_null_write,  NULL,          FMT_F_PACK                       },
+	{ "dec",   "",  fmt_dec_size,   fmt_dec_read,   fmt_dec_write,   NULL,          0                                },
+	{ "iqw",   "",  fmt_iqw_size,   fmt_iqw_read,   fmt_iqw_write,   fmt_iqw_demux, FMT_F_CHAN|FMT_F_PACK|FMT_F_CORR },
+	{ "p12",   "",  fmt_p12_size,   fmt_p12_read,   fmt_p12_write,   fmt_p12_demux, FMT_F_CHAN|FMT_F_PACK            },
+	{ "bit",   "",  NULL,           NULL,           fmt_bit_write,   NULL,          FMT_F_PACK                       },
+	{ "stats", "",  NULL,           NULL,           fmt_stats_write, NULL,          FMT_F_PACK                       },
+	{ "psd",   "",  NULL,           NULL,           fmt_psd_write,   NULL,          FMT_F_PACK                       },
+	{ "prbs",  "",  NULL,           NULL,           fmt_prbs_write,  NULL,          FMT_F_PACK                       },
+	{ "gen",   "",  fmt_gen_size,   fmt_gen_read,   NULL,            NULL,          FMT_F_CHAN|FMT_F_PACK|FMT_F_GEN  },
+	{ "udp",   "",  fmt_udp_size,   fmt_udp_read,   fmt_udp_write,   NULL,          FMT_F_CHAN|FMT_F_PACK|FMT_F_NET  },
+	{ "tcp",   "",  fmt_tcp_size,   fmt_tcp_read,   fmt_tcp_write,   NULL,          FMT_F_CHAN|FMT_F_PACK|FMT_F_NET  },
 	{ NULL }
 };
 
@@ -594,6 +1926,31 @@ struct format *format_find (const char *name)
 	return NULL;
 }
 
+int format_opt_next (char **ptr, char **key, char **val)
+{
+	char *p = *ptr;
+	char *e;
+
+	while ( *p == ',' )
+		p++;
+	if ( !*p )
+		return 0;
+
+	*key = p;
+	if ( (e = strchr(p, ',')) )
+	{
+		*e++ = '\0';
+		*ptr = e;
+	}
+	else
+		*ptr = p + strlen(p);
+
+	if ( (*val = strchr(p, '=')) )
+		*(*val)++ = '\0';
+
+	return 1;
+}
+
 // Future: guess format from filename extension?
 struct format *format_guess (const char *name)
 {
@@ -620,22 +1977,25 @@ void dsa_format_list(FILE *fp)
 	{
 		fprintf(fp, "  %-7s  ", fmt->name);
 		if ( fmt->read && fmt->write )
-			fprintf(fp, "in/out\n");
+			fprintf(fp, "in/out");
 		else if ( fmt->read )
-			fprintf(fp, "in-only\n");
+			fprintf(fp, "in-only");
 		else
-			fprintf(fp, "out-only\n");
+			fprintf(fp, "out-only");
+		fprintf(fp, "%s\n", (fmt->flags & FMT_F_PACK) ? ", packed ok" : "");
 	}
 }
 
 #ifdef UNIT_TEST
-#include "dsa_common.h"
-
 char *argv0;
 char *opt_in_file    = NULL;
 char *opt_in_format  = NULL;
+char *opt_in_opts    = NULL;
 char *opt_out_file   = NULL;
 char *opt_out_format = NULL;
+char *opt_out_opts   = NULL;
+char  opt_in_net[FMT_OPTS_MAX * 2];
+char  opt_out_net[FMT_OPTS_MAX * 2];
 int   opt_size       = 0;
 int   opt_chan       = 0;
 int   opt_lsh        = 0;
@@ -643,7 +2003,8 @@ int   opt_lsh        = 0;
 static int usage (void)
 {
 
-	printf("Usage: %s [-12lv] [-s size] in-format[:in-file] out-format[:out-file]\n"
+	printf("Usage: %s [-12lv] [-s size] in-format[,opts][:in-file]\n"
+	       "                  out-format[,opts][:out-file]\n"
 	       "Where:\n"
 	       "-1       For single-channel formats like .iqw, use only channel 1\n"
 	       "-2       For single-channel formats like .iqw, use only channel 2\n"
@@ -652,7 +2013,11 @@ static int usage (void)
 	       "-s size  When reading stdin, specify the buffer size.\n"
 	       "\n"
 	       "If in-file is not given or '-' then read from stdin\n"
-	       "If out-file is not given or '-' then write to stdout\n",
+	       "If out-file is not given or '-' then write to stdout\n"
+	       "The gen in-format synthesizes data from its options instead, for example\n"
+	       "\"gen,tone=0.01,len=64K:\"; see dma_streamer_app's buffer options for the rest\n"
+	       "The udp and tcp formats take an address instead: \"udp,len=64K:5500\" receives\n"
+	       "a stream on port 5500, \"udp:host:5500\" sends one there\n",
 	       argv0);
 
 	printf("in-format and out-format should be one of:\n");
@@ -714,6 +2079,8 @@ int main (int argc, char **argv)
 	if ( (opt_in_file = strchr(opt_in_format, ':')) )
 	{
 		*opt_in_file++ = '\0';
+		if ( (opt_in_opts = strchr(opt_in_format, ',')) )
+			*opt_in_opts++ = '\0';
 		in_format = format_find(opt_in_format);
 	}
 	else if ( (in_format = format_find(opt_in_format)) )
@@ -738,6 +2105,8 @@ int main (int argc, char **argv)
 	if ( (opt_out_file = strchr(opt_out_format, ':')) )
 	{
 		*opt_out_file++ = '\0';
+		if ( (opt_out_opts = strchr(opt_out_format, ',')) )
+			*opt_out_opts++ = '\0';
 		out_format = format_find(opt_out_format);
 	}
 	else if ( (out_format = format_find(opt_out_format)) )
@@ -750,23 +2119,39 @@ int main (int argc, char **argv)
 	if ( !out_format || !out_format->write )
 		return usage();
 
+	// network formats take the address as an option
+	if ( in_format->flags & FMT_F_NET )
+	{
+		snprintf(opt_in_net, sizeof(opt_in_net), "addr=%s,%s", opt_in_file,
+		         opt_in_opts ? opt_in_opts : "");
+		opt_in_opts = opt_in_net;
+	}
+	if ( out_format->flags & FMT_F_NET )
+	{
+		snprintf(opt_out_net, sizeof(opt_out_net), "addr=%s,%s", opt_out_file,
+		         opt_out_opts ? opt_out_opts : "");
+		opt_out_opts = opt_out_net;
+	}
+
 	LOG_DEBUG("opt_in_format '%s' and opt_in_file '%s'\n", in_format->name, opt_in_file);
 	LOG_DEBUG("opt_out_format '%s' and opt_out_file '%s'\n", out_format->name, opt_out_file);
 	
 	FILE *in_file;
-	if ( !strcmp(opt_in_file, "-") )
+	if ( in_format->flags & (FMT_F_GEN|FMT_F_NET) )
+		in_file = NULL;
+	else if ( !strcmp(opt_in_file, "-") )
 		in_file = stdin;
 	else if ( !(in_file = fopen(opt_in_file, "r")) )
 		stop("fopen(%s, r)", opt_in_file);
 
 	if ( !opt_size )
 	{
-		if ( !strcmp(opt_in_file, "-") )
+		if ( in_file == stdin )
 			stop("Specify size with -s when using stdin");
 		if ( !in_format->size )
 			stop("Specify size with -s when using %s", opt_in_format);
 
-		if ( (opt_size = format_size(in_format, in_file, opt_chan)) < 1 )
+		if ( (opt_size = format_size(in_format, in_file, opt_chan, opt_in_opts)) < 1 )
 			stop("format_%s_size(%s)", opt_in_format, opt_in_file);
 	}
 
@@ -780,26 +2165,29 @@ int main (int argc, char **argv)
 	if ( !buff )
 		stop("failed to alloc buffer");
 
-	if ( format_read(in_format, in_file, buff, opt_size, opt_chan, opt_lsh) < 0 )
+	if ( format_read(in_format, in_file, buff, opt_size, opt_chan, opt_lsh, opt_in_opts) < 0 )
 		stop("format_%s_read()", opt_in_format);
 	
-	if ( in_file != stdin )
+	if ( in_file && in_file != stdin )
 		fclose(in_file);
 	in_file = NULL;
 
 	FILE *out_file;
-	if ( !strcmp(opt_out_file, "-") )
+	if ( out_format->flags & FMT_F_NET )
+		out_file = NULL;
+	else if ( !strcmp(opt_out_file, "-") )
 		out_file = stdout;
 	else if ( !(out_file = fopen(opt_out_file, "w")) )
 		stop("fopen(%s, r)", opt_out_file);
 
-	if ( format_write(out_format, out_file, buff, opt_size, opt_chan) < 0 )
+	if ( format_write(out_format, out_file, buff, opt_size, opt_chan, opt_out_opts) < 0 )
 		stop("format_%s_write()", opt_out_format);
 	
-	if ( out_file != stdout )
+	if ( out_file && out_file != stdout )
 		fclose(out_file);
 	out_file = NULL;
 
+	dsa_net_done();
 	free(buff);
 	return 0;
 }
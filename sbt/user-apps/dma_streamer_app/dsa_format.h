@@ -19,9 +19,35 @@
 #define _DSA_FORMAT_H_
 
 
-typedef long (* format_size_fn)   (FILE *fp, int chan);
-typedef int  (* format_read_fn)   (FILE *fp, void *buff, size_t size, int chan, int lsh);
-typedef int  (* format_write_fn)  (FILE *fp, void *buff, size_t size, int chan);
+typedef long (* format_size_fn)   (FILE *fp, int chan, const char *opts);
+typedef int  (* format_read_fn)   (FILE *fp, void *buff, size_t size, int chan, int lsh,
+                                   const char *opts);
+typedef int  (* format_write_fn)  (FILE *fp, void *buff, size_t size, int chan,
+                                   const char *opts);
+typedef int  (* format_demux_fn)  (FILE **fp, void *buff, size_t size, const char *opts);
+
+// format reads a single channel given in the chan mask, leaving the other intact; formats
+// without this flag fill both channels of the buffer
+#define FMT_F_CHAN  0x01
+
+// format handles packed single-channel buffers, given DC_PACKED in the chan mask; size
+// methods return the buffer bytes in that layout
+#define FMT_F_PACK  0x02
+
+// format takes a corr= option and corrects DC and I/Q balance itself while converting
+#define FMT_F_CORR  0x04
+
+// format synthesizes its data from its options: there's no file to open, size and read
+// methods are passed a NULL fp
+#define FMT_F_GEN   0x08
+
+// format streams over the network: the location is an address rather than a file, so
+// there's none to open; methods are passed a NULL fp and the address as an "addr=" option
+// ahead of the rest
+#define FMT_F_NET   0x10
+
+// longest options string for a format, given as "format,opts:filename"
+#define FMT_OPTS_MAX  128
 
 
 struct format
@@ -31,14 +57,21 @@ struct format
 	format_size_fn   size;
 	format_read_fn   read;
 	format_write_fn  write;
+	format_demux_fn  demux;
+	unsigned         flags;
 };
 
 
 struct format *format_find (const char *name);
 struct format *format_guess (const char *name);
 
+// step through a format's options string, a comma-separated list of key or key=value
+// items.  *ptr starts at a writable copy of the options; returns 1 with key and val set
+// (val NULL if no '=' given), or 0 at the end.
+int format_opt_next (char **ptr, char **key, char **val);
 
-static inline int format_size (struct format *fmt, FILE *fp, int chan)
+
+static inline int format_size (struct format *fmt, FILE *fp, int chan, const char *opts)
 {
 	if ( !fmt || !fmt->size )
 	{
@@ -46,11 +79,11 @@ static inline int format_size (struct format *fmt, FILE *fp, int chan)
 		return -1;
 	}
 
-	return fmt->size(fp, chan);
+	return fmt->size(fp, chan, opts);
 }
 
 static inline int format_read (struct format *fmt, FILE *fp, void *buff, size_t size,
-                               int chan, int lsh)
+                               int chan, int lsh, const char *opts)
 {
 	if ( !fmt || !fmt->read )
 	{
@@ -58,11 +91,11 @@ static inline int format_read (struct format *fmt, FILE *fp, void *buff, size_t
 		return -1;
 	}
 
-	return fmt->read(fp, buff, size, chan, lsh);
+	return fmt->read(fp, buff, size, chan, lsh, opts);
 }
 
 static inline int format_write (struct format *fmt, FILE *fp, void *buff, size_t size,
-                                int chan)
+                                int chan, const char *opts)
 {
 	if ( !fmt || !fmt->write )
 	{
@@ -70,7 +103,21 @@ static inline int format_write (struct format *fmt, FILE *fp, void *buff, size_t
 		return -1;
 	}
 
-	return fmt->write(fp, buff, size, chan);
+	return fmt->write(fp, buff, size, chan, opts);
+}
+
+// Write both channels of a buffer to separate files in one pass: fp[0] receives channel 1
+// and fp[1] channel 2, either may be NULL.
+static inline int format_demux (struct format *fmt, FILE **fp, void *buff, size_t size,
+                                const char *opts)
+{
+	if ( !fmt || !fmt->demux )
+	{
+		errno = ENOSYS;
+		return -1;
+	}
+
+	return fmt->demux(fp, buff, size, opts);
 }
 
 
@@ -0,0 +1,673 @@
+/** \file      dsa_gen.c
+ *  \brief     implementation of the TX waveform synthesizer behind the gen format
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <pthread.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GEN_NEON 1
+#endif
+
+#include "dsa_common.h"
+#include "dsa_format.h"
+#include "dsa_fft.h"
+#include "dsa_gen.h"
+#include "dsa_prbs.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("gen", LOG_LEVEL_INFO);
+
+
+#define GEN_LUT    (1 << DSA_GEN_LUT_BITS)
+#define GEN_CYCLE  4294967296.0
+#define GEN_FFT    1024
+
+
+// sine over a cycle and a quarter, so the cosine of index idx is at idx + GEN_LUT / 4
+static float           gen_lut[GEN_LUT + GEN_LUT / 4];
+static pthread_once_t  gen_lut_once = PTHREAD_ONCE_INIT;
+
+
+// cycles to a 2^32-per-cycle phase or phase step; negative values wrap
+static inline uint32_t gen_phase (double cycles)
+{
+	return (uint32_t)(int64_t)llround(cycles * GEN_CYCLE);
+}
+
+static inline uint32_t gen_rand (uint32_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+
+int dsa_gen_prbs (uint32_t *lfsr, unsigned order)
+{
+	int  tap;
+	int  bit;
+
+	if ( (tap = dsa_prbs_tap(order)) < 0 )
+		return -1;
+
+	bit   = ((*lfsr >> (order - 1)) ^ (*lfsr >> (tap - 1))) & 1;
+	*lfsr = ((*lfsr << 1) | bit) & ((1UL << order) - 1);
+	return bit;
+}
+
+
+// phases for num samples of a tone, from phase by step
+static void gen_ramp (uint32_t *ph, uint32_t phase, uint32_t step, size_t num)
+{
+#ifdef GEN_NEON
+	uint32_t    init[4] = { phase, phase + step, phase + step * 2, phase + step * 3 };
+	uint32x4_t  vec     = vld1q_u32(init);
+	uint32x4_t  inc     = vdupq_n_u32(step * 4);
+
+	for ( ; num >= 4; num -= 4, ph += 4, phase += step * 4 )
+	{
+		vst1q_u32(ph, vec);
+		vec = vaddq_u32(vec, inc);
+	}
+#endif
+
+	while ( num-- )
+	{
+		*ph++  = phase;
+		phase += step;
+	}
+}
+
+// add amp * cos/sin of num phases to i/q through the table
+static void gen_lut_add_ref (float *i, float *q, const uint32_t *ph, size_t num, float amp)
+{
+	uint32_t  idx;
+
+	while ( num-- )
+	{
+		idx   = *ph++ >> (32 - DSA_GEN_LUT_BITS);
+		*i++ += amp * gen_lut[idx + GEN_LUT / 4];
+		*q++ += amp * gen_lut[idx];
+	}
+}
+
+// scale num samples of x to 12-bit words, clamping to full scale; returns the number
+// clamped.  Offsetting by 2048.5 keeps the value positive, so truncating rounds it, and
+// the offset comes back out as the sign bit.
+static unsigned gen_words_ref (uint16_t *w, const float *x, size_t num, int lsh)
+{
+	unsigned  clip = 0;
+	uint16_t  s;
+	float     v;
+
+	while ( num-- )
+	{
+		v = *x++ * 2048.0f + 2048.5f;
+		if ( v < 0.5f )
+		{
+			v = 0.5f;
+			clip++;
+		}
+		else if ( v > 4095.5f )
+		{
+			v = 4095.5f;
+			clip++;
+		}
+
+		s    = (uint16_t)v ^ 0x800;
+		*w++ = lsh ? s << 4 : s;
+	}
+
+	return clip;
+}
+
+#ifdef GEN_NEON
+// no gather on NEON: the phases are shifted to indices four at a time, and the table
+// values loaded a lane at a time
+static void gen_lut_add_neon (float *i, float *q, const uint32_t *ph, size_t num,
+                              float amp)
+{
+	const float  *cos = gen_lut + GEN_LUT / 4;
+	uint32_t      idx[4];
+	float32x4_t   s;
+	float32x4_t   c;
+
+	for ( ; num >= 4; num -= 4, ph += 4, i += 4, q += 4 )
+	{
+		vst1q_u32(idx, vshrq_n_u32(vld1q_u32(ph), 32 - DSA_GEN_LUT_BITS));
+
+		s = vld1q_dup_f32(&gen_lut[idx[0]]);
+		s = vld1q_lane_f32(&gen_lut[idx[1]], s, 1);
+		s = vld1q_lane_f32(&gen_lut[idx[2]], s, 2);
+		s = vld1q_lane_f32(&gen_lut[idx[3]], s, 3);
+		c = vld1q_dup_f32(&cos[idx[0]]);
+		c = vld1q_lane_f32(&cos[idx[1]], c, 1);
+		c = vld1q_lane_f32(&cos[idx[2]], c, 2);
+		c = vld1q_lane_f32(&cos[idx[3]], c, 3);
+
+		vst1q_f32(i, vmlaq_n_f32(vld1q_f32(i), c, amp));
+		vst1q_f32(q, vmlaq_n_f32(vld1q_f32(q), s, amp));
+	}
+
+	gen_lut_add_ref(i, q, ph, num, amp);
+}
+
+static unsigned gen_words_neon (uint16_t *w, const float *x, size_t num, int lsh)
+{
+	float32x4_t  lo   = vdupq_n_f32(0.5f);
+	float32x4_t  hi   = vdupq_n_f32(4095.5f);
+	float32x4_t  ofs  = vdupq_n_f32(2048.5f);
+	uint32x4_t   clip = vdupq_n_u32(0);
+	uint16x8_t   sign = vdupq_n_u16(0x800);
+	uint16x8_t   s;
+	float32x4_t  v0;
+	float32x4_t  v1;
+
+	for ( ; num >= 8; num -= 8, x += 8, w += 8 )
+	{
+		v0 = vmlaq_n_f32(ofs, vld1q_f32(x),     2048.0f);
+		v1 = vmlaq_n_f32(ofs, vld1q_f32(x + 4), 2048.0f);
+
+		// compares give all-ones, -1, in lanes out of range
+		clip = vsubq_u32(clip, vcltq_f32(v0, lo));
+		clip = vsubq_u32(clip, vcgtq_f32(v0, hi));
+		clip = vsubq_u32(clip, vcltq_f32(v1, lo));
+		clip = vsubq_u32(clip, vcgtq_f32(v1, hi));
+
+		v0 = vminq_f32(vmaxq_f32(v0, lo), hi);
+		v1 = vminq_f32(vmaxq_f32(v1, lo), hi);
+		s  = vcombine_u16(vmovn_u32(vcvtq_u32_f32(v0)), vmovn_u32(vcvtq_u32_f32(v1)));
+		s  = veorq_u16(s, sign);
+		if ( lsh )
+			s = vshlq_n_u16(s, 4);
+		vst1q_u16(w, s);
+	}
+
+	return vgetq_lane_u32(clip, 0) + vgetq_lane_u32(clip, 1) +
+	       vgetq_lane_u32(clip, 2) + vgetq_lane_u32(clip, 3) +
+	       gen_words_ref(w, x, num, lsh);
+}
+
+#define gen_lut_add  gen_lut_add_neon
+#define gen_words    gen_words_neon
+#else
+#define gen_lut_add  gen_lut_add_ref
+#define gen_words    gen_words_ref
+#endif
+
+static void gen_lut_init (void)
+{
+	int  n;
+
+	for ( n = 0; n < GEN_LUT + GEN_LUT / 4; n++ )
+		gen_lut[n] = sin(2.0 * M_PI * n / GEN_LUT);
+}
+
+
+static void gen_tone (struct dsa_gen *gen, float *i, float *q, size_t num)
+{
+	uint32_t  ph[DSA_GEN_BLOCK];
+	unsigned  t;
+
+	for ( t = 0; t < gen->tones; t++ )
+	{
+		gen_ramp(ph, gen->phase[t], gen->step[t], num);
+		gen_lut_add(i, q, ph, num, gen->amp / gen->tones);
+		gen->phase[t] += gen->step[t] * num;
+	}
+}
+
+// the phase is quadratic in the sample index k within the sweep, so the step grows by
+// a fixed amount each sample; resynced from the exact phase each block and sweep
+static void gen_chirp (struct dsa_gen *gen, float *i, float *q, size_t num)
+{
+	uint32_t  ph[DSA_GEN_BLOCK];
+	uint32_t  phase = 0;
+	uint32_t  step  = 0;
+	double    rate  = (gen->f1 - gen->f0) / gen->period;
+	uint32_t  accel = gen_phase(rate);
+	size_t    pos   = gen->pos;
+	double    k;
+	double    p;
+	size_t    n;
+
+	for ( n = 0; n < num; n++, pos++ )
+	{
+		if ( !n || !(pos % gen->period) )
+		{
+			k     = pos % gen->period;
+			p     = gen->f0 * k + rate * k * k / 2;
+			phase = gen_phase(p - floor(p));
+			step  = gen_phase(gen->f0 + rate * (k + 0.5));
+		}
+
+		ph[n]  = phase;
+		phase += step;
+		step  += accel;
+	}
+
+	gen_lut_add(i, q, ph, num, gen->amp);
+}
+
+static void gen_qpsk (struct dsa_gen *gen, float *i, float *q, size_t num)
+{
+	float   amp = gen->amp * M_SQRT1_2;
+	size_t  n;
+
+	for ( n = 0; n < num; n++ )
+	{
+		if ( !((gen->pos + n) % gen->sps) )
+		{
+			gen->sym_i = dsa_gen_prbs(&gen->lfsr, gen->prbs) ? -amp : amp;
+			gen->sym_q = dsa_gen_prbs(&gen->lfsr, gen->prbs) ? -amp : amp;
+		}
+
+		i[n] = gen->sym_i;
+		q[n] = gen->sym_q;
+	}
+}
+
+// the PRBS as raw words for the prbs format to check, no waveform: I and Q are each a
+// lane with its own copy of the sequence, Q's started elsewhere in it
+static void gen_bits (struct dsa_gen *gen, uint16_t w[][DSA_GEN_BLOCK], size_t num, int lsh)
+{
+	size_t  n;
+
+	for ( n = 0; n < num; n++ )
+	{
+		w[0][n] = dsa_prbs_word(&gen->lfsr,   gen->prbs) << (lsh ? 4 : 0);
+		w[1][n] = dsa_prbs_word(&gen->lfsr_q, gen->prbs) << (lsh ? 4 : 0);
+	}
+}
+
+// one block of noise: unit tones of random phase on the bins within bw, through the FFT,
+// scaled to an RMS of amp / 4 so peaks are rarely clipped
+static void gen_noise_block (struct dsa_gen *gen)
+{
+	size_t    size = gen->fft->size;
+	long      edge = gen->bw * size / 2;
+	float     scale;
+	uint32_t  idx;
+	long      k;
+
+	if ( edge >= size / 2 )
+		edge = size / 2 - 1;
+	scale = gen->amp / 4 / sqrt(edge * 2 + 1);
+
+	memset(gen->buff, 0, size * 2 * sizeof(float));
+	for ( k = -edge; k <= edge; k++ )
+	{
+		idx = gen_rand(&gen->rand) >> (32 - DSA_GEN_LUT_BITS);
+		gen->buff[((k + size) % size) * 2]     = scale * gen_lut[idx + GEN_LUT / 4];
+		gen->buff[((k + size) % size) * 2 + 1] = scale * gen_lut[idx];
+	}
+
+	dsa_fft_run(gen->fft, gen->buff);
+}
+
+static void gen_noise (struct dsa_gen *gen, float *i, float *q, size_t num)
+{
+	size_t  ofs;
+	size_t  n;
+
+	for ( n = 0; n < num; n++ )
+	{
+		if ( !(ofs = (gen->pos + n) % gen->fft->size) )
+			gen_noise_block(gen);
+
+		i[n] = gen->buff[ofs * 2];
+		q[n] = gen->buff[ofs * 2 + 1];
+	}
+}
+
+
+// up to max frequencies in cycles per sample, separated by '/'; returns the number
+// parsed or <0 on error
+static int gen_freqs (double *f, int max, const char *val)
+{
+	char *end;
+	int   num = 0;
+
+	do
+	{
+		if ( num >= max )
+			return -1;
+
+		f[num] = strtod(val, &end);
+		if ( end == val || f[num] < -0.5 || f[num] > 0.5 )
+			return -1;
+
+		val = end + 1;
+		num++;
+	}
+	while ( *end == '/' );
+
+	return *end ? -1 : num;
+}
+
+int dsa_gen_init (struct dsa_gen *gen, const char *opts)
+{
+	double  f[DSA_GEN_TONES];
+	size_t  fft   = GEN_FFT;
+	int     kinds = 0;
+	char    copy[FMT_OPTS_MAX];
+	char   *ptr = copy;
+	char   *key;
+	char   *val;
+	char   *end;
+	int     num = 0;
+	int     t;
+
+	pthread_once(&gen_lut_once, gen_lut_init);
+
+	memset(gen, 0, sizeof(*gen));
+	gen->amp  = 0.5;
+	gen->prbs = 15;
+	gen->rand = 1;
+
+	snprintf(copy, sizeof(copy), "%s", opts ? opts : "");
+	while ( format_opt_next(&ptr, &key, &val) )
+	{
+		errno = 0;
+		if ( !val )
+			goto invalid;
+		else if ( !strcmp(key, "tone") )
+		{
+			if ( (num = gen_freqs(f, DSA_GEN_TONES, val)) < 1 )
+				goto invalid;
+			gen->kind = DSA_GEN_TONE;
+			kinds++;
+		}
+		else if ( !strcmp(key, "chirp") )
+		{
+			if ( gen_freqs(f, 2, val) != 2 )
+				goto invalid;
+			gen->kind = DSA_GEN_CHIRP;
+			gen->f0   = f[0];
+			gen->f1   = f[1];
+			kinds++;
+		}
+		else if ( !strcmp(key, "qpsk") )
+		{
+			gen->sps = strtoul(val, &end, 0);
+			if ( errno || *end || gen->sps < 1 )
+				goto invalid;
+			gen->kind = DSA_GEN_QPSK;
+			kinds++;
+		}
+		else if ( !strcmp(key, "bits") )
+		{
+			gen->prbs = strtoul(val, &end, 0);
+			if ( *end || dsa_prbs_tap(gen->prbs) < 0 )
+				goto invalid;
+			gen->kind = DSA_GEN_BITS;
+			kinds++;
+		}
+		else if ( !strcmp(key, "noise") )
+		{
+			gen->bw = strtod(val, &end);
+			if ( *end || gen->bw <= 0.0 || gen->bw > 1.0 )
+				goto invalid;
+			gen->kind = DSA_GEN_NOISE;
+			kinds++;
+		}
+		else if ( !strcmp(key, "amp") )
+		{
+			gen->amp = strtod(val, &end);
+			if ( *end || gen->amp <= 0.0 || gen->amp > 1.0 )
+				goto invalid;
+		}
+		else if ( !strcmp(key, "len") )
+		{
+			if ( (gen->len = size_dec(val)) < 1 )
+				goto invalid;
+		}
+		else if ( !strcmp(key, "period") )
+		{
+			if ( (gen->period = size_dec(val)) < 1 )
+				goto invalid;
+		}
+		else if ( !strcmp(key, "prbs") )
+		{
+			gen->prbs = strtoul(val, &end, 0);
+			if ( *end || dsa_prbs_tap(gen->prbs) < 0 )
+				goto invalid;
+		}
+		else if ( !strcmp(key, "fft") )
+		{
+			fft = strtoul(val, &end, 0);
+			if ( *end || fft < DSA_FFT_MIN || fft > DSA_FFT_MAX || (fft & (fft - 1)) )
+				goto invalid;
+		}
+		else if ( !strcmp(key, "seed") )
+		{
+			gen->rand = strtoul(val, &end, 0);
+			if ( errno || *end || !gen->rand )
+				goto invalid;
+		}
+		else
+			goto invalid;
+	}
+
+	if ( kinds != 1 )
+	{
+		LOG_ERROR("gen: give one of tone=, chirp=, qpsk=, noise=, or bits=\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	switch ( gen->kind )
+	{
+		case DSA_GEN_TONE:
+			gen->tones = num;
+			for ( t = 0; t < num; t++ )
+				gen->step[t] = gen_phase(f[t]);
+			break;
+
+		case DSA_GEN_CHIRP:
+			break;
+
+		case DSA_GEN_QPSK:
+			gen->lfsr = (1UL << gen->prbs) - 1;
+			break;
+
+		case DSA_GEN_BITS:
+			gen->lfsr   = (1UL << gen->prbs) - 1;
+			gen->lfsr_q = gen->lfsr - 1;
+			break;
+
+		case DSA_GEN_NOISE:
+			if ( gen->bw * fft / 2 < 1.0 )
+			{
+				LOG_ERROR("gen: noise bandwidth under one bin, use a larger fft=\n");
+				errno = EINVAL;
+				return -1;
+			}
+			if ( !(gen->fft = dsa_fft_init(fft)) ||
+			     !(gen->buff = malloc(fft * 2 * sizeof(float))) )
+			{
+				dsa_gen_free(gen);
+				return -1;
+			}
+			break;
+	}
+
+	return 0;
+
+invalid:
+	LOG_ERROR("gen: invalid option '%s%s%s', see usage for tone=, chirp=, qpsk=, noise=, "
+	          "bits=, amp=, len=, period=, prbs=, fft=, seed=\n", key, val ? "=" : "",
+	          val ? val : "");
+	errno = EINVAL;
+	return -1;
+}
+
+int dsa_gen_run (struct dsa_gen *gen, uint16_t *d, size_t stride, size_t num, int lanes,
+                 int lsh)
+{
+	float     i[DSA_GEN_BLOCK];
+	float     q[DSA_GEN_BLOCK];
+	uint16_t  w[2][DSA_GEN_BLOCK];
+	size_t    want;
+	size_t    n;
+	int       l;
+
+	if ( gen->kind == DSA_GEN_CHIRP && !gen->period )
+		gen->period = num;
+
+	while ( num )
+	{
+		want = num < DSA_GEN_BLOCK ? num : DSA_GEN_BLOCK;
+		memset(i, 0, sizeof(i));
+		memset(q, 0, sizeof(q));
+
+		switch ( gen->kind )
+		{
+			case DSA_GEN_TONE:  gen_tone(gen, i, q, want);  break;
+			case DSA_GEN_CHIRP: gen_chirp(gen, i, q, want); break;
+			case DSA_GEN_QPSK:  gen_qpsk(gen, i, q, want);  break;
+			case DSA_GEN_NOISE: gen_noise(gen, i, q, want); break;
+			case DSA_GEN_BITS:  gen_bits(gen, w, want, lsh); break;
+		}
+
+		if ( gen->kind != DSA_GEN_BITS )
+		{
+			gen->clip += gen_words(w[0], i, want, lsh);
+			gen->clip += gen_words(w[1], q, want, lsh);
+		}
+
+		// even lanes are I, odd are Q
+		for ( l = 0; l < stride; l++ )
+			if ( lanes & (1 << l) )
+				for ( n = 0; n < want; n++ )
+					d[n * stride + l] = w[l & 1][n];
+
+		d        += want * stride;
+		num      -= want;
+		gen->pos += want;
+	}
+
+	return 0;
+}
+
+void dsa_gen_free (struct dsa_gen *gen)
+{
+	if ( gen->fft )
+		dsa_fft_free(gen->fft);
+	free(gen->buff);
+	gen->fft  = NULL;
+	gen->buff = NULL;
+}
+
+
+#ifdef GEN_TEST
+// Check of the synthesis kernels against the scalar references, which is only a real
+// check when built for NEON, on a sweep through the table, then of the table against
+// libm and of the words' rounding and clamping.
+int main (int argc, char **argv)
+{
+	float     i[2][DSA_GEN_BLOCK];
+	float     q[2][DSA_GEN_BLOCK];
+	uint16_t  w[2][DSA_GEN_BLOCK];
+	uint32_t  ph[DSA_GEN_BLOCK];
+	unsigned  clip[2];
+	double    err = 0;
+	double    ang;
+	size_t    num = DSA_GEN_BLOCK - 1;
+	size_t    n;
+
+	log_dupe(stdout);
+	setbuf(stdout, NULL);
+
+	pthread_once(&gen_lut_once, gen_lut_init);
+
+	// odd length, so the scalar tails run too
+	gen_ramp(ph, 12345, 0x1234567, num);
+	for ( n = 0; n < num; n++ )
+		if ( ph[n] != 12345 + 0x1234567 * (uint32_t)n )
+		{
+			printf("FAIL: phase %zu is %08x\n", n, ph[n]);
+			return 1;
+		}
+
+	memset(i, 0, sizeof(i));
+	memset(q, 0, sizeof(q));
+	gen_lut_add_ref(i[0], q[0], ph, num, 1.25);
+	gen_lut_add(i[1], q[1], ph, num, 1.25);
+	for ( n = 0; n < num; n++ )
+	{
+		if ( fabsf(i[0][n] - i[1][n]) > 1e-6 || fabsf(q[0][n] - q[1][n]) > 1e-6 )
+		{
+			printf("FAIL: sample %zu is %g/%g, reference %g/%g\n", n, i[1][n], q[1][n],
+			       i[0][n], q[0][n]);
+			return 1;
+		}
+
+		ang = 2.0 * M_PI * ph[n] / GEN_CYCLE;
+		err = fmax(err, fabs(i[0][n] - 1.25 * cos(ang)));
+		err = fmax(err, fabs(q[0][n] - 1.25 * sin(ang)));
+	}
+	printf("table error %.3g over %zu samples\n", err, num);
+	if ( err > 1.25 * 2.0 * M_PI / GEN_LUT )
+	{
+		printf("FAIL: table error over one step\n");
+		return 1;
+	}
+
+	// at 1.25 times full scale the samples around each peak clamp
+	clip[0] = gen_words_ref(w[0], i[0], num, 1);
+	clip[1] = gen_words(w[1], i[0], num, 1);
+	printf("clipped %u, reference %u\n", clip[1], clip[0]);
+	if ( clip[0] != clip[1] || memcmp(w[0], w[1], num * sizeof(uint16_t)) )
+	{
+		printf("FAIL: words disagree with the reference\n");
+		return 1;
+	}
+	for ( n = 0; n < num; n++ )
+		if ( (i[0][n] >= 1.0f && w[0][n] != 0x7FF0) || (i[0][n] <= -1.0f && w[0][n] != 0x8000) )
+		{
+			printf("FAIL: %g clamped to %04x\n", i[0][n], w[0][n]);
+			return 1;
+		}
+	if ( !clip[0] || clip[0] == num )
+	{
+		printf("FAIL: expected some clipped and some not\n");
+		return 1;
+	}
+
+	i[0][0] = 0.0f;
+	i[0][1] = 1.0f / 2048;
+	i[0][2] = -1.0f / 2048;
+	i[0][3] = 0.4f / 2048;
+	if ( gen_words_ref(w[0], i[0], 4, 0) || w[0][0] != 0x000 || w[0][1] != 0x001 ||
+	     w[0][2] != 0xFFF || w[0][3] != 0x000 )
+	{
+		printf("FAIL: rounding gave %03x %03x %03x %03x\n", w[0][0], w[0][1], w[0][2],
+		       w[0][3]);
+		return 1;
+	}
+
+	printf("PASS\n");
+	return 0;
+}
+#endif
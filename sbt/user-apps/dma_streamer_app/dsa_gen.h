@@ -0,0 +1,91 @@
+/** \file      dsa_gen.h
+ *  \brief     interfaces for the TX waveform synthesizer behind the gen format
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_DSA_GEN_H_
+#define _INCLUDE_DSA_GEN_H_
+#include <stdint.h>
+#include <stddef.h>
+
+#include "dsa_fft.h"
+
+
+#define DSA_GEN_BLOCK     256   // samples synthesized per block
+#define DSA_GEN_TONES     16
+#define DSA_GEN_LUT_BITS  12    // sine table of 2^bits entries, indexed by phase
+
+
+enum dsa_gen_kind
+{
+	DSA_GEN_TONE,
+	DSA_GEN_CHIRP,
+	DSA_GEN_QPSK,
+	DSA_GEN_NOISE,
+	DSA_GEN_BITS,
+};
+
+// a waveform set up from the gen format's options.  Frequencies are in cycles per
+// sample, so relative to the sample rate, and phases are 2^32 per cycle.  The state
+// carries over between dsa_gen_run() calls, so a long waveform can be made in pieces.
+struct dsa_gen
+{
+	enum dsa_gen_kind  kind;
+	float              amp;    // peak, as a fraction of full scale
+	size_t             len;    // samples, to size a buffer from; 0 if not given
+	size_t             pos;    // samples made so far
+	unsigned long      clip;
+
+	// tones
+	unsigned           tones;
+	uint32_t           phase[DSA_GEN_TONES];
+	uint32_t           step[DSA_GEN_TONES];
+
+	// chirp: f0 to f1 over period samples, 0 for the length of the first run
+	double             f0, f1;
+	size_t             period;
+
+	// qpsk: PRBS bits, two per symbol, each symbol held for sps samples; bits: the PRBS
+	// itself, 12 bits per word, Q from lfsr_q
+	unsigned           sps;
+	unsigned           prbs;
+	uint32_t           lfsr;
+	uint32_t           lfsr_q;
+	float              sym_i, sym_q;
+
+	// noise: each fft-sample block sums random-phase tones on the bins within bw
+	double             bw;
+	uint32_t           rand;
+	struct dsa_fft    *fft;
+	float             *buff;
+};
+
+
+// set up gen from a gen format options string; returns 0 on success or <0 on error
+int  dsa_gen_init (struct dsa_gen *gen, const char *opts);
+
+// synthesize num samples into the sample words set in lanes of d, stride 16-bit words
+// apart: lanes has a bit per word, 0x3 for channel 1 I/Q, 0xC for channel 2.  Words are
+// 12-bit two's complement, shifted up 4 bits if lsh.  Returns 0 or <0 on error.
+int  dsa_gen_run (struct dsa_gen *gen, uint16_t *d, size_t stride, size_t num, int lanes,
+                  int lsh);
+
+void dsa_gen_free (struct dsa_gen *gen);
+
+// step a Fibonacci LFSR for PRBS order 7, 15, 23 or 31 (ITU-T O.150 polynomials) and
+// return the new bit; returns -1 for another order
+int  dsa_gen_prbs (uint32_t *lfsr, unsigned order);
+
+#endif // _INCLUDE_DSA_GEN_H_
@@ -72,6 +72,17 @@ int dsa_ioctl_set_timeout (unsigned long timeout)
 	return ret;
 }
 
+int dsa_ioctl_set_timeout_ms (unsigned long ms)
+{
+	int ret;
+
+	errno = 0;
+	if ( (ret = ioctl(dsa_dev, DSM_IOCS_TIMEOUT_MS, ms)) )
+		printf("DSM_IOCS_TIMEOUT_MS %lu: %d: %s\n", ms, ret, strerror(errno));
+
+	return ret;
+}
+
 int dsa_ioctl_trigger (void)
 {
 	int ret;
@@ -92,3 +103,13 @@ int dsa_ioctl_get_stats (struct dsm_user_stats *sb)
 	return ret;
 }
 
+int dsa_ioctl_start_at (struct dsm_user_start *us)
+{
+	int ret;
+
+	errno = 0;
+	if ( (ret = ioctl(dsa_dev, DSM_IOCS_START_AT, us)) )
+		printf("DSM_IOCS_START_AT: %d: %s\n", ret, strerror(errno));
+
+	return ret;
+}
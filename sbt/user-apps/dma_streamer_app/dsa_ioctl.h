@@ -24,8 +24,10 @@ int dsa_ioctl_map (struct dsm_user_buffs *buffs);
 int dsa_ioctl_unmap (void);
 int dsa_ioctl_target_list (unsigned long *mask);
 int dsa_ioctl_set_timeout (unsigned long timeout);
+int dsa_ioctl_set_timeout_ms (unsigned long ms);
 int dsa_ioctl_trigger (void);
 int dsa_ioctl_get_stats (struct dsm_user_stats *sb);
+int dsa_ioctl_start_at (struct dsm_user_start *us);
 
 
 #endif // _INCLUDE_DSA_IOCTL_H_
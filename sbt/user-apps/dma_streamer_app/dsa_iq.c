@@ -0,0 +1,141 @@
+/** \file      dsa_iq.c
+ *  \brief     implementation of I/Q balance measurement and correction
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+#include "dsa_sample.h"
+#include "dsa_iq.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("iq", LOG_LEVEL_INFO);
+
+
+// one chunk's sums in 32 bits, in a simple loop the compiler can vectorize
+static void iq_chunk (struct dsa_iq_acc *acc, const uint16_t *d, size_t stride,
+                      size_t num)
+{
+	int32_t   si = 0, sq = 0;
+	uint32_t  sii = 0, sqq = 0;
+	int32_t   siq = 0;
+	uint32_t  peak = acc->peak;
+	uint32_t  clip = 0;
+	uint32_t  p;
+	int32_t   i, q;
+
+	acc->num += num;
+	for ( ; num; num--, d += stride )
+	{
+		i     = dsa_sample_value(d[0]);
+		q     = dsa_sample_value(d[1]);
+		si   += i;
+		sq   += q;
+		sii  += i * i;
+		sqq  += q * q;
+		siq  += i * q;
+		p     = i * i + q * q;
+		peak  = p > peak ? p : peak;
+		clip += (i <= -2048) | (i >= 2047) | (q <= -2048) | (q >= 2047);
+	}
+
+	acc->si   += si;
+	acc->sq   += sq;
+	acc->sii  += sii;
+	acc->sqq  += sqq;
+	acc->siq  += siq;
+	acc->peak  = peak;
+	acc->clip += clip;
+}
+
+void dsa_iq_sum (struct dsa_iq_acc *acc, const uint16_t *d, size_t stride, size_t num)
+{
+	size_t  want;
+
+	for ( ; num; num -= want, d += want * stride )
+	{
+		want = num < DSA_IQ_CHUNK ? num : DSA_IQ_CHUNK;
+		iq_chunk(acc, d, stride, want);
+	}
+}
+
+void dsa_iq_balance (const struct dsa_iq_acc *acc, struct dsa_iq_bal *bal)
+{
+	double  n  = acc->num ? acc->num : 1;
+	double  mi = acc->si / n;
+	double  mq = acc->sq / n;
+	double  vi = acc->sii / n - mi * mi;
+	double  vq = acc->sqq / n - mq * mq;
+	double  c  = acc->siq / n - mi * mq;
+
+	bal->dc_i  = mi / 2048.0;
+	bal->dc_q  = mq / 2048.0;
+	bal->gain  = vi > 0.0 && vq > 0.0 ? 10.0 * log10(vi / vq) : 0.0;
+	bal->phase = vi > 0.0 && vq > 0.0 ? asin(c / sqrt(vi * vq)) * 180.0 / M_PI : 0.0;
+}
+
+int dsa_iq_corr_parse (struct dsa_iq_bal *bal, const char *spec)
+{
+	char  tail;
+
+	if ( !strcmp(spec, "auto") )
+		return 1;
+
+	if ( sscanf(spec, "%lf/%lf/%lf/%lf%c", &bal->dc_i, &bal->dc_q, &bal->gain,
+	            &bal->phase, &tail) != 4 || fabs(bal->phase) >= 90.0 )
+	{
+		LOG_ERROR("Invalid correction '%s', use auto or dci/dcq/gain/phase\n", spec);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+// Q is taken as (I's amplitude / g) * sin(t + phase): scaling by g and removing the part
+// of I leaked by the phase error leaves cos(phase) * sin(t), hence the 1 / cos(phase)
+void dsa_iq_corr_setup (struct dsa_iq_corr *corr, const struct dsa_iq_bal *bal)
+{
+	double  g = pow(10.0, bal->gain / 20.0);
+	double  p = bal->phase * M_PI / 180.0;
+
+	corr->dc_i = bal->dc_i;
+	corr->dc_q = bal->dc_q;
+	corr->a    = g / cos(p);
+	corr->b    = -tan(p);
+}
+
+void dsa_iq_corr_apply (const struct dsa_iq_corr *corr, uint16_t *dst,
+                        const uint16_t *src, size_t stride, size_t num)
+{
+	float    dc_i = corr->dc_i * 2048.0f;
+	float    dc_q = corr->dc_q * 2048.0f;
+	float    i, q;
+	int32_t  vi, vq;
+
+	for ( ; num; num--, src += stride, dst += stride )
+	{
+		i  = dsa_sample_value(src[0]) - dc_i;
+		q  = corr->a * (dsa_sample_value(src[1]) - dc_q) + corr->b * i;
+		vi = lrintf(i);
+		vq = lrintf(q);
+		dst[0] = vi > 2047 ? 2047 : vi < -2048 ? -2048 : vi;
+		dst[1] = vq > 2047 ? 2047 : vq < -2048 ? -2048 : vq;
+	}
+}
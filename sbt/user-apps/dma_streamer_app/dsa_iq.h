@@ -0,0 +1,75 @@
+/** \file      dsa_iq.h
+ *  \brief     interfaces for I/Q balance measurement and correction
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_DSA_IQ_H_
+#define _INCLUDE_DSA_IQ_H_
+#include <stdint.h>
+#include <stddef.h>
+
+
+// samples summed in 32 bits before adding to the totals: 256 * 2048^2 fits
+#define DSA_IQ_CHUNK  256
+
+
+// sums over one channel's samples, in 12-bit units
+struct dsa_iq_acc
+{
+	int64_t   si, sq;
+	int64_t   sii, sqq, siq;
+	uint32_t  peak;  // largest I^2 + Q^2
+	uint32_t  clip;
+	uint64_t  num;
+};
+
+// DC offset as a fraction of full scale, gain as the I vs Q power in dB, and phase as
+// degrees from quadrature: the units the stats format reports, and -Q takes
+struct dsa_iq_bal
+{
+	double  dc_i;
+	double  dc_q;
+	double  gain;
+	double  phase;
+};
+
+// correction in full-scale units: I' = I - dc_i, Q' = a * (Q - dc_q) + b * I'
+struct dsa_iq_corr
+{
+	float  dc_i;
+	float  dc_q;
+	float  a;
+	float  b;
+};
+
+
+// add num samples of one channel from d, stride 16-bit words apart, to acc
+void dsa_iq_sum (struct dsa_iq_acc *acc, const uint16_t *d, size_t stride, size_t num);
+
+// the balance of the samples summed in acc
+void dsa_iq_balance (const struct dsa_iq_acc *acc, struct dsa_iq_bal *bal);
+
+// parse a correction spec, "auto" or "dci/dcq/gain/phase".  Returns 1 for auto, 0 with
+// bal set for fixed values, or <0 if invalid.
+int  dsa_iq_corr_parse (struct dsa_iq_bal *bal, const char *spec);
+
+// correction which removes the imbalance bal
+void dsa_iq_corr_setup (struct dsa_iq_corr *corr, const struct dsa_iq_bal *bal);
+
+// correct num samples of one channel from src into dst, both stride words apart
+void dsa_iq_corr_apply (const struct dsa_iq_corr *corr, uint16_t *dst,
+                        const uint16_t *src, size_t stride, size_t num);
+
+#endif // _INCLUDE_DSA_IQ_H_
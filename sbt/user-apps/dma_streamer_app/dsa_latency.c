@@ -0,0 +1,370 @@
+/** \file      dsa_latency.c
+ *  \brief     implementation of TX to RX loopback latency measurement
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <math.h>
+#include <errno.h>
+
+#include "dsa_main.h"
+#include "dsa_sample.h"
+#include "dsa_channel.h"
+#include "dsa_command.h"
+#include "dsa_common.h"
+#include "dsa_fft.h"
+#include "dsa_latency.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("latency", LOG_LEVEL_INFO);
+
+
+// The TX buffer is the marker: its FFT is taken once, conjugated, and each RX capture's
+// FFT multiplied by it gives the cross-correlation's.  There's no inverse transform, so
+// the product is conjugated and run forward again, which gives the conjugate of the
+// correlation scaled by the size - the magnitudes are all that's needed.
+struct latency_state
+{
+	const struct dsa_latency_opts *opts;
+	struct dsa_channel_xfer       *tx;
+	struct dsa_channel_xfer       *rx;
+	int                            rx_dev;
+	size_t                         rx_ofs;     // word offset of the RX channel
+	size_t                         rx_stride;  // uint16_t words per RX sample period
+	unsigned long                  rate;       // RX samples/sec, 0 if unknown
+
+	size_t                         mark;       // marker samples
+	size_t                         win;        // RX samples correlated per capture
+	double                         mark_pwr;   // marker energy
+	double                        *pwr;        // RX energy, cumulative, win + 1
+	struct dsa_fft                *fft;
+	float                         *ref;        // conjugate of the marker's FFT
+	float                         *buff;
+
+	double                        *lags;
+	unsigned long                  num;
+	unsigned long                  miss;
+};
+
+
+static volatile sig_atomic_t latency_stop;
+
+static void latency_sigint (int signum)
+{
+	latency_stop = 1;
+}
+
+
+int dsa_latency_parse (struct dsa_latency_opts *opts, char *arg)
+{
+	char *end;
+
+	memset(opts, 0, sizeof(*opts));
+	opts->bin = 1;
+
+	errno = 0;
+	opts->corr = strtod(arg, &end);
+	if ( errno || (*end && *end != ':') || opts->corr <= 0.0 || opts->corr > 1.0 )
+	{
+		LOG_ERROR("Invalid correlation threshold '%s', must be over 0 and up to 1\n", arg);
+		return -1;
+	}
+
+	if ( *end && !(opts->bin = size_dec(end + 1)) )
+	{
+		LOG_ERROR("Invalid histogram bin width '%s', minimum 1 sample\n", end + 1);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+// word offset in a sample period of the channel to correlate on: channel 1 if it has a
+// file or the buffer's packed, else channel 2
+static size_t latency_chan (const struct dsa_channel_xfer *xfer,
+                            struct dsa_channel_sxx * const *sxx)
+{
+	return !xfer->pack && !sxx[0] && sxx[1] ? 2 : 0;
+}
+
+static int latency_setup (struct latency_state *st, struct dsa_channel_event *evt)
+{
+	const uint16_t *d;
+	size_t          stride;
+	size_t          ofs;
+	size_t          size;
+	size_t          i;
+	float           re, im;
+	int             dev;
+
+	for ( dev = 0; dev < 2; dev++ )
+		if ( evt->rx[dev] )
+		{
+			st->rx     = evt->rx[dev];
+			st->rx_dev = dev;
+		}
+	st->tx = evt->tx[0] ? evt->tx[0] : evt->tx[1];
+	if ( (evt->tx[0] && evt->tx[1]) || (evt->rx[0] && evt->rx[1]) || !st->tx || !st->rx )
+	{
+		LOG_ERROR("Latency needs one TX and one RX buffer\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	// correlating the TX buffer against a longer RX window must fit the largest FFT
+	st->mark = st->tx->len;
+	st->win  = st->rx->len;
+	if ( st->win > DSA_FFT_MAX - st->mark )
+		st->win = DSA_FFT_MAX - st->mark;
+	if ( st->mark > DSA_FFT_MAX / 2 || st->win <= st->mark )
+	{
+		LOG_ERROR("Latency needs an RX buffer longer than the TX, and a TX of at most "
+		          "%d samples\n", DSA_FFT_MAX / 2);
+		errno = EINVAL;
+		return -1;
+	}
+
+	st->rate = dsa_active_rates[st->rx_dev * 2 + 1];
+	dev      = evt->tx[1] ? 1 : 0;
+	if ( st->rate && dsa_active_rates[dev * 2] && dsa_active_rates[dev * 2] != st->rate )
+	{
+		LOG_ERROR("Latency needs TX and RX at the same rate, not %lu and %lu\n",
+		          dsa_active_rates[dev * 2], st->rate);
+		errno = EINVAL;
+		return -1;
+	}
+
+	for ( size = DSA_FFT_MIN; size < st->win + st->mark; size <<= 1 )
+		;
+	if ( !(st->fft = dsa_fft_init(size)) )
+		return -1;
+
+	st->ref  = malloc(size * 2 * sizeof(float));
+	st->buff = malloc(size * 2 * sizeof(float));
+	st->pwr  = malloc((st->win + 1) * sizeof(double));
+	if ( !st->ref || !st->buff || !st->pwr )
+		return -1;
+
+	// the marker as loaded: new ADI TX data is shifted up 4 bits
+	d      = (const uint16_t *)st->tx->smp;
+	stride = dsa_channel_width(st->tx) / sizeof(uint16_t);
+	ofs    = latency_chan(st->tx, st->tx->src);
+	memset(st->ref, 0, size * 2 * sizeof(float));
+	for ( i = 0; i < st->mark; i++, d += stride )
+	{
+		re = dsa_adi_new ? (int16_t)d[ofs]     >> 4 : dsa_sample_value(d[ofs]);
+		im = dsa_adi_new ? (int16_t)d[ofs + 1] >> 4 : dsa_sample_value(d[ofs + 1]);
+		st->ref[i * 2]     = re;
+		st->ref[i * 2 + 1] = im;
+		st->mark_pwr      += re * re + im * im;
+	}
+	if ( !st->mark_pwr )
+	{
+		LOG_ERROR("TX buffer is silent, nothing to correlate\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	dsa_fft_run(st->fft, st->ref);
+	for ( i = 0; i < size; i++ )
+		st->ref[i * 2 + 1] = -st->ref[i * 2 + 1];
+
+	st->rx_stride = dsa_channel_width(st->rx) / sizeof(uint16_t);
+	st->rx_ofs    = latency_chan(st->rx, st->rx->snk);
+
+	LOG_INFO("Latency: %zu-sample marker from AD%d TX in %zu samples of AD%d RX, "
+	         "FFT %zu\n", st->mark, dev + 1, st->win, st->rx_dev + 1, size);
+	return 0;
+}
+
+// correlate the captured RX buffer with the marker; sets *lag to the marker's position in
+// samples, interpolated between the peak and its neighbours, and returns the normalized
+// correlation there
+static double latency_measure (struct latency_state *st, double *lag)
+{
+	const uint16_t *d    = (const uint16_t *)st->rx->smp + st->rx_ofs;
+	size_t          size = st->fft->size;
+	size_t          last = st->win - st->mark;
+	size_t          peak = 0;
+	size_t          i;
+	float           re, im;
+	double          mag, best = -1.0;
+	double          m0, m2, den;
+
+	memset(st->buff, 0, size * 2 * sizeof(float));
+	st->pwr[0] = 0.0;
+	for ( i = 0; i < st->win; i++, d += st->rx_stride )
+	{
+		re = dsa_sample_value(d[0]);
+		im = dsa_sample_value(d[1]);
+		st->buff[i * 2]     = re;
+		st->buff[i * 2 + 1] = im;
+		st->pwr[i + 1]      = st->pwr[i] + re * re + im * im;
+	}
+	dsa_fft_run(st->fft, st->buff);
+
+	for ( i = 0; i < size; i++ )
+	{
+		re = st->buff[i * 2] * st->ref[i * 2]     - st->buff[i * 2 + 1] * st->ref[i * 2 + 1];
+		im = st->buff[i * 2] * st->ref[i * 2 + 1] + st->buff[i * 2 + 1] * st->ref[i * 2];
+		st->buff[i * 2]     = re;
+		st->buff[i * 2 + 1] = -im;
+	}
+	dsa_fft_run(st->fft, st->buff);
+
+	// peak over the lags where the whole marker is inside the window
+	for ( i = 0; i <= last; i++ )
+	{
+		mag = hypot(st->buff[i * 2], st->buff[i * 2 + 1]);
+		if ( mag > best )
+		{
+			best = mag;
+			peak = i;
+		}
+	}
+
+	*lag = peak;
+	if ( peak > 0 && peak < last )
+	{
+		m0  = hypot(st->buff[peak * 2 - 2], st->buff[peak * 2 - 1]);
+		m2  = hypot(st->buff[peak * 2 + 2], st->buff[peak * 2 + 3]);
+		den = m0 - 2.0 * best + m2;
+		if ( den < 0.0 )
+			*lag += 0.5 * (m0 - m2) / den;
+	}
+
+	den = sqrt(st->mark_pwr * (st->pwr[peak + st->mark] - st->pwr[peak]));
+	return den > 0.0 ? best / size / den : 0.0;
+}
+
+static void latency_report (const struct latency_state *st, unsigned long caps)
+{
+	unsigned long  hist[DSA_LATENCY_BINS];
+	unsigned long  most = 0;
+	double         min, max, sum = 0.0, var = 0.0, mean;
+	size_t         bin = st->opts->bin;
+	size_t         lo, hi, b;
+	unsigned long  i;
+
+	printf("Latency: %lu captures, %lu measured, %lu below %.2f correlation\n", caps,
+	       st->num, st->miss, st->opts->corr);
+	if ( !st->num )
+		return;
+
+	min = max = st->lags[0];
+	for ( i = 0; i < st->num; i++ )
+	{
+		sum += st->lags[i];
+		if ( st->lags[i] < min )
+			min = st->lags[i];
+		if ( st->lags[i] > max )
+			max = st->lags[i];
+	}
+	mean = sum / st->num;
+	for ( i = 0; i < st->num; i++ )
+		var += (st->lags[i] - mean) * (st->lags[i] - mean);
+
+	printf("  samples: min %.1f, max %.1f, mean %.2f, stddev %.2f\n", min, max, mean,
+	       sqrt(var / st->num));
+	if ( st->rate )
+		printf("  usec:    min %.3f, max %.3f, mean %.3f, stddev %.3f at %lu samples/sec\n",
+		       min * 1e6 / st->rate, max * 1e6 / st->rate, mean * 1e6 / st->rate,
+		       sqrt(var / st->num) * 1e6 / st->rate, st->rate);
+
+	// bins on whole samples, from the lowest bin-aligned one
+	lo = lround(min) / bin * bin;
+	hi = lround(max);
+	if ( (hi - lo) / bin >= DSA_LATENCY_BINS )
+		bin = (hi - lo) / DSA_LATENCY_BINS + 1;
+
+	memset(hist, 0, sizeof(hist));
+	for ( i = 0; i < st->num; i++ )
+		if ( ++hist[(lround(st->lags[i]) - lo) / bin] > most )
+			most = hist[(lround(st->lags[i]) - lo) / bin];
+
+	for ( b = 0; lo + b * bin <= hi; b++ )
+	{
+		printf("  %7zu", lo + b * bin);
+		if ( st->rate )
+			printf(" %10.3f us", (double)(lo + b * bin) * 1e6 / st->rate);
+		printf(" %7lu %.*s\n", hist[b], (int)((hist[b] * 50 + most - 1) / most),
+		       "##################################################");
+	}
+}
+
+
+int dsa_latency_run (struct dsa_channel_event *evt, const struct dsa_trigger_opts *opts)
+{
+	struct dsa_trigger_opts  cap_opts = *opts;
+	struct latency_state     st;
+	struct sigaction         sa, old;
+	unsigned long            num;
+	double                   lag;
+	double                   corr;
+	int                      ret = 0;
+
+	memset(&st, 0, sizeof(st));
+	st.opts = &opts->lat;
+
+	if ( latency_setup(&st, evt) < 0 || !(st.lags = malloc(opts->reps * sizeof(double))) )
+	{
+		ret = -1;
+		goto done;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = latency_sigint;
+	latency_stop  = 0;
+	sigaction(SIGINT, &sa, &old);
+
+	// stats per capture would drown the report; a timed start applies to the first only
+	cap_opts.stats = 0;
+	cap_opts.reps  = 1;
+	for ( num = 0; !latency_stop && num < opts->reps; num++ )
+	{
+		if ( dsa_command_trigger_run(evt, &cap_opts) < 0 )
+		{
+			ret = -1;
+			break;
+		}
+		cap_opts.timed = 0;
+
+		corr = latency_measure(&st, &lag);
+		if ( corr < opts->lat.corr )
+		{
+			LOG_WARN("Capture %lu: marker not found, correlation %.2f\n", num, corr);
+			st.miss++;
+			continue;
+		}
+
+		LOG_DEBUG("Capture %lu: %.2f samples, correlation %.2f\n", num, lag, corr);
+		st.lags[st.num++] = lag;
+	}
+
+	sigaction(SIGINT, &old, NULL);
+	latency_report(&st, num);
+
+done:
+	free(st.lags);
+	free(st.pwr);
+	free(st.buff);
+	free(st.ref);
+	dsa_fft_free(st.fft);
+	return ret < 0 ? ret : (int)st.num;
+}
@@ -0,0 +1,46 @@
+/** \file      dsa_latency.h
+ *  \brief     interfaces for TX to RX loopback latency measurement
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_DSA_LATENCY_H_
+#define _INCLUDE_DSA_LATENCY_H_
+#include <stddef.h>
+
+// the histogram bin width is widened if needed to fit the spread in this many bins
+#define DSA_LATENCY_BINS  32
+
+
+struct dsa_latency_opts
+{
+	double  corr;  // minimum normalized correlation peak for a capture to count, 0-1
+	size_t  bin;   // histogram bin width in samples
+};
+
+struct dsa_channel_event;
+struct dsa_trigger_opts;
+
+
+// parse "corr[:bin]" into opts, returns 0 on success, <0 on error
+int dsa_latency_parse (struct dsa_latency_opts *opts, char *arg);
+
+// trigger evt reps times, each time locating the TX buffer in the RX buffer captured with
+// it by cross-correlation, and report the latency in samples and time with a histogram.
+// evt must be loaded and mapped, with one TX and one RX buffer, the RX longer than the
+// TX; the channel correlated on each is channel 1 if it has a file, else channel 2.
+// Returns the number of captures measured, or <0 on error.
+int dsa_latency_run (struct dsa_channel_event *evt, const struct dsa_trigger_opts *opts);
+
+#endif // _INCLUDE_DSA_LATENCY_H_
@@ -27,6 +27,13 @@
 #include "dsa_ioctl.h"
 #include "dsa_command.h"
 #include "dsa_common.h"
+#include "dsa_worker.h"
+#include "dsa_pool.h"
+#include "dsa_shm.h"
+#include "dsa_report.h"
+#include "dsa_daemon.h"
+#include "dsa_playlist.h"
+#include "dsa_net.h"
 
 #include "log.h"
 LOG_MODULE_STATIC("main", LOG_LEVEL_INFO);
@@ -40,175 +47,7 @@ LOG_MODULE_STATIC("main", LOG_LEVEL_INFO);
 #define BOARD_REV "sim"
 #endif
 
-#define EXPORT_FILE "/tmp/.ad9361.channels"
-
 const char *dsa_argv0;
-int         dsa_dev = -1;
-int         dsa_adi_new = 0;
-
-size_t      dsa_opt_len      = 1000000; // 1MS default
-unsigned    dsa_opt_timeout  = 0; // auto-calculated now
-const char *dsa_opt_device   = DEF_DEVICE;
-
-char *opt_lib_dir   = NULL;
-char  env_data_path[PATH_MAX];
-
-unsigned char  dsa_active_channels[4];
-
-struct format *dsa_opt_format = NULL;
-struct dsa_channel_event dsa_evt;
-
-
-void dsa_main_show_stats (const struct dsm_xfer_stats *st, const char *dir)
-{
-	printf("%s stats:\n", dir);
-	if ( !st->bytes )
-	{
-		printf ("  not run\n");
-		return;
-	}
-
-	unsigned long long usec = st->total.tv_sec;
-	usec *= 1000000000;
-	usec += st->total.tv_nsec;
-	usec /= 1000;
-
-	unsigned long long rate = 0;
-	if ( usec > 0 )
-		rate = st->bytes / usec;
-
-	printf("  bytes    : %llu\n",      st->bytes);
-	printf("  total    : %lu.%09lu\n", st->total.tv_sec, st->total.tv_nsec);
-	printf("  rate     : %llu MB/s\n", rate);
-
-	printf("  completes: %lu\n",       st->completes);
-	printf("  errors   : %lu\n",       st->errors);
-	printf("  timeouts : %lu\n",       st->timeouts);
-}
-
-void dsa_main_show_fifos (const struct dsm_fifo_counts *buff)
-{
-	printf("  RX 1: %08lx/%08lx\n", buff->rx_1_ins, buff->rx_1_ext);
-	printf("  RX 2: %08lx/%08lx\n", buff->rx_2_ins, buff->rx_2_ext);
-	printf("  TX 1: %08lx/%08lx\n", buff->tx_1_ins, buff->tx_1_ext);
-	printf("  TX 2: %08lx/%08lx\n", buff->tx_2_ins, buff->tx_2_ext);
-}
-
-
-static char *target_desc (int mask)
-{
-	static char buff[64];
-
-	snprintf(buff, sizeof(buff), "{ %s%s%s%s%s}",
-		     mask & DSM_TARGT_ADI1 ? "adi1 " : "",
-		     mask & DSM_TARGT_ADI2 ? "adi2 " : "",
-		     mask & DSM_TARGT_NEW  ? "new: " : "",
-		     mask & DSM_TARGT_DSXX ? "dsrc " : "",
-		     mask & DSM_TARGT_DSXX ? "dsnk " : "");
-
-	return buff;
-}
-
-
-int dsa_main_map (int reps)
-{
-	// pass to kernelspace and prepare DMA
-	struct dsm_user_buffs  buffs;
-
-	if ( dsa_dev < 0 )
-		return -1;
-
-	memset (&buffs, 0, sizeof(struct dsm_user_buffs));
-
-	if ( dsa_evt.tx[0] )
-	{
-		buffs.adi1.tx.addr = (unsigned long)dsa_evt.tx[0]->smp;
-		buffs.adi1.tx.size = dsa_evt.tx[0]->len * DSM_BUS_WIDTH;
-		buffs.adi1.tx.words = dsa_evt.tx[0]->len * reps;
-	}
-
-	if ( dsa_evt.tx[1] )
-	{
-		buffs.adi2.tx.addr = (unsigned long)dsa_evt.tx[1]->smp;
-		buffs.adi2.tx.size = dsa_evt.tx[1]->len * DSM_BUS_WIDTH;
-		buffs.adi2.tx.words = dsa_evt.tx[1]->len * reps;
-	}
-
-	if ( dsa_evt.rx[0] )
-	{
-		buffs.adi1.rx.addr = (unsigned long)dsa_evt.rx[0]->smp;
-		buffs.adi1.rx.size = dsa_evt.rx[0]->len * DSM_BUS_WIDTH;
-		buffs.adi1.rx.words = dsa_evt.rx[0]->len;
-	}
-
-	if ( dsa_evt.rx[1] )
-	{
-		buffs.adi2.rx.addr = (unsigned long)dsa_evt.rx[1]->smp;
-		buffs.adi2.rx.size = dsa_evt.rx[1]->len * DSM_BUS_WIDTH;
-		buffs.adi2.rx.words = dsa_evt.rx[1]->len;
-	}
-
-	// old: calculate FIFO control register ctrl value based on channel config
-	// new: calculate channel/TX/RX enable ctrl value based on channel config
-	if ( dsa_evt.tx[0] || dsa_evt.rx[0] )
-		buffs.adi1.ctrl = dsa_channel_ctrl(&dsa_evt, DC_DEV_AD1, !dsa_adi_new);
-	if ( dsa_evt.tx[1] || dsa_evt.rx[1] )
-		buffs.adi2.ctrl = dsa_channel_ctrl(&dsa_evt, DC_DEV_AD2, !dsa_adi_new);
-
-	return dsa_ioctl_map(&buffs);
-}
-
-
-int dsa_main_unmap (void)
-{
-	if ( dsa_dev < 0 )
-		return -1;
-
-	return dsa_ioctl_unmap();
-}
-
-
-void dsa_main_dev_close (void)
-{
-	if ( dsa_dev < 0 )
-		return;
-
-	close(dsa_dev);
-	dsa_dev = -1;
-}
-
-
-int dsa_main_dev_reopen (unsigned long *mask)
-{
-	dsa_main_dev_close();
-
-	if ( (dsa_dev = open(dsa_opt_device, O_RDWR)) < 0 )
-	{
-		LOG_DEBUG("open(%s): %s\n", dsa_opt_device, strerror(errno));
-		return -1;
-	}
-
-	if ( dsa_ioctl_target_list(mask) )
-		stop("DSM_IOCG_TARGET_LIST");
-
-	LOG_DEBUG("Supported targets: %s\n", target_desc(*mask));
-	if ( !*mask )
-	{
-		LOG_ERROR("No supported targets in this build; reconfigure your PetaLinux with the path to\n"
-		       "your hardware project's BSP include directory, containing xparameters.h.  The\n"
-		       "petalinux-config-apps path is:\n"
-		       "  User Modules ->\n"
-		       "    dma_streamer_mod -> \n"
-		       "      Path to Xilinx-generated BSP containing xparameters.h\n"
-		       "or search for USER_MODULES_DMA_STREAMER_MOD_BSP\n");
-
-		dsa_main_dev_close();
-		return -1;
-	}
-
-	return 0;
-}
-
 
 
 static void path_setup (char *dst, size_t max, const char *leaf)
@@ -262,54 +101,146 @@ static void dsa_main_footer (void)
 	       "  >   ad2r2 /media/card/ad2r2.iqw\n\n"
 	       "- Using printf-style substitutions as described under Buffer options, the above\n"
 	       "  could be shortened to:\n"
-	       "  # dma_streamer_app  -S 1M  adr /media/card/ad%%ar%%c.iqw\n");
+	       "  # dma_streamer_app  -S 1M  adr /media/card/ad%%ar%%c.iqw\n\n"
+	       "- Start a resident daemon, then run the first example through it:\n"
+	       "  # dma_streamer_app -L /tmp/dsa.sock &\n"
+	       "  # dma_streamer_app -c /tmp/dsa.sock  adt /media/card/wimax.iqw  1000\n");
+}
+
+static void dsa_main_usage (int ret)
+{
+	dsa_main_header();
+	dsa_command_options_usage();
+	dsa_main_formats();
+	if ( ret < -1 )
+	{
+		dsa_command_setup_usage();
+		dsa_command_trigger_usage();
+		dsa_playlist_usage();
+	}
+	dsa_main_footer();
 }
 
-static void import_active_channels (void)
+// One run after global options are parsed and the device is open: import the channel
+// state, setup buffers from the buffer options at optind, then trigger and save.  Used
+// directly for a normal invocation, and once per request by the daemon.
+static int dsa_main_run (int argc, char **argv)
 {
-	int  fd;
-	int  ret;
-	int  dev;
-	int  dir;
+	struct dsa_report_mark  mark;
+	int                     ret;
+
+	dsa_report_start(&mark);
+	dsa_main_import_channels();
+	dsa_report_phase(&mark, "import", NULL, 0);
+	dsa_shm_init(dsa_opt_shm);
+	if ( dsa_opt_pack && !dsa_adi_new )
+		LOG_WARN("Packed buffers need the new ADI core, using sample pairs\n");
+
+	// a playlist replaces the buffer and trigger options
+	if ( dsa_opt_playlist )
+	{
+		if ( optind < argc && argv[optind] )
+			LOG_WARN("Running playlist %s, ignoring buffer options\n", dsa_opt_playlist);
+		return dsa_playlist_run(dsa_opt_playlist) < 0;
+	}
+
+	// iterative buffer setup of new dsa_channel_event struct
+	int ofs = optind;
+	while ( ofs < argc && argv[ofs] )
+	{
+		ret = dsa_command_setup(&dsa_evt, -1, argc - ofs, argv + ofs);
+		if ( ret < 0 )
+		{
+			dsa_main_header();
+			dsa_command_setup_usage();
+			dsa_main_formats();
+			dsa_channel_cleanup(&dsa_evt);
+			return 1;
+		}
+		else if ( ret < 1 )
+			break;
 
-	// before importing, auto-probe the channel config - starts ad9361 looking at ad1,
-	// then switch to ad2, then writes out the channel status on exit
-	system("/usr/bin/ad9361 device ad2 2>/dev/null");
+		ofs += ret;
+	}
 
-	memset(dsa_active_channels, 0, sizeof(dsa_active_channels));
-	if ( (fd = open(EXPORT_FILE, O_RDONLY)) < 0 )
-		return;
+	// if no buffers were setup, there's nothing to do.  stop and give full usage.
+	if ( !dsa_evt.tx[0] && !dsa_evt.tx[1] && !dsa_evt.rx[0] && !dsa_evt.rx[1] )
+	{
+		dsa_channel_cleanup(&dsa_evt); // probably redundant but doesn't hurt
+		dsa_main_usage(-2);
+		return 1;
+	}
 
-	if ( (ret = read(fd, dsa_active_channels, sizeof(dsa_active_channels))) < 0 )
+	// a failed run has said why, options need the usage
+	ofs--;
+	if ( (ret = dsa_command_trigger(&dsa_evt, argc - ofs, argv + ofs)) == -1 )
 	{
-		close(fd);
-		return;
+		dsa_main_header();
+		dsa_command_trigger_usage();
 	}
-	close(fd);
+	dsa_channel_event_dump(&dsa_evt);
 
-	if ( ret < sizeof(dsa_active_channels) )
-		memset(dsa_active_channels + ret, 0, sizeof(dsa_active_channels) - ret);
+	dsa_channel_cleanup(&dsa_evt);
+	return ret < 0;
+}
 
-	LOG_DEBUG("Active channels from %02x %02x %02x %02x:\n", 
-	          dsa_active_channels[0], dsa_active_channels[1], 
-	          dsa_active_channels[2], dsa_active_channels[3]);
+// Global options which a request may change, restored before each daemon request.  The
+// worker count, huge pages, and device node are fixed when the daemon starts.
+static struct
+{
+	size_t          len;
+	unsigned        timeout;
+	struct format  *format;
+	const char     *cache;
+	int             pack;
+	int             level;
+	const char     *playlist;
+	const char     *fir;
+	const char     *corr;
+	const char     *shm;
+	const char     *report;
+	int            *levels;   // each module's, with -D settings
+}
+dsa_main_saved;
 
-	for ( dev = 0; dev < 4; dev += 2 )
-		for ( dir = 0; dir < 2; dir++ )
-		{
-			unsigned char ch = dsa_active_channels[dev + dir];
-			LOG_DEBUG("  %s %s:%s%s%s\n",
-			          dev ? "AD2" : "AD1",
-			          dir ? "RX"  : "TX",
-			          ch & 0x80 ? " CH2" : "",
-			          ch & 0x40 ? " CH1" : "",
-			          ch & 0xC0 ? "" : " none");
-		}
+static int dsa_main_request (int argc, char **argv)
+{
+	struct dsa_report_mark  mark;
+	int                     ret;
+
+	dsa_opt_len      = dsa_main_saved.len;
+	dsa_opt_timeout  = dsa_main_saved.timeout;
+	dsa_opt_format   = dsa_main_saved.format;
+	dsa_opt_cache    = dsa_main_saved.cache;
+	dsa_opt_pack     = dsa_main_saved.pack;
+	dsa_opt_level    = dsa_main_saved.level;
+	dsa_opt_playlist = dsa_main_saved.playlist;
+	dsa_opt_fir      = dsa_main_saved.fir;
+	dsa_opt_corr     = dsa_main_saved.corr;
+	dsa_opt_shm      = dsa_main_saved.shm;
+	dsa_opt_report   = dsa_main_saved.report;
+	log_restore_levels(dsa_main_saved.levels);
+
+	dsa_report_start(&mark);
+	optind = 1;
+	if ( (ret = dsa_command_options(argc, argv)) < 0 )
+	{
+		dsa_main_usage(ret);
+		return 1;
+	}
+	if ( dsa_report_open(dsa_opt_report, argc, argv) < 0 )
+		return 1;
+	dsa_report_phase(&mark, "parse", NULL, 0);
+
+	ret = dsa_main_run(argc, argv);
+	dsa_report_close(ret);
+	return ret;
 }
 
 int main(int argc, char *argv[])
 {
-	int  ret;
+	struct dsa_report_mark  mark;
+	int                     ret;
 
 	log_dupe(stdout);
 	setbuf(stdout, NULL);
@@ -327,6 +258,12 @@ int main(int argc, char *argv[])
 	else
 		path_setup(env_data_path, sizeof(env_data_path), "data");
 
+	if ( (p = getenv("DSA_CACHE_DIR")) && *p )
+		dsa_opt_cache = p;
+
+	if ( (p = getenv("DSA_SOCKET")) && *p )
+		dsa_opt_client = p;
+
 	LOG_DEBUG("initial argc %d, argv[]:\n", argc);
 	int i;
 	for ( i = 0; i <= argc; i++ )
@@ -335,71 +272,76 @@ int main(int argc, char *argv[])
 
 	// set global options - returns 0 on success, -1 on global options fail, -2 if '?'
 	// given, so print all the help
+	dsa_report_start(&mark);
 	if ( (ret = dsa_command_options(argc, argv)) < 0 )
 	{
-		dsa_main_header();
-		dsa_command_options_usage();
-		dsa_main_formats();
-		if ( ret < -1 )
-		{
-			dsa_command_setup_usage();
-			dsa_command_trigger_usage();
-		}
-		dsa_main_footer();
+		dsa_main_usage(ret);
 		return 1;
 	}
-	import_active_channels();
-
-	unsigned long  mask;
-	if ( dsa_main_dev_reopen(&mask) < 0 )
-		stop("failed to open: %s", dsa_opt_device);
-	dsa_adi_new = mask & DSM_TARGT_NEW;
-	LOG_INFO("Using %s ADI access\n", dsa_adi_new ? "new" : "old");
 
-	// iterative buffer setup of new dsa_channel_event struct
-	int ofs = optind;
-	while ( ofs < argc && argv[ofs] )
+	// thin client: the daemon does the work with our arguments, directory, and stdio
+	if ( dsa_opt_client && !dsa_opt_daemon )
 	{
-		ret = dsa_command_setup(-1, argc - ofs, argv + ofs);
-		if ( ret < 0 )
-		{
-			dsa_main_header();
-			dsa_command_setup_usage();
-			dsa_main_formats();
+		if ( (ret = dsa_daemon_client(dsa_opt_client, argc, argv)) < 0 )
 			return 1;
-		}
-		else if ( ret < 1 )
-			break;
-
-		ofs += ret;
+		return ret;
 	}
 
-	// if no buffers were setup, there's nothing to do.  stop and give full usage.
-	if ( !dsa_evt.tx[0] && !dsa_evt.tx[1] && !dsa_evt.rx[0] && !dsa_evt.rx[1] )
+	// a daemon reports each request rather than its whole life
+	if ( !dsa_opt_daemon )
 	{
-		dsa_channel_cleanup(&dsa_evt); // probably redundant but doesn't hurt
-		dsa_main_dev_close();
-		dsa_main_header();
-		dsa_command_options_usage();
-		dsa_main_formats();
-		dsa_command_setup_usage();
-		dsa_command_trigger_usage();
-		dsa_main_footer();
-		return 1;
+		if ( dsa_report_open(dsa_opt_report, argc, argv) < 0 )
+			return 1;
+		dsa_report_phase(&mark, "parse", NULL, 0);
 	}
 
-	ofs--;
-	if ( dsa_command_trigger(argc - ofs, argv + ofs) < 0 )
+	// load and save convert and write channel files in parallel, default one per CPU
+	dsa_report_start(&mark);
+	if ( !dsa_opt_jobs && (dsa_opt_jobs = sysconf(_SC_NPROCESSORS_ONLN)) < 1 )
+		dsa_opt_jobs = 1;
+	if ( dsa_worker_init(dsa_opt_jobs) < 0 )
+		LOG_WARN("Failed to start workers, loading and saving serially\n");
+
+	// buffers are mapped at least the default size, so they can be reused
+	dsa_pool_init(dsa_opt_len * sizeof(struct dsa_sample_pair), dsa_opt_huge);
+
+	unsigned long  mask;
+	if ( dsa_main_dev_reopen(&mask) < 0 )
+		stop("failed to open: %s", dsa_opt_device);
+	dsa_adi_new = mask & DSM_TARGT_NEW;
+	LOG_INFO("Using %s ADI access\n", dsa_adi_new ? "new" : "old");
+	dsa_report_phase(&mark, "open", NULL, 0);
+
+	// resident daemon: device stays open and buffers stay mapped between requests
+	if ( dsa_opt_daemon )
 	{
-		dsa_main_header();
-		dsa_command_trigger_usage();
+		dsa_main_saved.len      = dsa_opt_len;
+		dsa_main_saved.timeout  = dsa_opt_timeout;
+		dsa_main_saved.format   = dsa_opt_format;
+		dsa_main_saved.cache    = dsa_opt_cache;
+		dsa_main_saved.pack     = dsa_opt_pack;
+		dsa_main_saved.level    = dsa_opt_level;
+		dsa_main_saved.playlist = dsa_opt_playlist;
+		dsa_main_saved.fir      = dsa_opt_fir;
+		dsa_main_saved.corr     = dsa_opt_corr;
+		dsa_main_saved.shm      = dsa_opt_shm;
+		dsa_main_saved.report   = dsa_opt_report;
+		if ( !(dsa_main_saved.levels = malloc(log_module_count() * sizeof(int))) )
+			stop("failed to save log levels");
+		log_save_levels(dsa_main_saved.levels);
+		ret = dsa_daemon_serve(dsa_opt_daemon, dsa_main_request) < 0;
+		free(dsa_main_saved.levels);
 	}
-	dsa_channel_event_dump(&dsa_evt);
+	else
+		ret = dsa_main_run(argc, argv);
 
-	dsa_channel_cleanup(&dsa_evt);
+	dsa_worker_done();
+	dsa_pool_done();
+	dsa_shm_done();
+	dsa_net_done();
 
 	LOG_DEBUG("Close device...\n");
 	dsa_main_dev_close();
-	return 0;
+	dsa_report_close(ret);
+	return ret;
 }
-
@@ -17,6 +17,7 @@
  */
 #ifndef _INCLUDE_DSA_MAIN_H_
 #define _INCLUDE_DSA_MAIN_H_
+#include <limits.h>
 #include <dma_streamer_mod.h>
 #include "dsa_channel.h"
 
@@ -35,21 +36,39 @@ extern int         dsa_adi_new;
 
 extern size_t      dsa_opt_len;
 extern unsigned    dsa_opt_timeout;
+extern int         dsa_opt_jobs;
+extern const char *dsa_opt_cache;
+extern int         dsa_opt_huge;
+extern int         dsa_opt_pack;
+extern int         dsa_opt_level;
+extern const char *dsa_opt_daemon;
+extern const char *dsa_opt_client;
 extern const char *dsa_opt_device;
+extern const char *dsa_opt_playlist;
+extern const char *dsa_opt_fir;
+extern const char *dsa_opt_corr;
+extern const char *dsa_opt_shm;
+extern const char *dsa_opt_report;
 
-extern char  env_data_path[];
+extern char *opt_lib_dir;
+extern char  env_data_path[PATH_MAX];
 
 extern struct format            *dsa_opt_format;
 extern struct dsa_channel_event  dsa_evt;
 
 extern unsigned char  dsa_active_channels[];
+extern unsigned long  dsa_active_rates[];
 
 void dsa_main_show_stats (const struct dsm_xfer_stats *st, const char *dir);
 void dsa_main_show_fifos (const struct dsm_fifo_counts *buff);
 void dsa_main_dev_close (void);
 int dsa_main_dev_reopen (unsigned long *mask);
 
-int dsa_main_map   (int reps);
+// read the channel enables and rates the ad9361 tool publishes into dsa_active_channels
+// and dsa_active_rates, probing with it first if needed
+void dsa_main_import_channels (void);
+
+int dsa_main_map   (struct dsa_channel_event *evt, int reps);
 int dsa_main_unmap (void);
 
 #endif // _INCLUDE_DSA_MAIN_MOD_H_
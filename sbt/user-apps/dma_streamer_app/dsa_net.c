@@ -0,0 +1,914 @@
+/** \file      dsa_net.c
+ *  \brief     implementation of framed sample streams over UDP and TCP
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "dsa_common.h"
+#include "dsa_net.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("net", LOG_LEVEL_INFO);
+
+
+#define NET_IOV_MAX  1024      // UIO_MAXIOV, the most iovecs sendmsg takes
+#define NET_RCVBUF   4194304   // asked of a UDP source, to ride out bursts
+#define NET_POLL_MS  100       // longest a TCP frame read goes without checking quit
+
+
+static struct dsa_net  *net_list = NULL;
+static pthread_mutex_t  net_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static const char *net_proto (int type)
+{
+	return type == SOCK_STREAM ? "tcp" : "udp";
+}
+
+// resolve "host:port" or, for a source, "port" or ":port" for any address; an IPv6 host
+// is given in brackets
+static struct addrinfo *net_resolve (const char *addr, int type, int passive)
+{
+	struct addrinfo   hints;
+	struct addrinfo  *res;
+	char              copy[256];
+	char             *host = copy;
+	char             *port;
+	char             *end;
+	int               ret;
+
+	snprintf(copy, sizeof(copy), "%s", addr);
+	if ( (port = strrchr(copy, ':')) )
+		*port++ = '\0';
+	else
+	{
+		port = copy;
+		host = "";
+	}
+	if ( *host == '[' && (end = strchr(host, ']')) )
+	{
+		*end = '\0';
+		host++;
+	}
+	if ( !*port )
+	{
+		LOG_ERROR("%s: no port given\n", addr);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family   = AF_UNSPEC;
+	hints.ai_socktype = type;
+	hints.ai_flags    = passive ? AI_PASSIVE : 0;
+	if ( (ret = getaddrinfo(*host ? host : NULL, port, &hints, &res)) )
+	{
+		LOG_ERROR("%s: %s\n", addr, gai_strerror(ret));
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return res;
+}
+
+// connect a sink's socket to its address
+static int net_connect (struct dsa_net *net)
+{
+	struct addrinfo *res;
+	struct addrinfo *ai;
+	int              fd = -1;
+
+	if ( !(res = net_resolve(net->addr, net->type, 0)) )
+		return -1;
+
+	for ( ai = res; ai; ai = ai->ai_next )
+	{
+		if ( (fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+		                  ai->ai_protocol)) < 0 )
+			continue;
+		if ( !connect(fd, ai->ai_addr, ai->ai_addrlen) )
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+
+	if ( fd < 0 )
+	{
+		LOG_ERROR("%s %s: %s\n", net_proto(net->type), net->addr, strerror(errno));
+		return -1;
+	}
+
+	net->fd = fd;
+	LOG_DEBUG("%s %s: connected\n", net_proto(net->type), net->addr);
+	return 0;
+}
+
+// bind a source's socket to its address, listening if TCP
+static int net_bind (struct dsa_net *net)
+{
+	struct addrinfo *res;
+	struct addrinfo *ai;
+	int              one = 1;
+	int              size = NET_RCVBUF;
+	int              fd = -1;
+
+	if ( !(res = net_resolve(net->addr, net->type, 1)) )
+		return -1;
+
+	for ( ai = res; ai; ai = ai->ai_next )
+	{
+		if ( (fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+		                  ai->ai_protocol)) < 0 )
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if ( !bind(fd, ai->ai_addr, ai->ai_addrlen) &&
+		     (net->type != SOCK_STREAM || !listen(fd, 1)) )
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+
+	if ( fd < 0 )
+	{
+		LOG_ERROR("%s %s: %s\n", net_proto(net->type), net->addr, strerror(errno));
+		return -1;
+	}
+
+	if ( net->type == SOCK_STREAM )
+		net->lfd = fd;
+	else
+	{
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+		net->fd = fd;
+	}
+
+	LOG_DEBUG("%s %s: listening\n", net_proto(net->type), net->addr);
+	return 0;
+}
+
+static void *net_thread (void *arg);
+
+// find or make the stream in the list; called with net_lock held
+static struct dsa_net *net_get (const char *addr, int type, int sink, int stream,
+                                size_t ring)
+{
+	struct dsa_net *net;
+
+	for ( net = net_list; net; net = net->next )
+		if ( net->type == type && net->sink == sink && !strcmp(net->addr, addr) &&
+		     (!sink || net->stream == stream) )
+		{
+			net->stream = stream;
+			return net;
+		}
+
+	if ( !(net = calloc(1, sizeof(*net) + strlen(addr) + 1)) )
+		return NULL;
+
+	strcpy(net->addr, addr);
+	net->type   = type;
+	net->sink   = sink;
+	net->stream = stream;
+	net->fd     = -1;
+	net->lfd    = -1;
+	if ( sink )
+	{
+		if ( net_connect(net) )
+		{
+			free(net);
+			return NULL;
+		}
+	}
+	else
+	{
+		net->size = ring ? ring : DSA_NET_RING;
+		if ( !(net->buf   = malloc(sizeof(struct dsa_net_hdr) + DSA_NET_PKT_MAX)) ||
+		     !(net->ring  = malloc(net->size * 4 * sizeof(uint16_t))) ||
+		     !(net->valid = calloc(net->size, 1)) ||
+		     net_bind(net) )
+			goto fail;
+
+		pthread_mutex_init(&net->lock, NULL);
+		pthread_cond_init(&net->cond, NULL);
+		if ( (errno = pthread_create(&net->thread, NULL, net_thread, net)) )
+		{
+			LOG_ERROR("%s %s: %s\n", net_proto(type), addr, strerror(errno));
+			close(net->fd >= 0 ? net->fd : net->lfd);
+			goto fail;
+		}
+	}
+
+	net->next = net_list;
+	net_list  = net;
+	return net;
+
+fail:
+	free(net->valid);
+	free(net->ring);
+	free(net->buf);
+	free(net);
+	return NULL;
+}
+
+struct dsa_net *dsa_net_sink (const char *addr, int type, unsigned stream)
+{
+	struct dsa_net *net;
+
+	pthread_mutex_lock(&net_lock);
+	if ( (net = net_get(addr, type, 1, stream, 0)) && net->fd < 0 && net_connect(net) )
+		net = NULL;
+	pthread_mutex_unlock(&net_lock);
+
+	return net;
+}
+
+struct dsa_net *dsa_net_source (const char *addr, int type, int stream, size_t ring)
+{
+	struct dsa_net *net;
+
+	pthread_mutex_lock(&net_lock);
+	net = net_get(addr, type, 0, stream, ring);
+	pthread_mutex_unlock(&net_lock);
+
+	return net;
+}
+
+
+// a TCP sendmsg may return part way through the list: step past what went and go again
+static int net_send_all (int fd, struct msghdr *msg)
+{
+	ssize_t  ret;
+
+	while ( msg->msg_iovlen )
+	{
+		if ( (ret = sendmsg(fd, msg, MSG_NOSIGNAL)) < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			return -1;
+		}
+
+		while ( msg->msg_iovlen && ret >= msg->msg_iov->iov_len )
+		{
+			ret -= msg->msg_iov->iov_len;
+			msg->msg_iov++;
+			msg->msg_iovlen--;
+		}
+		if ( msg->msg_iovlen )
+		{
+			msg->msg_iov->iov_base = (uint8_t *)msg->msg_iov->iov_base + ret;
+			msg->msg_iov->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
+int dsa_net_send (struct dsa_net *snk, const void *smp, size_t stride, size_t width,
+                  size_t num, int chans, size_t pkt, uint64_t time, unsigned long rate)
+{
+	struct dsa_net_hdr  hdr;
+	struct iovec        iov[NET_IOV_MAX];
+	struct msghdr       msg;
+	const uint8_t      *ptr = smp;
+	unsigned long long  beg = mono_usec();
+	size_t              per;
+	size_t              cnt;
+	size_t              pos;
+	size_t              i;
+	int                 gather = stride != width;
+
+	if ( snk->fd < 0 )
+	{
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	// periods per packet: within the payload, the header's count, and the gather list
+	if ( !pkt || pkt > DSA_NET_PKT_MAX )
+		pkt = DSA_NET_PKT_MAX;
+	if ( !(per = pkt / width) )
+		per = 1;
+	if ( per > UINT16_MAX )
+		per = UINT16_MAX;
+	if ( gather && per > NET_IOV_MAX - 1 )
+		per = NET_IOV_MAX - 1;
+
+	memset(&msg, 0, sizeof(msg));
+	hdr.magic   = htonl(DSA_NET_MAGIC);
+	hdr.version = DSA_NET_VERSION;
+	hdr.format  = DSA_NET_FMT_S12;
+	hdr.chans   = chans;
+	hdr.stream  = htons(snk->stream);
+
+	for ( pos = 0; pos < num; pos += cnt )
+	{
+		cnt = num - pos < per ? num - pos : per;
+
+		hdr.flags = pos ? 0 : DSA_NET_F_SEG;
+		hdr.count = htons(cnt);
+		hdr.seq   = htonl(snk->seq);
+		hdr.index = htobe64(snk->index);
+		hdr.time  = htobe64(time && rate ? time + pos * 1000000000ULL / rate : time);
+
+		// the header, then the periods straight from the buffer: one run if they're
+		// contiguous, else one entry per period
+		iov[0].iov_base = &hdr;
+		iov[0].iov_len  = sizeof(hdr);
+		if ( gather )
+			for ( i = 0; i < cnt; i++ )
+			{
+				iov[i + 1].iov_base = (void *)(ptr + (pos + i) * stride);
+				iov[i + 1].iov_len  = width;
+			}
+		else
+		{
+			iov[1].iov_base = (void *)(ptr + pos * stride);
+			iov[1].iov_len  = cnt * width;
+		}
+		msg.msg_iov    = iov;
+		msg.msg_iovlen = gather ? cnt + 1 : 2;
+
+		if ( snk->type == SOCK_STREAM )
+		{
+			if ( net_send_all(snk->fd, &msg) )
+			{
+				LOG_ERROR("tcp %s: %s\n", snk->addr, strerror(errno));
+				close(snk->fd);
+				snk->fd = -1;
+				return -1;
+			}
+		}
+		// a datagram that can't go now is gone: the receiver sees the gap in seq
+		else if ( sendmsg(snk->fd, &msg, MSG_NOSIGNAL) < 0 )
+		{
+			if ( errno != ENOBUFS && errno != EAGAIN && errno != ECONNREFUSED &&
+			     errno != EINTR )
+			{
+				LOG_ERROR("udp %s: %s\n", snk->addr, strerror(errno));
+				return -1;
+			}
+			LOG_DEBUG("udp %s: seq %u dropped: %s\n", snk->addr, snk->seq, strerror(errno));
+			snk->stats.lost++;
+			snk->seq++;
+			snk->index += cnt;
+			continue;
+		}
+
+		snk->stats.packets++;
+		snk->stats.bytes   += cnt * width;
+		snk->stats.samples += cnt;
+		snk->seq++;
+		snk->index += cnt;
+	}
+
+	snk->stats.segments++;
+	snk->stats.usec += mono_usec() - beg;
+	return 0;
+}
+
+
+// take the next connection on a TCP source, a new sender with its own sequence
+static int net_accept (struct dsa_net *src, int timeout)
+{
+	struct pollfd  pfd = { .fd = src->lfd, .events = POLLIN };
+	int            ret;
+
+	if ( (ret = poll(&pfd, 1, timeout)) <= 0 )
+		return ret;
+
+	if ( (src->fd = accept(src->lfd, NULL, NULL)) < 0 )
+	{
+		LOG_ERROR("tcp %s: %s\n", src->addr, strerror(errno));
+		return -1;
+	}
+	fcntl(src->fd, F_SETFD, FD_CLOEXEC);
+
+	src->synced = 0;
+	LOG_DEBUG("tcp %s: connected\n", src->addr);
+	return 1;
+}
+
+// drop the TCP source's connection, at its end or when the framing is lost
+static void net_hangup (struct dsa_net *src)
+{
+	close(src->fd);
+	src->fd = -1;
+	LOG_DEBUG("tcp %s: disconnected\n", src->addr);
+}
+
+// read size bytes of a TCP frame; a frame may trickle in, but a sender that stalls
+// mid-frame mustn't keep the source's thread from stopping.  Returns 0, or <0 on error,
+// end of stream, or quit.
+static int net_read (struct dsa_net *src, void *buf, size_t size)
+{
+	struct pollfd  pfd = { .fd = src->fd, .events = POLLIN };
+	uint8_t       *ptr = buf;
+	ssize_t        ret;
+
+	while ( size )
+	{
+		if ( src->quit )
+			return -1;
+		if ( (ret = poll(&pfd, 1, NET_POLL_MS)) <= 0 )
+		{
+			if ( ret < 0 && errno != EINTR )
+				return -1;
+			continue;
+		}
+
+		if ( (ret = recv(src->fd, ptr, size, 0)) <= 0 )
+		{
+			if ( ret < 0 && errno == EINTR )
+				continue;
+			if ( ret < 0 )
+				LOG_ERROR("tcp %s: %s\n", src->addr, strerror(errno));
+			return -1;
+		}
+		ptr  += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+// nonzero if hdr is malformed or its payload wouldn't fit a packet
+static int net_check (const struct dsa_net_hdr *hdr)
+{
+	if ( hdr->magic != DSA_NET_MAGIC || hdr->version != DSA_NET_VERSION ||
+	     hdr->format != DSA_NET_FMT_S12 || !hdr->chans || hdr->chans > 3 || !hdr->count )
+		return -1;
+
+	return hdr->count * sizeof(uint16_t) * 2 * (hdr->chans == 3 ? 2 : 1) > DSA_NET_PKT_MAX;
+}
+
+ssize_t dsa_net_recv (struct dsa_net *src, struct dsa_net_hdr *hdr, const void **data,
+                      int timeout)
+{
+	unsigned long long  beg = mono_usec();
+	unsigned long long  end = beg + timeout * 1000ULL;
+	struct pollfd       pfd;
+	size_t              size;
+	ssize_t             ret;
+	int                 wait = timeout;
+
+	for ( ;; )
+	{
+		if ( timeout >= 0 && (wait = (long long)(end - mono_usec()) / 1000) < 0 )
+			wait = 0;
+
+		if ( src->fd < 0 )
+		{
+			if ( (ret = net_accept(src, wait)) <= 0 )
+				return ret;
+			continue;
+		}
+
+		pfd.fd     = src->fd;
+		pfd.events = POLLIN;
+		if ( (ret = poll(&pfd, 1, wait)) < 0 && errno != EINTR )
+			return -1;
+		if ( ret <= 0 )
+			return 0;
+
+		// a whole datagram, or a TCP frame's header and then its payload
+		if ( src->type == SOCK_STREAM )
+		{
+			if ( net_read(src, src->buf, sizeof(*hdr)) )
+			{
+				net_hangup(src);
+				continue;
+			}
+			ret = sizeof(*hdr);
+		}
+		else if ( (ret = recv(src->fd, src->buf, sizeof(*hdr) + DSA_NET_PKT_MAX, 0)) < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			LOG_ERROR("udp %s: %s\n", src->addr, strerror(errno));
+			return -1;
+		}
+
+		if ( ret < (ssize_t)sizeof(*hdr) )
+		{
+			src->stats.bad++;
+			continue;
+		}
+		memcpy(hdr, src->buf, sizeof(*hdr));
+		hdr->magic  = ntohl(hdr->magic);
+		hdr->stream = ntohs(hdr->stream);
+		hdr->count  = ntohs(hdr->count);
+		hdr->seq    = ntohl(hdr->seq);
+		hdr->index  = be64toh(hdr->index);
+		hdr->time   = be64toh(hdr->time);
+
+		if ( net_check(hdr) )
+		{
+			src->stats.bad++;
+			if ( src->type == SOCK_STREAM )
+				net_hangup(src);
+			continue;
+		}
+
+		size = hdr->count * sizeof(uint16_t) * 2 * (hdr->chans == 3 ? 2 : 1);
+		if ( src->type == SOCK_STREAM )
+		{
+			if ( net_read(src, src->buf + sizeof(*hdr), size) )
+			{
+				net_hangup(src);
+				continue;
+			}
+		}
+		else if ( ret != sizeof(*hdr) + size )
+		{
+			src->stats.bad++;
+			continue;
+		}
+
+		if ( src->stream >= 0 && hdr->stream != src->stream )
+			continue;
+
+		// sequence: count a gap as lost, drop anything behind
+		if ( !hdr->seq && (hdr->flags & DSA_NET_F_SEG) )
+			src->synced = 0;
+		if ( src->synced && hdr->seq != src->seq )
+		{
+			if ( (int32_t)(hdr->seq - src->seq) < 0 )
+			{
+				src->stats.late++;
+				continue;
+			}
+			LOG_DEBUG("%s %s: seq %u, expected %u\n", net_proto(src->type), src->addr,
+			          hdr->seq, src->seq);
+			src->stats.lost += hdr->seq - src->seq;
+		}
+		src->seq    = hdr->seq + 1;
+		src->synced = 1;
+
+		if ( hdr->flags & DSA_NET_F_SEG )
+			src->stats.segments++;
+		src->stats.bytes   += size;
+		src->stats.samples += hdr->count;
+		if ( !src->stats.packets++ )
+			src->start = mono_usec();
+		src->stats.usec = mono_usec() - src->start;
+
+		*data = src->buf + sizeof(*hdr);
+		return size;
+	}
+}
+
+
+// put a packet's periods into the ring by sample index; called with the lock held.  A
+// new sender, or one too far from the ring to be the same stream, restarts it.
+static void net_store (struct dsa_net *src, const struct dsa_net_hdr *hdr,
+                       const uint16_t *data)
+{
+	size_t    in  = hdr->chans == 3 ? 4 : 2;
+	uint64_t  idx = hdr->index;
+	uint64_t  end = idx + hdr->count;
+	uint16_t *d;
+	size_t    pos;
+
+	if ( !src->started || (!hdr->seq && (hdr->flags & DSA_NET_F_SEG)) ||
+	     idx + src->size < src->tail || idx > src->tail + 2 * src->size )
+	{
+		memset(src->valid, 0, src->size);
+		src->head    = idx;
+		src->tail    = idx;
+		src->started = 1;
+		src->primed  = 0;
+		src->starved = 0;
+	}
+
+	// the first packet after an underflow: one behind the filled tail is from a sender
+	// which paused rather than lost the time, so take from it on
+	if ( src->starved )
+	{
+		if ( idx < src->tail )
+			src->tail = idx;
+		src->head    = src->tail;
+		src->starved = 0;
+	}
+
+	if ( idx < src->tail )
+	{
+		src->stats.late++;
+		if ( end <= src->tail )
+			return;
+		data += (src->tail - idx) * in;
+		idx   = src->tail;
+	}
+	if ( end > src->tail + src->size )
+	{
+		src->stats.overruns += end - (src->tail + src->size);
+		end = src->tail + src->size;
+	}
+
+	pos = idx % src->size;
+	for ( ; idx < end; idx++, data += in )
+	{
+		d = src->ring + pos * 4;
+		d[0] = le16toh(data[0]);
+		d[1] = le16toh(data[1]);
+		d[2] = le16toh(data[in - 2]);
+		d[3] = le16toh(data[in - 1]);
+		src->valid[pos] = 1;
+		if ( ++pos == src->size )
+			pos = 0;
+	}
+
+	if ( end > src->head )
+		src->head = end;
+}
+
+static void *net_thread (void *arg)
+{
+	struct dsa_net     *src = arg;
+	struct dsa_net_hdr  hdr;
+	const void         *data;
+	ssize_t             ret;
+
+	while ( !src->quit )
+	{
+		// a short timeout so the thread sees quit
+		if ( (ret = dsa_net_recv(src, &hdr, &data, 100)) < 0 )
+		{
+			usleep(100000);
+			continue;
+		}
+		if ( !ret )
+			continue;
+
+		pthread_mutex_lock(&src->lock);
+		net_store(src, &hdr, data);
+		src->arrival = mono_usec();
+		pthread_cond_broadcast(&src->cond);
+		pthread_mutex_unlock(&src->lock);
+	}
+
+	return NULL;
+}
+
+// wait on the source's condition until usec on the monotonic clock, or forever if 0;
+// returns nonzero on timeout
+static int net_wait (struct dsa_net *src, unsigned long long usec)
+{
+	unsigned long long  now = mono_usec();
+	struct timespec     ts;
+
+	if ( !usec )
+		return pthread_cond_wait(&src->cond, &src->lock), 0;
+	if ( usec <= now )
+		return 1;
+
+	// the condition waits on CLOCK_REALTIME: wait out the same interval from now
+	clock_gettime(CLOCK_REALTIME, &ts);
+	usec -= now;
+	ts.tv_sec  += usec / 1000000 + (ts.tv_nsec / 1000 + usec % 1000000) / 1000000;
+	ts.tv_nsec  = (ts.tv_nsec / 1000 + usec % 1000000) % 1000000 * 1000;
+
+	return pthread_cond_timedwait(&src->cond, &src->lock, &ts) == ETIMEDOUT;
+}
+
+ssize_t dsa_net_take (struct dsa_net *src, uint16_t *d, size_t stride, const int slot[2],
+                      int lsh, size_t num, const struct dsa_net_take *take)
+{
+	unsigned long long  beg  = mono_usec();
+	unsigned long long  filled;
+	size_t              need;
+	size_t              got  = 0;
+	size_t              used = 0;
+	size_t              pos;
+	size_t              n;
+	int                 c, w;
+
+	pthread_mutex_lock(&src->lock);
+	filled = src->stats.filled;
+	while ( got < num )
+	{
+		// wait for the jitter to gather first, then take samples as they come
+		need = src->primed ? 1 : take->jitter < src->size ? take->jitter : src->size;
+		if ( !need )
+			need = 1;
+		if ( src->started && src->head > src->tail && src->head - src->tail >= need )
+		{
+			n   = src->head - src->tail < num - got ? src->head - src->tail : num - got;
+			pos = src->tail % src->size;
+			for ( ; n; n--, got++, src->tail++, d += stride )
+			{
+				if ( src->valid[pos] )
+				{
+					memcpy(src->last, src->ring + pos * 4, sizeof(src->last));
+					src->valid[pos] = 0;
+					used++;
+				}
+				else
+				{
+					if ( take->fill == DSA_NET_FILL_ZERO )
+						memset(src->last, 0, sizeof(src->last));
+					src->stats.filled++;
+				}
+
+				for ( c = 0; c < 2; c++ )
+					if ( slot[c] >= 0 )
+						for ( w = 0; w < 2; w++ )
+							d[c * 2 + w] = (src->last[slot[c] * 2 + w] & 0xFFF) <<
+							               (lsh ? 4 : 0);
+
+				if ( ++pos == src->size )
+					pos = 0;
+			}
+			src->primed = 1;
+			continue;
+		}
+
+		// no stream yet: wait for one; else starve when it goes quiet
+		if ( !src->started )
+		{
+			if ( !net_wait(src, take->wait < 0 ? 0 : beg + take->wait * 1000ULL) )
+				continue;
+			pthread_mutex_unlock(&src->lock);
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		if ( !net_wait(src, take->idle < 0 ? 0 : src->arrival + take->idle * 1000ULL) )
+			continue;
+
+		// underflow: fill the rest, and let the stream catch up to the time it lost; tail
+		// stays past head until the next packet, which re-bases it if it's behind
+		if ( take->fill == DSA_NET_FILL_ZERO )
+			memset(src->last, 0, sizeof(src->last));
+		memset(src->valid, 0, src->size);
+		src->stats.filled += num - got;
+		src->stats.underflows++;
+		src->tail   += num - got;
+		src->primed  = 0;
+		src->starved = 1;
+		for ( ; got < num; got++, d += stride )
+			for ( c = 0; c < 2; c++ )
+				if ( slot[c] >= 0 )
+					for ( w = 0; w < 2; w++ )
+						d[c * 2 + w] = (src->last[slot[c] * 2 + w] & 0xFFF) << (lsh ? 4 : 0);
+	}
+	filled = src->stats.filled - filled;
+	pthread_mutex_unlock(&src->lock);
+
+	if ( filled )
+		LOG_WARN("%s %s: %llu of %zu samples filled\n", net_proto(src->type), src->addr,
+		         filled, num);
+	return used;
+}
+
+
+void dsa_net_report (struct dsa_net *net)
+{
+	struct dsa_net_stats *st   = &net->stats;
+	double                rate = st->usec ? (double)st->samples / st->usec : 0.0;
+
+	if ( net->sink )
+		LOG_INFO("%s %s stream %d: sent %llu packets, %llu samples in %lu segments at "
+		         "%.2f MS/s, %llu lost\n", net_proto(net->type), net->addr, net->stream,
+		         st->packets, st->samples, st->segments, rate, st->lost);
+	else
+		LOG_INFO("%s %s: received %llu packets, %llu samples in %lu segments at %.2f "
+		         "MS/s, %llu lost, %llu late, %llu bad\n", net_proto(net->type), net->addr,
+		         st->packets, st->samples, st->segments, rate, st->lost, st->late,
+		         st->bad);
+	if ( !net->sink && (st->underflows || st->filled || st->overruns) )
+		LOG_INFO("%s %s: %lu underflows, %llu samples filled, %llu overrun\n",
+		         net_proto(net->type), net->addr, st->underflows, st->filled,
+		         st->overruns);
+}
+
+void dsa_net_done (void)
+{
+	struct dsa_net *net;
+
+	pthread_mutex_lock(&net_lock);
+	while ( (net = net_list) )
+	{
+		net_list = net->next;
+		if ( !net->sink )
+		{
+			net->quit = 1;
+			pthread_join(net->thread, NULL);
+			pthread_cond_destroy(&net->cond);
+			pthread_mutex_destroy(&net->lock);
+		}
+		if ( net->stats.packets || net->stats.lost || net->stats.bad )
+			dsa_net_report(net);
+		if ( net->fd >= 0 )
+			close(net->fd);
+		if ( net->lfd >= 0 )
+			close(net->lfd);
+		free(net->valid);
+		free(net->ring);
+		free(net->buf);
+		free(net);
+	}
+	pthread_mutex_unlock(&net_lock);
+}
+
+
+#ifdef NET_TEST
+// Loopback check of the jitter buffer: take a segment, underflow twice with nothing
+// sent, then resume the stream where it left off and take its samples in order.
+#define TEST_ADDR  "127.0.0.1:5599"
+
+static uint16_t  test_tx[2000 * 4];
+static uint16_t  test_rx[1000 * 4];
+
+static int test_take (struct dsa_net *src, size_t num, size_t want, unsigned long unders)
+{
+	static const int        slot[2] = { 0, 1 };
+	struct dsa_net_take     take    = { 1000, 100, 100, DSA_NET_FILL_ZERO };
+	ssize_t                 ret;
+
+	ret = dsa_net_take(src, test_rx, 4, slot, 0, num, &take);
+	printf("take %zu: %zd used, %lu underflows, %llu filled\n", num, ret,
+	       src->stats.underflows, src->stats.filled);
+	if ( ret != want || src->stats.underflows != unders )
+	{
+		printf("FAIL: expected %zu used, %lu underflows\n", want, unders);
+		return -1;
+	}
+	return 0;
+}
+
+int main (int argc, char **argv)
+{
+	struct dsa_net *snk;
+	struct dsa_net *src;
+	size_t          i;
+	int             ret = 1;
+
+	log_dupe(stdout);
+	setbuf(stdout, NULL);
+
+	for ( i = 0; i < sizeof(test_tx) / sizeof(test_tx[0]); i++ )
+		test_tx[i] = i & 0xFFF;
+
+	if ( !(src = dsa_net_source(TEST_ADDR, SOCK_DGRAM, -1, 4096)) ||
+	     !(snk = dsa_net_sink(TEST_ADDR, SOCK_DGRAM, 0)) )
+	{
+		perror(TEST_ADDR);
+		return 1;
+	}
+
+	// a segment taken whole
+	dsa_net_send(snk, test_tx, 8, 8, 1000, 3, DSA_NET_UDP_PKT, 0, 0);
+	if ( test_take(src, 1000, 1000, 0) < 0 )
+		goto done;
+
+	// nothing sent: each take waits out the idle time and underflows
+	if ( test_take(src, 500, 0, 1) < 0 || test_take(src, 500, 0, 2) < 0 )
+		goto done;
+
+	// the stream resumes where it paused, behind the filled tail
+	dsa_net_send(snk, test_tx + 1000 * 4, 8, 8, 100, 3, DSA_NET_UDP_PKT, 0, 0);
+	usleep(50000);
+	if ( test_take(src, 100, 100, 2) < 0 )
+		goto done;
+	if ( memcmp(test_rx, test_tx + 1000 * 4, 100 * 4 * sizeof(uint16_t)) )
+	{
+		printf("FAIL: resumed samples out of order\n");
+		goto done;
+	}
+
+	printf("PASS\n");
+	ret = 0;
+
+done:
+	dsa_net_done();
+	return ret;
+}
+#endif
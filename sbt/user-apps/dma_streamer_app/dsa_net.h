@@ -0,0 +1,174 @@
+/** \file      dsa_net.h
+ *  \brief     interfaces for framed sample streams over UDP and TCP
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_DSA_NET_H_
+#define _INCLUDE_DSA_NET_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+
+#define DSA_NET_MAGIC    0x44534E31  // "DSN1"
+#define DSA_NET_VERSION  1
+
+// sample encoding: 12-bit two's complement in the low bits of little-endian 16-bit words,
+// I then Q for each channel, channel 1 first
+#define DSA_NET_FMT_S12  1
+
+// first packet of a segment: the sample index runs on from the last, the time restarts
+#define DSA_NET_F_SEG    0x01
+
+// default payload bytes per packet: a UDP datagram fits a 1500-byte MTU, a TCP frame is
+// bounded only to keep the gather list short
+#define DSA_NET_UDP_PKT  1408
+#define DSA_NET_TCP_PKT  32768
+
+// largest payload a packet may carry, the most a UDP datagram can hold after the header
+#define DSA_NET_PKT_MAX  65472
+
+// default sample periods a source's jitter buffer holds
+#define DSA_NET_RING     262144
+
+// what a source fills in for samples it doesn't have when taken
+#define DSA_NET_FILL_ZERO  0
+#define DSA_NET_FILL_LAST  1
+
+
+// Each packet is this header, then count sample periods of the channels in chans.  Header
+// fields are in network byte order on the wire; dsa_net_recv returns them in host order.
+struct dsa_net_hdr
+{
+	uint32_t  magic;
+	uint8_t   version;
+	uint8_t   format;   // DSA_NET_FMT_*
+	uint8_t   chans;    // channels in each period, bit 0 for channel 1, bit 1 for channel 2
+	uint8_t   flags;    // DSA_NET_F_*
+	uint16_t  stream;
+	uint16_t  count;    // sample periods in the payload
+	uint32_t  seq;      // packet number in the stream
+	uint64_t  index;    // stream sample index of the first period
+	uint64_t  time;     // CLOCK_MONOTONIC ns of the first period on the sender, 0 if unknown
+} __attribute__((packed));
+
+struct dsa_net_stats
+{
+	unsigned long long  packets;
+	unsigned long long  bytes;       // payload only
+	unsigned long long  samples;
+	unsigned long long  lost;        // sent: dropped on send errors; received: seq gaps
+	unsigned long long  late;        // received behind the sequence or the take, dropped
+	unsigned long long  bad;         // received with a bad header, dropped
+	unsigned long       segments;
+	unsigned long long  usec;        // spent sending, or since the first packet received
+	unsigned long       underflows;  // takes which ran out of samples before the end
+	unsigned long long  filled;      // periods taken without data, on underflow or loss
+	unsigned long long  overruns;    // periods received with the jitter buffer full
+};
+
+// how a take waits for samples from a source: wait for the first packet of a stream, idle
+// without one before the take is filled out, both in ms or <0 for forever; jitter periods
+// gathered at the start and after an underflow before taking any; fill a DSA_NET_FILL_*
+struct dsa_net_take
+{
+	int     wait;
+	int     idle;
+	size_t  jitter;
+	int     fill;
+};
+
+// One end of a stream: a sink sends to addr, a source listens on it.  Both are kept open
+// between uses, so a stream's sequence and sample index carry on over many segments.
+// A source's thread receives into a ring of periods by sample index, the jitter buffer,
+// from which takes copy out in order; a single channel received is kept in both halves of
+// each period.  The ring fields are under lock.
+struct dsa_net
+{
+	struct dsa_net        *next;
+	int                    type;     // SOCK_DGRAM or SOCK_STREAM
+	int                    sink;
+	int                    fd;       // connected socket, -1 while there's none
+	int                    lfd;      // TCP source's listening socket
+	int                    stream;   // sink: ID sent; source: ID taken, -1 for any
+	uint32_t               seq;      // sink: next to send; source: next expected
+	uint64_t               index;    // sink: next sample index to send
+	int                    synced;   // source: seq valid
+	uint8_t               *buf;      // source: packet being received
+	unsigned long long     start;    // source: arrival of the first packet
+	struct dsa_net_stats   stats;
+
+	pthread_t              thread;
+	pthread_mutex_t        lock;
+	pthread_cond_t         cond;
+	int                    quit;
+	uint16_t              *ring;     // 4 words per period
+	uint8_t               *valid;    // per period, set when received
+	size_t                 size;     // periods in the ring
+	uint64_t               head;     // one past the highest index received
+	uint64_t               tail;     // next index to take
+	int                    started;  // tail set from a stream's first packet
+	int                    primed;   // jitter gathered, taking as samples come
+	int                    starved;  // underflow filled tail past head, until the next packet
+	unsigned long long     arrival;  // of the last packet
+	uint16_t               last[4];  // last period taken, for DSA_NET_FILL_LAST
+
+	char                   addr[0];
+};
+
+
+// returns the open sink for addr, "host:port", of SOCK_DGRAM or SOCK_STREAM type and
+// stream ID, opening it first if needed; NULL on error
+struct dsa_net *dsa_net_sink (const char *addr, int type, unsigned stream);
+
+// returns the open source listening on addr, "[host:]port", taking packets of stream ID,
+// or any if stream < 0, opening it with a jitter buffer of ring periods and starting its
+// receive thread if needed; NULL on error
+struct dsa_net *dsa_net_source (const char *addr, int type, int stream, size_t ring);
+
+// Send num sample periods starting at smp as one segment: each period is width bytes,
+// holding the channels in chans, and the periods are stride bytes apart.  The periods
+// are passed to the socket in place, gathered from the buffer with the header.  Each
+// packet carries at most pkt bytes of payload; time is the first period's, stepped at
+// rate if nonzero.  Returns 0 on success or <0 on error; UDP send failures are counted
+// as lost rather than failing the segment.
+int  dsa_net_send (struct dsa_net *snk, const void *smp, size_t stride, size_t width,
+                   size_t num, int chans, size_t pkt, uint64_t time, unsigned long rate);
+
+// Wait up to timeout ms, or forever if <0, for the source's next packet.  Returns the
+// payload bytes with hdr filled in host order and *data pointing at the payload, valid
+// until the next call; 0 on timeout; <0 on error.  Packets behind the sequence or with
+// a bad header are dropped and counted, gaps counted as lost; seq 0 starting a segment
+// is a new sender.  The source's thread calls this, feeding the jitter buffer.
+ssize_t dsa_net_recv (struct dsa_net *src, struct dsa_net_hdr *hdr, const void **data,
+                      int timeout);
+
+// Take num periods from the source's jitter buffer into d, stride words apart.  Channel
+// c of each period, the words at c * 2, gets channel slot[c] of the stream, shifted left
+// 4 bits if lsh, or is left alone if slot[c] < 0.  Samples missing, lost or not arrived
+// within take->idle, are filled as take->fill says and counted.  Returns the periods
+// taken from the stream, or <0 on error, with errno ETIMEDOUT if no stream started
+// within take->wait.
+ssize_t dsa_net_take (struct dsa_net *src, uint16_t *d, size_t stride, const int slot[2],
+                      int lsh, size_t num, const struct dsa_net_take *take);
+
+// log the stream's counts and rate
+void dsa_net_report (struct dsa_net *net);
+
+// stop and close every sink and source, reporting each
+void dsa_net_done (void);
+
+#endif // _INCLUDE_DSA_NET_H_
@@ -0,0 +1,747 @@
+/** \file      dsa_playlist.c
+ *  \brief     implementation of transfer playlists
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include <dma_streamer_mod.h>
+
+#include "dsa_main.h"
+#include "dsa_ioctl_adi_new.h"
+#include "dsa_channel.h"
+#include "dsa_command.h"
+#include "dsa_common.h"
+#include "dsa_playlist.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("playlist", LOG_LEVEL_INFO);
+
+
+#define SEP_CHARS " \t\r\n"
+
+// Steps with identical buffer options share one set of buffers.  spec holds the buffer
+// options as parsed, to find the match.  Parsing only notes the buffer sizes: a set's
+// sample buffers are taken from the pool and loaded while the step before it runs, and
+// returned once its step is done with them, so the pool hands them on by size and the
+// memory held follows the steps in flight, not the length of the playlist.
+struct playlist_buf
+{
+	struct playlist_buf      *next;
+	struct playlist_buf      *save_next;
+	char                     *spec;
+	int                       sinks;     // has RX buffers to save after each trigger
+	int                       saving;    // queued for or running in the saver
+	int                       release;   // return the buffers to the pool once saved
+	int                       loaded;    // buffers held and sources loaded
+	int                       streamed;  // TX fed from a network stream
+	int                       fresh;     // loaded and not yet triggered
+	struct dsa_channel_event  evt;
+};
+
+enum playlist_type
+{
+	STEP_XFER,
+	STEP_DELAY,
+	STEP_REG,
+};
+
+struct playlist_step
+{
+	struct playlist_step    *next;
+	enum playlist_type       type;
+	int                      line;
+
+	// STEP_XFER
+	struct playlist_buf     *buf;
+	struct dsa_trigger_opts  opts;
+
+	// STEP_DELAY
+	unsigned long            msec;
+
+	// STEP_REG
+	int                      dev;
+	int                      tx;
+	unsigned long            ofs;
+	unsigned long            val;
+};
+
+
+static struct playlist_buf   *buf_list  = NULL;
+static struct playlist_step  *step_head = NULL;
+static struct playlist_step  *step_tail = NULL;
+
+// the saver thread writes out sink buffers while the main thread triggers later steps
+static pthread_mutex_t       saver_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t        saver_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t        saver_idle = PTHREAD_COND_INITIALIZER;
+static pthread_t             saver_thread;
+static int                   saver_quit = 0;
+static int                   saver_errs = 0;
+static int                   saver_queued = 0;
+static struct playlist_buf  *saver_head = NULL;
+static struct playlist_buf  *saver_tail = NULL;
+
+// the loader thread loads the next step's buffers while the main thread runs this one
+static pthread_t             loader_thread;
+static struct playlist_buf  *loader_buf = NULL;
+static int                   loader_ret = 0;
+
+
+void dsa_playlist_usage (void)
+{
+	printf("\nPlaylist file: one step per line, '#' starts a comment\n"
+	       "  buffer-options... [trigger-options] [reps|once]\n"
+	       "      Trigger a transfer, with the same options as the command line\n"
+	       "  delay msec\n"
+	       "      Wait before the next step\n"
+	       "  reg ad1|ad2 rx|tx offset value\n"
+	       "      Write a register in the ADI core (new ADI only)\n"
+	       "Each step's source buffers are loaded while the step before it runs.  Steps\n"
+	       "with identical buffer options share buffers, and consecutive ones with the same\n"
+	       "reps stay mapped between triggers.  Sink buffers are saved while later steps\n"
+	       "run.\n"
+	       "Buffers with a network TX source are refilled from the stream before each\n"
+	       "trigger after the first, and trigger once per rep, saving RX as they go.\n\n");
+}
+
+
+// take buffers from the pool and load the sources, before a step runs
+static int buf_load (struct playlist_buf *buf)
+{
+	// pass dsa_adi_new as lsh: new ADI PL enforces a 4-bit right-shift on TX data
+	if ( dsa_channel_acquire(&buf->evt) < 0 || dsa_channel_load(&buf->evt, dsa_adi_new) < 0 )
+	{
+		LOG_ERROR("Failed to load IQ data: %s\n", strerror(errno));
+		dsa_channel_release(&buf->evt);
+		return -1;
+	}
+
+	buf->loaded = 1;
+	buf->fresh  = 1;
+	return 0;
+}
+
+static void buf_release (struct playlist_buf *buf)
+{
+	dsa_channel_release(&buf->evt);
+	buf->loaded = 0;
+}
+
+
+static void *saver_main (void *arg)
+{
+	struct playlist_buf *buf;
+	int                  release;
+	int                  ret;
+
+	pthread_mutex_lock(&saver_lock);
+	while ( 1 )
+	{
+		if ( !(buf = saver_head) )
+		{
+			if ( saver_quit )
+				break;
+			pthread_cond_wait(&saver_work, &saver_lock);
+			continue;
+		}
+
+		if ( !(saver_head = buf->save_next) )
+			saver_tail = NULL;
+		pthread_mutex_unlock(&saver_lock);
+
+		if ( (ret = dsa_channel_save(&buf->evt)) < 0 )
+			LOG_ERROR("Failed to save IQ data: %s\n", strerror(errno));
+
+		// the buffers go back to the pool, unless a coming step has asked to keep them
+		pthread_mutex_lock(&saver_lock);
+		release = buf->release;
+		pthread_mutex_unlock(&saver_lock);
+		if ( release )
+			buf_release(buf);
+
+		pthread_mutex_lock(&saver_lock);
+		if ( ret < 0 )
+			saver_errs++;
+		buf->saving = 0;
+		saver_queued--;
+		pthread_cond_broadcast(&saver_idle);
+	}
+	pthread_mutex_unlock(&saver_lock);
+
+	return NULL;
+}
+
+// queue buf for saving, waiting first if the queue is full; with release set the buffers
+// are returned to the pool after
+static void saver_queue (struct playlist_buf *buf, int release)
+{
+	pthread_mutex_lock(&saver_lock);
+	while ( saver_queued >= DSA_PLAYLIST_SAVES )
+		pthread_cond_wait(&saver_idle, &saver_lock);
+
+	buf->saving    = 1;
+	buf->release   = release;
+	buf->save_next = NULL;
+	if ( saver_tail )
+		saver_tail->save_next = buf;
+	else
+		saver_head = buf;
+	saver_tail = buf;
+	saver_queued++;
+	pthread_cond_signal(&saver_work);
+	pthread_mutex_unlock(&saver_lock);
+}
+
+// wait until buf's last save finishes, before it's triggered again
+static void saver_wait (struct playlist_buf *buf)
+{
+	pthread_mutex_lock(&saver_lock);
+	while ( buf->saving )
+		pthread_cond_wait(&saver_idle, &saver_lock);
+	pthread_mutex_unlock(&saver_lock);
+}
+
+// keep buf's buffers after a save in progress, for a coming step; returns nonzero if
+// they need loading, not being loaded or saved already
+static int saver_keep (struct playlist_buf *buf)
+{
+	int  ret;
+
+	pthread_mutex_lock(&saver_lock);
+	buf->release = 0;
+	ret = !buf->saving && !buf->loaded;
+	pthread_mutex_unlock(&saver_lock);
+
+	return ret;
+}
+
+static void saver_done (void)
+{
+	pthread_mutex_lock(&saver_lock);
+	saver_quit = 1;
+	pthread_cond_signal(&saver_work);
+	pthread_mutex_unlock(&saver_lock);
+
+	pthread_join(saver_thread, NULL);
+}
+
+
+static void *loader_main (void *arg)
+{
+	loader_ret = buf_load(arg);
+	return NULL;
+}
+
+// start loading buf's buffers for the next step
+static void loader_start (struct playlist_buf *buf)
+{
+	int  ret;
+
+	if ( (ret = pthread_create(&loader_thread, NULL, loader_main, buf)) )
+	{
+		// not fatal: the step loads its own buffers when it runs
+		LOG_WARN("Failed to start loader: %s\n", strerror(ret));
+		return;
+	}
+	loader_buf = buf;
+}
+
+// wait for a load started with loader_start(), returning its result
+static int loader_wait (void)
+{
+	if ( !loader_buf )
+		return 0;
+
+	pthread_join(loader_thread, NULL);
+	loader_buf = NULL;
+	return loader_ret;
+}
+
+
+static void step_append (struct playlist_step *step)
+{
+	if ( step_tail )
+		step_tail->next = step;
+	else
+		step_head = step;
+	step_tail = step;
+}
+
+// join argv[0..argc) into a single string, for comparing buffer options between steps
+static char *spec_join (int argc, char **argv)
+{
+	size_t  len = 1;
+	char   *ret;
+	int     idx;
+
+	for ( idx = 0; idx < argc; idx++ )
+		len += strlen(argv[idx]) + 1;
+
+	if ( !(ret = malloc(len)) )
+		return NULL;
+
+	*ret = '\0';
+	for ( idx = 0; idx < argc; idx++ )
+	{
+		if ( idx )
+			strcat(ret, " ");
+		strcat(ret, argv[idx]);
+	}
+
+	return ret;
+}
+
+static int parse_delay (struct playlist_step *step, int argc, char **argv)
+{
+	char *end;
+
+	if ( argc != 2 )
+		return -1;
+
+	errno = 0;
+	step->msec = strtoul(argv[1], &end, 0);
+	if ( errno || *end )
+		return -1;
+
+	step->type = STEP_DELAY;
+	return 0;
+}
+
+static int parse_reg (struct playlist_step *step, int argc, char **argv)
+{
+	char *end;
+
+	if ( argc != 5 )
+		return -1;
+
+	if ( !dsa_adi_new )
+	{
+		LOG_ERROR("Register writes need the new ADI core\n");
+		return -1;
+	}
+
+	if ( !strcasecmp(argv[1], "ad1") )
+		step->dev = 0;
+	else if ( !strcasecmp(argv[1], "ad2") )
+		step->dev = 1;
+	else
+		return -1;
+
+	if ( !strcasecmp(argv[2], "rx") )
+		step->tx = ADI_NEW_RX;
+	else if ( !strcasecmp(argv[2], "tx") )
+		step->tx = ADI_NEW_TX;
+	else
+		return -1;
+
+	errno = 0;
+	step->ofs = strtoul(argv[3], &end, 0);
+	if ( errno || *end || step->ofs & 3 )
+		return -1;
+
+	step->val = strtoul(argv[4], &end, 0);
+	if ( errno || *end )
+		return -1;
+
+	step->type = STEP_REG;
+	return 0;
+}
+
+// parse a transfer step: buffer options as for the command line, then trigger options.
+// copy holds the same words as argv, before dsa_command_setup() modifies them.
+static int parse_xfer (struct playlist_step *step, int argc, char **argv, char **copy)
+{
+	struct dsa_channel_event  evt;
+	struct playlist_buf      *buf;
+	char                     *spec;
+	int                       ofs = 0;
+	int                       ret;
+
+	// the buffers are only allocated when the step is about to run
+	memset(&evt, 0, sizeof(evt));
+	evt.defer = 1;
+	while ( ofs < argc && argv[ofs] )
+	{
+		if ( (ret = dsa_command_setup(&evt, -1, argc - ofs, argv + ofs)) < 0 )
+		{
+			dsa_channel_cleanup(&evt);
+			return -1;
+		}
+		else if ( ret < 1 )
+			break;
+
+		ofs += ret;
+	}
+
+	if ( !evt.tx[0] && !evt.tx[1] && !evt.rx[0] && !evt.rx[1] )
+	{
+		LOG_ERROR("No buffers given\n");
+		return -1;
+	}
+	evt.defer = 0;
+
+	ofs--;
+	if ( dsa_command_trigger_parse(&step->opts, argc - ofs, argv + ofs) < 0 )
+	{
+		dsa_channel_cleanup(&evt);
+		return -1;
+	}
+
+	// share buffers with an earlier step with the same buffer options
+	if ( !(spec = spec_join(ofs + 1, copy)) )
+	{
+		dsa_channel_cleanup(&evt);
+		return -1;
+	}
+	for ( buf = buf_list; buf; buf = buf->next )
+		if ( !strcmp(buf->spec, spec) )
+		{
+			LOG_DEBUG("Line %d shares buffers '%s'\n", step->line, spec);
+			dsa_channel_cleanup(&evt);
+			free(spec);
+			step->buf  = buf;
+			step->type = STEP_XFER;
+			return 0;
+		}
+
+	if ( !(buf = calloc(1, sizeof(*buf))) )
+	{
+		dsa_channel_cleanup(&evt);
+		free(spec);
+		return -1;
+	}
+	buf->spec     = spec;
+	buf->evt      = evt;
+	buf->sinks    = evt.rx[0] || evt.rx[1];
+	buf->streamed = dsa_channel_streamed(&evt);
+	buf->next     = buf_list;
+	buf_list      = buf;
+
+	step->buf  = buf;
+	step->type = STEP_XFER;
+	return 0;
+}
+
+static int parse_line (int line, char *text)
+{
+	struct playlist_step *step;
+	char                 *argv[DSA_PLAYLIST_ARGS + 1];
+	char                 *copy[DSA_PLAYLIST_ARGS + 1];
+	char                 *dupe;
+	char                 *s;
+	char                 *t;
+	int                   argc = 0;
+	int                   ret  = -1;
+
+	if ( (s = strchr(text, '#')) )
+		*s = '\0';
+
+	if ( !(dupe = strdup(text)) )
+		return -1;
+
+	for ( t = strtok_r(text, SEP_CHARS, &s); t; t = strtok_r(NULL, SEP_CHARS, &s) )
+	{
+		if ( argc >= DSA_PLAYLIST_ARGS )
+		{
+			LOG_ERROR("Line %d: too many words, maximum %d\n", line, DSA_PLAYLIST_ARGS);
+			free(dupe);
+			return -1;
+		}
+		argv[argc++] = t;
+	}
+	argv[argc] = NULL;
+
+	argc = 0;
+	for ( t = strtok_r(dupe, SEP_CHARS, &s); t; t = strtok_r(NULL, SEP_CHARS, &s) )
+		copy[argc++] = t;
+	copy[argc] = NULL;
+
+	// blank or comment line
+	if ( !argc )
+	{
+		free(dupe);
+		return 0;
+	}
+
+	if ( !(step = calloc(1, sizeof(*step))) )
+	{
+		free(dupe);
+		return -1;
+	}
+	step->line = line;
+
+	if ( !strcasecmp(argv[0], "delay") )
+		ret = parse_delay(step, argc, argv);
+	else if ( !strcasecmp(argv[0], "reg") )
+		ret = parse_reg(step, argc, argv);
+	else
+		ret = parse_xfer(step, argc, argv, copy);
+
+	free(dupe);
+	if ( ret < 0 )
+	{
+		LOG_ERROR("Line %d: invalid step\n", line);
+		free(step);
+		return -1;
+	}
+
+	step_append(step);
+	return 0;
+}
+
+static int parse_file (const char *path)
+{
+	char  text[DSA_PLAYLIST_LINE];
+	FILE *fp;
+	int   line = 0;
+	int   ret  = 0;
+
+	if ( !(fp = fopen(path, "r")) )
+	{
+		LOG_ERROR("%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while ( !ret && fgets(text, sizeof(text), fp) )
+		ret = parse_line(++line, text);
+
+	fclose(fp);
+	return ret;
+}
+
+static void free_all (void)
+{
+	struct playlist_step *step;
+	struct playlist_buf  *buf;
+
+	while ( (step = step_head) )
+	{
+		step_head = step->next;
+		free(step);
+	}
+	step_tail = NULL;
+
+	while ( (buf = buf_list) )
+	{
+		buf_list = buf->next;
+		dsa_channel_cleanup(&buf->evt);
+		free(buf->spec);
+		free(buf);
+	}
+}
+
+
+// the next transfer step after step, skipping delays and register writes
+static struct playlist_step *next_xfer (struct playlist_step *step)
+{
+	for ( step = step->next; step; step = step->next )
+		if ( step->type == STEP_XFER )
+			return step;
+
+	return NULL;
+}
+
+// reps the buffers are mapped for: detection re-triggers one rep per segment, latency
+// one per capture, and a streamed TX one per buffer; repeated captures map their own
+// pair of buffers, so 0 for none
+static unsigned long map_reps (const struct playlist_step *step)
+{
+	if ( step->opts.repeat )
+		return 0;
+
+	return step->opts.detect || step->opts.latency || step->buf->streamed ? 1 :
+	       step->opts.reps;
+}
+
+static int run_steps (void)
+{
+	struct playlist_step *step;
+	struct playlist_step *next;
+	struct playlist_buf  *mapped = NULL;
+	unsigned long         reps   = 0;
+	int                   keep;
+	int                   num    = 0;
+
+	for ( step = step_head; step; step = step->next )
+	{
+		num++;
+		switch ( step->type )
+		{
+			case STEP_DELAY:
+				LOG_INFO("Step %d: delay %lu ms\n", num, step->msec);
+				usleep(step->msec * 1000);
+				break;
+
+			case STEP_REG:
+				LOG_INFO("Step %d: AD%d %cX reg %04lx <- %08lx\n", num, step->dev + 1,
+				         step->tx ? 'T' : 'R', step->ofs, step->val);
+				if ( dsa_ioctl_adi_new_write(step->dev, step->tx, step->ofs, step->val) )
+				{
+					LOG_ERROR("Line %d: register write failed: %s\n", step->line,
+					          strerror(errno));
+					goto fail;
+				}
+				break;
+
+			case STEP_XFER:
+				LOG_INFO("Step %d: %s\n", num, step->buf->spec);
+
+				// RX data from the last trigger of these buffers must be saved first,
+				// and they may have been loaded during the last step or need loading now
+				if ( loader_wait() < 0 )
+					goto fail;
+				saver_wait(step->buf);
+				if ( !step->buf->loaded && buf_load(step->buf) < 0 )
+					goto fail;
+
+				// load the next step's buffers while this one runs
+				next = next_xfer(step);
+				if ( next && next->buf != step->buf && saver_keep(next->buf) )
+					loader_start(next->buf);
+
+				// the mapping is kept while the same buffers and reps repeat, otherwise
+				// map this step's buffers
+				if ( !step->opts.repeat && (mapped != step->buf || reps != map_reps(step)) )
+				{
+					if ( dsa_main_map(&step->buf->evt, map_reps(step)) )
+					{
+						LOG_ERROR("Line %d: DMA mapping failed: %s\n", step->line,
+						          strerror(errno));
+						goto fail;
+					}
+					mapped = step->buf;
+					reps   = map_reps(step);
+				}
+
+				// detection saves its own events as they're found, repeated captures
+				// each capture
+				if ( step->opts.repeat )
+				{
+					if ( dsa_repeat_run(&step->buf->evt, &step->opts) < 0 )
+					{
+						LOG_ERROR("Line %d: repeated capture failed\n", step->line);
+						goto fail;
+					}
+				}
+				else if ( step->opts.detect )
+				{
+					if ( dsa_detect_run(&step->buf->evt, &step->opts) < 0 )
+					{
+						LOG_ERROR("Line %d: detection failed\n", step->line);
+						goto fail;
+					}
+				}
+				else if ( step->opts.latency )
+				{
+					if ( dsa_latency_run(&step->buf->evt, &step->opts) < 0 )
+					{
+						LOG_ERROR("Line %d: latency measurement failed\n", step->line);
+						goto fail;
+					}
+				}
+				else if ( step->buf->streamed )
+				{
+					if ( dsa_command_stream(&step->buf->evt, &step->opts,
+					                        step->buf->fresh) < 0 )
+					{
+						LOG_ERROR("Line %d: streamed trigger failed\n", step->line);
+						goto fail;
+					}
+				}
+				else if ( dsa_command_trigger_run(&step->buf->evt, &step->opts) < 0 )
+				{
+					LOG_ERROR("Line %d: trigger failed\n", step->line);
+					goto fail;
+				}
+				step->buf->fresh = 0;
+
+				// unmap unless the next transfer triggers the same mapping again
+				if ( mapped && (!next || next->buf != mapped || map_reps(next) != reps) )
+				{
+					if ( dsa_main_unmap() )
+						LOG_ERROR("DMA unmapping failed: %s\n", strerror(errno));
+					mapped = NULL;
+				}
+
+				// the buffers go back to the pool unless the next transfer uses them,
+				// after saving if there's RX to save
+				keep = next && next->buf == step->buf;
+				if ( step->buf->sinks && !step->opts.detect && !step->opts.repeat &&
+				     (step->opts.latency || !step->buf->streamed) )
+					saver_queue(step->buf, !keep);
+				else if ( !keep )
+					buf_release(step->buf);
+				break;
+		}
+	}
+
+	return loader_wait();
+
+fail:
+	loader_wait();
+	if ( mapped && dsa_main_unmap() )
+		LOG_ERROR("DMA unmapping failed: %s\n", strerror(errno));
+	return -1;
+}
+
+
+int dsa_playlist_run (const char *path)
+{
+	struct playlist_buf *buf;
+	int                  ret;
+
+	if ( parse_file(path) < 0 )
+	{
+		dsa_playlist_usage();
+		free_all();
+		return -1;
+	}
+	if ( !step_head )
+	{
+		LOG_ERROR("%s: no steps\n", path);
+		free_all();
+		return -1;
+	}
+
+	saver_quit   = 0;
+	saver_errs   = 0;
+	saver_queued = 0;
+	if ( (ret = pthread_create(&saver_thread, NULL, saver_main, NULL)) )
+	{
+		LOG_ERROR("Failed to start saver: %s\n", strerror(ret));
+		free_all();
+		errno = ret;
+		return -1;
+	}
+
+	ret = run_steps();
+
+	// finish pending saves before the buffers are freed
+	saver_done();
+	if ( saver_errs )
+		ret = -1;
+
+	for ( buf = buf_list; buf; buf = buf->next )
+		dsa_channel_event_dump(&buf->evt);
+
+	free_all();
+	return ret;
+}
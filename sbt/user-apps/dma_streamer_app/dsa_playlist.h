@@ -0,0 +1,36 @@
+/** \file      dsa_playlist.h
+ *  \brief     interfaces for running a playlist of transfers from one process
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at: 
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_DSA_PLAYLIST_H_
+#define _INCLUDE_DSA_PLAYLIST_H_
+
+// longest line accepted in a playlist file, and most words on one line
+#define DSA_PLAYLIST_LINE  4096
+#define DSA_PLAYLIST_ARGS  64
+
+// sink buffers waiting to be saved while later steps run
+#define DSA_PLAYLIST_SAVES  2
+
+
+void dsa_playlist_usage (void);
+
+// parse the playlist at path, then run the steps back to back, loading each step's source
+// buffers while the step before it runs.  Returns 0 if all steps ran, <0 on a parse,
+// load, or trigger error.
+int dsa_playlist_run (const char *path);
+
+#endif // _INCLUDE_DSA_PLAYLIST_H_
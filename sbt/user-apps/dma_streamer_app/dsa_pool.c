@@ -0,0 +1,252 @@
+/** \file      dsa_pool.c
+ *  \brief     implementation of the sample buffer pool
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at: 
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <errno.h>
+
+#include "dsa_pool.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("pool", LOG_LEVEL_INFO);
+
+
+// Sample buffers are anonymous mappings, faulted in and locked once when created, and
+// kept across runs: returning a buffer only marks the slot free.  A mapping which has
+// never been handed out is still the kernel's zero-filled pages, which lets callers skip
+// painting it.
+struct pool_slot
+{
+	void    *base;
+	size_t   size;
+	int      used;
+	int      fresh;
+	int      huge;
+};
+
+static pthread_mutex_t   pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pool_slot *pool_list = NULL;
+static size_t            pool_size = 0;
+static size_t            pool_min  = 0;
+static size_t            pool_huge = 0;  // huge page size, 0 if not using huge pages
+
+
+// huge page size from /proc/meminfo, 0 if not supported
+static size_t pool_huge_size (void)
+{
+	FILE          *fp;
+	char           line[128];
+	unsigned long  kb = 0;
+
+	if ( !(fp = fopen("/proc/meminfo", "r")) )
+		return 0;
+
+	while ( fgets(line, sizeof(line), fp) )
+		if ( sscanf(line, "Hugepagesize: %lu kB", &kb) == 1 )
+			break;
+
+	fclose(fp);
+	return kb * 1024;
+}
+
+static size_t pool_round (size_t size, size_t unit)
+{
+	return (size + unit - 1) / unit * unit;
+}
+
+static int pool_map (struct pool_slot *slot, size_t size)
+{
+	int  flags = MAP_PRIVATE|MAP_ANONYMOUS;
+
+#ifdef MAP_POPULATE
+	flags |= MAP_POPULATE;
+#endif
+
+	if ( size < pool_min )
+		size = pool_min;
+
+	slot->base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	if ( pool_huge )
+	{
+		slot->size = pool_round(size, pool_huge);
+		slot->base = mmap(NULL, slot->size, PROT_READ|PROT_WRITE, flags|MAP_HUGETLB, -1, 0);
+		if ( slot->base == MAP_FAILED )
+			LOG_DEBUG("huge page mmap() of %zu bytes failed: %s\n",
+			          slot->size, strerror(errno));
+		else
+			slot->huge = 1;
+	}
+#endif
+
+	if ( slot->base == MAP_FAILED )
+	{
+		slot->size = pool_round(size, sysconf(_SC_PAGESIZE));
+		slot->huge = 0;
+		slot->base = mmap(NULL, slot->size, PROT_READ|PROT_WRITE, flags, -1, 0);
+	}
+	if ( slot->base == MAP_FAILED )
+	{
+		LOG_ERROR("Failed to mmap() %zu bytes: %s\n", slot->size, strerror(errno));
+		slot->base = NULL;
+		return -1;
+	}
+
+	if ( mlock(slot->base, slot->size) )
+	{
+		LOG_ERROR("Failed to mlock() %zu bytes: %s\n", slot->size, strerror(errno));
+		munmap(slot->base, slot->size);
+		slot->base = NULL;
+		return -1;
+	}
+
+	LOG_DEBUG("mapped %zu bytes at %p%s\n", slot->size, slot->base,
+	          slot->huge ? " in huge pages" : "");
+	slot->fresh = 1;
+	return 0;
+}
+
+static void pool_unmap (struct pool_slot *slot)
+{
+	LOG_DEBUG("unmap %zu bytes at %p\n", slot->size, slot->base);
+	munlock(slot->base, slot->size);
+	munmap(slot->base, slot->size);
+	memset(slot, 0, sizeof(*slot));
+}
+
+// all buffers are in use: double the table, returning the first new slot
+static struct pool_slot *pool_grow (void)
+{
+	struct pool_slot *list;
+	size_t            size = pool_size ? pool_size * 2 : DSA_POOL_SLOTS;
+
+	if ( !(list = realloc(pool_list, size * sizeof(*list))) )
+	{
+		LOG_ERROR("Failed to grow buffer pool to %zu: %s\n", size, strerror(errno));
+		return NULL;
+	}
+	memset(list + pool_size, 0, (size - pool_size) * sizeof(*list));
+	LOG_DEBUG("grew pool to %zu buffers\n", size);
+
+	pool_list = list;
+	list += pool_size;
+	pool_size = size;
+	return list;
+}
+
+
+void dsa_pool_init (size_t size, int huge)
+{
+	pthread_mutex_lock(&pool_lock);
+	pool_min  = size;
+	pool_huge = huge ? pool_huge_size() : 0;
+	if ( huge && !pool_huge )
+		LOG_WARN("Huge pages not supported, using normal pages\n");
+	pthread_mutex_unlock(&pool_lock);
+}
+
+
+void *dsa_pool_get (size_t size, int *fresh)
+{
+	struct pool_slot *slot = NULL;
+	struct pool_slot *walk;
+	void             *ret  = NULL;
+
+	pthread_mutex_lock(&pool_lock);
+
+	// smallest free buffer which fits
+	for ( walk = pool_list; walk < pool_list + pool_size; walk++ )
+		if ( walk->base && !walk->used && walk->size >= size )
+			if ( !slot || walk->size < slot->size )
+				slot = walk;
+
+	// otherwise map a new one, in an empty slot or replacing a free one too small
+	if ( !slot )
+	{
+		for ( walk = pool_list; walk < pool_list + pool_size; walk++ )
+			if ( !walk->base )
+				break;
+		if ( walk == pool_list + pool_size )
+			for ( walk = pool_list; walk < pool_list + pool_size; walk++ )
+				if ( !walk->used )
+				{
+					pool_unmap(walk);
+					break;
+				}
+
+		if ( walk == pool_list + pool_size && !(walk = pool_grow()) )
+			goto done;
+		if ( pool_map(walk, size) )
+			goto done;
+
+		slot = walk;
+	}
+
+	if ( fresh )
+		*fresh = slot->fresh;
+	slot->fresh = 0;
+	slot->used  = 1;
+	ret = slot->base;
+
+done:
+	pthread_mutex_unlock(&pool_lock);
+	return ret;
+}
+
+
+void dsa_pool_put (void *buff)
+{
+	struct pool_slot *slot;
+
+	if ( !buff )
+		return;
+
+	pthread_mutex_lock(&pool_lock);
+	for ( slot = pool_list; slot < pool_list + pool_size; slot++ )
+		if ( slot->base == buff )
+		{
+			slot->used = 0;
+			break;
+		}
+	pthread_mutex_unlock(&pool_lock);
+
+	if ( slot == pool_list + pool_size )
+		LOG_ERROR("Buffer %p not from pool\n", buff);
+}
+
+
+void dsa_pool_done (void)
+{
+	struct pool_slot *slot;
+
+	pthread_mutex_lock(&pool_lock);
+	for ( slot = pool_list; slot < pool_list + pool_size; slot++ )
+		if ( slot->base )
+		{
+			if ( slot->used )
+				LOG_WARN("Buffer %p still in use at exit\n", slot->base);
+			pool_unmap(slot);
+		}
+	free(pool_list);
+	pool_list = NULL;
+	pool_size = 0;
+	pthread_mutex_unlock(&pool_lock);
+}
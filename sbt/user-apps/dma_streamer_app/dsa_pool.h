@@ -0,0 +1,43 @@
+/** \file      dsa_pool.h
+ *  \brief     interfaces for the sample buffer pool
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at: 
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_DSA_POOL_H_
+#define _INCLUDE_DSA_POOL_H_
+#include <stddef.h>
+
+// initial table size: 2 devices * 2 directions, plus room for late allocations; the
+// table grows when all its buffers are in use
+#define DSA_POOL_SLOTS  8
+
+
+// set the minimum size of new buffers in bytes, normally the largest buffer expected, so
+// buffers can be reused for smaller requests; if huge is set try to back buffers with
+// huge pages, falling back to normal pages if none are available
+void  dsa_pool_init (size_t size, int huge);
+
+// get a page-aligned, pre-faulted and locked buffer of at least size bytes.  If fresh is
+// not NULL it's set nonzero if the buffer has never been handed out and so is known to
+// be zero-filled.  Returns NULL on error.
+void *dsa_pool_get (size_t size, int *fresh);
+
+// return a buffer to the pool; it stays mapped and locked for reuse
+void  dsa_pool_put (void *buff);
+
+// unmap all buffers, which must have been returned
+void  dsa_pool_done (void);
+
+#endif // _INCLUDE_DSA_POOL_H_
@@ -0,0 +1,453 @@
+/** \file      dsa_prbs.c
+ *  \brief     implementation of the PRBS pattern checker behind the prbs format
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PRBS_NEON 1
+#endif
+
+#include "dsa_prbs.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("prbs", LOG_LEVEL_INFO);
+
+
+// error count for a word taken while locking, not checked
+#define PRBS_UNCHECKED  0xFF
+
+
+int dsa_prbs_tap (unsigned order)
+{
+	switch ( order )
+	{
+		case 7:  return 6;
+		case 15: return 14;
+		case 23: return 18;
+		case 31: return 28;
+	}
+
+	return -1;
+}
+
+// The LFSR holds the last order bits, newest in bit 0, and the next bit is bit order - 1
+// XOR bit tap - 1.  The next m bits only depend on bits already in the state while m is
+// at most tap, so they're made in one step: 12 at once for all but PRBS7, which takes
+// two steps of 6.  *m gets the step sizes and the number of steps is returned.
+static int prbs_steps (unsigned tap, unsigned *m)
+{
+	if ( tap >= 12 )
+	{
+		m[0] = 12;
+		return 1;
+	}
+
+	m[0] = m[1] = 6;
+	return 2;
+}
+
+static inline uint16_t prbs_word (uint32_t *lfsr, unsigned order, unsigned tap)
+{
+	uint32_t  s = *lfsr;
+	uint32_t  w = 0;
+	uint32_t  b;
+	unsigned  m[2];
+	int       steps = prbs_steps(tap, m);
+	int       k;
+
+	for ( k = 0; k < steps; k++ )
+	{
+		b = ((s >> (order - m[k])) ^ (s >> (tap - m[k]))) & ((1UL << m[k]) - 1);
+		s = ((s << m[k]) | b) & ((1UL << order) - 1);
+		w = (w << m[k]) | b;
+	}
+
+	*lfsr = s;
+	return w;
+}
+
+uint16_t dsa_prbs_word (uint32_t *lfsr, unsigned order)
+{
+	return prbs_word(lfsr, order, dsa_prbs_tap(order));
+}
+
+
+// one lane, locking as needed: e gets the error bits of each word, 4 apart
+static void prbs_run_lane (const struct dsa_prbs *chk, struct dsa_prbs_lane *ln,
+                           const uint16_t *d, size_t stride, size_t num, uint32_t *e)
+{
+	uint32_t  mask = (1UL << chk->order) - 1;
+	uint16_t  w;
+	size_t    n;
+
+	for ( n = 0; n < num; n++, d += stride, e += 4 )
+	{
+		w = *d & 0xFFF;
+		if ( ln->locked )
+		{
+			*e = __builtin_popcount(w ^ prbs_word(&ln->lfsr, chk->order, chk->tap));
+			continue;
+		}
+
+		*e       = PRBS_UNCHECKED;
+		ln->lfsr = ((ln->lfsr << 12) | w) & mask;
+		if ( (ln->fill += 12) >= chk->order )
+		{
+			// an all-zero state is no PRBS, most likely a silent lane
+			ln->fill   = 0;
+			ln->locked = !!ln->lfsr;
+		}
+	}
+}
+
+#ifdef PRBS_NEON
+// the four lanes of a pair buffer at once, all taken as locked: the shifts for each step
+// are fixed by the order, so they're set up once, and the error bits counted per byte
+static void prbs_run_neon (struct dsa_prbs *chk, const uint16_t *d, size_t num,
+                           uint32_t *e)
+{
+	uint32_t    init[4];
+	uint32x4_t  mask = vdupq_n_u32((1UL << chk->order) - 1);
+	uint32x4_t  w12  = vdupq_n_u32(0xFFF);
+	uint32x4_t  s, x, w, b;
+	uint32x4_t  mk[2];
+	int32x4_t   sh_o[2], sh_t[2], sh_m[2];
+	unsigned    m[2];
+	size_t      n;
+	int         steps = prbs_steps(chk->tap, m);
+	int         k;
+
+	for ( k = 0; k < steps; k++ )
+	{
+		mk[k]   = vdupq_n_u32((1UL << m[k]) - 1);
+		sh_o[k] = vdupq_n_s32(-(int)(chk->order - m[k]));
+		sh_t[k] = vdupq_n_s32(-(int)(chk->tap - m[k]));
+		sh_m[k] = vdupq_n_s32(m[k]);
+	}
+
+	for ( k = 0; k < 4; k++ )
+		init[k] = chk->lane[k].lfsr;
+	s = vld1q_u32(init);
+
+	for ( n = 0; n < num; n++, d += 4, e += 4 )
+	{
+		x = vandq_u32(vmovl_u16(vld1_u16(d)), w12);
+		w = vdupq_n_u32(0);
+		for ( k = 0; k < steps; k++ )
+		{
+			b = vandq_u32(veorq_u32(vshlq_u32(s, sh_o[k]), vshlq_u32(s, sh_t[k])), mk[k]);
+			s = vandq_u32(vorrq_u32(vshlq_u32(s, sh_m[k]), b), mask);
+			w = vorrq_u32(vshlq_u32(w, sh_m[k]), b);
+		}
+		x = veorq_u32(x, w);
+		vst1q_u32(e, vpaddlq_u16(vpaddlq_u8(vcntq_u8(vreinterpretq_u8_u32(x)))));
+	}
+
+	vst1q_u32(init, s);
+	for ( k = 0; k < 4; k++ )
+		chk->lane[k].lfsr = init[k];
+}
+#endif
+
+
+static void prbs_burst_end (struct dsa_prbs *chk, int c)
+{
+	struct dsa_prbs_burst *b = &chk->burst[c];
+
+	if ( !b->open )
+		return;
+
+	chk->count[c].bursts++;
+	if ( chk->report )
+		chk->report(chk->arg, c, b);
+	b->open = 0;
+}
+
+// count a chunk's errors for channel c, and drop the lock of a lane with too many
+static void prbs_tally (struct dsa_prbs *chk, int c, const uint32_t *e, size_t num)
+{
+	struct dsa_prbs_count *cnt  = &chk->count[c];
+	struct dsa_prbs_burst *b    = &chk->burst[c];
+	struct dsa_prbs_lane  *ln;
+	unsigned long          bits[2] = { 0, 0 };
+	unsigned long          errs[2] = { 0, 0 };
+	unsigned long long     pos;
+	uint32_t               ei, eq;
+	size_t                 n;
+	int                    l;
+
+	for ( n = 0, e += c * 2; n < num; n++, e += 4 )
+	{
+		ei = e[0];
+		eq = e[1];
+		if ( ei != PRBS_UNCHECKED )
+		{
+			bits[0] += 12;
+			errs[0] += ei;
+		}
+		if ( eq != PRBS_UNCHECKED )
+		{
+			bits[1] += 12;
+			errs[1] += eq;
+		}
+		if ( ei == PRBS_UNCHECKED || eq == PRBS_UNCHECKED )
+			continue;
+
+		cnt->samples++;
+		cnt->bits     += 24;
+		cnt->bit_errs += ei + eq;
+		if ( !(ei | eq) )
+			continue;
+
+		cnt->smp_errs++;
+		pos = chk->pos + n;
+		if ( b->open && pos - b->last > chk->gap )
+			prbs_burst_end(chk, c);
+		if ( !b->open )
+		{
+			memset(b, 0, sizeof(*b));
+			b->open  = 1;
+			b->start = pos;
+		}
+		b->last      = pos;
+		b->smp_errs += 1;
+		b->bit_errs += ei + eq;
+	}
+
+	// a burst ends once gap clean samples follow it, not only at the next error
+	if ( b->open && chk->pos + num - 1 - b->last > chk->gap )
+		prbs_burst_end(chk, c);
+
+	// sync is judged over a good part of a chunk, so a lane locked at its end isn't
+	// dropped for one bad word
+	for ( l = 0; l < 2; l++ )
+	{
+		ln = &chk->lane[c * 2 + l];
+		if ( ln->locked && bits[l] >= 12 * DSA_PRBS_CHUNK / 4 && errs[l] * 4 > bits[l] )
+		{
+			ln->locked = 0;
+			ln->fill   = 0;
+			cnt->losses++;
+		}
+	}
+}
+
+
+int dsa_prbs_init (struct dsa_prbs *chk, unsigned order, size_t gap)
+{
+	int  tap;
+
+	if ( (tap = dsa_prbs_tap(order)) < 0 )
+	{
+		LOG_ERROR("Invalid PRBS order %u, use 7, 15, 23, or 31\n", order);
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(chk, 0, sizeof(*chk));
+	chk->order = order;
+	chk->tap   = tap;
+	chk->gap   = gap;
+	return 0;
+}
+
+void dsa_prbs_check (struct dsa_prbs *chk, const uint16_t *d, size_t stride,
+                     size_t num, int chans)
+{
+	uint32_t              e[DSA_PRBS_CHUNK * 4];
+	size_t                want;
+	int                   lanes = 0;
+	int                   fast;
+	int                   l, c;
+#ifdef PRBS_NEON
+	struct dsa_prbs_lane  save[4];
+#endif
+
+	for ( c = 0; c < 2; c++ )
+		if ( chans & (1 << c) )
+			lanes |= 3 << (c * 2);
+
+	for ( ; num; num -= want, d += want * stride, chk->pos += want )
+	{
+		want = num < DSA_PRBS_CHUNK ? num : DSA_PRBS_CHUNK;
+
+		// the locked lanes of a pair buffer go through NEON, the others are run alone
+		fast = 0;
+#ifdef PRBS_NEON
+		for ( l = 0; l < 4; l++ )
+			if ( (lanes & (1 << l)) && chk->lane[l].locked )
+				fast |= 1 << l;
+		if ( stride == 4 && fast )
+		{
+			memcpy(save, chk->lane, sizeof(save));
+			prbs_run_neon(chk, d, want, e);
+			for ( l = 0; l < 4; l++ )
+				if ( !(fast & (1 << l)) )
+					chk->lane[l] = save[l];
+		}
+		else
+			fast = 0;
+#endif
+		for ( l = 0; l < 4; l++ )
+			if ( (lanes & (1 << l)) && !(fast & (1 << l)) )
+				prbs_run_lane(chk, &chk->lane[l], d + l, stride, want, e + l);
+
+		for ( c = 0; c < 2; c++ )
+			if ( chans & (1 << c) )
+				prbs_tally(chk, c, e, want);
+	}
+}
+
+void dsa_prbs_flush (struct dsa_prbs *chk)
+{
+	prbs_burst_end(chk, 0);
+	prbs_burst_end(chk, 1);
+}
+
+
+#ifdef PRBS_TEST
+// Check of the NEON kernel against the scalar one, when built for NEON, then of the
+// counts on a stream with errors put in at known places, through the pair-buffer path
+// and the per-lane one, in pieces that split the chunks.
+#define TEST_NUM  3000
+
+static uint16_t  test_d[TEST_NUM * 6];
+
+#ifdef PRBS_NEON
+static int test_neon (unsigned order)
+{
+	struct dsa_prbs  chk[2];
+	uint16_t         d[DSA_PRBS_CHUNK * 4];
+	uint32_t         e[2][DSA_PRBS_CHUNK * 4];
+	uint32_t         lfsr;
+	size_t           n;
+	int              l;
+
+	memset(&chk[0], 0, sizeof(chk[0]));
+	chk[0].order = order;
+	chk[0].tap   = dsa_prbs_tap(order);
+	for ( l = 0; l < 4; l++ )
+	{
+		chk[0].lane[l].lfsr   = lfsr = 0x5A5A5A5A >> (32 - order + l);
+		chk[0].lane[l].locked = 1;
+		for ( n = 0; n < DSA_PRBS_CHUNK; n++ )
+			d[n * 4 + l] = dsa_prbs_word(&lfsr, order) ^ (n % 37 ? 0 : n & 0xFFF);
+	}
+	chk[1] = chk[0];
+
+	prbs_run_neon(&chk[0], d, DSA_PRBS_CHUNK, e[0]);
+	for ( l = 0; l < 4; l++ )
+		prbs_run_lane(&chk[1], &chk[1].lane[l], d + l, 4, DSA_PRBS_CHUNK, e[1] + l);
+
+	if ( memcmp(e[0], e[1], sizeof(e[0])) ||
+	     memcmp(chk[0].lane, chk[1].lane, sizeof(chk[0].lane)) )
+	{
+		printf("FAIL: order %u NEON kernel disagrees with the reference\n", order);
+		return -1;
+	}
+	return 0;
+}
+#endif
+
+// channel 1 gets a bit error every 37 samples, channel 2 two every 101, after the lock
+static int test_stream (unsigned order, size_t stride)
+{
+	struct dsa_prbs        chk;
+	struct dsa_prbs_count *cnt;
+	unsigned long long     want[2] = { 0, 0 };
+	uint32_t               lfsr;
+	size_t                 lock = (order + 11) / 12;
+	size_t                 step;
+	size_t                 n;
+	int                    l, c;
+
+	for ( l = 0; l < 4; l++ )
+	{
+		lfsr = 0x12345678 >> (32 - order + l);
+		for ( n = 0; n < TEST_NUM; n++ )
+			test_d[n * stride + l] = dsa_prbs_word(&lfsr, order);
+	}
+	for ( n = lock; n < TEST_NUM; n++ )
+	{
+		if ( !(n % 37) )
+		{
+			test_d[n * stride] ^= 0x001;
+			want[0]++;
+		}
+		if ( !(n % 101) )
+		{
+			test_d[n * stride + 3] ^= 0x300;
+			want[1] += 2;
+		}
+	}
+
+	if ( dsa_prbs_init(&chk, order, DSA_PRBS_GAP) )
+	{
+		printf("FAIL: order %u not set up\n", order);
+		return -1;
+	}
+	for ( n = 0; n < TEST_NUM; n += step )
+	{
+		step = TEST_NUM - n < 700 ? TEST_NUM - n : 700;
+		dsa_prbs_check(&chk, test_d + n * stride, stride, step, 3);
+	}
+	dsa_prbs_flush(&chk);
+
+	for ( c = 0; c < 2; c++ )
+	{
+		cnt = &chk.count[c];
+		printf("order %u stride %zu chan %d: %llu samples, %llu bit errors, %llu sample "
+		       "errors, %lu bursts, %lu losses\n", order, stride, c + 1, cnt->samples,
+		       cnt->bit_errs, cnt->smp_errs, cnt->bursts, cnt->losses);
+		if ( cnt->samples != TEST_NUM - lock || cnt->bit_errs != want[c] ||
+		     cnt->smp_errs != want[c] / (c + 1) || cnt->bursts != want[c] / (c + 1) ||
+		     cnt->losses )
+		{
+			printf("FAIL: expected %zu samples, %llu bit errors\n", TEST_NUM - lock,
+			       want[c]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int main (int argc, char **argv)
+{
+	static const unsigned  orders[] = { 7, 15, 23, 31 };
+	int                    o;
+
+	log_dupe(stdout);
+	setbuf(stdout, NULL);
+
+	for ( o = 0; o < 4; o++ )
+	{
+#ifdef PRBS_NEON
+		if ( test_neon(orders[o]) )
+			return 1;
+#endif
+		if ( test_stream(orders[o], 4) || test_stream(orders[o], 6) )
+			return 1;
+	}
+
+	printf("PASS\n");
+	return 0;
+}
+#endif
@@ -0,0 +1,94 @@
+/** \file      dsa_prbs.h
+ *  \brief     interfaces for the PRBS pattern checker behind the prbs format
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_DSA_PRBS_H_
+#define _INCLUDE_DSA_PRBS_H_
+#include <stdint.h>
+#include <stddef.h>
+
+
+#define DSA_PRBS_CHUNK  256  // sample periods checked per pass, and over which sync is judged
+#define DSA_PRBS_GAP    16   // default error-free samples that end a burst
+
+
+// Each 16-bit word of a sample period is a lane with its own PRBS, 12 bits per word MSB
+// first.  A lane locks by taking order received bits as its LFSR state, then checks each
+// word against the next 12 bits; more than a quarter of a chunk's bits in error loses the
+// lock, and it locks again from the data.
+struct dsa_prbs_lane
+{
+	uint32_t  lfsr;
+	unsigned  fill;    // bits taken while locking
+	int       locked;
+};
+
+// per channel, over both of its lanes: a sample error is a period with errors in either
+struct dsa_prbs_count
+{
+	unsigned long long  samples;   // periods checked with both lanes locked
+	unsigned long long  bits;
+	unsigned long long  bit_errs;
+	unsigned long long  smp_errs;
+	unsigned long       bursts;
+	unsigned long       losses;    // times a lane lost sync after locking
+};
+
+// errors no more than gap samples apart, positions counted from the first sample checked
+struct dsa_prbs_burst
+{
+	unsigned long long  start;
+	unsigned long long  last;
+	unsigned long long  smp_errs;
+	unsigned long long  bit_errs;
+	int                 open;
+};
+
+struct dsa_prbs
+{
+	unsigned               order;
+	unsigned               tap;
+	size_t                 gap;
+	unsigned long long     pos;       // sample periods passed so far
+	struct dsa_prbs_lane   lane[4];
+	struct dsa_prbs_count  count[2];
+	struct dsa_prbs_burst  burst[2];
+
+	// called with each burst as it ends, if set
+	void                 (*report)(void *arg, int chan, const struct dsa_prbs_burst *burst);
+	void                  *arg;
+};
+
+
+// tap of the ITU-T O.150 polynomial for PRBS order 7, 15, 23 or 31, -1 for another order
+int      dsa_prbs_tap (unsigned order);
+
+// the next 12 bits of a PRBS from lfsr, the first in the MSB; order must be valid
+uint16_t dsa_prbs_word (uint32_t *lfsr, unsigned order);
+
+// set up chk for a PRBS order and burst gap in samples; returns 0 or <0 on error
+int      dsa_prbs_init (struct dsa_prbs *chk, unsigned order, size_t gap);
+
+// check num sample periods of d, stride 16-bit words apart, on the channels in chans, bit
+// 0 for the words at offset 0 and 1, bit 1 for 2 and 3.  The state carries over between
+// calls, so a stream can be checked in pieces.
+void     dsa_prbs_check (struct dsa_prbs *chk, const uint16_t *d, size_t stride,
+                         size_t num, int chans);
+
+// end any open bursts, reporting them
+void     dsa_prbs_flush (struct dsa_prbs *chk);
+
+#endif // _INCLUDE_DSA_PRBS_H_
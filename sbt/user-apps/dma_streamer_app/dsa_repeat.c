@@ -0,0 +1,364 @@
+/** \file      dsa_repeat.c
+ *  \brief     repeated captures, double-buffered so saving overlaps the next capture
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include <dma_streamer_mod.h>
+
+#include "dsa_main.h"
+#include "dsa_ioctl.h"
+#include "dsa_channel.h"
+#include "dsa_command.h"
+#include "dsa_common.h"
+#include "dsa_pool.h"
+#include "dsa_repeat.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("repeat", LOG_LEVEL_INFO);
+
+
+// Two slots take captures in turn: slot 0 uses evt's own RX buffers, slot 1 a second
+// set from the pool, and both trigger evt's TX buffers.  The saver thread takes the slots
+// in capture order, so at most one save runs, and the main thread only waits for it when
+// the slot it needs next is still being saved: loads and saves each wait for their own
+// jobs on the worker pool, so neither holds up the other.
+struct repeat_slot
+{
+	struct dsa_channel_event  evt;
+	struct dsa_channel_xfer   rx[2];
+	unsigned long             num;     // capture held
+	unsigned long long        time;    // ns of its first sample, 0 if not known
+	int                       saving;  // queued for or running in the saver
+};
+
+struct repeat_state
+{
+	struct dsa_channel_event *evt;
+	struct repeat_slot        slot[2];
+
+	pthread_mutex_t           lock;
+	pthread_cond_t            cond;
+	pthread_t                 thread;
+	unsigned long             next;    // capture the saver takes next
+	int                       quit;
+	unsigned long             saved;
+	unsigned long             errs;
+	unsigned long long        save_usec;
+};
+
+static volatile sig_atomic_t repeat_stop;
+
+static void repeat_sigint (int signum)
+{
+	repeat_stop = 1;
+}
+
+
+// save a slot's capture to evt's sinks, numbered
+static int slot_save (struct repeat_state *st, struct repeat_slot *slot)
+{
+	struct dsa_channel_event  sub;
+	struct dsa_channel_xfer  *src;
+	int                       ret = 0;
+	int                       dev;
+	int                       c;
+
+	memset(&sub, 0, sizeof(sub));
+	for ( dev = 0; dev < 2; dev++ )
+		if ( (src = st->evt->rx[dev]) )
+		{
+			sub.rx[dev] = &slot->rx[dev];
+			for ( c = 0; c < 2; c++ )
+				if ( src->snk[c] &&
+				     !(slot->rx[dev].snk[c] = dsa_channel_sxx_number(src->snk[c], slot->num,
+				                                                     slot->time)) )
+					ret = -1;
+		}
+
+	if ( !ret && (ret = dsa_channel_save(&sub)) < 0 )
+		LOG_ERROR("Failed to save capture %lu: %s\n", slot->num, strerror(errno));
+
+	for ( dev = 0; dev < 2; dev++ )
+		for ( c = 0; c < 2; c++ )
+		{
+			free(slot->rx[dev].snk[c]);
+			slot->rx[dev].snk[c] = NULL;
+		}
+
+	return ret;
+}
+
+static void *repeat_saver (void *arg)
+{
+	struct repeat_state *st = arg;
+	struct repeat_slot  *slot;
+	unsigned long long   usec;
+	int                  ret;
+
+	pthread_mutex_lock(&st->lock);
+	while ( 1 )
+	{
+		slot = &st->slot[st->next & 1];
+		if ( !slot->saving )
+		{
+			if ( st->quit )
+				break;
+			pthread_cond_wait(&st->cond, &st->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&st->lock);
+
+		usec = mono_usec();
+		ret  = slot_save(st, slot);
+		usec = mono_usec() - usec;
+
+		pthread_mutex_lock(&st->lock);
+		if ( ret < 0 )
+			st->errs++;
+		else
+			st->saved++;
+		st->save_usec += usec;
+		slot->saving = 0;
+		st->next++;
+		pthread_cond_broadcast(&st->cond);
+	}
+	pthread_mutex_unlock(&st->lock);
+
+	return NULL;
+}
+
+
+static int repeat_setup (struct repeat_state *st, struct dsa_channel_event *evt)
+{
+	struct repeat_slot *slot;
+	int                 dev;
+	int                 num;
+
+	st->evt = evt;
+	for ( num = 0; num < 2; num++ )
+	{
+		slot = &st->slot[num];
+		for ( dev = 0; dev < 2; dev++ )
+		{
+			slot->evt.tx[dev] = evt->tx[dev];
+			if ( !evt->rx[dev] )
+				continue;
+
+			// the sinks are numbered per capture, and there's nothing to load
+			slot->rx[dev] = *evt->rx[dev];
+			slot->rx[dev].src[0] = slot->rx[dev].src[1] = NULL;
+			slot->rx[dev].snk[0] = slot->rx[dev].snk[1] = NULL;
+			slot->evt.rx[dev] = &slot->rx[dev];
+
+			if ( num && !(slot->rx[dev].smp = dsa_pool_get(dsa_channel_bytes(evt->rx[dev]),
+			                                               NULL)) )
+			{
+				LOG_ERROR("Failed to allocate a second AD%d RX buffer\n", dev + 1);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static void repeat_cleanup (struct repeat_state *st)
+{
+	int  dev;
+
+	for ( dev = 0; dev < 2; dev++ )
+		if ( st->slot[1].evt.rx[dev] )
+			dsa_pool_put(st->slot[1].rx[dev].smp);
+}
+
+
+int dsa_repeat_run (struct dsa_channel_event *evt, const struct dsa_trigger_opts *opts)
+{
+	struct dsa_trigger_opts  cap_opts = *opts;
+	struct dsm_user_stats    sb;
+	struct dsm_xfer_stats   *xs;
+	struct repeat_state      st;
+	struct repeat_slot      *slot;
+	struct sigaction         sa, old;
+	unsigned long long       start;
+	unsigned long long       begin;
+	unsigned long long       usec;
+	unsigned long long       cap_usec = 0;
+	unsigned long long       wait_usec = 0;
+	unsigned long long       step = opts->rep.interval * 1000000.0;
+	unsigned long            late = 0;
+	unsigned long            num;
+	int                      streamed = dsa_channel_streamed(evt);
+	int                      ret = 0;
+
+	if ( (!evt->rx[0] || (!evt->rx[0]->snk[0] && !evt->rx[0]->snk[1])) &&
+	     (!evt->rx[1] || (!evt->rx[1]->snk[0] && !evt->rx[1]->snk[1])) )
+	{
+		LOG_ERROR("Repeated captures need an RX buffer with a file to save to\n");
+		errno = EINVAL;
+		return -1;
+	}
+	if ( opts->reps > 1 )
+		LOG_WARN("Repeated captures trigger once each, ignoring %lu reps\n", opts->reps);
+
+	memset(&st, 0, sizeof(st));
+	if ( repeat_setup(&st, evt) < 0 )
+	{
+		repeat_cleanup(&st);
+		return -1;
+	}
+
+	pthread_mutex_init(&st.lock, NULL);
+	pthread_cond_init(&st.cond, NULL);
+	if ( (errno = pthread_create(&st.thread, NULL, repeat_saver, &st)) )
+	{
+		LOG_ERROR("Failed to start saver thread: %s\n", strerror(errno));
+		pthread_cond_destroy(&st.cond);
+		pthread_mutex_destroy(&st.lock);
+		repeat_cleanup(&st);
+		return -1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = repeat_sigint;
+	repeat_stop   = 0;
+	sigaction(SIGINT, &sa, &old);
+
+	if ( opts->rep.count )
+		LOG_INFO("Capturing %lu times, saving while the next is captured\n",
+		         opts->rep.count);
+	else
+		LOG_INFO("Capturing until interrupted, saving while the next is captured\n");
+
+	// stats per capture would drown the progress; a timed start applies to the first
+	// capture only, and the interval counts from the first trigger
+	cap_opts.reps  = 1;
+	begin = start = mono_usec();
+	for ( num = 0; !repeat_stop && (!opts->rep.count || num < opts->rep.count); num++ )
+	{
+		slot = &st.slot[num & 1];
+
+		// the save of the capture two back has to finish before its buffer's reused
+		usec = mono_usec();
+		pthread_mutex_lock(&st.lock);
+		while ( slot->saving )
+			pthread_cond_wait(&st.cond, &st.lock);
+		pthread_mutex_unlock(&st.lock);
+		wait_usec += mono_usec() - usec;
+
+		if ( step && num )
+		{
+			start += step;
+			if ( (usec = mono_usec()) < start )
+			{
+				usleep(start - usec);
+				if ( repeat_stop )
+					break;
+			}
+			else if ( usec > start + step / 10 )
+			{
+				late++;
+				start = usec;
+			}
+		}
+
+		// a network TX source gives the next buffer's worth for each capture; the load
+		// waits for its own worker jobs only, not the saver's queued meanwhile
+		if ( num && streamed && dsa_channel_reload(evt, dsa_adi_new) < 0 )
+		{
+			LOG_ERROR("Failed to reload streamed IQ data: %s\n", strerror(errno));
+			ret = -1;
+			break;
+		}
+
+		usec = mono_usec();
+		if ( dsa_main_map(&slot->evt, 1) )
+		{
+			LOG_ERROR("DMA mapping failed: %s\n", strerror(errno));
+			ret = -1;
+			break;
+		}
+		ret = dsa_command_trigger_run(&slot->evt, &cap_opts);
+		memset(&sb, 0, sizeof(sb));
+		dsa_ioctl_get_stats(&sb);
+		if ( dsa_main_unmap() )
+			LOG_ERROR("DMA unmapping failed: %s\n", strerror(errno));
+		cap_usec += mono_usec() - usec;
+		if ( ret < 0 )
+			break;
+
+		cap_opts.stats = 0;
+		cap_opts.exp   = 0;
+		cap_opts.timed = 0;
+
+		// first sample's time from the driver, for network sinks
+		xs = evt->rx[0] ? &sb.adi1.rx : &sb.adi2.rx;
+		slot->time = 0;
+		if ( xs->start.tv_sec )
+			slot->time = xs->start.tv_sec * 1000000000ULL + xs->start.tv_nsec;
+
+		pthread_mutex_lock(&st.lock);
+		slot->num    = num;
+		slot->saving = 1;
+		pthread_cond_broadcast(&st.cond);
+		pthread_mutex_unlock(&st.lock);
+	}
+
+	sigaction(SIGINT, &old, NULL);
+
+	// let the saver finish what's queued
+	usec = mono_usec();
+	pthread_mutex_lock(&st.lock);
+	st.quit = 1;
+	pthread_cond_broadcast(&st.cond);
+	pthread_mutex_unlock(&st.lock);
+	pthread_join(st.thread, NULL);
+	usec = mono_usec() - usec;
+
+	pthread_cond_destroy(&st.cond);
+	pthread_mutex_destroy(&st.lock);
+	repeat_cleanup(&st);
+
+	begin = mono_usec() - begin;
+	printf("Repeat: %lu captures, %lu saved, %lu failed, in %.3f s: %.2f/s\n",
+	       num, st.saved, st.errs, begin / 1000000.0,
+	       begin ? st.saved * 1000000.0 / begin : 0.0);
+	if ( num )
+		printf("Repeat: capture %.3f ms, save %.3f ms average; waited %.3f ms for saves, "
+		       "%.3f ms at the end\n", cap_usec / 1000.0 / num,
+		       st.saved + st.errs ? st.save_usec / 1000.0 / (st.saved + st.errs) : 0.0,
+		       wait_usec / 1000.0, usec / 1000.0);
+	if ( late )
+		printf("Repeat: %lu captures started late for the %.3f s interval\n", late,
+		       opts->rep.interval);
+
+	// the failed saves are logged as they happen; the run fails if any did
+	if ( ret >= 0 && st.errs )
+	{
+		LOG_ERROR("Failed to save %lu of %lu captures\n", st.errs, st.saved + st.errs);
+		errno = EIO;
+		return -1;
+	}
+
+	return ret < 0 ? ret : (int)st.saved;
+}
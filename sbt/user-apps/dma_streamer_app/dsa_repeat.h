@@ -0,0 +1,41 @@
+/** \file      dsa_repeat.h
+ *  \brief     interfaces for repeated captures, saved while the next is captured
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_DSA_REPEAT_H_
+#define _INCLUDE_DSA_REPEAT_H_
+
+
+struct dsa_repeat_opts
+{
+	unsigned long  count;     // captures to run, 0 until interrupted
+	double         interval;  // seconds from the start of one capture to the next, 0 for
+	                          // back to back
+};
+
+struct dsa_channel_event;
+struct dsa_trigger_opts;
+
+
+// Trigger evt count times, or until SIGINT, with its RX buffers doubled: while one is
+// being saved on a thread, the next capture goes into the other.  Each capture is saved
+// to the sinks of evt with its number added to the filenames, as detection names its
+// events.  evt must be loaded but not mapped, with at least one RX buffer with a sink;
+// each buffer of the pair is mapped for its captures in turn.  Returns the number of
+// captures saved, or <0 on error, including any capture that failed to save.
+int dsa_repeat_run (struct dsa_channel_event *evt, const struct dsa_trigger_opts *opts);
+
+#endif // _INCLUDE_DSA_REPEAT_H_
@@ -0,0 +1,334 @@
+/** \file      dsa_report.c
+ *  \brief     per-phase timing reports of a run, in JSON or CSV
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include "dsa_report.h"
+#include "dsa_common.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("report", LOG_LEVEL_INFO);
+
+
+#define REPORT_JSON  0
+#define REPORT_CSV   1
+
+// phases are kept in the order they finish, and written out when the run's done
+struct report_phase
+{
+	struct report_phase *next;
+	const char          *phase;
+	char                *item;
+	unsigned long long   start;
+	unsigned long long   wall;
+	unsigned long long   cpu;
+	unsigned long long   bytes;
+};
+
+static pthread_mutex_t       report_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct report_phase  *report_head = NULL;
+static struct report_phase  *report_tail = NULL;
+static FILE                 *report_fp   = NULL;
+static int                   report_fmt  = REPORT_JSON;
+static int                   report_argc = 0;
+static char                **report_argv = NULL;
+static struct timespec       report_time;
+static unsigned long long    report_wall = 0;
+static unsigned long long    report_cpu  = 0;
+
+
+static unsigned long long report_clock (clockid_t id)
+{
+	struct timespec  ts;
+
+	clock_gettime(id, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// MB/s, as chan_op_time shows it: bytes per microsecond
+static double report_rate (unsigned long long bytes, unsigned long long usec)
+{
+	return usec ? (double)bytes / usec : 0.0;
+}
+
+static void report_json_str (FILE *fp, const char *str)
+{
+	fputc('"', fp);
+	for ( ; *str; str++ )
+		if ( *str == '"' || *str == '\\' )
+			fprintf(fp, "\\%c", *str);
+		else if ( (unsigned char)*str < 0x20 )
+			fprintf(fp, "\\u%04x", (unsigned char)*str);
+		else
+			fputc(*str, fp);
+	fputc('"', fp);
+}
+
+static void report_csv_str (FILE *fp, const char *str)
+{
+	fputc('"', fp);
+	for ( ; *str; str++ )
+	{
+		if ( *str == '"' )
+			fputc('"', fp);
+		fputc(*str, fp);
+	}
+	fputc('"', fp);
+}
+
+
+int dsa_report_open (const char *spec, int argc, char **argv)
+{
+	const char *path = spec;
+	const char *dot;
+
+	if ( !spec )
+		return 0;
+
+	report_fmt = REPORT_JSON;
+	if ( !strncasecmp(spec, "json:", 5) )
+		path = spec + 5;
+	else if ( !strncasecmp(spec, "csv:", 4) )
+	{
+		report_fmt = REPORT_CSV;
+		path = spec + 4;
+	}
+	else if ( (dot = strrchr(spec, '.')) && !strcasecmp(dot, ".csv") )
+		report_fmt = REPORT_CSV;
+
+	if ( !*path )
+	{
+		LOG_ERROR("No report file given in '%s'\n", spec);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ( !strcmp(path, "-") )
+		report_fp = stdout;
+	else if ( !(report_fp = fopen(path, "a")) )
+	{
+		LOG_ERROR("%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	report_argc = argc;
+	report_argv = argv;
+	clock_gettime(CLOCK_REALTIME, &report_time);
+	report_wall = mono_usec();
+	report_cpu  = report_clock(CLOCK_PROCESS_CPUTIME_ID);
+	return 0;
+}
+
+
+void dsa_report_start (struct dsa_report_mark *mark)
+{
+	mark->wall = mono_usec();
+	mark->cpu  = report_clock(CLOCK_THREAD_CPUTIME_ID);
+}
+
+
+void dsa_report_phase (const struct dsa_report_mark *mark, const char *phase,
+                       const char *item, unsigned long long bytes)
+{
+	struct report_phase *ph;
+
+	if ( !report_fp )
+		return;
+
+	if ( !(ph = calloc(1, sizeof(*ph))) )
+		return;
+
+	ph->phase = phase;
+	ph->item  = item ? strdup(item) : NULL;
+	ph->start = mark->wall;
+	ph->wall  = mono_usec() - mark->wall;
+	ph->cpu   = report_clock(CLOCK_THREAD_CPUTIME_ID) - mark->cpu;
+	ph->bytes = bytes;
+
+	pthread_mutex_lock(&report_lock);
+	if ( report_tail )
+		report_tail->next = ph;
+	else
+		report_head = ph;
+	report_tail = ph;
+
+	// the run starts with its earliest phase, which may be before the report's opened
+	if ( ph->start < report_wall )
+		report_wall = ph->start;
+	pthread_mutex_unlock(&report_lock);
+}
+
+
+// sums of the phases named like ph, from ph on; returns the count, 0 if a phase of the
+// same name came earlier and so has been summed already
+static unsigned long report_total (const struct report_phase *ph, struct report_phase *sum)
+{
+	const struct report_phase *walk;
+	unsigned long              num = 0;
+
+	for ( walk = report_head; walk != ph; walk = walk->next )
+		if ( !strcmp(walk->phase, ph->phase) )
+			return 0;
+
+	memset(sum, 0, sizeof(*sum));
+	sum->phase = ph->phase;
+	for ( walk = ph; walk; walk = walk->next )
+		if ( !strcmp(walk->phase, ph->phase) )
+		{
+			sum->wall  += walk->wall;
+			sum->cpu   += walk->cpu;
+			sum->bytes += walk->bytes;
+			num++;
+		}
+
+	return num;
+}
+
+static void report_json (FILE *fp, int status, unsigned long long wall,
+                         unsigned long long cpu)
+{
+	struct report_phase *ph;
+	struct report_phase  sum;
+	unsigned long        num;
+	int                  first;
+	int                  idx;
+
+	fprintf(fp, "{\"version\":%d,\"time\":%ld.%03ld,\"args\":[", DSA_REPORT_VERSION,
+	        (long)report_time.tv_sec, report_time.tv_nsec / 1000000);
+	for ( idx = 0; idx < report_argc; idx++ )
+	{
+		if ( idx )
+			fputc(',', fp);
+		report_json_str(fp, report_argv[idx]);
+	}
+	fprintf(fp, "],\"status\":%d,\"wall_us\":%llu,\"cpu_us\":%llu,\"phases\":[",
+	        status, wall, cpu);
+
+	for ( ph = report_head; ph; ph = ph->next )
+	{
+		fprintf(fp, "%s{\"phase\":", ph == report_head ? "" : ",");
+		report_json_str(fp, ph->phase);
+		if ( ph->item )
+		{
+			fprintf(fp, ",\"item\":");
+			report_json_str(fp, ph->item);
+		}
+		fprintf(fp, ",\"start_us\":%llu,\"wall_us\":%llu,\"cpu_us\":%llu,\"bytes\":%llu,"
+		        "\"mb_s\":%.3f}", ph->start - report_wall, ph->wall, ph->cpu, ph->bytes,
+		        report_rate(ph->bytes, ph->wall));
+	}
+
+	fprintf(fp, "],\"totals\":[");
+	for ( ph = report_head, first = 1; ph; ph = ph->next )
+		if ( (num = report_total(ph, &sum)) )
+		{
+			fprintf(fp, "%s{\"phase\":", first ? "" : ",");
+			report_json_str(fp, sum.phase);
+			fprintf(fp, ",\"count\":%lu,\"wall_us\":%llu,\"cpu_us\":%llu,\"bytes\":%llu,"
+			        "\"mb_s\":%.3f}", num, sum.wall, sum.cpu, sum.bytes,
+			        report_rate(sum.bytes, sum.wall));
+			first = 0;
+		}
+	fprintf(fp, "]}\n");
+}
+
+static void report_csv (FILE *fp, int status, unsigned long long wall,
+                        unsigned long long cpu)
+{
+	struct report_phase *ph;
+	struct report_phase  sum;
+	unsigned long        num;
+	const char          *arg;
+	char                 time[32];
+	int                  idx;
+
+	snprintf(time, sizeof(time), "%ld.%03ld", (long)report_time.tv_sec,
+	         report_time.tv_nsec / 1000000);
+
+	if ( fp == stdout || !ftell(fp) )
+		fprintf(fp, "time,status,phase,item,count,start_us,wall_us,cpu_us,bytes,mb_s\n");
+
+	for ( ph = report_head; ph; ph = ph->next )
+	{
+		fprintf(fp, "%s,%d,%s,", time, status, ph->phase);
+		report_csv_str(fp, ph->item ? ph->item : "");
+		fprintf(fp, ",1,%llu,%llu,%llu,%llu,%.3f\n", ph->start - report_wall, ph->wall,
+		        ph->cpu, ph->bytes, report_rate(ph->bytes, ph->wall));
+	}
+
+	// totals have an item of "*", and the whole run has the command line
+	for ( ph = report_head; ph; ph = ph->next )
+		if ( (num = report_total(ph, &sum)) )
+			fprintf(fp, "%s,%d,%s,\"*\",%lu,,%llu,%llu,%llu,%.3f\n", time, status,
+			        sum.phase, num, sum.wall, sum.cpu, sum.bytes,
+			        report_rate(sum.bytes, sum.wall));
+
+	fprintf(fp, "%s,%d,run,\"", time, status);
+	for ( idx = 0; idx < report_argc; idx++ )
+	{
+		if ( idx )
+			fputc(' ', fp);
+		for ( arg = report_argv[idx]; *arg; arg++ )
+		{
+			if ( *arg == '"' )
+				fputc('"', fp);
+			fputc(*arg, fp);
+		}
+	}
+	fprintf(fp, "\",1,0,%llu,%llu,,\n", wall, cpu);
+}
+
+
+void dsa_report_close (int status)
+{
+	struct report_phase *ph;
+	unsigned long long   wall;
+	unsigned long long   cpu;
+
+	if ( !report_fp )
+		return;
+
+	pthread_mutex_lock(&report_lock);
+	wall = mono_usec() - report_wall;
+	cpu  = report_clock(CLOCK_PROCESS_CPUTIME_ID) - report_cpu;
+
+	if ( report_fmt == REPORT_CSV )
+		report_csv(report_fp, status, wall, cpu);
+	else
+		report_json(report_fp, status, wall, cpu);
+
+	if ( report_fp == stdout )
+		fflush(report_fp);
+	else
+		fclose(report_fp);
+	report_fp = NULL;
+
+	while ( (ph = report_head) )
+	{
+		report_head = ph->next;
+		free(ph->item);
+		free(ph);
+	}
+	report_tail = NULL;
+	pthread_mutex_unlock(&report_lock);
+}
@@ -0,0 +1,51 @@
+/** \file      dsa_report.h
+ *  \brief     interfaces for per-phase timing reports of a run
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_DSA_REPORT_H_
+#define _INCLUDE_DSA_REPORT_H_
+
+#define DSA_REPORT_VERSION  1
+
+
+// the start of a phase: wall time and the CPU time of the thread running it, in us
+struct dsa_report_mark
+{
+	unsigned long long  wall;
+	unsigned long long  cpu;
+};
+
+
+// Start a report for a run of argv, to spec "[json:|csv:]path", the format guessed from
+// path's extension if not given and JSON by default, and "-" for stdout.  With spec NULL
+// phases aren't recorded.  Returns 0 on success, <0 on error.
+int  dsa_report_open (const char *spec, int argc, char **argv);
+
+// mark the start of a phase in the calling thread
+void dsa_report_start (struct dsa_report_mark *mark);
+
+// Record a phase from mark to now, in the same thread: its name, the item it worked on,
+// a file or transfer or NULL, and the bytes of sample data it moved.  Thread-safe; does
+// nothing unless a report is open.
+void dsa_report_phase (const struct dsa_report_mark *mark, const char *phase,
+                       const char *item, unsigned long long bytes);
+
+// Append the run's record to the report and close it: JSON is one line per run, with
+// each phase and totals per phase name; CSV is a row per phase, then the totals and the
+// whole run, with a header if the file's new.  status is the run's exit status.
+void dsa_report_close (int status);
+
+#endif // _INCLUDE_DSA_REPORT_H_
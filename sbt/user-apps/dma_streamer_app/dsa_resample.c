@@ -0,0 +1,242 @@
+/** \file      dsa_resample.c
+ *  \brief     implementation of the polyphase resampler for TX data at another rate
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+#include "dsa_sample.h"
+#include "dsa_channel.h"
+#include "dsa_fir.h"
+#include "dsa_resample.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("resample", LOG_LEVEL_INFO);
+
+
+#define RESAMPLE_BLOCK  4096  // outputs per lane made between stores
+
+
+static unsigned long resample_gcd (unsigned long a, unsigned long b)
+{
+	unsigned long  t;
+
+	while ( b )
+	{
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+// Blackman-windowed sinc at the interpolated rate, cutting off just inside the lower
+// of the two Nyquist rates, normalized to a gain of up so each phase has unity gain.  The
+// window spans len + 1 points so the centre falls on h[len / 2], a whole number of
+// interpolated samples of delay; its last point is zero and dropped.
+static void resample_design (double *h, size_t len, unsigned up, unsigned down)
+{
+	double  fc  = 0.45 / (up > down ? up : down);
+	double  mid = len / 2;
+	double  sum = 0.0;
+	double  t, w;
+	size_t  n;
+
+	for ( n = 0; n < len; n++ )
+	{
+		t = n - mid;
+		w = 0.42 - 0.5  * cos(2 * M_PI * n / len)
+		         + 0.08 * cos(4 * M_PI * n / len);
+		h[n] = (t == 0.0 ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t)) * w;
+		sum += h[n];
+	}
+
+	for ( n = 0; n < len; n++ )
+		h[n] *= up / sum;
+}
+
+struct dsa_resample *dsa_resample_init (unsigned long in, unsigned long out)
+{
+	struct dsa_resample *rs;
+	unsigned long        gcd;
+	double              *h;
+	size_t               len;
+	size_t               j;
+	unsigned             p;
+	long                 q;
+
+	if ( !in || !out )
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	gcd = resample_gcd(in, out);
+	if ( out / gcd > DSA_RESAMPLE_PHASES )
+	{
+		LOG_ERROR("Can't resample %lu to %lu: ratio %lu/%lu needs over %d phases\n",
+		          in, out, out / gcd, in / gcd, DSA_RESAMPLE_PHASES);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if ( !(rs = calloc(1, sizeof(*rs))) )
+		return NULL;
+
+	rs->in   = in;
+	rs->out  = out;
+	rs->up   = out / gcd;
+	rs->down = in / gcd;
+	rs->taps = DSA_RESAMPLE_TAPS;
+
+	len = rs->up * rs->taps;
+	if ( !(h = malloc(len * sizeof(double))) ||
+	     !(rs->coef = malloc(len * sizeof(int16_t))) )
+	{
+		free(h);
+		dsa_resample_free(rs);
+		return NULL;
+	}
+
+	// phase p, tap j holds h[p + (taps - 1 - j) * up]
+	resample_design(h, len, rs->up, rs->down);
+	for ( p = 0; p < rs->up; p++ )
+		for ( j = 0; j < rs->taps; j++ )
+		{
+			q = lround(h[p + (rs->taps - 1 - j) * rs->up] * 32768.0);
+			rs->coef[p * rs->taps + j] = q > 32767 ? 32767 : q < -32768 ? -32768 : q;
+		}
+	free(h);
+
+	LOG_DEBUG("Resample %lu to %lu: up %u down %u, %zu taps per phase\n",
+	          in, out, rs->up, rs->down, rs->taps);
+	return rs;
+}
+
+size_t dsa_resample_len (const struct dsa_resample *rs, size_t num)
+{
+	return ((unsigned long long)num * rs->up + rs->down - 1) / rs->down;
+}
+
+size_t dsa_resample_run (const struct dsa_resample *rs, unsigned long long *pos,
+                         int16_t *dst, size_t max, const int16_t *src, size_t num,
+                         size_t *used)
+{
+	const int16_t *x    = src - (rs->taps - 1);
+	unsigned       skip = rs->down / rs->up;
+	unsigned       frac = rs->down % rs->up;
+	unsigned       ph   = *pos % rs->up;
+	size_t         i    = *pos / rs->up;
+	size_t         n    = 0;
+	int32_t        acc;
+
+	// no divides in the loop: Cortex-A9 has no hardware divider
+	for ( ; n < max && i < num; n++ )
+	{
+		acc = dsa_fir_dot(x + i, rs->coef + ph * rs->taps, rs->taps);
+		acc = (acc + (1 << 14)) >> 15;
+		if ( acc > 2047 )
+			acc = 2047;
+		else if ( acc < -2048 )
+			acc = -2048;
+		dst[n] = acc;
+
+		i  += skip;
+		ph += frac;
+		if ( ph >= rs->up )
+		{
+			ph -= rs->up;
+			i++;
+		}
+	}
+
+	*used = i < num ? i : num;
+	*pos  = (unsigned long long)(i - *used) * rs->up + ph;
+	return n;
+}
+
+int dsa_resample_xfer (const struct dsa_resample *rs, struct dsa_channel_xfer *dst,
+                       const struct dsa_channel_xfer *src, int lanes, int lsh)
+{
+	const uint16_t     *in     = (const uint16_t *)src->smp;
+	uint16_t           *out    = (uint16_t *)dst->smp;
+	size_t              stride = dsa_channel_width(src) / sizeof(uint16_t);
+	size_t              hist   = rs->taps - 1;
+	size_t              num    = src->len;
+	int16_t             buff[RESAMPLE_BLOCK];
+	unsigned long long  pos;
+	int16_t            *ext;
+	size_t              made, want, got, used, base;
+	size_t              i, idx;
+	int                 lane;
+
+	if ( !num )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	// the output's last sample runs into its first only if it holds exactly num inputs'
+	// worth; otherwise the loop point is off by a fraction of an input period
+	if ( (unsigned long long)dst->len * rs->down != (unsigned long long)num * rs->up )
+		LOG_WARN("%zu samples at %lu aren't exactly %zu at %lu: output will glitch where "
+		         "it loops\n", num, rs->in, dst->len, rs->out);
+
+	if ( !(ext = malloc((hist + num) * sizeof(int16_t))) )
+		return -1;
+
+	for ( lane = 0; lane < stride; lane++ )
+		if ( lanes & (1 << lane) )
+		{
+			// the history before the first input wraps from the end of the buffer, so
+			// every pass over it sees the same inputs as a repeating transfer would
+			for ( i = 0; i < hist + num; i++ )
+				ext[i] = dsa_sample_value(in[((i + num - hist % num) % num) * stride + lane]);
+
+			// starting at the filter's centre takes out its delay
+			pos  = rs->up * rs->taps / 2;
+			base = 0;
+			for ( made = 0, idx = lane; made < dst->len; made += got )
+			{
+				want = dst->len - made < RESAMPLE_BLOCK ? dst->len - made : RESAMPLE_BLOCK;
+				got  = dsa_resample_run(rs, &pos, buff, want, ext + hist + base,
+				                        num - base, &used);
+
+				for ( i = 0; i < got; i++, idx += stride )
+					out[idx] = (buff[i] & 0xFFF) << (lsh ? 4 : 0);
+
+				// all of the inputs used: around again, pos carrying the position
+				if ( (base += used) == num )
+					base = 0;
+			}
+		}
+
+	free(ext);
+	return 0;
+}
+
+void dsa_resample_free (struct dsa_resample *rs)
+{
+	if ( !rs )
+		return;
+
+	free(rs->coef);
+	free(rs);
+}
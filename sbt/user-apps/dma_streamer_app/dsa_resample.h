@@ -0,0 +1,72 @@
+/** \file      dsa_resample.h
+ *  \brief     interfaces for the polyphase resampler for TX data at another sample rate
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_DSA_RESAMPLE_H_
+#define _INCLUDE_DSA_RESAMPLE_H_
+#include <stdint.h>
+#include <stddef.h>
+
+#include "dsa_channel.h"
+
+
+#define DSA_RESAMPLE_TAPS    32    // per phase, a multiple of DSA_FIR_ALIGN
+#define DSA_RESAMPLE_PHASES  4096  // largest interpolation factor
+
+
+// a resampler by up / down, the two rates divided by their GCD.  coef holds up phases of
+// taps Q15 coefficients each, time-reversed, so an output is a dot product of its phase
+// with the taps inputs up to its position.
+struct dsa_resample
+{
+	unsigned long  in;
+	unsigned long  out;
+	unsigned       up;
+	unsigned       down;
+	size_t         taps;
+	int16_t       *coef;
+};
+
+
+// set up a resampler from in to out samples/sec; returns NULL if the ratio needs more
+// than DSA_RESAMPLE_PHASES phases, or on error
+struct dsa_resample *dsa_resample_init (unsigned long in, unsigned long out);
+
+// outputs made from num inputs
+size_t dsa_resample_len (const struct dsa_resample *rs, size_t num);
+
+// streaming core, for one lane of 12-bit values: src must be preceded by taps - 1 inputs
+// of history, zero at the start of a stream.  *pos is the next output's position in
+// 1/up inputs from src[0], 0 at the start and carried between calls.  Makes up to max
+// outputs into dst and returns the number made; *used is set to the inputs consumed, and
+// the caller passes the rest with their history next time.
+size_t dsa_resample_run (const struct dsa_resample *rs, unsigned long long *pos,
+                         int16_t *dst, size_t max, const int16_t *src, size_t num,
+                         size_t *used);
+
+// resample lanes of a buffer loaded at the in rate into dst->len samples of dst, which
+// has the same width and packing; lanes has a bit per 16-bit word of a sample period, 0x3
+// for channel 1 I/Q, 0xC for channel 2.  src is taken as cyclic, as a TX buffer repeats,
+// so the filter delay is taken out and the output loops without a glitch if dst->len is
+// exactly src->len * up / down; for other lengths, including ratios where that isn't
+// whole, the loop point is off by a fraction of an input period, and a warning's logged.
+// Output words are 12-bit, shifted up 4 bits if lsh.  Returns 0 on success, <0 on error.
+int dsa_resample_xfer (const struct dsa_resample *rs, struct dsa_channel_xfer *dst,
+                       const struct dsa_channel_xfer *src, int lanes, int lsh);
+
+void dsa_resample_free (struct dsa_resample *rs);
+
+#endif // _INCLUDE_DSA_RESAMPLE_H_
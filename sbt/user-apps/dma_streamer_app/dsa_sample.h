@@ -35,4 +35,11 @@ struct dsa_sample_pair
 } __attribute__((packed));
 
 
+// value of a 12-bit two's complement sample word, -2048 to 2047
+static inline int dsa_sample_value (uint16_t v)
+{
+	return (int16_t)(v << 4) >> 4;
+}
+
+
 #endif // _INCLUDE_DSA_SAMPLE_H_
@@ -0,0 +1,338 @@
+/** \file      dsa_shm.c
+ *  \brief     RX capture buffers published in shared memory for analysis processes
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <errno.h>
+
+#include "dsa_shm.h"
+#include "dsa_main.h"
+#include "dsa_common.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("shm", LOG_LEVEL_INFO);
+
+
+// Like the pool's, published buffers are faulted in and locked once and kept across runs,
+// so readers can stay attached; an object is only replaced when a larger buffer is needed,
+// and the old one is marked stale for its readers before it's unlinked.
+struct shm_slot
+{
+	struct dsa_shm_hdr *hdr;
+	size_t              map;    // bytes mapped, header included
+	int                 used;
+	int                 fresh;
+	char                name[NAME_MAX];
+};
+
+static pthread_mutex_t  shm_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct shm_slot  shm_list[DSA_SHM_MAX];
+static char            *shm_name = NULL;
+
+
+static void *shm_data (struct shm_slot *slot)
+{
+	return (uint8_t *)slot->hdr + slot->hdr->offset;
+}
+
+static void shm_make_name (char *dst, size_t max, int dev)
+{
+	snprintf(dst, max, "/%s.ad%dr", shm_name, dev + 1);
+}
+
+// mark a header stale for its readers, wake any waiting, and let it go
+static void shm_retire (struct dsa_shm_hdr *hdr)
+{
+	__atomic_store_n(&hdr->stale, 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&hdr->seq, 2, __ATOMIC_RELEASE);
+	dsa_shm_wake(hdr);
+}
+
+// an object of the same name left by an earlier run, which may still have readers
+static void shm_clear (const char *name)
+{
+	struct dsa_shm_hdr *hdr = MAP_FAILED;
+	struct stat         sb;
+	int                 fd;
+
+	if ( (fd = shm_open(name, O_RDWR, 0)) < 0 )
+		return;
+
+	if ( !fstat(fd, &sb) && sb.st_size >= sizeof(*hdr) )
+		hdr = mmap(NULL, sizeof(*hdr), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if ( hdr != MAP_FAILED )
+	{
+		if ( hdr->magic == DSA_SHM_MAGIC )
+			shm_retire(hdr);
+		munmap(hdr, sizeof(*hdr));
+	}
+	close(fd);
+
+	LOG_DEBUG("unlink old %s\n", name);
+	shm_unlink(name);
+}
+
+static int shm_map (struct shm_slot *slot, size_t size)
+{
+	size_t  page = sysconf(_SC_PAGESIZE);
+	int     flags = MAP_SHARED;
+	int     fd;
+
+#ifdef MAP_POPULATE
+	flags |= MAP_POPULATE;
+#endif
+
+	shm_clear(slot->name);
+	if ( (fd = shm_open(slot->name, O_RDWR|O_CREAT|O_EXCL, 0644)) < 0 )
+	{
+		LOG_ERROR("Failed to create %s: %s\n", slot->name, strerror(errno));
+		return -1;
+	}
+
+	size = (size + page - 1) / page * page;
+	slot->map = page + size;
+	if ( ftruncate(fd, slot->map) )
+	{
+		LOG_ERROR("Failed to size %s to %zu bytes: %s\n", slot->name, slot->map,
+		          strerror(errno));
+		goto fail;
+	}
+
+	slot->hdr = mmap(NULL, slot->map, PROT_READ|PROT_WRITE, flags, fd, 0);
+	if ( slot->hdr == MAP_FAILED )
+	{
+		LOG_ERROR("Failed to mmap() %s: %s\n", slot->name, strerror(errno));
+		goto fail;
+	}
+	close(fd);
+
+	if ( mlock(slot->hdr, slot->map) )
+	{
+		LOG_ERROR("Failed to mlock() %zu bytes: %s\n", slot->map, strerror(errno));
+		munmap(slot->hdr, slot->map);
+		shm_unlink(slot->name);
+		slot->hdr = NULL;
+		return -1;
+	}
+
+	// the object is zero-filled, so seq starts at 0 with no capture
+	slot->hdr->version = DSA_SHM_VERSION;
+	slot->hdr->offset  = page;
+	slot->hdr->size    = size;
+	__atomic_store_n(&slot->hdr->magic, DSA_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	LOG_INFO("Publishing %zu-byte buffer as %s\n", size, slot->name);
+	slot->fresh = 1;
+	return 0;
+
+fail:
+	close(fd);
+	shm_unlink(slot->name);
+	slot->hdr = NULL;
+	return -1;
+}
+
+static void shm_unmap (struct shm_slot *slot)
+{
+	LOG_DEBUG("unpublish %s\n", slot->name);
+	shm_retire(slot->hdr);
+	shm_unlink(slot->name);
+	munlock(slot->hdr, slot->map);
+	munmap(slot->hdr, slot->map);
+	memset(slot, 0, sizeof(*slot));
+}
+
+
+void dsa_shm_init (const char *name)
+{
+	pthread_mutex_lock(&shm_lock);
+	free(shm_name);
+	shm_name = name ? strdup(name) : NULL;
+	pthread_mutex_unlock(&shm_lock);
+}
+
+
+void *dsa_shm_get (int dev, size_t size, int *fresh)
+{
+	struct shm_slot *slot;
+	void            *ret = NULL;
+
+	if ( dev < 0 || dev >= DSA_SHM_MAX )
+		return NULL;
+
+	pthread_mutex_lock(&shm_lock);
+	if ( !shm_name )
+		goto done;
+
+	slot = &shm_list[dev];
+	if ( slot->used )
+	{
+		LOG_WARN("AD%d RX buffer already published, not publishing another\n", dev + 1);
+		goto done;
+	}
+
+	// replace a buffer too small, or published under another name
+	if ( slot->hdr )
+	{
+		char  name[NAME_MAX];
+
+		shm_make_name(name, sizeof(name), dev);
+		if ( slot->hdr->size < size || strcmp(name, slot->name) )
+			shm_unmap(slot);
+	}
+	if ( !slot->hdr )
+	{
+		shm_make_name(slot->name, sizeof(slot->name), dev);
+		if ( shm_map(slot, size) )
+			goto done;
+	}
+
+	if ( fresh )
+		*fresh = slot->fresh;
+	slot->fresh = 0;
+	slot->used  = 1;
+	ret = shm_data(slot);
+
+done:
+	pthread_mutex_unlock(&shm_lock);
+	return ret;
+}
+
+
+int dsa_shm_put (void *buff)
+{
+	struct shm_slot *slot;
+	int              ret = -1;
+
+	if ( !buff )
+		return -1;
+
+	pthread_mutex_lock(&shm_lock);
+	for ( slot = shm_list; slot < shm_list + DSA_SHM_MAX; slot++ )
+		if ( slot->hdr && shm_data(slot) == buff )
+		{
+			slot->used = 0;
+			ret = 0;
+			break;
+		}
+	pthread_mutex_unlock(&shm_lock);
+
+	return ret;
+}
+
+
+// the slot holding an event's RX buffer for dev, if it's published
+static struct shm_slot *shm_find (struct dsa_channel_event *evt, int dev)
+{
+	struct shm_slot *slot = &shm_list[dev];
+
+	if ( !evt->rx[dev] || !slot->hdr || !slot->used || shm_data(slot) != evt->rx[dev]->smp )
+		return NULL;
+
+	return slot;
+}
+
+void dsa_shm_begin (struct dsa_channel_event *evt)
+{
+	struct shm_slot *slot;
+	int              dev;
+
+	for ( dev = 0; dev < DSA_SHM_MAX; dev++ )
+		if ( (slot = shm_find(evt, dev)) )
+		{
+			// odd from here until dsa_shm_end(); a reader still working on the last
+			// capture sees it move and knows the data's being overwritten
+			__atomic_add_fetch(&slot->hdr->seq, 1, __ATOMIC_ACQ_REL);
+			slot->hdr->ok    = 0;
+			slot->hdr->start = mono_usec();
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			dsa_shm_wake(slot->hdr);
+		}
+}
+
+void dsa_shm_end (struct dsa_channel_event *evt, int ok)
+{
+	struct dsa_channel_xfer *xfer;
+	struct shm_slot         *slot;
+	int                      dev;
+
+	for ( dev = 0; dev < DSA_SHM_MAX; dev++ )
+		if ( (slot = shm_find(evt, dev)) )
+		{
+			xfer = evt->rx[dev];
+			slot->hdr->ok    = ok;
+			slot->hdr->pack  = xfer->pack;
+			slot->hdr->width = dsa_channel_width(xfer);
+			slot->hdr->len   = xfer->len;
+			slot->hdr->rate  = dsa_active_rates[dev * 2 + 1];
+			slot->hdr->done  = mono_usec();
+
+			// even again: the capture's complete
+			__atomic_add_fetch(&slot->hdr->seq, 1, __ATOMIC_RELEASE);
+			dsa_shm_wake(slot->hdr);
+			LOG_DEBUG("%s: capture %u, %zu samples%s\n", slot->name, slot->hdr->seq / 2,
+			          xfer->len, ok ? "" : ", failed");
+		}
+}
+
+
+void dsa_shm_done (void)
+{
+	struct shm_slot *slot;
+
+	pthread_mutex_lock(&shm_lock);
+	for ( slot = shm_list; slot < shm_list + DSA_SHM_MAX; slot++ )
+		if ( slot->hdr )
+		{
+			if ( slot->used )
+				LOG_WARN("Buffer %s still in use at exit\n", slot->name);
+			shm_unmap(slot);
+		}
+	free(shm_name);
+	shm_name = NULL;
+	pthread_mutex_unlock(&shm_lock);
+}
+
+
+int dsa_shm_wait (struct dsa_shm_hdr *hdr, uint32_t val, int timeout)
+{
+	struct timespec  ts;
+
+	ts.tv_sec  = timeout / 1000;
+	ts.tv_nsec = (timeout % 1000) * 1000000;
+
+	// not FUTEX_PRIVATE: the word is shared between processes
+	if ( syscall(SYS_futex, &hdr->seq, FUTEX_WAIT, val, timeout < 0 ? NULL : &ts, NULL, 0) )
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+
+	return 0;
+}
+
+void dsa_shm_wake (struct dsa_shm_hdr *hdr)
+{
+	syscall(SYS_futex, &hdr->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
@@ -0,0 +1,83 @@
+/** \file      dsa_shm.h
+ *  \brief     interfaces for RX capture buffers published in shared memory
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_DSA_SHM_H_
+#define _INCLUDE_DSA_SHM_H_
+#include <stdint.h>
+#include <stddef.h>
+
+#include "dsa_channel.h"
+
+
+#define DSA_SHM_MAGIC    0x44534331  // "DSC1"
+#define DSA_SHM_VERSION  1
+
+// published buffers, one per device's RX
+#define DSA_SHM_MAX  2
+
+
+// Each published RX buffer is a POSIX shared memory object named "/<name>.ad1r" or
+// "/<name>.ad2r": this header in the first page, then the DMA buffer itself from offset,
+// laid out as in the app.  seq is a generation count, odd while a capture is being
+// written and even once it's done; a reader takes a capture by reading seq, the fields
+// after it and the samples, then checking seq hasn't moved.  seq is also a futex, woken
+// on each change.
+struct dsa_shm_hdr
+{
+	uint32_t  magic;
+	uint32_t  version;
+	uint32_t  offset;   // bytes from the start of the object to the samples
+	uint32_t  stale;    // replaced or unpublished: detach and attach by name again
+	uint64_t  size;     // bytes of sample space from offset
+
+	uint32_t  seq;
+	uint32_t  ok;       // the capture completed without error
+	uint32_t  pack;     // DC_CHAN_1 or DC_CHAN_2 if packed 1T1R, else 0
+	uint32_t  width;    // bytes per sample period
+	uint64_t  len;      // sample periods captured
+	uint64_t  rate;     // sample rate, 0 if unknown
+	uint64_t  start;    // CLOCK_MONOTONIC us the capture was triggered
+	uint64_t  done;     // and when it completed
+};
+
+
+// publish RX buffers allocated from now on under name, or stop if NULL
+void  dsa_shm_init (const char *name);
+
+// Get a buffer for device dev's RX of at least size bytes, published if dsa_shm_init
+// gave a name.  The shared object is kept for reuse, replaced by a larger one when
+// needed.  fresh is set as for dsa_pool_get if not NULL.  Returns NULL on error, or if
+// not publishing.
+void *dsa_shm_get (int dev, size_t size, int *fresh);
+
+// return a buffer; returns 0 if it was published, <0 if it's not one of ours
+int   dsa_shm_put (void *buff);
+
+// mark the event's published buffers as being written, before a trigger, then complete
+// them after with ok nonzero if the trigger succeeded
+void  dsa_shm_begin (struct dsa_channel_event *evt);
+void  dsa_shm_end   (struct dsa_channel_event *evt, int ok);
+
+// mark all published buffers stale, unlink and unmap them
+void  dsa_shm_done (void);
+
+// futex wait on a header's seq while it's val, up to timeout ms or forever if <0, and
+// wake all waiters; for readers and the writer alike
+int   dsa_shm_wait (struct dsa_shm_hdr *hdr, uint32_t val, int timeout);
+void  dsa_shm_wake (struct dsa_shm_hdr *hdr);
+
+#endif // _INCLUDE_DSA_SHM_H_
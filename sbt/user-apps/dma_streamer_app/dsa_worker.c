@@ -0,0 +1,179 @@
+/** \file      dsa_worker.c
+ *  \brief     implementation of the load/save worker pool
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at: 
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include "dsa_worker.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("worker", LOG_LEVEL_INFO);
+
+
+static pthread_mutex_t         worker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t          worker_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t          worker_idle = PTHREAD_COND_INITIALIZER;
+static pthread_t               worker_list[DSA_WORKER_MAX];
+static int                     worker_num  = 0;
+static int                     worker_quit = 0;
+static int                     worker_busy = 0;  // jobs queued or running
+static struct dsa_worker_job  *worker_head = NULL;
+static struct dsa_worker_job  *worker_tail = NULL;
+
+
+static void worker_run (struct dsa_worker_job *job)
+{
+	errno = 0;
+	job->ret = job->func(job->arg);
+	job->err = errno;
+}
+
+static void *worker_main (void *arg)
+{
+	struct dsa_worker_job *job;
+
+	pthread_mutex_lock(&worker_lock);
+	while ( !worker_quit )
+	{
+		if ( !(job = worker_head) )
+		{
+			pthread_cond_wait(&worker_work, &worker_lock);
+			continue;
+		}
+
+		if ( !(worker_head = job->next) )
+			worker_tail = NULL;
+		pthread_mutex_unlock(&worker_lock);
+
+		worker_run(job);
+
+		// batch waiters share the idle condition, each checking its own count
+		pthread_mutex_lock(&worker_lock);
+		if ( job->batch && !--job->batch->busy )
+			pthread_cond_broadcast(&worker_idle);
+		if ( !--worker_busy )
+			pthread_cond_broadcast(&worker_idle);
+	}
+	pthread_mutex_unlock(&worker_lock);
+
+	return NULL;
+}
+
+
+int dsa_worker_init (int jobs)
+{
+	int  err;
+
+	if ( worker_num )
+		dsa_worker_done();
+
+	if ( jobs > DSA_WORKER_MAX )
+		jobs = DSA_WORKER_MAX;
+	if ( jobs < 2 )
+		return 0;
+
+	worker_quit = 0;
+	while ( worker_num < jobs )
+	{
+		if ( (err = pthread_create(&worker_list[worker_num], NULL, worker_main, NULL)) )
+		{
+			LOG_ERROR("Failed to start worker %d: %s\n", worker_num, strerror(err));
+			dsa_worker_done();
+			errno = err;
+			return -1;
+		}
+		worker_num++;
+	}
+
+	LOG_DEBUG("Started %d workers\n", worker_num);
+	return 0;
+}
+
+int dsa_worker_count (void)
+{
+	return worker_num;
+}
+
+void dsa_worker_queue (struct dsa_worker_job *job)
+{
+	dsa_worker_queue_batch(NULL, job);
+}
+
+void dsa_worker_queue_batch (struct dsa_worker_batch *batch, struct dsa_worker_job *job)
+{
+	job->next  = NULL;
+	job->batch = batch;
+	job->ret   = 0;
+	job->err   = 0;
+
+	if ( !worker_num )
+	{
+		worker_run(job);
+		return;
+	}
+
+	pthread_mutex_lock(&worker_lock);
+	if ( worker_tail )
+		worker_tail->next = job;
+	else
+		worker_head = job;
+	worker_tail = job;
+	worker_busy++;
+	if ( batch )
+		batch->busy++;
+	pthread_cond_signal(&worker_work);
+	pthread_mutex_unlock(&worker_lock);
+}
+
+void dsa_worker_wait (void)
+{
+	pthread_mutex_lock(&worker_lock);
+	while ( worker_busy )
+		pthread_cond_wait(&worker_idle, &worker_lock);
+	pthread_mutex_unlock(&worker_lock);
+}
+
+void dsa_worker_wait_batch (struct dsa_worker_batch *batch)
+{
+	pthread_mutex_lock(&worker_lock);
+	while ( batch->busy )
+		pthread_cond_wait(&worker_idle, &worker_lock);
+	pthread_mutex_unlock(&worker_lock);
+}
+
+void dsa_worker_done (void)
+{
+	int  idx;
+
+	if ( !worker_num )
+		return;
+
+	dsa_worker_wait();
+
+	pthread_mutex_lock(&worker_lock);
+	worker_quit = 1;
+	pthread_cond_broadcast(&worker_work);
+	pthread_mutex_unlock(&worker_lock);
+
+	for ( idx = 0; idx < worker_num; idx++ )
+		pthread_join(worker_list[idx], NULL);
+
+	LOG_DEBUG("Stopped %d workers\n", worker_num);
+	worker_num = 0;
+}
@@ -0,0 +1,68 @@
+/** \file      dsa_worker.h
+ *  \brief     interfaces for the load/save worker pool
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at: 
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_DSA_WORKER_H_
+#define _INCLUDE_DSA_WORKER_H_
+
+#define DSA_WORKER_MAX  8
+
+
+typedef int (* dsa_worker_fn) (void *arg);
+
+// jobs queued together and waited for as a group, so a thread waits only for its own
+// jobs and not others sharing the pool; zero it before queueing the first
+struct dsa_worker_batch
+{
+	int  busy;
+};
+
+// a single job for the pool: the caller owns the struct, which must stay valid until
+// the wait for it returns.  ret and err are the job function's return value and errno.
+struct dsa_worker_job
+{
+	struct dsa_worker_job   *next;
+	struct dsa_worker_batch *batch;
+	dsa_worker_fn            func;
+	void                    *arg;
+	int                      ret;
+	int                      err;
+};
+
+
+// start the pool with the given number of threads; with jobs < 2 no threads are started
+// and jobs run synchronously in dsa_worker_queue().  Returns 0 on success, <0 on error.
+int  dsa_worker_init (int jobs);
+
+// number of threads running, or 0 if jobs are run synchronously
+int  dsa_worker_count (void);
+
+// queue a job to run on the next free thread
+void dsa_worker_queue (struct dsa_worker_job *job);
+
+// queue a job as part of batch, to wait for with dsa_worker_wait_batch()
+void dsa_worker_queue_batch (struct dsa_worker_batch *batch, struct dsa_worker_job *job);
+
+// wait for all queued jobs to complete
+void dsa_worker_wait (void);
+
+// wait for the jobs queued in batch to complete
+void dsa_worker_wait_batch (struct dsa_worker_batch *batch);
+
+// stop and join all threads
+void dsa_worker_done (void);
+
+#endif // _INCLUDE_DSA_WORKER_H_
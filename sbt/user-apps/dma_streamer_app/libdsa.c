@@ -0,0 +1,693 @@
+/** \file      libdsa.c
+ *  \brief     implementation of libdsa, the app's buffer, mapping, trigger, and format
+ *             code behind a stable API for in-process use
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <dma_streamer_mod.h>
+
+#include "libdsa.h"
+#include "dsa_main.h"
+#include "dsa_ioctl.h"
+#include "dsa_channel.h"
+#include "dsa_command.h"
+#include "dsa_common.h"
+#include "dsa_format.h"
+#include "dsa_sample.h"
+#include "dsa_worker.h"
+#include "dsa_pool.h"
+#include "dsa_net.h"
+#include "dsa_shm.h"
+
+#include "log.h"
+LOG_MODULE_STATIC("lib", LOG_LEVEL_INFO);
+
+
+struct dsa_stream
+{
+	struct dsa_channel_event  evt;
+	int                       ident[4];  // each transfer's as given, 0 if none
+	size_t                    pos[4];    // periods sent or received since the last trigger
+	struct dsa_stream_stats   stats;
+};
+
+// the stream mapped for DMA, if any
+static struct dsa_stream *lib_started = NULL;
+static int                lib_open    = 0;
+
+
+int dsa_lib_init (const char *device, int jobs)
+{
+	unsigned long  mask;
+	char          *p;
+
+	if ( lib_open )
+	{
+		errno = EBUSY;
+		return -1;
+	}
+
+	if ( device )
+		dsa_opt_device = device;
+	if ( (p = getenv("AD9361_DATA_PATH")) )
+		snprintf(env_data_path, sizeof(env_data_path), "%s", p);
+
+	if ( dsa_main_dev_reopen(&mask) < 0 )
+	{
+		LOG_ERROR("Failed to open %s: %s\n", dsa_opt_device, strerror(errno));
+		return -1;
+	}
+	dsa_adi_new = mask & DSM_TARGT_NEW;
+	LOG_INFO("Using %s ADI access\n", dsa_adi_new ? "new" : "old");
+
+	if ( !jobs && (jobs = sysconf(_SC_NPROCESSORS_ONLN)) < 1 )
+		jobs = 1;
+	if ( dsa_worker_init(jobs) < 0 )
+		LOG_WARN("Failed to start workers, loading and saving serially\n");
+	dsa_pool_init(dsa_opt_len * sizeof(struct dsa_sample_pair), dsa_opt_huge);
+
+	dsa_main_import_channels();
+	lib_open = 1;
+	return 0;
+}
+
+void dsa_lib_done (void)
+{
+	if ( !lib_open )
+		return;
+
+	if ( lib_started )
+		dsa_stream_stop(lib_started);
+
+	dsa_worker_done();
+	dsa_pool_done();
+	dsa_shm_done();
+	dsa_net_done();
+	dsa_main_dev_close();
+	lib_open = 0;
+}
+
+void dsa_lib_log (FILE *fp, int verbosity)
+{
+	static const int  levels[] = { LOG_LEVEL_WARN, LOG_LEVEL_INFO, LOG_LEVEL_DEBUG };
+
+	if ( verbosity < 0 )
+		verbosity = 0;
+	if ( verbosity > 2 )
+		verbosity = 2;
+
+	log_dupe(fp);
+	dsa_opt_level = levels[verbosity];
+	log_set_global_level(dsa_opt_level);
+}
+
+void dsa_lib_share (const char *name)
+{
+	dsa_shm_init(name);
+}
+
+
+// index of a transfer as for dsa_active_channels, from a single device and direction
+static int stream_index (int ident)
+{
+	return ((ident & DC_DEV_AD2) ? 2 : 0) + ((ident & DC_DIR_RX) ? 1 : 0);
+}
+
+// parse a transfer name, which must be one device and direction of the stream
+static struct dsa_channel_xfer *stream_xfer (struct dsa_stream *st, const char *xfer,
+                                             int *ident)
+{
+	struct dsa_channel_xfer *ret = NULL;
+	int                      id;
+
+	if ( st && xfer && (id = dsa_channel_ident(xfer)) > 0 &&
+	     ((id & (DC_DEV_AD1|DC_DEV_AD2)) == DC_DEV_AD1 ||
+	      (id & (DC_DEV_AD1|DC_DEV_AD2)) == DC_DEV_AD2) &&
+	     ((id & (DC_DIR_TX|DC_DIR_RX)) == DC_DIR_TX ||
+	      (id & (DC_DIR_TX|DC_DIR_RX)) == DC_DIR_RX) )
+	{
+		ret = (id & DC_DIR_TX) ? st->evt.tx[(id & DC_DEV_AD2) ? 1 : 0]
+		                       : st->evt.rx[(id & DC_DEV_AD2) ? 1 : 0];
+		if ( ident )
+			*ident = id & (DC_DEV_AD1|DC_DEV_AD2|DC_DIR_TX|DC_DIR_RX);
+	}
+
+	if ( !ret )
+	{
+		LOG_ERROR("No transfer '%s' in the stream\n", xfer ? xfer : "");
+		errno = EINVAL;
+	}
+	return ret;
+}
+
+// the channels a transfer carries, as a dsa_stream_buffer's chans
+static int stream_chans (const struct dsa_stream *st, const struct dsa_channel_xfer *xfer,
+                         int ident)
+{
+	int  chan = xfer->pack ? xfer->pack : st->ident[stream_index(ident)];
+
+	return (chan & DC_CHAN_1 ? 1 : 0) | (chan & DC_CHAN_2 ? 2 : 0);
+}
+
+
+struct dsa_stream *dsa_stream_open (const char *ident, size_t len)
+{
+	struct dsa_stream *st;
+	char               copy[256];
+	char              *tok;
+	char              *ptr;
+	size_t             width;
+	int                idx;
+	int                id;
+
+	if ( !ident || snprintf(copy, sizeof(copy), "%s", ident) >= sizeof(copy) || !len )
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	if ( !(st = calloc(1, sizeof(*st))) )
+		return NULL;
+
+	// each transfer as the app's buffer options give it, separated by spaces or commas
+	for ( tok = strtok_r(copy, " ,", &ptr); tok; tok = strtok_r(NULL, " ,", &ptr) )
+	{
+		if ( (id = dsa_channel_ident(tok)) < 1 )
+		{
+			LOG_ERROR("Invalid transfer '%s'\n", tok);
+			errno = EINVAL;
+			goto fail;
+		}
+		if ( dsa_channel_check_active(id) )
+		{
+			errno = EINVAL;
+			goto fail;
+		}
+
+		width = dsa_channel_pack(id) ? sizeof(struct dsa_sample) :
+		                               sizeof(struct dsa_sample_pair);
+		if ( len > DSM_MAX_SIZE / width )
+		{
+			LOG_ERROR("Invalid buffer size, maximum %zu samples\n", DSM_MAX_SIZE / width);
+			errno = EINVAL;
+			goto fail;
+		}
+		if ( dsa_channel_buffer(&st->evt, id, len, 1) < 0 )
+		{
+			LOG_ERROR("Buffer alloc (%zu samples) failed: %s\n", len, strerror(errno));
+			goto fail;
+		}
+
+		for ( idx = 0; idx < 4; idx++ )
+			if ( (id & (idx & 2 ? DC_DEV_AD2 : DC_DEV_AD1)) &&
+			     (id & (idx & 1 ? DC_DIR_RX  : DC_DIR_TX)) )
+				st->ident[idx] = id;
+	}
+	if ( !st->evt.tx[0] && !st->evt.tx[1] && !st->evt.rx[0] && !st->evt.rx[1] )
+	{
+		errno = EINVAL;
+		goto fail;
+	}
+
+	// nothing captured to receive until the first trigger
+	for ( idx = 0; idx < 4; idx++ )
+		st->pos[idx] = (idx & 1) ? SIZE_MAX : 0;
+
+	return st;
+
+fail:
+	dsa_channel_cleanup(&st->evt);
+	free(st);
+	return NULL;
+}
+
+void dsa_stream_close (struct dsa_stream *st)
+{
+	if ( !st )
+		return;
+
+	if ( lib_started == st )
+		dsa_stream_stop(st);
+
+	dsa_channel_cleanup(&st->evt);
+	free(st);
+}
+
+int dsa_stream_buffer (struct dsa_stream *st, const char *xfer,
+                       struct dsa_stream_buffer *buf)
+{
+	struct dsa_channel_xfer *x;
+	int                      id;
+
+	if ( !(x = stream_xfer(st, xfer, &id)) )
+		return -1;
+
+	buf->words  = (uint16_t *)x->smp;
+	buf->len    = x->len;
+	buf->stride = dsa_channel_width(x) / sizeof(uint16_t);
+	buf->chans  = stream_chans(st, x, id);
+	buf->shift  = (id & DC_DIR_TX) && dsa_adi_new ? 4 : 0;
+	buf->packed = !!x->pack;
+	return 0;
+}
+
+
+// Load or save one transfer with the app's source/sink setup: the spec is parsed as the
+// buffer options parse it, set on the transfer alone, run, and cleared again.
+static int stream_sxx (struct dsa_stream *st, const char *xfer, const char *spec, int dir)
+{
+	struct dsa_channel_event  one;
+	struct dsa_channel_xfer  *x;
+	struct format            *fmt;
+	char                      copy[PATH_MAX];
+	char                     *opts = NULL;
+	char                     *loc  = copy;
+	char                     *p;
+	int                       id;
+	int                       ret;
+	int                       c;
+
+	if ( !(x = stream_xfer(st, xfer, &id)) )
+		return -1;
+	if ( !spec || snprintf(copy, sizeof(copy), "%s", spec) >= sizeof(copy) )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	// "format[,opts]:location", or a filename to guess the format from
+	if ( (p = strchr(copy, ':')) )
+	{
+		*p++ = '\0';
+		loc  = p;
+		if ( (opts = strchr(copy, ',')) )
+			*opts++ = '\0';
+		if ( opts && strlen(opts) >= FMT_OPTS_MAX )
+		{
+			LOG_ERROR("Format options '%s' too long\n", opts);
+			errno = EINVAL;
+			return -1;
+		}
+		if ( !(fmt = format_find(copy)) )
+		{
+			LOG_ERROR("Format '%s' not known\n", copy);
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	else if ( !(fmt = format_guess(copy)) && !(fmt = dsa_opt_format) )
+	{
+		LOG_ERROR("Format not given or guessable from '%s'\n", copy);
+		errno = EINVAL;
+		return -1;
+	}
+
+	// an event holding just this transfer, with the stream's channels
+	memset(&one, 0, sizeof(one));
+	if ( id & DC_DIR_TX )
+		one.tx[(id & DC_DEV_AD2) ? 1 : 0] = x;
+	else
+		one.rx[(id & DC_DEV_AD2) ? 1 : 0] = x;
+	id |= st->ident[stream_index(id)] & (DC_CHAN_1|DC_CHAN_2);
+
+	if ( (ret = dsa_channel_sxx(&one, id, dir, fmt, opts, loc)) >= 0 )
+		ret = dir == DC_DIR_TX ? dsa_channel_load(&one, dsa_adi_new) : dsa_channel_save(&one);
+
+	for ( c = 0; c < 2; c++ )
+	{
+		free(x->src[c]);
+		free(x->snk[c]);
+		x->src[c] = NULL;
+		x->snk[c] = NULL;
+	}
+	return ret;
+}
+
+int dsa_stream_load (struct dsa_stream *st, const char *xfer, const char *src)
+{
+	return stream_sxx(st, xfer, src, DC_DIR_TX);
+}
+
+int dsa_stream_save (struct dsa_stream *st, const char *xfer, const char *dst)
+{
+	return stream_sxx(st, xfer, dst, DC_DIR_RX);
+}
+
+
+int dsa_stream_start (struct dsa_stream *st)
+{
+	if ( !st || (lib_started && lib_started != st) )
+	{
+		errno = st ? EBUSY : EINVAL;
+		return -1;
+	}
+	if ( lib_started )
+		return 0;
+
+	if ( dsa_main_map(&st->evt, 1) )
+	{
+		LOG_ERROR("DMA mapping failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	lib_started = st;
+	return 0;
+}
+
+int dsa_stream_stop (struct dsa_stream *st)
+{
+	if ( !st || lib_started != st )
+		return 0;
+
+	lib_started = NULL;
+	if ( dsa_main_unmap() )
+	{
+		LOG_ERROR("DMA unmapping failed: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+
+int dsa_stream_trigger (struct dsa_stream *st, int timeout)
+{
+	struct dsa_trigger_opts  opts;
+	int                      ret;
+	int                      idx;
+
+	if ( !st || lib_started != st )
+	{
+		LOG_ERROR("Stream not started\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(&opts, 0, sizeof(opts));
+	opts.reps = 1;
+
+	// the driver converts ms to its own jiffies
+	opts.timeout_ms = timeout > 0 ? timeout : 0;
+	ret = dsa_command_trigger_run(&st->evt, &opts);
+
+	st->stats.triggers++;
+	if ( ret < 0 )
+		st->stats.failures++;
+
+	// TX buffers fill again from the start, RX data is fresh
+	for ( idx = 0; idx < 4; idx++ )
+		st->pos[idx] = 0;
+
+	return ret < 0 ? -1 : 0;
+}
+
+
+ssize_t dsa_stream_send (struct dsa_stream *st, const char *xfer, const int16_t *iq,
+                         size_t num, int timeout)
+{
+	struct dsa_channel_xfer *x;
+	uint16_t                *d;
+	size_t                   stride;
+	size_t                   pos;
+	size_t                   n;
+	int                      lsh;
+	int                      chans;
+	int                      id;
+	int                      c, w;
+
+	if ( !(x = stream_xfer(st, xfer, &id)) )
+		return -1;
+	if ( !(id & DC_DIR_TX) )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	stride = dsa_channel_width(x) / sizeof(uint16_t);
+	lsh    = dsa_adi_new ? 4 : 0;
+	chans  = stream_chans(st, x, id);
+	pos    = st->pos[stream_index(id)];
+	n      = num < x->len - pos ? num : x->len - pos;
+
+	// a packed buffer has its one channel in the first words
+	d = (uint16_t *)x->smp + pos * stride;
+	for ( pos = 0; pos < n; pos++, d += stride )
+		for ( c = 0; c < 2; c++ )
+			if ( chans & (1 << c) )
+				for ( w = 0; w < 2; w++ )
+					d[(x->pack ? 0 : c * 2) + w] = (*iq++ & 0xFFF) << lsh;
+
+	st->pos[stream_index(id)] += n;
+	st->stats.sent            += n;
+
+	// trigger once every TX buffer is full
+	for ( c = 0; c < 2; c++ )
+		if ( st->evt.tx[c] && st->pos[c * 2] < st->evt.tx[c]->len )
+			return n;
+
+	if ( dsa_stream_trigger(st, timeout) < 0 )
+		return -1;
+	return n;
+}
+
+ssize_t dsa_stream_recv (struct dsa_stream *st, const char *xfer, int16_t *iq,
+                         size_t num, int timeout)
+{
+	struct dsa_channel_xfer *x;
+	const uint16_t          *s;
+	size_t                   stride;
+	size_t                   pos;
+	size_t                   n;
+	int                      chans;
+	int                      id;
+	int                      c, w;
+
+	if ( !(x = stream_xfer(st, xfer, &id)) )
+		return -1;
+	if ( !(id & DC_DIR_RX) )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ( st->pos[stream_index(id)] >= x->len && dsa_stream_trigger(st, timeout) < 0 )
+		return -1;
+
+	stride = dsa_channel_width(x) / sizeof(uint16_t);
+	chans  = stream_chans(st, x, id);
+	pos    = st->pos[stream_index(id)];
+	n      = num < x->len - pos ? num : x->len - pos;
+
+	s = (const uint16_t *)x->smp + pos * stride;
+	for ( pos = 0; pos < n; pos++, s += stride )
+		for ( c = 0; c < 2; c++ )
+			if ( chans & (1 << c) )
+				for ( w = 0; w < 2; w++ )
+					*iq++ = dsa_sample_value(s[(x->pack ? 0 : c * 2) + w]);
+
+	st->pos[stream_index(id)] += n;
+	st->stats.received        += n;
+	return n;
+}
+
+
+int dsa_stream_stats (struct dsa_stream *st, struct dsa_stream_stats *stats)
+{
+	struct dsm_user_stats         sb;
+	struct dsm_xfer_stats        *src[4] = { &sb.adi1.tx, &sb.adi1.rx,
+	                                         &sb.adi2.tx, &sb.adi2.rx };
+	struct dsa_stream_xfer_stats *dst;
+	int                           idx;
+
+	if ( !st || !stats )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	*stats = st->stats;
+	if ( !st->stats.triggers )
+		return 0;
+
+	memset(&sb, 0, sizeof(sb));
+	if ( dsa_ioctl_get_stats(&sb) )
+		return -1;
+
+	for ( idx = 0; idx < 4; idx++ )
+		if ( (idx & 1 ? st->evt.rx : st->evt.tx)[idx >> 1] )
+		{
+			dst = &stats->xfer[idx];
+			dst->bytes     = src[idx]->bytes;
+			dst->usec      = src[idx]->total.tv_sec * 1000000ULL +
+			                 src[idx]->total.tv_nsec / 1000;
+			dst->completes = src[idx]->completes;
+			dst->errors    = src[idx]->errors;
+			dst->timeouts  = src[idx]->timeouts;
+			dst->start     = src[idx]->start.tv_sec * 1000000000ULL +
+			                 src[idx]->start.tv_nsec;
+		}
+
+	return 0;
+}
+
+
+struct dsa_capture
+{
+	const struct dsa_shm_hdr *hdr;
+	size_t                    map;
+};
+
+struct dsa_capture *dsa_capture_attach (const char *name, const char *xfer)
+{
+	struct dsa_capture *cap;
+	struct stat         sb;
+	char                path[PATH_MAX];
+	int                 fd;
+	int                 id;
+
+	if ( !name || !xfer || (id = dsa_channel_ident(xfer)) < 1 || !(id & DC_DIR_RX) ||
+	     (id & DC_DIR_TX) || (id & (DC_DEV_AD1|DC_DEV_AD2)) == (DC_DEV_AD1|DC_DEV_AD2) ||
+	     snprintf(path, sizeof(path), "/%s.ad%dr", name, id & DC_DEV_AD2 ? 2 : 1)
+	       >= sizeof(path) )
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if ( (fd = shm_open(path, O_RDONLY, 0)) < 0 )
+		return NULL;
+	if ( !(cap = calloc(1, sizeof(*cap))) )
+	{
+		close(fd);
+		return NULL;
+	}
+
+	if ( fstat(fd, &sb) )
+		goto fail;
+	if ( sb.st_size < sizeof(struct dsa_shm_hdr) )
+	{
+		errno = EPROTO;
+		goto fail;
+	}
+
+	cap->map = sb.st_size;
+	cap->hdr = mmap(NULL, cap->map, PROT_READ, MAP_SHARED, fd, 0);
+	if ( cap->hdr == MAP_FAILED )
+		goto fail;
+	close(fd);
+
+	if ( cap->hdr->magic != DSA_SHM_MAGIC || cap->hdr->version != DSA_SHM_VERSION ||
+	     cap->hdr->offset + cap->hdr->size > cap->map )
+	{
+		LOG_ERROR("%s is not a capture buffer this library knows\n", path);
+		munmap((void *)cap->hdr, cap->map);
+		free(cap);
+		errno = EPROTO;
+		return NULL;
+	}
+
+	LOG_DEBUG("attached %s, %zu bytes\n", path, cap->map);
+	return cap;
+
+fail:
+	id = errno;
+	close(fd);
+	free(cap);
+	errno = id;
+	return NULL;
+}
+
+int dsa_capture_wait (struct dsa_capture *cap, unsigned long seq, int timeout,
+                      struct dsa_capture_info *info)
+{
+	const struct dsa_shm_hdr *hdr = cap->hdr;
+	unsigned long long        end = mono_usec() + timeout * 1000ULL;
+	unsigned long long        now;
+	uint32_t                  val;
+	int                       ret;
+
+	for ( ;; )
+	{
+		if ( __atomic_load_n(&hdr->stale, __ATOMIC_ACQUIRE) )
+		{
+			errno = ESTALE;
+			return -1;
+		}
+
+		// a complete capture other than the caller's: copy its details out, then make
+		// sure it wasn't restarted meanwhile
+		val = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+		if ( val && !(val & 1) && val / 2 != seq )
+		{
+			info->seq    = val / 2;
+			info->words  = (const uint16_t *)((const uint8_t *)hdr + hdr->offset);
+			info->len    = hdr->len;
+			info->stride = hdr->width / sizeof(uint16_t);
+			info->chans  = hdr->pack ? (hdr->pack & DC_CHAN_1 ? 1 : 2) : 3;
+			info->packed = !!hdr->pack;
+			info->ok     = hdr->ok;
+			info->rate   = hdr->rate;
+			info->start  = hdr->start;
+			info->done   = hdr->done;
+
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if ( __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) == val )
+				return 0;
+			continue;
+		}
+
+		// a timed-out wait goes round to check the deadline; anything else is fatal
+		if ( timeout < 0 )
+			ret = dsa_shm_wait((struct dsa_shm_hdr *)hdr, val, -1);
+		else if ( (now = mono_usec()) < end )
+			ret = dsa_shm_wait((struct dsa_shm_hdr *)hdr, val, (end - now + 999) / 1000);
+		else
+		{
+			errno = ETIMEDOUT;
+			return -1;
+		}
+
+		if ( ret < 0 && errno != ETIMEDOUT )
+			return -1;
+	}
+}
+
+int dsa_capture_check (struct dsa_capture *cap, const struct dsa_capture_info *info)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if ( __atomic_load_n(&cap->hdr->seq, __ATOMIC_RELAXED) != info->seq * 2 )
+	{
+		errno = ESTALE;
+		return -1;
+	}
+
+	return 0;
+}
+
+void dsa_capture_detach (struct dsa_capture *cap)
+{
+	if ( !cap )
+		return;
+
+	munmap((void *)cap->hdr, cap->map);
+	free(cap);
+}
@@ -0,0 +1,191 @@
+/** \file      libdsa.h
+ *  \brief     public API of libdsa, for driving DMA transfers to and from the AD9361s
+ *             in-process rather than through dma_streamer_app
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_LIBDSA_H_
+#define _INCLUDE_LIBDSA_H_
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define DSA_LIB_VERSION_MAJOR  0
+#define DSA_LIB_VERSION_MINOR  2
+
+// transfers of a stream, indexing dsa_stream_stats.xfer
+#define DSA_STREAM_AD1_TX  0
+#define DSA_STREAM_AD1_RX  1
+#define DSA_STREAM_AD2_TX  2
+#define DSA_STREAM_AD2_RX  3
+
+
+// A stream is a set of transfer buffers triggered together, one for each device and
+// direction given when it's opened.  Only one stream may be started, with its buffers
+// mapped for DMA, at a time.
+struct dsa_stream;
+
+// One transfer's buffer, for access in place.  Each sample period is stride 16-bit
+// words: channel 1 in words 0 and 1 (I, Q), channel 2 in words 2 and 3, or the one
+// channel in words 0 and 1 of a packed buffer.  chans has bit 0 set if channel 1 is
+// transferred, bit 1 for channel 2.  Samples are 12-bit two's complement in the low
+// bits, shifted left shift bits in a TX buffer for the new ADI core.
+struct dsa_stream_buffer
+{
+	uint16_t  *words;
+	size_t     len;     // sample periods
+	size_t     stride;  // words per period
+	int        chans;
+	int        shift;
+	int        packed;
+};
+
+// counts for one transfer, as the driver reports them after the last trigger
+struct dsa_stream_xfer_stats
+{
+	unsigned long long  bytes;
+	unsigned long long  usec;       // spent transferring
+	unsigned long       completes;
+	unsigned long       errors;
+	unsigned long       timeouts;
+	unsigned long long  start;      // CLOCK_MONOTONIC ns the transfer started, 0 if unknown
+};
+
+struct dsa_stream_stats
+{
+	unsigned long long            triggers;
+	unsigned long long            failures;  // triggers which failed or timed out
+	unsigned long long            sent;      // sample periods passed to dsa_stream_send
+	unsigned long long            received;  // sample periods returned by dsa_stream_recv
+	struct dsa_stream_xfer_stats  xfer[4];   // indexed by DSA_STREAM_AD*_*
+};
+
+
+// Open the DMA driver's device, or the default if device is NULL, and read the channel
+// setup the ad9361 tool publishes.  jobs threads load and save formats, 0 for one per
+// CPU.  Returns 0 on success, <0 on error with errno set.
+int  dsa_lib_init (const char *device, int jobs);
+
+// stop any started stream and close the device; streams must be closed first
+void dsa_lib_done (void);
+
+// log to fp, or nowhere if NULL, which is the default; verbosity 0 logs errors and
+// warnings, 1 adds progress as the app shows it, 2 debugging
+void dsa_lib_log  (FILE *fp, int verbosity);
+
+// Publish the RX buffers of streams opened from now on in shared memory, as /name.ad1r
+// and /name.ad2r, for dsa_capture_attach in other processes; stop if name is NULL.  This
+// is dma_streamer_app's -M option.
+void dsa_lib_share (const char *name);
+
+
+// Open a stream for the transfers in ident, each given as on dma_streamer_app's command
+// line and separated by spaces or commas, like "AD1T AD1R" or "AD2R1", each buffer len
+// sample periods and filled with zeros.  Returns NULL on error with errno set.
+struct dsa_stream *dsa_stream_open (const char *ident, size_t len);
+
+// stop the stream if started, and free it
+void dsa_stream_close (struct dsa_stream *st);
+
+// Fill buf in for one transfer of the stream, named like "AD1T".  Returns 0 on success,
+// <0 with errno EINVAL if the stream has no such transfer.
+int  dsa_stream_buffer (struct dsa_stream *st, const char *xfer,
+                        struct dsa_stream_buffer *buf);
+
+// Load a transfer's buffer from src, or save it to dst, given as dma_streamer_app's
+// buffer options take them: "format[,opts]:location", or a file name with the format
+// guessed from its extension.  Loads are converted and resampled as the app does, and
+// the gen, udp, and tcp formats work too.  Returns 0 on success, <0 on error with errno
+// set.
+int  dsa_stream_load (struct dsa_stream *st, const char *xfer, const char *src);
+int  dsa_stream_save (struct dsa_stream *st, const char *xfer, const char *dst);
+
+// map the stream's buffers for DMA, or unmap them; 0 on success, <0 on error
+int  dsa_stream_start (struct dsa_stream *st);
+int  dsa_stream_stop  (struct dsa_stream *st);
+
+// Run each transfer of the started stream once, waiting up to timeout ms for them to
+// finish, or for a time worked out from the buffer sizes if timeout <= 0.  Returns 0 on
+// success, <0 on error or timeout.
+int  dsa_stream_trigger (struct dsa_stream *st, int timeout);
+
+// Copy up to num sample periods from iq into a TX transfer's buffer, following those
+// sent since the last trigger.  Each period is I then Q for each channel the transfer
+// carries, channel 1 first, as signed 12-bit values.  When every TX buffer of the
+// stream is full the stream is triggered, with timeout as for dsa_stream_trigger.
+// Returns the periods taken, which may be fewer than num, or <0 on error.
+ssize_t dsa_stream_send (struct dsa_stream *st, const char *xfer, const int16_t *iq,
+                         size_t num, int timeout);
+
+// Copy up to num sample periods from an RX transfer's buffer into iq, laid out as for
+// dsa_stream_send, following those received since the last trigger.  If none are left
+// the stream is triggered first, sending the TX buffers as they are.  Returns the
+// periods copied, or <0 on error.
+ssize_t dsa_stream_recv (struct dsa_stream *st, const char *xfer, int16_t *iq,
+                         size_t num, int timeout);
+
+// fill stats in with the stream's counts; 0 on success, <0 on error
+int  dsa_stream_stats (struct dsa_stream *st, struct dsa_stream_stats *stats);
+
+
+// A published RX buffer, attached read-only by an analysis process, which needn't call
+// dsa_lib_init.  Captures are read in place: the buffer is only rewritten when the next
+// capture starts, which dsa_capture_check detects, so any number of readers can work on
+// one capture in parallel while the capturing process sets up the next.
+struct dsa_capture;
+
+struct dsa_capture_info
+{
+	unsigned long        seq;     // capture number, from 1
+	const uint16_t      *words;   // laid out as for dsa_stream_buffer, with no shift
+	size_t               len;     // sample periods
+	size_t               stride;  // words per period
+	int                  chans;
+	int                  packed;
+	int                  ok;      // the transfer completed without error
+	unsigned long        rate;    // sample rate, 0 if unknown
+	unsigned long long   start;   // CLOCK_MONOTONIC us the capture was triggered
+	unsigned long long   done;    // and when it completed
+};
+
+// Attach to the buffer published under name for xfer, "AD1R" or "AD2R".  Returns NULL on
+// error with errno set, ENOENT if it's not published.
+struct dsa_capture *dsa_capture_attach (const char *name, const char *xfer);
+
+// Wait up to timeout ms, or forever if <0, for a completed capture other than number
+// seq, or any if seq is 0, and fill info in.  Returns 0 on success, or <0 with errno
+// ETIMEDOUT if none completed, ESTALE if the buffer was replaced or unpublished, in
+// which case detach and attach again, or the futex wait's own error.
+int  dsa_capture_wait (struct dsa_capture *cap, unsigned long seq, int timeout,
+                       struct dsa_capture_info *info);
+
+// Returns 0 if the capture in info is still intact, or <0 with errno ESTALE if a new
+// capture has started over it since, so that results computed from it are suspect.
+int  dsa_capture_check (struct dsa_capture *cap, const struct dsa_capture_info *info);
+
+void dsa_capture_detach (struct dsa_capture *cap);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _INCLUDE_LIBDSA_H_
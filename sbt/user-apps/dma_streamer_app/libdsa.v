@@ -0,0 +1,45 @@
+/** \file      libdsa.v
+ *  \brief     Shared-library exports and version control
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+libdsa_0.1 {
+	global:
+		dsa_lib_init;
+		dsa_lib_done;
+		dsa_lib_log;
+		dsa_stream_open;
+		dsa_stream_close;
+		dsa_stream_buffer;
+		dsa_stream_load;
+		dsa_stream_save;
+		dsa_stream_start;
+		dsa_stream_stop;
+		dsa_stream_trigger;
+		dsa_stream_send;
+		dsa_stream_recv;
+		dsa_stream_stats;
+	local:
+		*;
+};
+
+libdsa_0.2 {
+	global:
+		dsa_lib_share;
+		dsa_capture_attach;
+		dsa_capture_wait;
+		dsa_capture_check;
+		dsa_capture_detach;
+} libdsa_0.1;
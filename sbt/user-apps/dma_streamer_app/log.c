@@ -474,5 +474,36 @@ void log_set_module_level (const char *module, int level)
 			*(map->var) = level;
 }
 
+/** \brief Count the modules, to size a buffer for log_save_levels()
+ *
+ *  \return number of modules with a verbosity level
+ */
+int log_module_count (void)
+{
+	return &__stop_log_module_map - &__start_log_module_map;
+}
+
+/** \brief Save every module's verbosity level
+ *
+ *  \param levels  buffer of log_module_count() entries
+ */
+void log_save_levels (int *levels)
+{
+	struct log_module_map_t *map;
+	for ( map = &__start_log_module_map; map != &__stop_log_module_map; map++ )
+		*levels++ = *(map->var);
+}
+
+/** \brief Restore every module's verbosity level, as saved by log_save_levels()
+ *
+ *  \param levels  buffer of log_module_count() entries
+ */
+void log_restore_levels (const int *levels)
+{
+	struct log_module_map_t *map;
+	for ( map = &__start_log_module_map; map != &__stop_log_module_map; map++ )
+		*(map->var) = *levels++;
+}
+
 
 /* Ends    : log.c */
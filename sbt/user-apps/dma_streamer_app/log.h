@@ -100,6 +100,24 @@ void log_set_global_level (int level);
  */
 void log_set_module_level (const char *module, int level);
 
+/** \brief Count the modules, to size a buffer for log_save_levels()
+ *
+ *  \return number of modules with a verbosity level
+ */
+int log_module_count (void);
+
+/** \brief Save every module's verbosity level
+ *
+ *  \param levels  buffer of log_module_count() entries
+ */
+void log_save_levels (int *levels);
+
+/** \brief Restore every module's verbosity level, as saved by log_save_levels()
+ *
+ *  \param levels  buffer of log_module_count() entries
+ */
+void log_restore_levels (const int *levels);
+
 
 /** \brief Configure logging from config file
  *
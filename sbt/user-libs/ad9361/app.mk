@@ -19,7 +19,7 @@ include $(LOGGING_MK)
 endif
 
 # library deps and out-of-tree - not cleaned
-LIBS := -l$(NAME) -lm
+LIBS := -l$(NAME) -lm -lrt
 
 APPS := $(BIN)/$(NAME)
 
@@ -0,0 +1,157 @@
+/** \file      include/lib/ad9361_channels.h
+ *  \brief     Active channel state shared through POSIX shared memory
+ *  \copyright Copyright 2013,2014 Silver Bullet Technology
+ *
+ *             Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *             use this file except in compliance with the License.  You may obtain a copy
+ *             of the License at:
+ *               http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *             Unless required by applicable law or agreed to in writing, software
+ *             distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *             WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ *             License for the specific language governing permissions and limitations
+ *             under the License.
+ *
+ * vim:ts=4:noexpandtab
+ */
+#ifndef _INCLUDE_LIB_AD9361_CHANNELS_H_
+#define _INCLUDE_LIB_AD9361_CHANNELS_H_
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+
+/* The ad9361 tool publishes the channel enables (bits 7:6 of registers 0x002 and 0x003)
+ * and sample rates of each AD9361 here whenever it switches devices or exits, and
+ * consumers like dma_streamer_app read them without starting the tool.  Writers bump seq
+ * to odd before and back to even after an update; readers retry if seq was odd or moved.
+ */
+#define AD9361_CHANNELS_SHM      "/ad9361.channels"
+#define AD9361_CHANNELS_MAGIC    0x43363941  /* "A96C" */
+#define AD9361_CHANNELS_VERSION  1
+#define AD9361_CHANNELS_DEVS     2
+
+#define AD9361_CHANNELS_CH1      0x40
+#define AD9361_CHANNELS_CH2      0x80
+
+struct ad9361_channels_dev
+{
+	uint8_t   valid;    /* nonzero once the device has been read */
+	uint8_t   tx;       /* AD9361_CHANNELS_CH* for enabled TX channels */
+	uint8_t   rx;       /* AD9361_CHANNELS_CH* for enabled RX channels */
+	uint8_t   pad;
+	uint32_t  tx_rate;  /* Hz, 0 if unknown */
+	uint32_t  rx_rate;  /* Hz, 0 if unknown */
+};
+
+struct ad9361_channels
+{
+	uint32_t                    magic;
+	uint16_t                    version;
+	uint16_t                    size;
+	volatile uint32_t           seq;
+	uint32_t                    pad;
+	struct ad9361_channels_dev  dev[AD9361_CHANNELS_DEVS];
+};
+
+
+/** Map the shared segment, creating it if create is set.  Returns NULL on error with
+ *  errno set; ENOENT means no writer has created it yet. */
+static inline struct ad9361_channels *ad9361_channels_map (int create)
+{
+	struct ad9361_channels *ret;
+	struct stat             sb;
+	int                     fd;
+
+	if ( (fd = shm_open(AD9361_CHANNELS_SHM, create ? O_RDWR|O_CREAT : O_RDONLY, 0644)) < 0 )
+		return NULL;
+
+	if ( fstat(fd, &sb) )
+		goto fail;
+	if ( create && sb.st_size < (off_t)sizeof(*ret) && ftruncate(fd, sizeof(*ret)) )
+		goto fail;
+	else if ( !create && sb.st_size < (off_t)sizeof(*ret) )
+	{
+		errno = ENOENT;
+		goto fail;
+	}
+
+	ret = mmap(NULL, sizeof(*ret), create ? PROT_READ|PROT_WRITE : PROT_READ, MAP_SHARED,
+	           fd, 0);
+	if ( ret == MAP_FAILED )
+		goto fail;
+
+	close(fd);
+	return ret;
+
+fail:
+	close(fd);
+	return NULL;
+}
+
+static inline void ad9361_channels_unmap (struct ad9361_channels *chs)
+{
+	munmap(chs, sizeof(*chs));
+}
+
+/** Update one device's entry; the caller must be the only writer */
+static inline void ad9361_channels_write (struct ad9361_channels *chs, int dev,
+                                          const struct ad9361_channels_dev *val)
+{
+	chs->seq |= 1;
+	__sync_synchronize();
+
+	chs->magic   = AD9361_CHANNELS_MAGIC;
+	chs->version = AD9361_CHANNELS_VERSION;
+	chs->size    = sizeof(*chs);
+	memcpy(&chs->dev[dev], val, sizeof(*val));
+
+	__sync_synchronize();
+	chs->seq++;
+}
+
+/** Take a consistent copy of all devices.  Returns 0 on success, <0 with errno EINVAL if
+ *  the segment is a different version, or EAGAIN if a writer seems to have died during an
+ *  update. */
+static inline int ad9361_channels_read (const struct ad9361_channels *chs,
+                                        struct ad9361_channels_dev dev[AD9361_CHANNELS_DEVS])
+{
+	uint32_t  seq;
+	int       tries = 1000;
+
+	do
+	{
+		while ( (seq = chs->seq) & 1 )
+		{
+			if ( !--tries )
+			{
+				errno = EAGAIN;
+				return -1;
+			}
+			sched_yield();
+		}
+		__sync_synchronize();
+
+		if ( chs->magic != AD9361_CHANNELS_MAGIC || chs->version != AD9361_CHANNELS_VERSION ||
+		     chs->size != sizeof(*chs) )
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		memcpy(dev, (const void *)chs->dev, sizeof(chs->dev));
+
+		__sync_synchronize();
+	}
+	while ( chs->seq != seq );
+
+	return 0;
+}
+
+
+#endif /* _INCLUDE_LIB_AD9361_CHANNELS_H_ */
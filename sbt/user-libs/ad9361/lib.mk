@@ -81,6 +81,7 @@ else
 	cp -a include/lib/common.h              $(STAGEDIR)/usr/include/$(NAME)
 endif
 	cp -a include/lib/ad9361_hal*.h         $(STAGEDIR)/usr/include/$(NAME)
+	cp -a include/lib/ad9361_channels.h     $(STAGEDIR)/usr/include/$(NAME)
 
 $(BIN)/$(ANAME): $(OBJS)
 	$(AR) rcs $@ $^
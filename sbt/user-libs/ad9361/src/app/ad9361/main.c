@@ -36,6 +36,7 @@
 #endif
 
 #include <ad9361.h>
+#include <ad9361_channels.h>
 #include <config.h>
 
 #include "map.h"
@@ -45,7 +46,6 @@
 #define MAX_ARGS    32
 #define SEP_CHARS   " \t\n\r"
 #define DEF_DEV_NUM 0
-#define EXPORT_FILE "/tmp/.ad9361.channels"
 
 #if defined(BOARD_REV_CUT1)
 #define BOARD_REV "cut1"
@@ -76,41 +76,46 @@ static struct dev_info dev_node_list[] =
 };
 struct dev_info *dev_info_curr = NULL;
 
-static void export_active_channels (void)
+// sample rate from the IIO driver's sysfs attribute, or 0 if not available
+static uint32_t export_rate (const char *attr)
 {
-	unsigned char  fb[4];
-	unsigned char *fp = fb;
-	int            fd;
-	int            ret;
-	int            reg;
-	int            adr;
-
-	if ( (fd = open(EXPORT_FILE, O_RDWR|O_CREAT)) < 0 )
-		stop(EXPORT_FILE);
-
-	if ( (ret = read(fd, fb, sizeof(fb))) < 0 )
-		stop(EXPORT_FILE);
-	if ( ret < sizeof(fb) )
-		memset(fb + ret, 0, sizeof(fb) - ret);
+	char  path[PATH_MAX];
+	char  buff[64];
 
-	if ( opt_dev_num > 0 )
-		fp += 2;
+	if ( !dev_info_curr || !dev_info_curr->leaf )
+		return 0;
 
-	for ( adr = 0x002; adr <= 0x003; adr++ )
-	{
-		if ( (reg = ad9361_hal_spi_reg_get(adr)) > -1 )
-			*fp = reg & 0xC0;
-		fp++;
-	}
+	snprintf(path, sizeof(path), "/sys/bus/iio/devices/%s/%s", dev_info_curr->leaf, attr);
+	if ( proc_read(path, buff, sizeof(buff)) < 1 )
+		return 0;
 
-	if ( lseek(fd, 0, SEEK_SET) )
-		stop(EXPORT_FILE);
-
-	if ( (ret = write(fd, fb, sizeof(fb))) != sizeof(fb) )
-		stop(EXPORT_FILE);
+	return strtoul(buff, NULL, 10);
+}
 
-	if ( close(fd) )
-		stop(EXPORT_FILE);
+// publish the current device's channel enables and rates for dma_streamer_app
+static void export_active_channels (void)
+{
+	struct ad9361_channels_dev  val;
+	struct ad9361_channels     *chs;
+	int                         dev = opt_dev_num > 0;
+	int                         reg;
+
+	if ( !(chs = ad9361_channels_map(1)) )
+		stop(AD9361_CHANNELS_SHM);
+
+	// keep the last known value of any register which can't be read
+	memcpy(&val, &chs->dev[dev], sizeof(val));
+	if ( (reg = ad9361_hal_spi_reg_get(0x002)) > -1 )
+		val.tx = reg & (AD9361_CHANNELS_CH1|AD9361_CHANNELS_CH2);
+	if ( (reg = ad9361_hal_spi_reg_get(0x003)) > -1 )
+		val.rx = reg & (AD9361_CHANNELS_CH1|AD9361_CHANNELS_CH2);
+
+	val.tx_rate = export_rate("out_voltage_sampling_frequency");
+	val.rx_rate = export_rate("in_voltage_sampling_frequency");
+	val.valid   = 1;
+
+	ad9361_channels_write(chs, dev, &val);
+	ad9361_channels_unmap(chs);
 }
 
 static int sysfs_scan (void)
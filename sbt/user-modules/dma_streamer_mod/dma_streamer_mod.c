@@ -31,6 +31,7 @@
 #include <linux/uaccess.h>
 #include <linux/pagemap.h>
 #include <linux/kthread.h>
+#include <linux/hrtimer.h>
 #include <linux/scatterlist.h>
 #include <linux/dmaengine.h>
 #include <linux/amba/xilinx_dma.h>
@@ -72,6 +73,16 @@ struct dsm_xfer
 	unsigned long  left;
 	int            start;
 
+	// set once the mapping has been triggered; dma_map_sg() hands the buffers to the
+	// device for the first trigger, later ones need them synced back from the CPU
+	int            triggered;
+
+	// timed start, set with DSM_IOCS_START_AT for the next trigger only.  started is
+	// completed when the transfer starts, for others timed relative to this one.
+	struct dsm_start_at  start_at;
+	struct dsm_xfer     *start_ref;
+	struct completion    started;
+
 	// DMA engine glue
 	enum dma_transfer_direction  dir;
 	struct dma_chan             *chan;
@@ -121,6 +132,59 @@ static void dsm_thread_cb (void *cmp)
 	complete(cmp);
 }
 
+// A timed start sleeps on an hrtimer until this long before the release time, then
+// spins for the rest with interrupts off
+#define DSM_START_SPIN_NS  50000
+
+static int dsm_start_wait (struct dsm_xfer *state, struct timespec *rel)
+{
+	ktime_t  wake;
+
+	if ( state->start_at.mode == DSM_START_AFTER )
+	{
+		if ( !wait_for_completion_timeout(&state->start_ref->started, dsm_timeout) )
+			pr_warn("%s: reference transfer didn't start, starting now\n", state->name);
+		*rel = timespec_add(state->start_ref->stats.start,
+		                    ns_to_timespec(state->start_at.delay));
+	}
+	else
+		*rel = state->start_at.time;
+
+	// early wakeups go back to sleep, so the spin is only entered within
+	// DSM_START_SPIN_NS of the release time
+	wake = ktime_sub_ns(timespec_to_ktime(*rel), DSM_START_SPIN_NS);
+	for ( ;; )
+	{
+		set_current_state(TASK_INTERRUPTIBLE);
+		if ( kthread_should_stop() || signal_pending(current) )
+		{
+			__set_current_state(TASK_RUNNING);
+			return -EINTR;
+		}
+		if ( ktime_to_ns(ktime_get()) >= ktime_to_ns(wake) )
+		{
+			__set_current_state(TASK_RUNNING);
+			return 0;
+		}
+		schedule_hrtimeout(&wake, HRTIMER_MODE_ABS);
+	}
+}
+
+// Spins until rel, but never for more than DSM_START_SPIN_NS, as interrupts are off
+static void dsm_start_spin (const struct timespec *rel)
+{
+	struct timespec  now;
+	struct timespec  end;
+
+	ktime_get_ts(&now);
+	end = timespec_add(now, ns_to_timespec(DSM_START_SPIN_NS));
+	if ( timespec_compare(rel, &end) < 0 )
+		end = *rel;
+
+	while ( timespec_compare(&now, &end) < 0 )
+		ktime_get_ts(&now);
+}
+
 static int dsm_thread (void *data)
 {
 	struct dsm_xfer                *state  = (struct dsm_xfer *)data;
@@ -136,7 +200,10 @@ static int dsm_thread (void *data)
 	unsigned long                   timeout;
 	unsigned long                   irq_flags;
 	struct timespec                 beg, end;
+	struct timespec                 rel;
 	spinlock_t                      irq_lock;
+	int                             first;
+	int                             timed;
 	int                             ret = 0;
 	u32                             reg;
 	int                             ch;
@@ -190,11 +257,30 @@ static int dsm_thread (void *data)
 		if ( state->dir == DMA_MEM_TO_DEV && state->fd_peer )
 			wait_for_completion(&parent->txrx);
 
+		// timed start: sleep until just before the release time
+		first = state->start;
+		timed = first && state->start_at.mode != DSM_START_NOW;
+		if ( timed && dsm_start_wait(state, &rel) )
+		{
+			pr_warn("%s: stopped while waiting to start\n", state->name);
+			dmaengine_terminate_all(chan);
+			goto done;
+		}
+
 		// experimental: get start time a little earlier, then disable interrupts while
 		// starting the FIFO and DMA
 		getrawmonotonic(&beg);
 		spin_lock_irqsave(&irq_lock, irq_flags);
 
+		// timed start: spin for the rest of the wait with interrupts off
+		if ( timed )
+		{
+			dsm_start_spin(&rel);
+			getrawmonotonic(&beg);
+		}
+		if ( first )
+			ktime_get_ts(&state->stats.start);
+
 		// start the DMA and wait for completion
 		pr_debug("%s: dma_async_issue_pending()...\n", state->name);
 		dma_async_issue_pending(chan);
@@ -248,6 +334,16 @@ static int dsm_thread (void *data)
 		// experimental: re-enable interrupts after DMA/FIFO start
 		spin_unlock_irqrestore(&irq_lock, irq_flags);
 
+		// report the start error and release transfers timed relative to this one
+		if ( timed )
+		{
+			state->stats.start_err  = timespec_to_ns(&state->stats.start);
+			state->stats.start_err -= timespec_to_ns(&rel);
+			pr_debug("%s: start error %lld ns\n", state->name, state->stats.start_err);
+		}
+		if ( first )
+			complete_all(&state->started);
+
 		// in FD, tx thread should start after RX
 		if ( state->dir == DMA_DEV_TO_MEM && state->fd_peer )
 			complete(&parent->txrx);
@@ -283,6 +379,14 @@ static int dsm_thread (void *data)
 	}
 
 done:
+	// the start setup is used once; don't leave dependent transfers waiting on a failure
+	state->start_at.mode = DSM_START_NOW;
+	complete_all(&state->started);
+
+	// hand RX data back to the CPU, so the buffers may be read while still mapped
+	if ( state->dir == DMA_DEV_TO_MEM )
+		dma_sync_sg_for_cpu(dsm_dev, state->chain[0], state->pages, state->dir);
+
 	// thread's done, decrement counter and wakeup caller
 	atomic_sub(1, &dsm_busy);
 	wake_up_interruptible(&dsm_wait);
@@ -545,6 +649,7 @@ pr_debug("%lu words per DMA, %lu per rep = %lu + %lu reps\n",
 
 	// assumes that map_sg uses chain-aware iteration (sg_next/for_each_sg)
 	dma_map_sg(dsm_dev, state->chain[0], state->pages, state->dir);
+	state->triggered = 0;
 
 	pr_debug("Mapped scatterlist chain:\n");
 	for_each_sg(state->chain[0], sg_walk, state->pages, idx)
@@ -609,6 +714,136 @@ static void dsm_cleanup (void)
 	dsm_mapped = 0;
 }
 
+// Reset the per-trigger state so a mapping may be triggered more than once: the rep
+// count and FIFO start are consumed by dsm_thread, and after a trigger the buffers need
+// to be handed back to the device, as the CPU may have touched them since.
+static void dsm_xfer_rearm (struct dsm_xfer *state)
+{
+	state->left  = state->chunk;
+	state->start = 1;
+	memset(&state->stats, 0, sizeof(state->stats));
+	init_completion(&state->started);
+
+	if ( state->triggered )
+		dma_sync_sg_for_device(dsm_dev, state->chain[0], state->pages, state->dir);
+}
+
+static struct dsm_xfer *dsm_find_xfer (unsigned long targ, unsigned long rx)
+{
+	struct dsm_chan *chan;
+
+	switch ( targ )
+	{
+		case DSM_TARGT_ADI1: chan = &dsm_adi1_state; break;
+		case DSM_TARGT_ADI2: chan = &dsm_adi2_state; break;
+		case DSM_TARGT_DSXX: chan = &dsm_dsxx_state; break;
+		default:             return NULL;
+	}
+
+	return rx ? chan->rx : chan->tx;
+}
+
+// Set the start timing for one transfer; state is NULL if the transfer isn't mapped,
+// which is fine as long as no timing is asked for.  Release times already well past, or
+// too far ahead to sleep for, are refused.
+static int dsm_set_start (struct dsm_xfer *state, const struct dsm_start_at *at)
+{
+	struct dsm_xfer *ref = NULL;
+	s64              now;
+	s64              rel;
+
+	if ( at->mode == DSM_START_NOW )
+	{
+		if ( state )
+			state->start_at.mode = DSM_START_NOW;
+		return 0;
+	}
+
+	if ( !state )
+	{
+		pr_err("timed start for a transfer which isn't mapped\n");
+		return -EINVAL;
+	}
+
+	switch ( at->mode )
+	{
+		case DSM_START_TIME:
+			if ( at->time.tv_sec < 0 || at->time.tv_nsec < 0 ||
+			     at->time.tv_nsec >= NSEC_PER_SEC )
+			{
+				pr_err("%s: bad start time\n", state->name);
+				return -EINVAL;
+			}
+			now = ktime_to_ns(ktime_get());
+			rel = timespec_to_ns(&at->time);
+			if ( rel < now - (s64)DSM_START_LATE_NS || rel > now + (s64)DSM_START_MAX_NS )
+			{
+				pr_err("%s: start time %lld ns from now is out of range\n", state->name,
+				       rel - now);
+				return -EINVAL;
+			}
+			break;
+
+		case DSM_START_AFTER:
+			if ( !(ref = dsm_find_xfer(at->ref, at->ref_rx)) || ref == state )
+			{
+				pr_err("%s: bad reference transfer %lx/%s\n", state->name, at->ref,
+				       at->ref_rx ? "rx" : "tx");
+				return -EINVAL;
+			}
+			if ( at->delay > DSM_START_MAX_NS )
+			{
+				pr_err("%s: start delay %lu ns is too long\n", state->name, at->delay);
+				return -EINVAL;
+			}
+			break;
+
+		default:
+			pr_err("%s: bad start mode %lu\n", state->name, at->mode);
+			return -EINVAL;
+	}
+
+	state->start_at  = *at;
+	state->start_ref = ref;
+	return 0;
+}
+
+static int dsm_set_starts (const struct dsm_user_start *us)
+{
+	static const struct dsm_start_at now = { .mode = DSM_START_NOW };
+	int                              ret;
+
+	if ( (ret = dsm_set_start(dsm_adi1_state.tx, &us->adi1.tx)) ||
+	     (ret = dsm_set_start(dsm_adi1_state.rx, &us->adi1.rx)) ||
+	     (ret = dsm_set_start(dsm_adi2_state.tx, &us->adi2.tx)) ||
+	     (ret = dsm_set_start(dsm_adi2_state.rx, &us->adi2.rx)) ||
+	     (ret = dsm_set_start(dsm_dsxx_state.tx, &us->dsxx.tx)) ||
+	     (ret = dsm_set_start(dsm_dsxx_state.rx, &us->dsxx.rx)) )
+	{
+		dsm_set_start(dsm_adi1_state.tx, &now);
+		dsm_set_start(dsm_adi1_state.rx, &now);
+		dsm_set_start(dsm_adi2_state.tx, &now);
+		dsm_set_start(dsm_adi2_state.rx, &now);
+		dsm_set_start(dsm_dsxx_state.tx, &now);
+		dsm_set_start(dsm_dsxx_state.rx, &now);
+		return ret;
+	}
+
+	return 0;
+}
+
+// All channels are rearmed before any thread starts, as a timed start may wait on a
+// transfer in another channel
+static void dsm_rearm (struct dsm_chan *chan)
+{
+	if ( chan->tx )
+		dsm_xfer_rearm(chan->tx);
+	if ( chan->rx )
+		dsm_xfer_rearm(chan->rx);
+	if ( chan->tx && chan->rx )
+		init_completion(&chan->txrx);
+}
+
 static int inline dsm_start (struct dsm_chan *chan)
 {
 	static char name[32];
@@ -622,6 +857,7 @@ static int inline dsm_start (struct dsm_chan *chan)
 			return -1;
 		}
 
+		chan->tx->triggered = 1;
 		atomic_add(1, &dsm_busy);
 	}
 
@@ -634,6 +870,7 @@ static int inline dsm_start (struct dsm_chan *chan)
 			return -1;
 		}
 
+		chan->rx->triggered = 1;
 		atomic_add(1, &dsm_busy);
 	}
 
@@ -812,13 +1049,19 @@ static long dsm_ioctl (struct file *filp, unsigned int cmd, unsigned long arg)
 		// DSM_IOCS_MAP.  If the mapped buffers have a nonzero tx_size, a TX transfer is
 		// started.  If the mapped buffers have a nonzero rx_size, a RX transfer is
 		// started.  The two directions may be run in parallel.  The calling process will
-		// block until both transfers are complete, or a timeout occurs. 
+		// block until both transfers are complete, or a timeout occurs.   The mapping
+		// stays in place afterwards, so the same buffers may be triggered again without
+		// another DSM_IOCS_MAP; RX buffers are synced back to the CPU on completion.
 		case  DSM_IOCS_TRIGGER:
 			pr_debug("DSM_IOCS_TRIGGER\n");
 //			zynq_slcr_dump_fclkc_regs("DSM_IOCS_TRIGGER");
 //			if ( dsm_adi1_new_regs )  dsm_dump_new_adi(dsm_adi1_new_regs, 0x79000000);
 			if ( dsm_adi2_new_regs )  dsm_dump_new_adi(dsm_adi2_new_regs, 0x79020000);
 
+			dsm_rearm(&dsm_adi1_state);
+			dsm_rearm(&dsm_adi2_state);
+			dsm_rearm(&dsm_dsxx_state);
+
 			if ( dsm_start(&dsm_adi1_state) || 
 			     dsm_start(&dsm_adi2_state) || 
 			     dsm_start(&dsm_dsxx_state) )
@@ -847,6 +1090,33 @@ static long dsm_ioctl (struct file *filp, unsigned int cmd, unsigned long arg)
 			ret = 0;
 			break;
 
+		// Arm mapped transfers to start at a given time, or a delay after another
+		// transfer starts, on the next DSM_IOCS_TRIGGER.
+		case DSM_IOCS_START_AT:
+		{
+			struct dsm_user_start dsm_user_start;
+			pr_debug("DSM_IOCS_START_AT %08lx\n", arg);
+
+			if ( !dsm_mapped )
+			{
+				pr_err("no pages mapped; MAP first\n");
+				return -EINVAL;
+			}
+
+			ret = copy_from_user(&dsm_user_start, (void *)arg, sizeof(dsm_user_start));
+			if ( ret )
+			{
+				pr_err("failed to copy %d bytes, stop\n", ret);
+				return -EFAULT;
+			}
+
+			if ( (ret = dsm_set_starts(&dsm_user_start)) )
+				return ret;
+
+			ret = 0;
+			break;
+		}
+
 		case  DSM_IOCG_FIFO_CNT:
 		{
 			struct dsm_fifo_counts buff;
@@ -941,6 +1211,13 @@ static long dsm_ioctl (struct file *filp, unsigned int cmd, unsigned long arg)
 			ret = 0;
 			break;
 
+		// Set a timeout in ms on the DMA transfer
+		case DSM_IOCS_TIMEOUT_MS:
+			pr_debug("DSM_IOCS_TIMEOUT_MS %lu\n", arg);
+			dsm_timeout = msecs_to_jiffies(arg);
+			ret = 0;
+			break;
+
 
 		// Access to data source regs
 		case DSM_IOCS_DSRC_CTRL:
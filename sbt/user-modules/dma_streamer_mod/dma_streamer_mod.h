@@ -90,6 +90,8 @@ struct dsm_xfer_stats
 	unsigned long       completes;
 	unsigned long       errors;
 	unsigned long       timeouts;
+	struct timespec     start;      /* CLOCK_MONOTONIC time the transfer was started */
+	long long           start_err;  /* ns late (>0) or early (<0) vs a timed start */
 };
 
 struct dsm_chan_stats
@@ -117,6 +119,38 @@ struct dsm_fifo_counts
 	unsigned long  tx_2_ext;
 };
 
+#define DSM_START_NOW             0  /* as soon as the transfer thread runs */
+#define DSM_START_TIME            1  /* at an absolute CLOCK_MONOTONIC time */
+#define DSM_START_AFTER           2  /* a delay after another transfer starts */
+
+/* limits on timed starts, checked when armed: a release time no more than
+ * DSM_START_LATE_NS in the past or DSM_START_MAX_NS ahead, and a delay no longer than
+ * DSM_START_MAX_NS */
+#define DSM_START_LATE_NS         10000000ULL
+#define DSM_START_MAX_NS          60000000000ULL
+
+struct dsm_start_at
+{
+	unsigned long    mode;     /* DSM_START_* */
+	struct timespec  time;     /* DSM_START_TIME: release time */
+	unsigned long    ref;      /* DSM_START_AFTER: DSM_TARGT_* of the reference... */
+	unsigned long    ref_rx;   /* ...and nonzero for its RX side, 0 for TX */
+	unsigned long    delay;    /* DSM_START_AFTER: ns after the reference starts */
+};
+
+struct dsm_chan_start
+{
+	struct dsm_start_at  tx;
+	struct dsm_start_at  rx;
+};
+
+struct dsm_user_start
+{
+	struct dsm_chan_start  adi1;
+	struct dsm_chan_start  adi2;
+	struct dsm_chan_start  dsxx;
+};
+
 struct dsm_new_adi_regs
 {
 	unsigned long  adi;
@@ -185,6 +219,14 @@ struct dsm_new_adi_regs
 // Get counters from ADI DPFD/LVDS interface FIFOs. 
 #define  DSM_IOCG_FIFO_CNT     _IOR(DSM_IOCTL_MAGIC, 41, unsigned long *)
 
+// Arm transfers mapped with DSM_IOCS_MAP to start at a given time, or a delay after
+// another transfer starts, on the next DSM_IOCS_TRIGGER only.  The achieved start time
+// and error are returned by DSM_IOCG_STATS.
+#define  DSM_IOCS_START_AT     _IOW(DSM_IOCTL_MAGIC, 42, struct dsm_user_start *)
+
+// Set the timeout on the DMA transfer in ms, as userspace can't know the kernel's HZ
+#define  DSM_IOCS_TIMEOUT_MS   _IOW(DSM_IOCTL_MAGIC, 43, unsigned long)
+
 // Get clock counters for digital interface
 #define  DSM_IOCG_ADI1_OLD_CLK_CNT      _IOR(DSM_IOCTL_MAGIC, 50, unsigned long *)
 #define  DSM_IOCG_ADI2_OLD_CLK_CNT      _IOR(DSM_IOCTL_MAGIC, 51, unsigned long *)